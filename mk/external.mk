@@ -39,9 +39,30 @@ endif
 PUREDOOM_URL = https://raw.githubusercontent.com/Daivuk/PureDOOM/master/PureDOOM.h
 PUREDOOM_HEADER = src/PureDOOM.h
 
+# The engine's linear W_CheckNumForName() is renamed so src/main.c can supply
+# a hash-indexed lookup. The marker is only appended when the rename matched,
+# so an upstream change falls back to the original code instead of breaking.
+# The patch leaves a patched header alone and is applied again through a
+# stamp (see the Makefile) whenever the header changes, so a header that is
+# already in place is patched too, or the fallback is reported.
+define patch_puredoom
+	$(Q)if ! grep -q '^#define PUREDOOM_LUMP_HASH_HOOK' $(1); then \
+		printf "  PATCH\t$(1)\n"; \
+		sed -e 's/^\(int W_CheckNumForName\)\( *(char *\* *name) *\)$$/\1_linear\2/' \
+			$(1) > $(1).tmp && mv $(1).tmp $(1); \
+		if grep -q '^int W_CheckNumForName_linear' $(1); then \
+			printf '\n#define PUREDOOM_LUMP_HASH_HOOK\n' >> $(1); \
+		else \
+			echo "Warning: lump lookup hook not applied to $(1), using linear scan"; \
+		fi; \
+	fi
+endef
+
 $(PUREDOOM_HEADER):
 	$(VECHO) "  GET\t$@\n"
-	$(Q)$(DOWNLOAD_CMD) $@ $(PUREDOOM_URL)
+	$(Q)$(DOWNLOAD_CMD) $@.tmp $(PUREDOOM_URL)
+	$(Q)mv $@.tmp $@
+	$(call patch_puredoom,$@)
 
 # Clean external files
 .PHONY: clean-external
@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Agent control mode
+ *
+ * With --agent SOCKET the game runs headless and an external process steps
+ * it: each request names the keys to hold and how many tics to run, and the
+ * reply says where the resulting observation is. Requests and replies are
+ * fixed-size messages on a SOCK_SEQPACKET Unix socket, so each read is one
+ * whole message and no framing is needed.
+ *
+ * Observations (the 8-bit indexed framebuffer plus its palette) are written
+ * to a ring of AGENT_SLOTS slots in a memfd that the client receives with
+ * the hello reply and maps read-only. Nothing large crosses the socket, and
+ * the last few frames stay readable for frame stacking. Each slot carries the
+ * sequence number of the observation in it, zero while it is being
+ * rewritten, so a client holding on to an old reply can tell when the slot
+ * has moved on. The check is a seqlock read: agent_observation() before
+ * copying and agent_observation_valid() after it.
+ *
+ * One process runs one game; a client drives many environments by sending
+ * a step to each of them before collecting any reply (agent_send_step, then
+ * agent_recv_step), so the games run in parallel while it waits.
+ */
+
+#define _GNU_SOURCE /* memfd_create */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#define AGENT_MAGIC 0x4b444147 /* "KDAG" */
+#define AGENT_VERSION 1
+
+struct agent {
+    int listen_fd, client_fd;
+    char path[108];
+    int shm_fd;
+    uint8_t *shm;
+    size_t shm_size;
+    uint64_t seq;
+    bool reply_due; /* the client waits for the current request */
+};
+
+struct agent_client {
+    int fd;
+    const uint8_t *shm;
+    size_t shm_size;
+};
+
+static size_t slot_size(int width, int height)
+{
+    /* Cache-line aligned so slots never share a line */
+    const size_t size = sizeof(agent_slot_t) + (size_t) width * height;
+    return (size + 63) & ~(size_t) 63;
+}
+
+static agent_slot_t *get_slot(uint8_t *shm, uint32_t index)
+{
+    const agent_shm_header_t *header = (const agent_shm_header_t *) shm;
+    return (agent_slot_t *) (shm + header->first_slot +
+                             (size_t) index * header->slot_size);
+}
+
+agent_t *agent_create(const char *path, int width, int height)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Agent socket path too long: %s\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    agent_t *a = calloc(1, sizeof(agent_t));
+    if (!a)
+        return NULL;
+    a->client_fd = -1;
+    a->shm_fd = -1;
+    strcpy(a->path, path);
+
+    const size_t first = (sizeof(agent_shm_header_t) + 63) & ~(size_t) 63;
+    a->shm_size = first + AGENT_SLOTS * slot_size(width, height);
+    a->shm_fd = memfd_create("kitty-doom-agent", MFD_CLOEXEC);
+    if (a->shm_fd < 0 || ftruncate(a->shm_fd, (off_t) a->shm_size) < 0) {
+        fprintf(stderr, "Agent shared memory: %s\n", strerror(errno));
+        goto fail;
+    }
+    a->shm = mmap(NULL, a->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  a->shm_fd, 0);
+    if (a->shm == MAP_FAILED) {
+        a->shm = NULL;
+        fprintf(stderr, "Agent shared memory: %s\n", strerror(errno));
+        goto fail;
+    }
+    *(agent_shm_header_t *) a->shm = (agent_shm_header_t) {
+        .magic = AGENT_MAGIC,
+        .version = AGENT_VERSION,
+        .width = (uint32_t) width,
+        .height = (uint32_t) height,
+        .slots = AGENT_SLOTS,
+        .slot_size = (uint32_t) slot_size(width, height),
+        .first_slot = (uint32_t) first,
+    };
+
+    a->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (a->listen_fd < 0) {
+        fprintf(stderr, "Agent socket: %s\n", strerror(errno));
+        goto fail;
+    }
+    /* Replace a stale socket left behind by a previous run */
+    unlink(path);
+    if (bind(a->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(a->listen_fd, 1) < 0) {
+        fprintf(stderr, "Agent socket %s: %s\n", path, strerror(errno));
+        close(a->listen_fd);
+        goto fail;
+    }
+    return a;
+
+fail:
+    if (a->shm)
+        munmap(a->shm, a->shm_size);
+    if (a->shm_fd >= 0)
+        close(a->shm_fd);
+    free(a);
+    return NULL;
+}
+
+void agent_destroy(agent_t *a)
+{
+    if (!a)
+        return;
+    if (a->client_fd >= 0)
+        close(a->client_fd);
+    close(a->listen_fd);
+    unlink(a->path);
+    munmap(a->shm, a->shm_size);
+    close(a->shm_fd);
+    free(a);
+}
+
+/* The hello reply carries the shared memory fd */
+static bool send_hello(agent_t *a)
+{
+    const agent_reply_t reply = {.seq = a->seq};
+    struct iovec iov = {.iov_base = (void *) &reply, .iov_len = sizeof(reply)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &a->shm_fd, sizeof(int));
+    return sendmsg(a->client_fd, &msg, MSG_NOSIGNAL) == sizeof(reply);
+}
+
+static void drop_client(agent_t *a)
+{
+    close(a->client_fd);
+    a->client_fd = -1;
+    a->reply_due = false;
+}
+
+static bool reply(agent_t *a, const agent_reply_t *r)
+{
+    if (send(a->client_fd, r, sizeof(*r), MSG_NOSIGNAL) == sizeof(*r))
+        return true;
+    drop_client(a);
+    return false;
+}
+
+bool agent_next(agent_t *a, agent_request_t *req)
+{
+    if (a->client_fd < 0) {
+        a->client_fd = accept4(a->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (a->client_fd < 0)
+            return false; /* EINTR: let the caller check for signals */
+    }
+
+    const ssize_t n = recv(a->client_fd, req, sizeof(*req), 0);
+    if (n < 0 && errno == EINTR)
+        return false;
+    if (n <= 0) {
+        /* Gone: release whatever it was holding */
+        drop_client(a);
+        *req = (agent_request_t) {.op = AGENT_OP_STEP};
+        return true;
+    }
+
+    if (n != sizeof(*req) || req->key_count > AGENT_MAX_KEYS ||
+        req->tics > AGENT_MAX_TICS ||
+        (req->op != AGENT_OP_HELLO && req->op != AGENT_OP_STEP)) {
+        reply(a, &(agent_reply_t) {.status = EINVAL});
+        return false;
+    }
+    if (req->op == AGENT_OP_HELLO) {
+        if (!send_hello(a))
+            drop_client(a);
+        return false;
+    }
+
+    a->reply_due = true;
+    return true;
+}
+
+void agent_publish(agent_t *a, const uint8_t *pixels, const uint8_t *palette,
+                   const agent_reply_t *info)
+{
+    const agent_shm_header_t *header = (const agent_shm_header_t *) a->shm;
+    agent_reply_t r = *info;
+    r.status = 0;
+    r.seq = ++a->seq;
+    r.slot = (uint32_t) (r.seq % AGENT_SLOTS);
+
+    agent_slot_t *slot = get_slot(a->shm, r.slot);
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->info = r;
+    memcpy(slot->palette, palette, sizeof(slot->palette));
+    memcpy(slot->pixels, pixels, (size_t) header->width * header->height);
+    atomic_store_explicit(&slot->seq, r.seq, memory_order_release);
+
+    if (a->reply_due) {
+        a->reply_due = false;
+        reply(a, &r);
+    }
+}
+
+agent_client_t *agent_connect(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return NULL;
+    strcpy(addr.sun_path, path);
+
+    agent_client_t *c = calloc(1, sizeof(agent_client_t));
+    if (!c)
+        return NULL;
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 ||
+        connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        goto fail;
+
+    const agent_request_t hello = {.op = AGENT_OP_HELLO};
+    if (send(c->fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello))
+        goto fail;
+
+    agent_reply_t reply;
+    struct iovec iov = {.iov_base = &reply, .iov_len = sizeof(reply)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    if (recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(reply) ||
+        reply.status)
+        goto fail;
+    const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+        goto fail;
+    int shm_fd;
+    memcpy(&shm_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    const off_t size = lseek(shm_fd, 0, SEEK_END);
+    c->shm = size > 0 ? mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED,
+                             shm_fd, 0)
+                      : MAP_FAILED;
+    close(shm_fd);
+    if (c->shm == MAP_FAILED) {
+        c->shm = NULL;
+        goto fail;
+    }
+    c->shm_size = (size_t) size;
+
+    const agent_shm_header_t *header = agent_header(c);
+    if (header->magic != AGENT_MAGIC || header->version != AGENT_VERSION) {
+        munmap((void *) c->shm, c->shm_size);
+        goto fail;
+    }
+    return c;
+
+fail:
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+    return NULL;
+}
+
+void agent_disconnect(agent_client_t *c)
+{
+    if (!c)
+        return;
+    close(c->fd);
+    munmap((void *) c->shm, c->shm_size);
+    free(c);
+}
+
+const agent_shm_header_t *agent_header(const agent_client_t *c)
+{
+    return (const agent_shm_header_t *) c->shm;
+}
+
+bool agent_send_step(agent_client_t *c, const uint8_t *keys, int key_count,
+                     int tics)
+{
+    if (key_count < 0 || key_count > AGENT_MAX_KEYS || tics < 0 ||
+        tics > AGENT_MAX_TICS)
+        return false;
+
+    agent_request_t req = {
+        .op = AGENT_OP_STEP,
+        .tics = (uint32_t) tics,
+        .key_count = (uint32_t) key_count,
+    };
+    if (key_count)
+        memcpy(req.keys, keys, (size_t) key_count);
+    return send(c->fd, &req, sizeof(req), MSG_NOSIGNAL) == sizeof(req);
+}
+
+bool agent_recv_step(agent_client_t *c, agent_reply_t *reply)
+{
+    ssize_t n;
+    do {
+        n = recv(c->fd, reply, sizeof(*reply), 0);
+    } while (n < 0 && errno == EINTR);
+    return n == sizeof(*reply) && !reply->status;
+}
+
+const agent_slot_t *agent_observation(const agent_client_t *c,
+                                      const agent_reply_t *reply)
+{
+    const agent_shm_header_t *header = agent_header(c);
+    if (reply->slot >= header->slots)
+        return NULL;
+    const agent_slot_t *slot = (const agent_slot_t *) (c->shm +
+                               header->first_slot +
+                               (size_t) reply->slot * header->slot_size);
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != reply->seq)
+        return NULL;
+    return slot;
+}
+
+bool agent_observation_valid(const agent_slot_t *slot,
+                             const agent_reply_t *reply)
+{
+    /* Order the caller's reads of the slot before the second seq load */
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) ==
+           reply->seq;
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * ARM NEON optimized audio gain stage
+ *
+ * Scales interleaved signed 16-bit PCM by a Q12 fixed-point gain with
+ * saturation.
+ */
+
+#pragma once
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Processes 8 samples per iteration: vmull_s16 widens to 32-bit products and
+ * vqshrn_n_s32 shifts out the fraction bits while saturating back to 16 bits
+ */
+static inline void audio_gain_neon(int16_t *restrict dst,
+                                   const int16_t *restrict src,
+                                   size_t samples,
+                                   int16_t gain_q12)
+{
+    const int16x4_t gain = vdup_n_s16(gain_q12);
+    size_t i = 0;
+
+    for (; i + 8 <= samples; i += 8) {
+        const int16x8_t x = vld1q_s16(src + i);
+        const int32x4_t p0 = vmull_s16(vget_low_s16(x), gain);
+        const int32x4_t p1 = vmull_s16(vget_high_s16(x), gain);
+        vst1q_s16(dst + i,
+                  vcombine_s16(vqshrn_n_s32(p0, 12), vqshrn_n_s32(p1, 12)));
+    }
+
+    for (; i < samples; i++) {
+        int32_t v = ((int32_t) src[i] * gain_q12) >> 12;
+        dst[i] = (int16_t) (v > INT16_MAX ? INT16_MAX
+                                          : v < INT16_MIN ? INT16_MIN : v);
+    }
+}
+
+#endif /* __aarch64__ || __ARM_NEON */
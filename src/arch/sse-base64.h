@@ -32,6 +32,7 @@
     defined(_M_IX86)
 
 #include <emmintrin.h> /* SSE2 */
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -98,11 +99,14 @@ static inline __m128i bitunpack128v8_6(__m128i v)
 
 /* Base64 encoding using SSSE3 SIMD optimization
  *
- * Processes 12 input bytes -> 16 base64 characters per iteration
+ * Processes 12 input bytes -> 16 base64 characters per iteration. With
+ * stream set, the 16-byte blocks bypass the cache (out must be 16-byte
+ * aligned); callers pass a constant so each variant compiles separately.
  */
-static inline size_t base64_encode_sse(const uint8_t *restrict in,
-                                       size_t inlen,
-                                       uint8_t *restrict out)
+static inline size_t base64_encode_sse_impl(const uint8_t *restrict in,
+                                            size_t inlen,
+                                            uint8_t *restrict out,
+                                            bool stream)
 {
     /* Base64 lookup table for scalar fallback */
     static const char base64_table[] =
@@ -136,7 +140,10 @@ static inline size_t base64_encode_sse(const uint8_t *restrict in,
         v = bitmap128v8_6(v);
 
         /* Store 16 base64 characters */
-        _mm_storeu_si128((__m128i *) op, v);
+        if (stream)
+            _mm_stream_si128((__m128i *) op, v);
+        else
+            _mm_storeu_si128((__m128i *) op, v);
         op += 16;
         ip += 12;
     }
@@ -171,9 +178,28 @@ static inline size_t base64_encode_sse(const uint8_t *restrict in,
         *op++ = '=';
     }
 
+    /* Order the streaming stores before the buffer is handed to write() */
+    if (stream)
+        _mm_sfence();
+
     return op - out;
 }
 
+static inline size_t base64_encode_sse(const uint8_t *restrict in,
+                                       size_t inlen,
+                                       uint8_t *restrict out)
+{
+    return base64_encode_sse_impl(in, inlen, out, false);
+}
+
+/* Non-temporal variant for large output that is only read back by write() */
+static inline size_t base64_encode_sse_stream(const uint8_t *restrict in,
+                                              size_t inlen,
+                                              uint8_t *restrict out)
+{
+    return base64_encode_sse_impl(in, inlen, out, true);
+}
+
 #else /* !__SSSE3__ */
 
 /* SSE2 without SSSE3: fall back to scalar implementation */
@@ -187,6 +213,13 @@ static inline size_t base64_encode_sse(const uint8_t *restrict in,
     return base64_encode_scalar(in, inlen, out);
 }
 
+static inline size_t base64_encode_sse_stream(const uint8_t *restrict in,
+                                              size_t inlen,
+                                              uint8_t *restrict out)
+{
+    return base64_encode_sse(in, inlen, out);
+}
+
 #endif /* __SSSE3__ */
 
 #endif /* __x86_64__ || _M_X64 || __i386__ || _M_IX86 */
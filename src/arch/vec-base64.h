@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Portable vector-extension base64 encoding
+ *
+ * Same structure as the SSSE3 and NEON kernels (12 input bytes become 16
+ * output characters per iteration), but written with generic vectors so it
+ * compiles on any architecture GCC or Clang supports.
+ */
+
+#pragma once
+
+#include "vec-common.h"
+
+#ifdef VEC_AVAILABLE
+
+/* Algorithm:
+ * 1. Shuffle each 3-byte group into its own 32-bit lane as a 24-bit value
+ * 2. Shift and mask the four 6-bit indices into the lane's four bytes
+ * 3. Map indices to ASCII by adding a per-range offset selected with
+ *    compares ('A'-0, 'a'-26, '0'-52, '+'-62, '/'-63)
+ */
+static inline size_t base64_encode_vec(const uint8_t *restrict input,
+                                       size_t input_len,
+                                       uint8_t *restrict output)
+{
+    size_t i = 0, o = 0;
+
+    /* Each 16-byte load uses 12 bytes, so keep 4 bytes of slack */
+    for (; i + 16 <= input_len; i += 12, o += 16) {
+        const vec_u8_t in = vec_load_u8(input + i);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        const vec_u32_t t = (vec_u32_t) VEC_SHUFFLE_U8(
+                                in, 0, 0, 1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9,
+                                10, 11) &
+                            0xFFFFFF;
+        const vec_u32_t idx = ((t << 6) & 0x3F000000) |
+                              ((t << 4) & 0x3F0000) | ((t << 2) & 0x3F00) |
+                              (t & 0x3F);
+#else
+        const vec_u32_t t = (vec_u32_t) VEC_SHUFFLE_U8(
+                                in, 2, 1, 0, 0, 5, 4, 3, 3, 8, 7, 6, 6, 11,
+                                10, 9, 9) &
+                            0xFFFFFF;
+        const vec_u32_t idx = (t >> 18) | ((t >> 4) & 0x3F00) |
+                              ((t << 10) & 0x3F0000) |
+                              ((t << 24) & 0x3F000000);
+#endif
+
+        const vec_u8_t v = (vec_u8_t) idx;
+        const vec_u8_t offset = 65 + ((vec_u8_t) (v >= 26) & 6) +
+                                ((vec_u8_t) (v >= 52) & (uint8_t) -75) +
+                                ((vec_u8_t) (v >= 62) & (uint8_t) -15) +
+                                ((vec_u8_t) (v >= 63) & 3);
+        vec_store_u8(output + o, v + offset);
+    }
+
+    return o + base64_encode_scalar(input + i, input_len - i, output + o);
+}
+
+#endif /* VEC_AVAILABLE */
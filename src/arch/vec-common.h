@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Portable SIMD building blocks using GCC/Clang vector extensions
+ *
+ * Kernels written against these types compile to whatever vector unit the
+ * target has (AltiVec/VSX, LSX, MSA, RVV, WASM SIMD, ...) without
+ * architecture-specific intrinsics, and to plain scalar code where it has
+ * none. They back the architectures without an SSE or NEON kernel.
+ */
+
+#pragma once
+
+#if defined(__GNUC__)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VEC_AVAILABLE 1
+
+/* Targets where the vector types map to real SIMD registers */
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ALTIVEC__) || \
+    defined(__loongarch_sx) || defined(__mips_msa) ||                   \
+    defined(__wasm_simd128__) || defined(__riscv_vector) ||             \
+    (defined(__s390x__) && defined(__VEC__))
+#define VEC_NATIVE 1
+#endif
+
+typedef uint8_t vec_u8_t __attribute__((vector_size(16)));
+typedef uint32_t vec_u32_t __attribute__((vector_size(16)));
+
+/* Constant byte shuffle; GCC and Clang spell it differently */
+#if defined(__clang__)
+#define VEC_SHUFFLE_U8(v, ...) __builtin_shufflevector(v, v, __VA_ARGS__)
+#else
+#define VEC_SHUFFLE_U8(v, ...) __builtin_shuffle(v, (vec_u8_t) {__VA_ARGS__})
+#endif
+
+/* Unaligned load and store; memcpy compiles to a single vector move */
+static inline vec_u8_t vec_load_u8(const uint8_t *p)
+{
+    vec_u8_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vec_store_u8(uint8_t *p, vec_u8_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+#endif /* __GNUC__ */
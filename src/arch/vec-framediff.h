@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Portable vector-extension frame difference detection
+ *
+ * Counts differing RGB24 pixels between two frames. Unlike the SSE kernel,
+ * which counts differing bytes and divides by three, the count is exact:
+ * the byte masks of each pixel are folded together, as the NEON kernel does
+ * with its deinterleaved channels.
+ */
+
+#pragma once
+
+#include "vec-common.h"
+
+#ifdef VEC_AVAILABLE
+
+/* All ones in the bytes where the two frames differ */
+static inline vec_u8_t framediff_mask_vec(const uint8_t *a, const uint8_t *b)
+{
+    return (vec_u8_t) (vec_load_u8(a) != vec_load_u8(b));
+}
+
+/* Processes 16 pixels (48 bytes) per iteration:
+ * 1. Compare 16 bytes at offsets 0, 1 and 2 and OR the masks, so each byte
+ *    says whether it or one of the next two differ; at the byte holding a
+ *    pixel's red component that is the whole pixel's result. The unaligned
+ *    loads do the byte shifting, which would otherwise take a two-vector
+ *    shuffle that not every target lowers well.
+ * 2. Keep those bytes as 0 or 1 and add them to per-byte counters
+ * The pixels start at bytes 0, 3, ... 45, i.e. at different lanes of each
+ * 16-byte vector, so the three kept sets do not overlap and are combined
+ * with OR. The last vector reads two bytes past the block.
+ */
+static inline size_t framediff_count_vec(const uint8_t *restrict frame1,
+                                         const uint8_t *restrict frame2,
+                                         size_t pixel_count)
+{
+    const vec_u8_t start[3] = {
+        {1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1},
+        {0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0},
+        {0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0, 1, 0, 0},
+    };
+    const size_t total_bytes = pixel_count * 3;
+    size_t diff = 0;
+    size_t i = 0;
+
+    while (i + 50 <= total_bytes) {
+        /* A byte counter takes at most 255 blocks before it is summed */
+        vec_u8_t counts = {0};
+        for (int n = 0; n < 255 && i + 50 <= total_bytes; n++, i += 48) {
+            vec_u8_t pixels = {0};
+            for (int v = 0; v < 3; v++) {
+                const uint8_t *a = frame1 + i + v * 16;
+                const uint8_t *b = frame2 + i + v * 16;
+                pixels |= (framediff_mask_vec(a, b) |
+                           framediff_mask_vec(a + 1, b + 1) |
+                           framediff_mask_vec(a + 2, b + 2)) &
+                          start[v];
+            }
+            counts += pixels;
+        }
+        for (int k = 0; k < 16; k++)
+            diff += counts[k];
+    }
+
+    for (; i + 3 <= total_bytes; i += 3) {
+        if (frame1[i] != frame2[i] || frame1[i + 1] != frame2[i + 1] ||
+            frame1[i + 2] != frame2[i + 2])
+            diff++;
+    }
+    return diff;
+}
+
+/* Calculate difference percentage (0-100) */
+static inline int framediff_percentage_vec(const uint8_t *restrict frame1,
+                                           const uint8_t *restrict frame2,
+                                           size_t pixel_count)
+{
+    size_t diff_pixels = framediff_count_vec(frame1, frame2, pixel_count);
+    return (int) ((diff_pixels * 100) / pixel_count);
+}
+
+#endif /* VEC_AVAILABLE */
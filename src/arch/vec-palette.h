@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Portable vector-extension palette expansion
+ *
+ * Expands 8-bit indexed pixels to RGB24. The palette is first widened to a
+ * 256-entry table of 32-bit RGBx words, so each pixel costs one load, and
+ * four pixels are packed to 12 bytes with a single byte shuffle.
+ */
+
+#pragma once
+
+#include "vec-common.h"
+
+#ifdef VEC_AVAILABLE
+
+/* Build the lookup table from a 768-byte RGB palette. The padding byte is
+ * zero; byte order in memory is R, G, B on every endianness.
+ */
+static inline void palette_build_lut(uint32_t lut[256],
+                                     const uint8_t *restrict palette)
+{
+    for (int i = 0; i < 256; i++) {
+        const uint8_t rgbx[4] = {palette[i * 3], palette[i * 3 + 1],
+                                 palette[i * 3 + 2], 0};
+        memcpy(&lut[i], rgbx, sizeof(rgbx));
+    }
+}
+
+/* Each 16-byte store writes 4 bytes past the 4 pixels it expands; they are
+ * overwritten by the next iteration, and the tail is finished in scalar code
+ * so nothing is written past the end of the output.
+ */
+static inline void palette_expand_vec(uint8_t *restrict rgb24,
+                                      const uint8_t *restrict indexed,
+                                      const uint32_t *restrict lut,
+                                      size_t pixel_count)
+{
+    size_t i = 0;
+
+    for (; i + 6 <= pixel_count; i += 4) {
+        const vec_u32_t px = {lut[indexed[i]], lut[indexed[i + 1]],
+                              lut[indexed[i + 2]], lut[indexed[i + 3]]};
+        vec_store_u8(rgb24 + i * 3,
+                     VEC_SHUFFLE_U8((vec_u8_t) px, 0, 1, 2, 4, 5, 6, 8, 9,
+                                    10, 12, 13, 14, 0, 0, 0, 0));
+    }
+
+    for (; i < pixel_count; i++)
+        memcpy(rgb24 + i * 3, &lut[indexed[i]], 3);
+}
+
+#endif /* VEC_AVAILABLE */
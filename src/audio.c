@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Audio pipeline
+ *
+ * The game thread pulls the engine's mixed sound buffer at the engine's
+ * sample rate (audio_pump() after each doom_update()) and pushes it into a
+ * single-producer single-consumer ring. If the ring is full the buffer is
+ * dropped and counted as an overrun; the game tic never waits for audio.
+ *
+ * An audio thread drains the ring on the same clock, started by
+ * audio_start(), applies the master gain and writes interleaved 16-bit
+ * stereo PCM to the sink. The engine mixes its channels itself, inside
+ * PureDOOM.h, so the gain (SSE2/NEON where available) only scales the mixed
+ * result. When the ring cannot supply the samples that are due, it pads
+ * with silence so the sink stays in real time, and counts an underrun.
+ *
+ * Sinks:
+ *   wav:PATH (or any PATH ending in .wav)  WAV file
+ *   raw:PATH                               raw s16le stereo, file or FIFO
+ *   fd:N                                   raw s16le stereo to an open fd
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "PureDOOM.h"
+#include "kitty-doom.h"
+
+#include "arch/neon-audio.h"
+#include "arch/sse-audio.h"
+
+#define AUDIO_RATE 11025          /* engine mixing rate */
+#define AUDIO_BUFFER_FRAMES 512   /* frames per doom_get_sound_buffer() */
+#define AUDIO_RING_FRAMES 8192    /* ~0.74 s, power of two */
+#define AUDIO_LATENCY_FRAMES 1024 /* ~93 ms of slack for tic jitter */
+#define AUDIO_CHUNK_FRAMES 1024
+#define AUDIO_PERIOD_MS 10
+
+typedef enum { SINK_WAV, SINK_RAW, SINK_FD } sink_kind_t;
+
+static struct {
+    /* Ring: written by the game thread, read by the audio thread */
+    int16_t ring[AUDIO_RING_FRAMES * 2];
+    _Atomic uint32_t head __attribute__((aligned(64)));
+    _Atomic uint32_t tail __attribute__((aligned(64)));
+
+    /* Game thread state */
+    uint64_t start_ns;
+    uint64_t produced_frames;
+    unsigned long long overruns;
+
+    /* Audio thread state */
+    sink_kind_t kind;
+    const char *path;
+    int fd;
+    bool sink_failed;
+    int sink_errno; /* why, reported by audio_stop() */
+    int16_t gain_q12;
+    uint64_t written_frames;
+    unsigned long long underruns;
+
+    pthread_t thread;
+    atomic_bool stop;
+    bool running;
+} audio = {.fd = -1};
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static inline void audio_gain_scalar(int16_t *restrict dst,
+                                     const int16_t *restrict src,
+                                     size_t samples,
+                                     int16_t gain_q12)
+{
+    for (size_t i = 0; i < samples; i++) {
+        int32_t v = ((int32_t) src[i] * gain_q12) >> 12;
+        dst[i] = (int16_t) (v > INT16_MAX ? INT16_MAX
+                                          : v < INT16_MIN ? INT16_MIN : v);
+    }
+}
+
+static inline void audio_gain(int16_t *restrict dst,
+                              const int16_t *restrict src,
+                              size_t samples,
+                              int16_t gain_q12)
+{
+#if defined(__aarch64__) || defined(__ARM_NEON)
+    audio_gain_neon(dst, src, samples, gain_q12);
+#elif defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+    audio_gain_sse(dst, src, samples, gain_q12);
+#else
+    audio_gain_scalar(dst, src, samples, gain_q12);
+#endif
+}
+
+/* Write everything or mark the sink as failed (e.g. the player exited).
+ * The failure is reported at exit, not over the game screen.
+ */
+static void sink_write(const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0 && !audio.sink_failed) {
+        ssize_t n = write(audio.fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            audio.sink_errno = n < 0 ? errno : EIO;
+            audio.sink_failed = true;
+            return;
+        }
+        p += n;
+        size -= (size_t) n;
+    }
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, (uint16_t) v);
+    put_le16(p + 2, (uint16_t) (v >> 16));
+}
+
+static void wav_header(uint8_t hdr[44], uint32_t data_bytes)
+{
+    memcpy(hdr, "RIFF", 4);
+    put_le32(hdr + 4, 36 + data_bytes);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    put_le32(hdr + 16, 16);                  /* fmt chunk size */
+    put_le16(hdr + 20, 1);                   /* PCM */
+    put_le16(hdr + 22, 2);                   /* channels */
+    put_le32(hdr + 24, AUDIO_RATE);          /* sample rate */
+    put_le32(hdr + 28, AUDIO_RATE * 2 * 2);  /* byte rate */
+    put_le16(hdr + 32, 4);                   /* block align */
+    put_le16(hdr + 34, 16);                  /* bits per sample */
+    memcpy(hdr + 36, "data", 4);
+    put_le32(hdr + 40, data_bytes);
+}
+
+/* Opened from the audio thread. A FIFO has no writer side until a player
+ * opens it for reading, so poll with O_NONBLOCK (ENXIO) while watching for
+ * shutdown, then switch the descriptor back to blocking writes.
+ */
+static bool sink_open(void)
+{
+    while (audio.kind != SINK_FD) {
+        audio.fd = open(audio.path,
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NONBLOCK,
+                        0644);
+        if (audio.fd >= 0) {
+            fcntl(audio.fd, F_SETFL,
+                  fcntl(audio.fd, F_GETFL) & ~O_NONBLOCK);
+            break;
+        }
+        if (errno != ENXIO ||
+            atomic_load_explicit(&audio.stop, memory_order_relaxed)) {
+            if (errno != ENXIO)
+                fprintf(stderr, "Cannot open audio sink %s: %s\n",
+                        audio.path, strerror(errno));
+            return false;
+        }
+        nanosleep(&(struct timespec) {.tv_nsec = 50000000L}, NULL);
+    }
+
+    if (audio.kind == SINK_WAV) {
+        /* Sizes are patched in sink_close() once the length is known */
+        uint8_t hdr[44];
+        wav_header(hdr, 0xffffffffu - 36);
+        sink_write(hdr, sizeof(hdr));
+    }
+    return !audio.sink_failed;
+}
+
+static void sink_close(void)
+{
+    if (audio.fd < 0)
+        return;
+
+    if (audio.kind == SINK_WAV) {
+        uint8_t hdr[44];
+        wav_header(hdr, (uint32_t) (audio.written_frames * 4));
+        /* Not possible on a FIFO; players cope with the streaming header */
+        if (pwrite(audio.fd, hdr, sizeof(hdr), 0) != sizeof(hdr) &&
+            errno != ESPIPE)
+            fprintf(stderr, "Cannot finalize WAV header of %s\n", audio.path);
+    }
+    if (audio.kind != SINK_FD)
+        close(audio.fd);
+    audio.fd = -1;
+}
+
+/* Write n frames from the ring, padding with silence if it runs dry */
+static void drain(uint32_t n)
+{
+    static int16_t out[AUDIO_CHUNK_FRAMES * 2];
+    const uint32_t head =
+        atomic_load_explicit(&audio.head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&audio.tail, memory_order_relaxed);
+    const uint32_t avail = head - tail;
+    const uint32_t take = avail < n ? avail : n;
+
+    uint32_t done = 0;
+    while (done < take) {
+        /* Contiguous run up to the ring's wrap point */
+        const uint32_t idx = tail & (AUDIO_RING_FRAMES - 1);
+        uint32_t run = AUDIO_RING_FRAMES - idx;
+        if (run > take - done)
+            run = take - done;
+        audio_gain(out + done * 2, audio.ring + idx * 2, run * 2,
+                   audio.gain_q12);
+        tail += run;
+        done += run;
+    }
+    atomic_store_explicit(&audio.tail, tail, memory_order_release);
+
+    if (take < n) {
+        memset(out + take * 2, 0, (n - take) * 4);
+        audio.underruns++;
+    }
+    sink_write(out, n * 4);
+    audio.written_frames += n;
+}
+
+static void *audio_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "audio");
+
+    /* A departed player must surface as EPIPE here, not kill the game */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (!sink_open())
+        audio.sink_failed = true;
+
+    /* The game has been producing since audio_start(). Whatever piled up
+     * while the sink was opening (a FIFO waits for its reader) would play
+     * that much late for good; once the ring is full the newest buffers
+     * are the ones dropped, so none of it is current. Discard it all and
+     * start the schedule at the present, one latency slack from now.
+     */
+    uint64_t skipped = 0;
+    const uint64_t opened =
+        (get_time_ns() - audio.start_ns) * AUDIO_RATE / 1000000000ULL;
+    if (opened > AUDIO_LATENCY_FRAMES) {
+        skipped = opened;
+        atomic_store_explicit(
+            &audio.tail,
+            atomic_load_explicit(&audio.head, memory_order_acquire),
+            memory_order_release);
+    }
+
+    const struct timespec period = {
+        .tv_sec = 0,
+        .tv_nsec = AUDIO_PERIOD_MS * 1000000L,
+    };
+
+    while (!atomic_load_explicit(&audio.stop, memory_order_relaxed)) {
+        nanosleep(&period, NULL);
+
+        const uint64_t elapsed = get_time_ns() - audio.start_ns;
+        const uint64_t clock = elapsed * AUDIO_RATE / 1000000000ULL;
+        if (clock <= AUDIO_LATENCY_FRAMES)
+            continue;
+
+        const uint64_t due = clock - AUDIO_LATENCY_FRAMES;
+        while (skipped + audio.written_frames < due) {
+            uint64_t n = due - skipped - audio.written_frames;
+            drain(n < AUDIO_CHUNK_FRAMES ? (uint32_t) n : AUDIO_CHUNK_FRAMES);
+        }
+    }
+
+    sink_close();
+    return NULL;
+}
+
+static bool parse_sink(const char *spec)
+{
+    const size_t len = strlen(spec);
+    if (!strncmp(spec, "wav:", 4)) {
+        audio.kind = SINK_WAV;
+        audio.path = spec + 4;
+    } else if (!strncmp(spec, "raw:", 4)) {
+        audio.kind = SINK_RAW;
+        audio.path = spec + 4;
+    } else if (!strncmp(spec, "fd:", 3)) {
+        char *end;
+        long fd = strtol(spec + 3, &end, 10);
+        if (*end || fd < 0 || fcntl((int) fd, F_GETFD) < 0)
+            return false;
+        audio.kind = SINK_FD;
+        audio.fd = (int) fd;
+    } else if (len > 4 && !strcmp(spec + len - 4, ".wav")) {
+        audio.kind = SINK_WAV;
+        audio.path = spec;
+    } else {
+        return false;
+    }
+    return audio.kind == SINK_FD || *audio.path;
+}
+
+bool audio_start(const char *sink, int gain_percent)
+{
+    if (!sink || audio.running)
+        return false;
+
+    if (!parse_sink(sink)) {
+        fprintf(stderr,
+                "Invalid audio sink '%s' (use wav:PATH, raw:PATH or fd:N)\n",
+                sink);
+        return false;
+    }
+
+    long gain = (long) gain_percent * 4096 / 100;
+    audio.gain_q12 = (int16_t) (gain > INT16_MAX ? INT16_MAX : gain);
+    audio.start_ns = get_time_ns();
+    atomic_store_explicit(&audio.stop, false, memory_order_relaxed);
+
+    if (pthread_create(&audio.thread, NULL, audio_thread_func, NULL) != 0) {
+        fprintf(stderr, "Failed to start audio thread\n");
+        return false;
+    }
+    audio.running = true;
+    return true;
+}
+
+void audio_pump(void)
+{
+    if (!audio.running)
+        return;
+
+    const uint64_t elapsed = get_time_ns() - audio.start_ns;
+    const uint64_t due = elapsed * AUDIO_RATE / 1000000000ULL;
+
+    /* After a long stall, resynchronize instead of mixing a burst of stale
+     * buffers; the audio thread has already padded that gap with silence.
+     */
+    if (due > audio.produced_frames + AUDIO_RING_FRAMES)
+        audio.produced_frames = due - AUDIO_BUFFER_FRAMES;
+
+    while (audio.produced_frames < due) {
+        const int16_t *buf = (const int16_t *) doom_get_sound_buffer();
+        audio.produced_frames += AUDIO_BUFFER_FRAMES;
+
+        const uint32_t head =
+            atomic_load_explicit(&audio.head, memory_order_relaxed);
+        const uint32_t tail =
+            atomic_load_explicit(&audio.tail, memory_order_acquire);
+        if (AUDIO_RING_FRAMES - (head - tail) < AUDIO_BUFFER_FRAMES) {
+            audio.overruns++;
+            continue;
+        }
+
+        /* 512 divides the ring size, so a buffer never wraps */
+        const uint32_t idx = head & (AUDIO_RING_FRAMES - 1);
+        memcpy(audio.ring + idx * 2, buf, AUDIO_BUFFER_FRAMES * 4);
+        atomic_store_explicit(&audio.head, head + AUDIO_BUFFER_FRAMES,
+                              memory_order_release);
+    }
+}
+
+void audio_stop(void)
+{
+    if (!audio.running)
+        return;
+
+    atomic_store_explicit(&audio.stop, true, memory_order_relaxed);
+    pthread_join(audio.thread, NULL);
+    audio.running = false;
+
+    fprintf(stderr, "Audio: %.1f s written, %llu underruns, %llu overruns\n",
+            audio.written_frames / (double) AUDIO_RATE, audio.underruns,
+            audio.overruns);
+    if (audio.sink_failed)
+        fprintf(stderr, "Audio: sink write failed: %s\n",
+                strerror(audio.sink_errno));
+}
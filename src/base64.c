@@ -5,12 +5,47 @@
 
 #include "base64.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 /* Include architecture-specific implementations */
 #include "arch/neon-base64.h"
 #include "arch/sse-base64.h"
+#include "arch/vec-base64.h"
+
+/* 12-bit pair table: each half of a 3-byte group maps straight to two output
+ * characters, halving the lookups of base64_encode_scalar(). The 8 KB table
+ * is built on first use.
+ */
+static uint16_t base64_pairs[4096];
+static pthread_once_t base64_pairs_once = PTHREAD_ONCE_INIT;
+
+static void base64_pairs_init(void)
+{
+    for (int i = 0; i < 4096; i++) {
+        const uint8_t pair[2] = {base64_table[i >> 6], base64_table[i & 0x3F]};
+        memcpy(&base64_pairs[i], pair, sizeof(pair));
+    }
+}
+
+size_t base64_encode_pairs(const uint8_t *restrict input,
+                           size_t input_len,
+                           uint8_t *restrict output)
+{
+    pthread_once(&base64_pairs_once, base64_pairs_init);
+
+    size_t i = 0, o = 0;
+    for (; i + 2 < input_len; i += 3, o += 4) {
+        const uint32_t triple = ((uint32_t) input[i] << 16) |
+                                ((uint32_t) input[i + 1] << 8) | input[i + 2];
+        memcpy(output + o, &base64_pairs[triple >> 12], 2);
+        memcpy(output + o + 2, &base64_pairs[triple & 0xFFF], 2);
+    }
+
+    return o + base64_encode_scalar(input + i, input_len - i, output + o);
+}
 
 #if defined(__aarch64__) || defined(__arm__)
 /* ARM/ARM64: Check for NEON support */
@@ -119,7 +154,7 @@ static base64_encode_func_t select_best_impl(void)
     static base64_encode_func_t best_impl = NULL;
 
     if (!initialized) {
-        /* Priority: NEON > SSE/SSSE3 > Scalar */
+        /* Priority: NEON > SSE/SSSE3 > vector extensions > pair table */
         if (cpu_has_neon()) {
 #if defined(__aarch64__) || defined(__ARM_NEON)
             /* Use NEON SIMD implementation (simdutf algorithm) */
@@ -138,8 +173,15 @@ static base64_encode_func_t select_best_impl(void)
             best_impl = base64_encode_scalar;
 #endif
         } else {
-            /* Fallback to basic scalar */
-            best_impl = base64_encode_scalar;
+#if defined(VEC_NATIVE)
+            /* Generic vectors map to this target's SIMD unit */
+            best_impl = base64_encode_vec;
+#else
+            /* No vector unit: the pair table beats vectors lowered to
+             * scalar code
+             */
+            best_impl = base64_encode_pairs;
+#endif
         }
         initialized = true;
     }
@@ -156,6 +198,27 @@ size_t base64_encode_auto(const uint8_t *restrict input,
     return impl(input, input_len, output);
 }
 
+size_t base64_encode_stream(const uint8_t *restrict input,
+                            size_t input_len,
+                            uint8_t *restrict output)
+{
+    base64_encode_func_t impl = select_best_impl();
+
+    /* Below the threshold the output fits in cache and the fence costs more
+     * than the eviction it avoids.
+     */
+    if (input_len < BASE64_STREAM_MIN ||
+        (uintptr_t) output % BASE64_STREAM_ALIGN)
+        return impl(input, input_len, output);
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+    if (impl == base64_encode_sse)
+        return base64_encode_sse_stream(input, input_len, output);
+#endif
+    return impl(input, input_len, output);
+}
+
 /* Get the name of the active implementation (for debugging) */
 const char *base64_get_impl_name(void)
 {
@@ -170,6 +233,12 @@ const char *base64_get_impl_name(void)
     if (impl == base64_encode_sse)
         return "SSE/SSSE3";
 #endif
+#ifdef VEC_AVAILABLE
+    if (impl == base64_encode_vec)
+        return "Vector";
+#endif
+    if (impl == base64_encode_pairs)
+        return "Pair table";
     if (impl == base64_encode_scalar)
         return "Scalar";
     return "Unknown";
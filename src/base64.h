@@ -69,9 +69,13 @@ static inline size_t base64_encode_scalar(const uint8_t *restrict input,
     return output_len;
 }
 
-/* Scalar unrolled version removed - NEON provides sufficient speedup
- * and fallback to basic scalar is acceptable for non-ARM platforms
+/* Scalar encoding through a 4096-entry table of character pairs, so each
+ * 3-byte group takes two lookups instead of four. Used on targets with
+ * neither a hand-written nor a compiler-vectorized SIMD kernel.
  */
+size_t base64_encode_pairs(const uint8_t *restrict input,
+                           size_t input_len,
+                           uint8_t *restrict output);
 
 /* Base64 encoding function pointer type */
 typedef size_t (*base64_encode_func_t)(const uint8_t *restrict input,
@@ -83,5 +87,18 @@ size_t base64_encode_auto(const uint8_t *restrict input,
                           size_t input_len,
                           uint8_t *restrict output);
 
+/* Like base64_encode_auto(), but for large output that is read exactly once
+ * (by write()): the bulk is written with non-temporal stores so it does not
+ * evict the caller's working set. Needs a 16-byte aligned output buffer and
+ * falls back to base64_encode_auto() for small input, unaligned output or
+ * implementations without streaming stores.
+ */
+#define BASE64_STREAM_MIN (32 * 1024)
+#define BASE64_STREAM_ALIGN 16
+
+size_t base64_encode_stream(const uint8_t *restrict input,
+                            size_t input_len,
+                            uint8_t *restrict output);
+
 /* Get the name of the active implementation (for debugging) */
 const char *base64_get_impl_name(void);
@@ -0,0 +1,564 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Runtime control socket
+ *
+ * A line protocol on a Unix socket for reading and changing transport and
+ * pacing settings of a running game, e.g.:
+ *   socat - UNIX-CONNECT:/tmp/kitty-doom-control.sock
+ *
+ *   get [KEY]                  print settings, then "ok"
+ *   set KEY VALUE [KEY VALUE]  change settings together; "ok N" or "error"
+ *   wait                       until the game applied the last set
+ *   help
+ *
+ * The control thread never touches game state. A set builds a complete new
+ * snapshot and swaps it into a single pending pointer; the game thread
+ * takes it with one atomic exchange at the next frame boundary and reports
+ * back with control_ack(). A frame with nothing pending costs one relaxed
+ * load, and no lock is taken on either side. Snapshots replaced before the
+ * game took them are freed by the control thread, the one the game took is
+ * freed by the game thread when it takes the next, so neither frees memory
+ * the other can still see.
+ *
+ * Acknowledgements go back the same way: control_ack() swaps the applied
+ * generation and its error, if any, into a single pointer that the control
+ * thread takes when it next answers a get or a wait.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#define CONTROL_CLIENTS 4
+#define CONTROL_LINE 256
+#define CONTROL_WAIT_MS 1000
+
+typedef struct {
+    control_config_t config;
+    unsigned generation;
+} snapshot_t;
+
+typedef struct {
+    unsigned generation;
+    char error[96]; /* empty when applied cleanly */
+} ack_t;
+
+typedef struct {
+    int fd;
+    size_t used;
+    char line[CONTROL_LINE];
+
+    /* A wait in progress; the lines after it are held until it returns */
+    bool waiting;
+    unsigned wait_for;
+    unsigned long long wait_until_ms;
+} client_t;
+
+static struct {
+    int listen_fd;
+    char path[108];
+    pthread_t thread;
+    atomic_bool stop;
+    bool running;
+    client_t clients[CONTROL_CLIENTS];
+
+    /* Control thread only */
+    snapshot_t latest;
+
+    /* Handed from the control thread to the game thread */
+    _Atomic(snapshot_t *) pending;
+
+    /* Game thread only */
+    snapshot_t *taken;
+
+    /* Handed from the game thread back to the control thread */
+    _Atomic(ack_t *) acked;
+
+    /* Control thread only: the latest ack taken, NULL before the first */
+    ack_t *ack;
+} control = {.listen_fd = -1};
+
+enum {
+    KEY_OUTPUT,
+    KEY_FPS,
+    KEY_DIVISOR,
+    KEY_DOWNSCALE,
+    KEY_COMPRESS,
+    KEY_WORKERS,
+    KEY_COUNT,
+};
+
+static const char *const key_names[KEY_COUNT] = {
+    [KEY_OUTPUT] = "output",
+    [KEY_FPS] = "fps",
+    [KEY_DIVISOR] = "frame-divisor",
+    [KEY_DOWNSCALE] = "downscale",
+    [KEY_COMPRESS] = "compress",
+    [KEY_WORKERS] = "workers",
+};
+
+static int find_key(const char *name)
+{
+    for (int i = 0; i < KEY_COUNT; i++) {
+        if (!strcmp(key_names[i], name))
+            return i;
+    }
+    return -1;
+}
+
+static void format_value(const control_config_t *c, int key, char *buf,
+                         size_t size)
+{
+    switch (key) {
+    case KEY_OUTPUT:
+        snprintf(buf, size, "%s", c->output);
+        break;
+    case KEY_FPS:
+        snprintf(buf, size, "%d", c->fps);
+        break;
+    case KEY_DIVISOR:
+        snprintf(buf, size, "%d", c->degrade.frame_divisor);
+        break;
+    case KEY_DOWNSCALE:
+        snprintf(buf, size, "%d", c->degrade.downscale);
+        break;
+    case KEY_COMPRESS:
+        snprintf(buf, size, "%d", c->degrade.compress);
+        break;
+    default:
+        snprintf(buf, size, "%d", c->workers);
+        break;
+    }
+}
+
+static bool parse_number(const char *str, int lo, int hi, int *out)
+{
+    char *end;
+    const long v = strtol(str, &end, 10);
+    if (!*str || *end || v < lo || v > hi)
+        return false;
+    *out = (int) v;
+    return true;
+}
+
+/* Returns NULL or why the value was refused */
+static const char *set_value(control_config_t *c, int key, const char *value)
+{
+    int n;
+    switch (key) {
+    case KEY_OUTPUT:
+        if (strcmp(value, "stdio") && strcmp(value, "write") &&
+            strcmp(value, "uring") && strcmp(value, "vmsplice"))
+            return "output is stdio, write, uring or vmsplice";
+        snprintf(c->output, sizeof(c->output), "%s", value);
+        return NULL;
+    case KEY_FPS:
+        if (!parse_number(value, 1, CONTROL_MAX_FPS, &c->fps))
+            return "fps is 1 to 35";
+        return NULL;
+    case KEY_DIVISOR:
+        if (!parse_number(value, 1, 8, &c->degrade.frame_divisor))
+            return "frame-divisor is 1 to 8";
+        return NULL;
+    case KEY_DOWNSCALE:
+        if (!parse_number(value, 1, 2, &c->degrade.downscale))
+            return "downscale is 1 or 2";
+        return NULL;
+    case KEY_COMPRESS:
+        if (!parse_number(value, 0, 1, &n))
+            return "compress is 0 or 1";
+#ifndef HAVE_ZLIB
+        if (n)
+            return "built without zlib";
+#endif
+        c->degrade.compress = n;
+        return NULL;
+    default:
+        if (!parse_number(value, 0, CONTROL_MAX_WORKERS, &c->workers))
+            return "workers is 0 (one per CPU) to 4";
+        return NULL;
+    }
+}
+
+static void reply(client_t *cl, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void reply(client_t *cl, const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t) n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+    /* Replies are short; a client that stops reading is dropped */
+    if (send(cl->fd, buf, (size_t) n, MSG_NOSIGNAL | MSG_DONTWAIT) != n) {
+        close(cl->fd);
+        cl->fd = -1;
+    }
+}
+
+static void publish(void)
+{
+    snapshot_t *next = malloc(sizeof(snapshot_t));
+    if (!next)
+        return;
+    *next = control.latest;
+    snapshot_t *old = atomic_exchange_explicit(&control.pending, next,
+                                               memory_order_acq_rel);
+    /* Replaced before the game thread took it: it never saw it */
+    free(old);
+}
+
+static const ack_t *take_ack(void)
+{
+    ack_t *next =
+        atomic_exchange_explicit(&control.acked, NULL, memory_order_acquire);
+    if (next) {
+        free(control.ack);
+        control.ack = next;
+    }
+    return control.ack;
+}
+
+static void cmd_get(client_t *cl, char *key)
+{
+    char value[32];
+    if (key) {
+        const int k = find_key(key);
+        if (k < 0) {
+            reply(cl, "error unknown setting %s\n", key);
+            return;
+        }
+        format_value(&control.latest.config, k, value, sizeof(value));
+        reply(cl, "%s %s\nok\n", key_names[k], value);
+        return;
+    }
+
+    for (int k = 0; k < KEY_COUNT && cl->fd >= 0; k++) {
+        format_value(&control.latest.config, k, value, sizeof(value));
+        reply(cl, "%s %s\n", key_names[k], value);
+    }
+    const ack_t *ack = take_ack();
+    if (cl->fd >= 0)
+        reply(cl, "generation %u applied %u\nok\n", control.latest.generation,
+              ack ? ack->generation : 0);
+}
+
+static void cmd_set(client_t *cl, char **save)
+{
+    control_config_t next = control.latest.config;
+    int count = 0;
+    char *key;
+    while ((key = strtok_r(NULL, " \t", save))) {
+        const char *value = strtok_r(NULL, " \t", save);
+        const int k = find_key(key);
+        if (k < 0) {
+            reply(cl, "error unknown setting %s\n", key);
+            return;
+        }
+        if (!value) {
+            reply(cl, "error %s needs a value\n", key);
+            return;
+        }
+        const char *why = set_value(&next, k, value);
+        if (why) {
+            reply(cl, "error %s\n", why);
+            return;
+        }
+        count++;
+    }
+    if (!count) {
+        reply(cl, "error usage: set KEY VALUE [KEY VALUE...]\n");
+        return;
+    }
+
+    control.latest.config = next;
+    control.latest.generation++;
+    publish();
+    reply(cl, "ok %u\n", control.latest.generation);
+}
+
+static unsigned long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* The control thread serves every client, so a wait only marks the client;
+ * wait_done() answers it from the poll loop
+ */
+static void cmd_wait(client_t *cl)
+{
+    cl->waiting = true;
+    cl->wait_for = control.latest.generation;
+    cl->wait_until_ms = now_ms() + CONTROL_WAIT_MS;
+}
+
+/* Answers the client's wait if it is over; returns whether it was */
+static bool wait_done(client_t *cl, unsigned long long now)
+{
+    const ack_t *ack = take_ack();
+    if (ack && ack->generation >= cl->wait_for) {
+        if (ack->error[0])
+            reply(cl, "error %s\n", ack->error);
+        else
+            reply(cl, "ok %u\n", cl->wait_for);
+    } else if (now >= cl->wait_until_ms) {
+        reply(cl, "error not applied yet\n");
+    } else {
+        return false;
+    }
+    cl->waiting = false;
+    return true;
+}
+
+static void handle_line(client_t *cl, char *line)
+{
+    const size_t len = strlen(line);
+    if (len && line[len - 1] == '\r')
+        line[len - 1] = '\0';
+
+    char *save = NULL;
+    char *cmd = strtok_r(line, " \t", &save);
+    if (!cmd)
+        return;
+
+    if (!strcmp(cmd, "get")) {
+        cmd_get(cl, strtok_r(NULL, " \t", &save));
+    } else if (!strcmp(cmd, "set")) {
+        cmd_set(cl, &save);
+    } else if (!strcmp(cmd, "wait")) {
+        cmd_wait(cl);
+    } else if (!strcmp(cmd, "help")) {
+        reply(cl, "get [KEY] | set KEY VALUE [KEY VALUE...] | wait\n"
+                  "keys: output fps frame-divisor downscale compress "
+                  "workers\nok\n");
+    } else {
+        reply(cl, "error unknown command %s\n", cmd);
+    }
+}
+
+/* Runs the complete lines in the client's buffer, stopping at a wait */
+static void client_run(client_t *cl)
+{
+    char *start = cl->line, *nl;
+    while (cl->fd >= 0 && !cl->waiting && (nl = strchr(start, '\n'))) {
+        *nl = '\0';
+        handle_line(cl, start);
+        start = nl + 1;
+    }
+    if (cl->fd < 0)
+        return;
+
+    cl->used -= (size_t) (start - cl->line);
+    memmove(cl->line, start, cl->used + 1);
+    if (cl->used == sizeof(cl->line) - 1) {
+        reply(cl, "error line too long\n");
+        cl->used = 0;
+        cl->line[0] = '\0';
+    }
+}
+
+static void client_read(client_t *cl)
+{
+    const ssize_t n = recv(cl->fd, cl->line + cl->used,
+                           sizeof(cl->line) - 1 - cl->used, 0);
+    if (n <= 0) {
+        close(cl->fd);
+        cl->fd = -1;
+        return;
+    }
+    cl->used += (size_t) n;
+    cl->line[cl->used] = '\0';
+    client_run(cl);
+}
+
+static void *control_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "control");
+
+    while (!atomic_load_explicit(&control.stop, memory_order_relaxed)) {
+        struct pollfd pfds[CONTROL_CLIENTS + 1];
+        bool waiting = false;
+        pfds[0] = (struct pollfd) {.fd = control.listen_fd, .events = POLLIN};
+        for (int i = 0; i < CONTROL_CLIENTS; i++) {
+            const client_t *cl = &control.clients[i];
+            /* A waiting client is not read, so its next line stays queued */
+            pfds[i + 1] = (struct pollfd) {
+                .fd = cl->fd,
+                .events = cl->waiting ? 0 : POLLIN,
+            };
+            waiting |= cl->fd >= 0 && cl->waiting;
+        }
+
+        /* Wake periodically to notice shutdown, and every millisecond
+         * while a wait is outstanding to notice the game applying it
+         */
+        const int ready = poll(pfds, CONTROL_CLIENTS + 1, waiting ? 1 : 100);
+
+        const unsigned long long now = now_ms();
+        for (int i = 0; i < CONTROL_CLIENTS; i++) {
+            client_t *cl = &control.clients[i];
+            if (cl->fd >= 0 && cl->waiting && wait_done(cl, now))
+                client_run(cl);
+        }
+        if (ready <= 0)
+            continue;
+
+        for (int i = 0; i < CONTROL_CLIENTS; i++) {
+            client_t *cl = &control.clients[i];
+            if (pfds[i + 1].fd < 0 || !pfds[i + 1].revents || cl->fd < 0)
+                continue;
+            if (cl->waiting) {
+                /* Only a hangup or an error is reported while waiting */
+                close(cl->fd);
+                cl->fd = -1;
+            } else {
+                client_read(cl);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            const int fd = accept(control.listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            int slot = -1;
+            for (int i = 0; i < CONTROL_CLIENTS && slot < 0; i++) {
+                if (control.clients[i].fd < 0)
+                    slot = i;
+            }
+            if (slot < 0) {
+                close(fd);
+                continue;
+            }
+            control.clients[slot] = (client_t) {.fd = fd};
+        }
+    }
+
+    for (int i = 0; i < CONTROL_CLIENTS; i++) {
+        if (control.clients[i].fd >= 0)
+            close(control.clients[i].fd);
+        control.clients[i].fd = -1;
+    }
+    return NULL;
+}
+
+bool control_start(const char *path, const control_config_t *initial)
+{
+    if (!path || control.running)
+        return false;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Control socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    /* Replace a stale socket left behind by a previous run */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, 4) < 0) {
+        fprintf(stderr, "Control socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    control.listen_fd = fd;
+    strcpy(control.path, path);
+    control.latest = (snapshot_t) {.config = *initial};
+    for (int i = 0; i < CONTROL_CLIENTS; i++)
+        control.clients[i] = (client_t) {.fd = -1};
+    atomic_store_explicit(&control.stop, false, memory_order_relaxed);
+
+    if (pthread_create(&control.thread, NULL, control_thread_func, NULL) !=
+        0) {
+        close(fd);
+        unlink(path);
+        control.listen_fd = -1;
+        return false;
+    }
+
+    control.running = true;
+    fprintf(stderr, "Control socket on %s\n", path);
+    return true;
+}
+
+void control_stop(void)
+{
+    if (!control.running)
+        return;
+
+    atomic_store_explicit(&control.stop, true, memory_order_relaxed);
+    pthread_join(control.thread, NULL);
+    close(control.listen_fd);
+    unlink(control.path);
+    control.listen_fd = -1;
+    control.running = false;
+
+    free(atomic_exchange_explicit(&control.pending, NULL,
+                                  memory_order_acquire));
+    free(control.taken);
+    control.taken = NULL;
+    free(atomic_exchange_explicit(&control.acked, NULL,
+                                  memory_order_acquire));
+    free(control.ack);
+    control.ack = NULL;
+}
+
+const control_config_t *control_poll(void)
+{
+    /* The common case: nothing new, one relaxed load */
+    if (!atomic_load_explicit(&control.pending, memory_order_relaxed))
+        return NULL;
+
+    snapshot_t *next = atomic_exchange_explicit(&control.pending, NULL,
+                                                memory_order_acquire);
+    if (!next)
+        return NULL;
+    free(control.taken);
+    control.taken = next;
+    return &next->config;
+}
+
+void control_ack(const char *error)
+{
+    if (!control.taken)
+        return;
+    ack_t *ack = malloc(sizeof(ack_t));
+    if (!ack)
+        return;
+    ack->generation = control.taken->generation;
+    snprintf(ack->error, sizeof(ack->error), "%s", error ? error : "");
+    /* Replaced before the control thread took it: it never saw it */
+    free(atomic_exchange_explicit(&control.acked, ack, memory_order_acq_rel));
+}
@@ -0,0 +1,352 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Fair-share supervisor
+ *
+ * Sessions hosted on one machine share a small table in a file, normally
+ * on tmpfs. Every period each session publishes its weight and demand, the
+ * encode CPU and output bytes per second it would use undegraded, and then
+ * works out the same weighted max-min fair split of the host budgets as
+ * every other session: light sessions get all they ask for, what they
+ * leave is divided among the heavy ones by weight. A session over its
+ * share jumps to the best degrade level whose predicted cost fits; one
+ * under it steps back one level at a time, with some headroom, so levels
+ * do not flap. There is no central process to crash or to restart.
+ *
+ * Slots are claimed with a compare-and-swap on the owner PID. A slot whose
+ * heartbeat is older than FAIR_STALE_NS is left out of the split and can be
+ * taken over, so a session that crashed stops holding a share.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#define FAIR_MAGIC 0x4b444653u /* "KDFS" */
+#define FAIR_MAX_SESSIONS 64
+#define FAIR_PERIOD_NS 500000000ULL
+#define FAIR_STALE_NS 3000000000ULL
+#define FAIR_HEADROOM 0.85 /* stepping back must fit in 85% of the share */
+
+typedef struct {
+    _Atomic int32_t pid; /* owner, 0 for a free slot */
+    _Atomic int32_t weight;
+    _Atomic int32_t level;
+    _Atomic uint64_t heartbeat_ns;
+    _Atomic uint64_t cpu_demand;  /* encode ns per second at level 0 */
+    _Atomic uint64_t byte_demand; /* output bytes per second at level 0 */
+} fair_slot_t;
+
+typedef struct {
+    _Atomic uint32_t magic;
+    uint32_t max_sessions;
+    fair_slot_t slots[FAIR_MAX_SESSIONS];
+} fair_table_t;
+
+/* Degrade levels from best to worst picture, with each level's encode CPU
+ * and output bytes relative to level 0. CPU follows bench-render's degrade
+ * ladder: SIMD base64 is so cheap that zlib costs tens of times more, so
+ * compression only pays where egress is the scarce resource. Bytes assume
+ * typical gameplay frames; the controller measures the current level, so
+ * the estimates only steer which level it tries next.
+ */
+typedef struct {
+    degrade_t degrade;
+    double cpu, bytes;
+} fair_level_t;
+
+static const fair_level_t levels[] = {
+    {{1, 1, false}, 1.00, 1.00},
+#ifdef HAVE_ZLIB
+    {{1, 1, true}, 60.0, 0.45},
+#endif
+    {{1, 2, false}, 1.40, 0.25},
+#ifdef HAVE_ZLIB
+    {{1, 2, true}, 15.0, 0.12},
+#endif
+    {{2, 2, false}, 0.70, 0.125},
+#ifdef HAVE_ZLIB
+    {{2, 2, true}, 7.50, 0.06},
+#endif
+    {{3, 2, false}, 0.47, 0.083},
+#ifdef HAVE_ZLIB
+    {{3, 2, true}, 5.00, 0.04},
+#endif
+};
+
+#define FAIR_LEVELS (int) (sizeof(levels) / sizeof(levels[0]))
+
+struct fairshare {
+    fair_table_t *table;
+    fair_slot_t *slot;
+    fairshare_config_t config;
+    int level;
+    unsigned level_changes;
+
+    /* Current measurement window */
+    unsigned long long window_ns, window_encode_ns, window_bytes;
+    double cpu_demand, byte_demand; /* smoothed, per second at level 0 */
+};
+
+static bool slot_stale(const fair_slot_t *slot, unsigned long long now_ns)
+{
+    const int32_t pid =
+        atomic_load_explicit(&slot->pid, memory_order_acquire);
+    const uint64_t beat =
+        atomic_load_explicit(&slot->heartbeat_ns, memory_order_relaxed);
+    if (!pid)
+        return false;
+    if (beat && now_ns > beat && now_ns - beat > FAIR_STALE_NS)
+        return true;
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static fair_slot_t *claim_slot(fair_table_t *table, unsigned long long now_ns)
+{
+    const int32_t self = (int32_t) getpid();
+    for (int i = 0; i < FAIR_MAX_SESSIONS; i++) {
+        fair_slot_t *slot = &table->slots[i];
+        int32_t owner = atomic_load_explicit(&slot->pid, memory_order_relaxed);
+        if (owner && !slot_stale(slot, now_ns))
+            continue;
+        if (!atomic_compare_exchange_strong(&slot->pid, &owner, self))
+            continue;
+        atomic_store(&slot->heartbeat_ns, now_ns);
+        atomic_store(&slot->cpu_demand, 0);
+        atomic_store(&slot->byte_demand, 0);
+        atomic_store(&slot->level, 0);
+        return slot;
+    }
+    return NULL;
+}
+
+fairshare_t *fairshare_join(const char *path,
+                            const fairshare_config_t *config,
+                            unsigned long long now_ns)
+{
+    if (!path || !config)
+        return NULL;
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open fair-share table %s: %s\n", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    /* Growing the file zero-fills it; every session may race to do so */
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        ((size_t) st.st_size < sizeof(fair_table_t) &&
+         ftruncate(fd, sizeof(fair_table_t)) != 0)) {
+        fprintf(stderr, "Cannot size fair-share table %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    fair_table_t *table = mmap(NULL, sizeof(fair_table_t),
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED)
+        return NULL;
+
+    uint32_t magic = 0;
+    if (!atomic_compare_exchange_strong(&table->magic, &magic, FAIR_MAGIC) &&
+        magic != FAIR_MAGIC) {
+        fprintf(stderr, "%s is not a fair-share table\n", path);
+        munmap(table, sizeof(fair_table_t));
+        return NULL;
+    }
+    table->max_sessions = FAIR_MAX_SESSIONS;
+
+    fairshare_t *fs = calloc(1, sizeof(fairshare_t));
+    fair_slot_t *slot = fs ? claim_slot(table, now_ns) : NULL;
+    if (!slot) {
+        if (fs)
+            fprintf(stderr, "Fair-share table %s is full\n", path);
+        free(fs);
+        munmap(table, sizeof(fair_table_t));
+        return NULL;
+    }
+
+    fs->table = table;
+    fs->slot = slot;
+    fs->config = *config;
+    if (fs->config.weight < 1)
+        fs->config.weight = 1;
+    fs->window_ns = now_ns;
+    atomic_store(&slot->weight, fs->config.weight);
+    return fs;
+}
+
+void fairshare_leave(fairshare_t *fs)
+{
+    if (!fs)
+        return;
+    atomic_store_explicit(&fs->slot->pid, 0, memory_order_release);
+    munmap(fs->table, sizeof(fair_table_t));
+    free(fs);
+}
+
+/* Weighted max-min fair share of budget for session self: demands that fit
+ * under the current per-weight level are granted in full and the rest of
+ * the budget is split again among the others, until nothing changes. A
+ * granted session gets the level it fitted under, not just its demand, so
+ * it has room to step back up to a better picture.
+ */
+static double fair_split(const double *demand,
+                         const int *weight,
+                         int n,
+                         int self,
+                         double budget)
+{
+    bool granted[FAIR_MAX_SESSIONS] = {false};
+    double left = budget;
+    for (;;) {
+        double weights = 0;
+        for (int i = 0; i < n; i++)
+            weights += granted[i] ? 0 : weight[i];
+        if (weights == 0)
+            return demand[self];
+
+        const double per_weight = left / weights;
+        if (demand[self] <= per_weight * weight[self])
+            return per_weight * weight[self];
+
+        bool changed = false;
+        for (int i = 0; i < n; i++) {
+            if (!granted[i] && demand[i] <= per_weight * weight[i]) {
+                granted[i] = true;
+                left -= demand[i];
+                changed = true;
+            }
+        }
+        if (!changed)
+            return per_weight * weight[self];
+    }
+}
+
+static bool level_fits(int level,
+                       double cpu_demand,
+                       double byte_demand,
+                       double cpu_share,
+                       double byte_share,
+                       double headroom)
+{
+    return cpu_demand * levels[level].cpu <= cpu_share * headroom &&
+           byte_demand * levels[level].bytes <= byte_share * headroom;
+}
+
+bool fairshare_update(fairshare_t *fs,
+                      unsigned long long now_ns,
+                      unsigned long long encode_ns,
+                      unsigned long long bytes,
+                      degrade_t *degrade)
+{
+    if (!fs || now_ns - fs->window_ns < FAIR_PERIOD_NS)
+        return false;
+
+    /* Usage over the window, scaled back to what level 0 would cost */
+    const double secs = (now_ns - fs->window_ns) / 1e9;
+    const double cpu = (encode_ns - fs->window_encode_ns) / secs;
+    const double out = (bytes - fs->window_bytes) / secs;
+    const double cpu_demand = cpu / levels[fs->level].cpu;
+    const double byte_demand = out / levels[fs->level].bytes;
+    const bool first = fs->cpu_demand == 0 && fs->byte_demand == 0;
+    fs->cpu_demand = first ? cpu_demand : (fs->cpu_demand + cpu_demand) / 2;
+    fs->byte_demand =
+        first ? byte_demand : (fs->byte_demand + byte_demand) / 2;
+    fs->window_ns = now_ns;
+    fs->window_encode_ns = encode_ns;
+    fs->window_bytes = bytes;
+
+    fair_slot_t *self_slot = fs->slot;
+    atomic_store_explicit(&self_slot->cpu_demand, (uint64_t) fs->cpu_demand,
+                          memory_order_relaxed);
+    atomic_store_explicit(&self_slot->byte_demand,
+                          (uint64_t) fs->byte_demand, memory_order_relaxed);
+    atomic_store_explicit(&self_slot->heartbeat_ns, now_ns,
+                          memory_order_release);
+
+    /* Everyone's demand, including ours as just published */
+    double cpu_demands[FAIR_MAX_SESSIONS], byte_demands[FAIR_MAX_SESSIONS];
+    int weights[FAIR_MAX_SESSIONS];
+    int n = 0, self = 0;
+    for (int i = 0; i < FAIR_MAX_SESSIONS; i++) {
+        fair_slot_t *slot = &fs->table->slots[i];
+        if (slot != self_slot &&
+            (!atomic_load_explicit(&slot->pid, memory_order_acquire) ||
+             slot_stale(slot, now_ns)))
+            continue;
+        if (slot == self_slot)
+            self = n;
+        cpu_demands[n] = (double) atomic_load_explicit(&slot->cpu_demand,
+                                                       memory_order_relaxed);
+        byte_demands[n] = (double) atomic_load_explicit(
+            &slot->byte_demand, memory_order_relaxed);
+        weights[n] = atomic_load_explicit(&slot->weight,
+                                          memory_order_relaxed);
+        if (weights[n] < 1)
+            weights[n] = 1;
+        n++;
+    }
+
+    /* Budgets are per host; 0 leaves that resource unlimited */
+    const double cpu_share =
+        fs->config.cpu_percent
+            ? fair_split(cpu_demands, weights, n, self,
+                         fs->config.cpu_percent * 1e7)
+            : HUGE_VAL;
+    const double byte_share =
+        fs->config.egress_kbytes
+            ? fair_split(byte_demands, weights, n, self,
+                         fs->config.egress_kbytes * 1000.0)
+            : HUGE_VAL;
+
+    /* Jump straight to the best level that fits; step back gently */
+    int level = FAIR_LEVELS - 1;
+    for (int l = 0; l < FAIR_LEVELS; l++) {
+        const double headroom = l < fs->level ? FAIR_HEADROOM : 1.0;
+        if (level_fits(l, fs->cpu_demand, fs->byte_demand, cpu_share,
+                       byte_share, headroom)) {
+            level = l;
+            break;
+        }
+    }
+    if (level < fs->level - 1)
+        level = fs->level - 1;
+
+    if (level == fs->level)
+        return false;
+
+    fs->level = level;
+    fs->level_changes++;
+    atomic_store_explicit(&self_slot->level, level, memory_order_relaxed);
+    *degrade = levels[level].degrade;
+    return true;
+}
+
+int fairshare_level(const fairshare_t *fs)
+{
+    return fs ? fs->level : 0;
+}
+
+unsigned fairshare_level_changes(const fairshare_t *fs)
+{
+    return fs ? fs->level_changes : 0;
+}
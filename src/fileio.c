@@ -0,0 +1,458 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Write-behind file I/O
+ *
+ * These are the engine's file callbacks (doom_set_file_io). The engine
+ * writes savegames and its config from inside the tic with synchronous
+ * stdio, which stalls the game loop for as long as the disk takes.
+ *
+ * Files opened for writing are instead collected in memory. Closing one
+ * hands the buffer to a writer thread, which writes a temporary file next
+ * to the target, fsyncs it and renames it into place, so a crash leaves
+ * either the old file or the new one. Until that has happened, opening the
+ * same path for reading serves the queued data, so loading a game straight
+ * after saving it sees the save. A second save of a file that is still
+ * queued replaces the queued data instead of writing twice.
+ *
+ * Reads of everything else (the WAD) go straight to stdio, as before.
+ * fileio_stop() drains the queue; it also runs at exit so a config written
+ * on quit reaches the disk.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+typedef struct job {
+    struct job *next;
+    char *path;
+    unsigned char *data;
+    size_t size;
+    bool writing; /* taken by the writer, no longer replaceable */
+} job_t;
+
+typedef struct {
+    FILE *file; /* stdio pass-through, NULL for a memory file */
+    char *path; /* destination of a memory file opened for writing */
+    unsigned char *data;
+    size_t size, capacity, pos;
+    bool eof;
+} handle_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake, idle;
+    job_t *head, *tail; /* oldest first; the head may be being written */
+    pthread_t thread;
+    bool running, stop;
+    fileio_stats_t stats;
+} fio = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+/* Newest queued contents of path. Call with the lock held. */
+static job_t *find_job(const char *path)
+{
+    job_t *found = NULL;
+    for (job_t *job = fio.head; job; job = job->next) {
+        if (!strcmp(job->path, path))
+            found = job;
+    }
+    return found;
+}
+
+static int sync_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char dir[4096];
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        if ((size_t) (slash - path) >= sizeof(dir))
+            return ENAMETOOLONG;
+        memcpy(dir, path, (size_t) (slash - path));
+        dir[slash - path] = '\0';
+    }
+
+    const int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+    const int err = fsync(fd) ? errno : 0;
+    close(fd);
+    /* Some filesystems cannot sync directories; the rename still happened */
+    return err == EINVAL ? 0 : err;
+}
+
+/* Write, fsync and rename into place; returns 0 or an errno value */
+static int write_file(const char *path, const unsigned char *data, size_t size)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+        return ENAMETOOLONG;
+
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return errno;
+
+    int err = 0;
+    size_t done = 0;
+    while (done < size && !err) {
+        const ssize_t n = write(fd, data + done, size - done);
+        if (n > 0)
+            done += (size_t) n;
+        else if (n < 0 && errno != EINTR)
+            err = errno;
+    }
+    if (!err && fsync(fd))
+        err = errno;
+    if (close(fd) && !err)
+        err = errno;
+    if (!err && rename(tmp, path))
+        err = errno;
+    if (err) {
+        unlink(tmp);
+        return err;
+    }
+    return sync_dir(path);
+}
+
+/* Write out the oldest job. Called with the lock held, which is dropped
+ * around the disk I/O so the game thread can keep queueing and reading.
+ */
+static void write_head(void)
+{
+    job_t *job = fio.head;
+    job->writing = true;
+    pthread_mutex_unlock(&fio.lock);
+
+    const unsigned long long t0 = trace_now();
+    const int err = write_file(job->path, job->data, job->size);
+    trace_slice("save", t0, (long long) job->size);
+    if (err)
+        fprintf(stderr, "Cannot save %s: %s\n", job->path, strerror(err));
+
+    pthread_mutex_lock(&fio.lock);
+    if (err) {
+        fio.stats.failed++;
+    } else {
+        fio.stats.files_written++;
+        fio.stats.bytes_written += job->size;
+    }
+    fio.head = job->next;
+    if (!fio.head) {
+        fio.tail = NULL;
+        pthread_cond_broadcast(&fio.idle);
+    }
+    free(job->path);
+    free(job->data);
+    free(job);
+}
+
+static void *writer_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "fileio");
+    trace_thread_name("fileio");
+
+    pthread_mutex_lock(&fio.lock);
+    for (;;) {
+        while (!fio.head && !fio.stop)
+            pthread_cond_wait(&fio.wake, &fio.lock);
+        if (!fio.head)
+            break;
+        write_head();
+    }
+    pthread_mutex_unlock(&fio.lock);
+    return NULL;
+}
+
+bool fileio_start(void)
+{
+    if (fio.running)
+        return true;
+
+    fio.stop = false;
+    if (pthread_create(&fio.thread, NULL, writer_thread_func, NULL) != 0) {
+        fprintf(stderr, "Failed to start file writer thread\n");
+        return false;
+    }
+    fio.running = true;
+
+    static bool atexit_registered = false;
+    if (!atexit_registered)
+        atexit_registered = atexit(fileio_stop) == 0;
+    return true;
+}
+
+void fileio_flush(void)
+{
+    pthread_mutex_lock(&fio.lock);
+    if (fio.running) {
+        while (fio.head)
+            pthread_cond_wait(&fio.idle, &fio.lock);
+    } else {
+        while (fio.head)
+            write_head();
+    }
+    pthread_mutex_unlock(&fio.lock);
+}
+
+/* Also registered with atexit(), so writes queued before an exit from inside
+ * the engine still reach the disk.
+ */
+void fileio_stop(void)
+{
+    if (fio.running) {
+        pthread_mutex_lock(&fio.lock);
+        fio.stop = true;
+        pthread_cond_signal(&fio.wake);
+        pthread_mutex_unlock(&fio.lock);
+        pthread_join(fio.thread, NULL);
+        fio.running = false;
+    }
+
+    /* Anything queued while no writer was running */
+    fileio_flush();
+}
+
+fileio_stats_t fileio_get_stats(void)
+{
+    pthread_mutex_lock(&fio.lock);
+    const fileio_stats_t stats = fio.stats;
+    pthread_mutex_unlock(&fio.lock);
+    return stats;
+}
+
+static void queue_file(char *path, unsigned char *data, size_t size)
+{
+    pthread_mutex_lock(&fio.lock);
+    job_t *job = find_job(path);
+    if (job && !job->writing) {
+        /* Only the newest contents matter */
+        free(job->data);
+        job->data = data;
+        job->size = size;
+        fio.stats.superseded++;
+        pthread_mutex_unlock(&fio.lock);
+        free(path);
+        return;
+    }
+
+    job = calloc(1, sizeof(job_t));
+    if (!job) {
+        pthread_mutex_unlock(&fio.lock);
+        /* Out of memory: better a stall than a lost save */
+        const int err = write_file(path, data, size);
+        if (err)
+            fprintf(stderr, "Cannot save %s: %s\n", path, strerror(err));
+        free(path);
+        free(data);
+        return;
+    }
+    job->path = path;
+    job->data = data;
+    job->size = size;
+    if (fio.tail)
+        fio.tail->next = job;
+    else
+        fio.head = job;
+    fio.tail = job;
+    fio.stats.queued++;
+    pthread_cond_signal(&fio.wake);
+    pthread_mutex_unlock(&fio.lock);
+}
+
+/* Copy the queued contents of path into handle; false if none are queued */
+static bool load_queued(const char *path, handle_t *h)
+{
+    bool found = false;
+    pthread_mutex_lock(&fio.lock);
+    const job_t *job = find_job(path);
+    if (job) {
+        h->data = malloc(job->size ? job->size : 1);
+        if (h->data) {
+            memcpy(h->data, job->data, job->size);
+            h->size = h->capacity = job->size;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&fio.lock);
+    return found;
+}
+
+/* Existing contents for append mode, queued or on disk */
+static bool load_existing(const char *path, handle_t *h)
+{
+    if (load_queued(path, h))
+        return true;
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return errno == ENOENT;
+
+    bool ok = true;
+    unsigned char chunk[4096];
+    size_t n;
+    while (ok && (n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        ok = fileio_write(h, chunk, (int) n) == (int) n;
+    }
+    ok &= !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+void *fileio_open(const char *path, const char *mode)
+{
+    const bool update = strchr(mode, '+');
+    const bool writing = strchr(mode, 'w') || strchr(mode, 'a');
+
+    handle_t *h = calloc(1, sizeof(handle_t));
+    if (!h)
+        return NULL;
+
+    if (update) {
+        /* Read-write access is not buffered; let queued writes land first */
+        fileio_flush();
+    } else if (writing) {
+        h->path = strdup(path);
+        if (h->path && (!strchr(mode, 'a') || load_existing(path, h))) {
+            h->pos = h->size;
+            return h;
+        }
+        free(h->path);
+        free(h->data);
+        free(h);
+        return NULL;
+    } else if (load_queued(path, h)) {
+        return h;
+    }
+
+    h->file = fopen(path, mode);
+    if (!h->file) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+void fileio_close(void *handle)
+{
+    handle_t *h = (handle_t *) handle;
+    if (!h)
+        return;
+
+    if (h->file)
+        fclose(h->file);
+    else if (h->path)
+        queue_file(h->path, h->data, h->size); /* takes ownership */
+    else
+        free(h->data);
+    free(h);
+}
+
+int fileio_read(void *handle, void *buf, int count)
+{
+    handle_t *h = (handle_t *) handle;
+    if (h->file)
+        return (int) fread(buf, 1, (size_t) count, h->file);
+    if (h->path || count <= 0)
+        return 0;
+
+    size_t n = h->pos < h->size ? h->size - h->pos : 0;
+    if (n < (size_t) count)
+        h->eof = true;
+    else
+        n = (size_t) count;
+    memcpy(buf, h->data + h->pos, n);
+    h->pos += n;
+    return (int) n;
+}
+
+int fileio_write(void *handle, const void *buf, int count)
+{
+    handle_t *h = (handle_t *) handle;
+    if (h->file)
+        return (int) fwrite(buf, 1, (size_t) count, h->file);
+    if (!h->path || count <= 0)
+        return 0;
+
+    const size_t end = h->pos + (size_t) count;
+    if (end > h->capacity) {
+        size_t capacity = h->capacity ? h->capacity * 2 : 16384;
+        while (capacity < end)
+            capacity *= 2;
+        unsigned char *data = realloc(h->data, capacity);
+        if (!data)
+            return 0;
+        h->data = data;
+        h->capacity = capacity;
+    }
+    /* Seeking past the end leaves a hole, which reads back as zeros */
+    if (h->pos > h->size)
+        memset(h->data + h->size, 0, h->pos - h->size);
+    memcpy(h->data + h->pos, buf, (size_t) count);
+    h->pos = end;
+    if (end > h->size)
+        h->size = end;
+    return count;
+}
+
+/* origin is SEEK_SET, SEEK_CUR or SEEK_END, which DOOM_SEEK_* match */
+int fileio_seek(void *handle, int offset, int origin)
+{
+    handle_t *h = (handle_t *) handle;
+    if (h->file)
+        return fseek(h->file, offset, origin);
+
+    long base;
+    switch (origin) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = (long) h->pos;
+        break;
+    case SEEK_END:
+        base = (long) h->size;
+        break;
+    default:
+        return -1;
+    }
+    if (base + offset < 0)
+        return -1;
+    h->pos = (size_t) (base + offset);
+    h->eof = false;
+    return 0;
+}
+
+int fileio_tell(void *handle)
+{
+    handle_t *h = (handle_t *) handle;
+    if (h->file)
+        return (int) ftell(h->file);
+    return (int) h->pos;
+}
+
+int fileio_eof(void *handle)
+{
+    handle_t *h = (handle_t *) handle;
+    if (h->file)
+        return feof(h->file);
+    return h->eof;
+}
@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Performance overlay
+ *
+ * Draws a few lines of text into the top-left corner of an RGB24 frame using
+ * a built-in 3x5 pixel font. The frame is stretched to the terminal window,
+ * so the glyphs stay readable at the usual window sizes.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+
+#include "kitty-doom.h"
+
+#define GLYPH_W 3
+#define GLYPH_H 5
+#define CELL_W (GLYPH_W + 1)
+#define CELL_H (GLYPH_H + 1)
+#define MARGIN 2
+
+/* One row per entry, bit 2 is the leftmost pixel */
+typedef struct {
+    char ch;
+    uint8_t rows[GLYPH_H];
+} glyph_t;
+
+static const glyph_t font[] = {
+    {'0', {7, 5, 5, 5, 7}}, {'1', {2, 6, 2, 2, 7}}, {'2', {7, 1, 7, 4, 7}},
+    {'3', {7, 1, 7, 1, 7}}, {'4', {5, 5, 7, 1, 1}}, {'5', {7, 4, 7, 1, 7}},
+    {'6', {7, 4, 7, 5, 7}}, {'7', {7, 1, 1, 1, 1}}, {'8', {7, 5, 7, 5, 7}},
+    {'9', {7, 5, 7, 1, 7}}, {'.', {0, 0, 0, 0, 2}}, {'%', {5, 1, 2, 4, 5}},
+    {':', {0, 2, 0, 2, 0}}, {'/', {1, 1, 2, 4, 4}}, {'-', {0, 0, 7, 0, 0}},
+    {'A', {2, 5, 7, 5, 5}}, {'B', {6, 5, 6, 5, 6}}, {'C', {3, 4, 4, 4, 3}},
+    {'D', {6, 5, 5, 5, 6}}, {'E', {7, 4, 6, 4, 7}}, {'F', {7, 4, 6, 4, 4}},
+    {'G', {3, 4, 5, 5, 3}}, {'H', {5, 5, 7, 5, 5}}, {'I', {7, 2, 2, 2, 7}},
+    {'J', {1, 1, 1, 5, 2}}, {'K', {5, 5, 6, 5, 5}}, {'L', {4, 4, 4, 4, 7}},
+    {'M', {5, 7, 7, 5, 5}}, {'N', {6, 5, 5, 5, 5}}, {'O', {2, 5, 5, 5, 2}},
+    {'P', {6, 5, 6, 4, 4}}, {'Q', {2, 5, 5, 6, 3}}, {'R', {6, 5, 6, 5, 5}},
+    {'S', {3, 4, 2, 1, 6}}, {'T', {7, 2, 2, 2, 2}}, {'U', {5, 5, 5, 5, 7}},
+    {'V', {5, 5, 5, 5, 2}}, {'W', {5, 5, 7, 7, 5}}, {'X', {5, 5, 2, 5, 5}},
+    {'Y', {5, 5, 2, 2, 2}}, {'Z', {7, 1, 2, 4, 7}},
+};
+
+static const uint8_t *find_glyph(char ch)
+{
+    ch = (char) toupper((unsigned char) ch);
+    for (size_t i = 0; i < sizeof(font) / sizeof(font[0]); i++) {
+        if (font[i].ch == ch)
+            return font[i].rows;
+    }
+    return NULL; /* blank, e.g. space */
+}
+
+static void draw_glyph(unsigned char *restrict rgb24,
+                       int width,
+                       int x,
+                       int y,
+                       const uint8_t *rows)
+{
+    for (int gy = 0; gy < GLYPH_H; gy++) {
+        for (int gx = 0; gx < GLYPH_W; gx++) {
+            if (!(rows[gy] & (4 >> gx)))
+                continue;
+            unsigned char *p = rgb24 + ((y + gy) * width + x + gx) * 3;
+            p[0] = 255;
+            p[1] = 255;
+            p[2] = 128;
+        }
+    }
+}
+
+void hud_draw(unsigned char *restrict rgb24,
+              int width,
+              const char *const *lines,
+              int count)
+{
+    /* Darken the panel so the text stays legible over bright scenes */
+    for (int y = 0; y < HUD_HEIGHT; y++) {
+        unsigned char *row = rgb24 + y * width * 3;
+        for (int i = 0; i < HUD_WIDTH * 3; i++)
+            row[i] >>= 2;
+    }
+
+    const int max_chars = (HUD_WIDTH - MARGIN) / CELL_W;
+    const int max_lines = (HUD_HEIGHT - MARGIN) / CELL_H;
+    for (int l = 0; l < count && l < max_lines; l++) {
+        const int y = MARGIN + l * CELL_H;
+        for (int c = 0; lines[l][c] && c < max_chars; c++) {
+            const uint8_t *rows = find_glyph(lines[l][c]);
+            if (rows)
+                draw_glyph(rgb24, width, MARGIN + c * CELL_W, y, rows);
+        }
+    }
+}
@@ -15,18 +15,29 @@
 
 #include "PureDOOM.h"
 #include "kitty-doom.h"
+#include "probes.h"
 
 #define MAX_PARMS 32
 #define MAX_DA 32
-#define MAX_PENDING_RELEASES 16
 #define MAX_KEY_CODE 256
-
-typedef enum { STATE_GROUND, STATE_ESC, STATE_SS3, STATE_CSI } parser_state_t;
-
-typedef struct {
-    int key;
-    struct timespec release_time;
-} pending_release_t;
+#define MAX_STRING 256   /* longest APC payload kept for decoding */
+#define REPLY_SLOTS 16   /* graphics replies queued for the renderer */
+
+/* The only control strings asked of the terminal are graphics replies,
+ * ESC _ G ... ESC \. STATE_APC has seen ESC _ and waits for the G; anything
+ * else makes it Alt+_. STATE_STRING and STATE_STRING_ESC are inside the
+ * reply, the latter just after an ESC that may start its ST. ESC P, ESC ],
+ * ESC ^ and ESC X are Alt keys like any other.
+ */
+typedef enum {
+    STATE_GROUND,
+    STATE_ESC,
+    STATE_SS3,
+    STATE_CSI,
+    STATE_APC,
+    STATE_STRING,
+    STATE_STRING_ESC,
+} parser_state_t;
 
 struct input {
     pthread_t thread;
@@ -41,6 +52,21 @@ struct input {
     int parm_count;
     char parm_prefix;
 
+    /* Graphics reply being read, from its G. string_len goes past
+     * MAX_STRING when the payload did not fit.
+     */
+    size_t string_len;
+    char string[MAX_STRING];
+
+    /* Graphics replies, single producer (input thread) and single consumer
+     * (game thread, see input_graphics_reply()). Indices run freely and are
+     * taken modulo REPLY_SLOTS; a reply that finds the ring full is dropped.
+     */
+    graphics_reply_t replies[REPLY_SLOTS];
+    _Atomic unsigned reply_head;
+    _Atomic unsigned reply_tail;
+    unsigned long replies_dropped;
+
     int *device_attributes;
     int da_count;
     bool has_cell_size;
@@ -48,10 +74,12 @@ struct input {
     bool has_cursor_pos;
     int_pair_t cursor_pos;
 
-    /* Pending key releases for non-blocking input */
-    pending_release_t pending_releases[MAX_PENDING_RELEASES];
-    int pending_count;
-    pthread_mutex_t release_mutex;
+    /* Pending key releases for non-blocking input: one deadline per key,
+     * valid while the key's bit is set in held_keys_bitmap. Scheduling and
+     * releasing both happen on the input thread, so no lock is needed;
+     * scheduling is O(1) and a release pass only visits held keys.
+     */
+    uint64_t release_ns[MAX_KEY_CODE];
 
     /* Bitmap for O(1) key held detection (256 bits = 4 x 64-bit words)
      * Using atomic operations for lock-free access
@@ -64,9 +92,12 @@ struct input {
      */
     _Atomic uint64_t held_keys_bitmap[4];
 
-    /* ESC key timeout tracking */
+    /* ESC key and control string timeout tracking */
     struct timespec esc_time;
     bool esc_waiting;
+
+    /* Performance overlay, toggled with the backtick key */
+    atomic_bool hud_visible;
 };
 
 static inline void for_each_modifier(int modifiers, void (*lambda)(int))
@@ -84,9 +115,19 @@ static inline void for_each_modifier(int modifiers, void (*lambda)(int))
 
 static void key_down(int key)
 {
+    PROBE(key__down, key);
+    trace_instant("key down", key);
+    recorder_input_event();
     doom_key_down(key);
 }
 
+/* Fresh key press: forward it and start the key latency measurement */
+static void key_pressed(int key)
+{
+    key_down(key);
+    metrics_key_pressed();
+}
+
 /* Mark key as held in bitmap (lock-free atomic operation) */
 static inline void mark_key_held(input_t *restrict input, int key)
 {
@@ -109,42 +150,24 @@ static inline void mark_key_released(input_t *restrict input, int key)
                               memory_order_relaxed);
 }
 
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
 /* Schedule a key release after specified delay (in milliseconds).
- * If the key is already scheduled, update its release time instead of creating
- * a duplicate entry. This handles key repeat correctly.
+ * If the key is already scheduled, its release time is pushed back instead.
+ * This handles key repeat correctly.
  */
 static void sched_key_release(input_t *restrict input, int key, int delay_ms)
 {
-    pthread_mutex_lock(&input->release_mutex);
-
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-
-    /* Calculate release time */
-    struct timespec release_time = now;
-    release_time.tv_nsec += delay_ms * 1000000L;
-    if (release_time.tv_nsec >= 1000000000L) {
-        release_time.tv_sec += release_time.tv_nsec / 1000000000L;
-        release_time.tv_nsec %= 1000000000L;
-    }
-
-    /* Check if key is already scheduled - if so, update its time */
-    for (int i = 0; i < input->pending_count; i++) {
-        if (input->pending_releases[i].key == key) {
-            input->pending_releases[i].release_time = release_time;
-            pthread_mutex_unlock(&input->release_mutex);
-            return;
-        }
-    }
-
-    /* Add new key if not already scheduled */
-    if (input->pending_count < MAX_PENDING_RELEASES) {
-        input->pending_releases[input->pending_count++] =
-            (pending_release_t) {.key = key, .release_time = release_time};
-        mark_key_held(input, key); /* Mark in bitmap */
-    }
+    if (key < 0 || key >= MAX_KEY_CODE)
+        return;
 
-    pthread_mutex_unlock(&input->release_mutex);
+    input->release_ns[key] = get_time_ns() + delay_ms * 1000000ULL;
+    mark_key_held(input, key); /* Mark in bitmap */
 }
 
 /* Schedule modifier key releases */
@@ -166,31 +189,33 @@ static void sched_modifier_releases(input_t *restrict input,
 /* Process pending key releases - called from input thread loop */
 static void process_pending_releases(input_t *restrict input)
 {
-    pthread_mutex_lock(&input->release_mutex);
-
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-
-    /* Process releases in reverse order to allow safe removal */
-    for (int i = input->pending_count - 1; i >= 0; i--) {
-        const pending_release_t *pr = &input->pending_releases[i];
+    const uint64_t now = get_time_ns();
+    int pending = 0;
+
+    /* Visit only held keys, one bitmap word at a time */
+    for (int word = 0; word < MAX_KEY_CODE / 64; word++) {
+        uint64_t bits = atomic_load_explicit(&input->held_keys_bitmap[word],
+                                             memory_order_relaxed);
+        while (bits) {
+            const int key = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            /* Check if release time has passed */
+            if (now < input->release_ns[key]) {
+                pending++;
+                continue;
+            }
 
-        /* Check if release time has passed */
-        if (now.tv_sec > pr->release_time.tv_sec ||
-            (now.tv_sec == pr->release_time.tv_sec &&
-             now.tv_nsec >= pr->release_time.tv_nsec)) {
             /* Release the key */
-            doom_key_up(pr->key);
-            mark_key_released(input, pr->key); /* Clear from bitmap */
-
-            /* Remove from list by shifting remaining items */
-            for (int j = i; j < input->pending_count - 1; j++)
-                input->pending_releases[j] = input->pending_releases[j + 1];
-            input->pending_count--;
+            PROBE(key__up, key);
+            trace_instant("key up", key);
+            recorder_input_event();
+            doom_key_up(key);
+            mark_key_released(input, key); /* Clear from bitmap */
         }
     }
 
-    pthread_mutex_unlock(&input->release_mutex);
+    metrics_input_queue_depth(pending);
 }
 
 /* Check if a key is already held (lock-free atomic read, O(1)) */
@@ -209,6 +234,19 @@ static bool is_key_held(input_t *restrict input, int key)
 
 static void ascii_key(input_t *restrict input, char ch)
 {
+    /* Backtick toggles the performance overlay and never reaches DOOM */
+    if (ch == '`') {
+        atomic_store_explicit(&input->hud_visible,
+                              !atomic_load_explicit(&input->hud_visible,
+                                                    memory_order_relaxed),
+                              memory_order_relaxed);
+        return;
+    }
+
+    /* Bytes of UTF-8 sequences (e.g. pasted text) are not DOOM keys */
+    if ((unsigned char) ch >= 0x80)
+        return;
+
     int doom_key = ch;
     if (doom_key == '\r')
         doom_key = DOOM_KEY_ENTER;
@@ -225,7 +263,7 @@ static void ascii_key(input_t *restrict input, char ch)
      * This provides smooth continuous movement when holding arrow keys.
      */
     if (!is_key_held(input, doom_key))
-        doom_key_down(doom_key);
+        key_pressed(doom_key);
     sched_key_release(input, doom_key, 50); /*  50ms delay */
 }
 
@@ -248,7 +286,7 @@ static void ss3_key(input_t *restrict input, char ch)
     }
     if (doom_key) {
         if (!is_key_held(input, doom_key))
-            doom_key_down(doom_key);
+            key_pressed(doom_key);
         sched_key_release(input, doom_key, 50);
     }
 }
@@ -324,7 +362,7 @@ static void csi_key(input_t *restrict input, char ch, int parm1, int parm2)
 
         if (!already_held) {
             for_each_modifier(parm2, key_down);
-            doom_key_down(doom_key);
+            key_pressed(doom_key);
         }
 
         sched_key_release(input, doom_key, delay_ms);
@@ -359,8 +397,141 @@ static void position_report(input_t *restrict input, int row, int col)
     pthread_mutex_unlock(&input->query_mutex);
 }
 
+static const struct {
+    const char *code;
+    graphics_error_t error;
+} graphics_errors[] = {
+    {"ENOENT", GRAPHICS_ENOENT},   {"EINVAL", GRAPHICS_EINVAL},
+    {"EBADMSG", GRAPHICS_EBADMSG}, {"ENODATA", GRAPHICS_ENODATA},
+    {"EFBIG", GRAPHICS_EFBIG},     {"ENOSPC", GRAPHICS_ENOSPC},
+};
+
+/* Decode the payload of a graphics reply after its 'G', e.g.
+ * "i=31,p=7;ENOENT:No such image". Keys other than i, I and p are ignored.
+ */
+static bool graphics_reply_decode(const char *s,
+                                  size_t len,
+                                  graphics_reply_t *restrict reply)
+{
+    const char *end = s + len;
+    const char *msg = memchr(s, ';', len);
+    if (!msg)
+        return false;
+
+    *reply = (graphics_reply_t) {.error = GRAPHICS_OK};
+    for (const char *p = s; p < msg; p++) {
+        const char key = *p;
+        unsigned value = 0;
+        if (p + 1 < msg && p[1] == '=') {
+            for (p += 2; p < msg && *p >= '0' && *p <= '9'; p++)
+                value = value * 10 + (unsigned) (*p - '0');
+        }
+        if (key == 'i')
+            reply->image_id = value;
+        else if (key == 'I')
+            reply->image_number = value;
+        else if (key == 'p')
+            reply->placement_id = value;
+        while (p < msg && *p != ',')
+            p++;
+    }
+
+    msg++;
+    size_t msg_len = (size_t) (end - msg);
+    if (msg_len >= sizeof(reply->message))
+        msg_len = sizeof(reply->message) - 1;
+    memcpy(reply->message, msg, msg_len);
+    reply->message[msg_len] = '\0';
+    if (!strcmp(reply->message, "OK"))
+        return true;
+
+    /* Error replies are "CODE:text" */
+    const size_t code_len = strcspn(reply->message, ":");
+    reply->error = GRAPHICS_EOTHER;
+    for (size_t i = 0; i < sizeof(graphics_errors) / sizeof(graphics_errors[0]);
+         i++) {
+        if (strlen(graphics_errors[i].code) == code_len &&
+            !memcmp(reply->message, graphics_errors[i].code, code_len)) {
+            reply->error = graphics_errors[i].error;
+            break;
+        }
+    }
+    return true;
+}
+
+static void graphics_reply_push(input_t *restrict input,
+                                const graphics_reply_t *restrict reply)
+{
+    const unsigned head =
+        atomic_load_explicit(&input->reply_head, memory_order_relaxed);
+    const unsigned tail =
+        atomic_load_explicit(&input->reply_tail, memory_order_acquire);
+    if (head - tail == REPLY_SLOTS) {
+        input->replies_dropped++;
+        return;
+    }
+    input->replies[head % REPLY_SLOTS] = *reply;
+    atomic_store_explicit(&input->reply_head, head + 1, memory_order_release);
+}
+
+/* A graphics reply ended with ST */
+static void string_end(input_t *restrict input)
+{
+    input->state = STATE_GROUND;
+    if (input->string_len > MAX_STRING)
+        return;
+
+    graphics_reply_t reply;
+    if (graphics_reply_decode(input->string + 1, input->string_len - 1,
+                              &reply)) {
+        trace_instant("graphics reply", reply.error);
+        graphics_reply_push(input, &reply);
+    }
+}
+
+/* Inside a graphics reply every byte is payload, Ctrl+C included, until the
+ * string terminator ESC \. CAN and SUB abort.
+ */
+static void string_char(input_t *restrict input, char ch)
+{
+    if (ch == 27) {
+        input->state = STATE_STRING_ESC;
+    } else if (ch == 0x18 || ch == 0x1a) {
+        input->state = STATE_GROUND;
+    } else if (input->string_len <= MAX_STRING) {
+        if (input->string_len < MAX_STRING)
+            input->string[input->string_len] = ch;
+        input->string_len++;
+    }
+}
+
 static void parse_char(input_t *restrict input, char ch)
 {
+    if (input->state == STATE_STRING) {
+        string_char(input, ch);
+        return;
+    }
+    if (input->state == STATE_STRING_ESC) {
+        if (ch == '\\') {
+            string_end(input);
+            return;
+        }
+        /* Not an ST: the string is cut short and the ESC starts over */
+        input->state = ch == 27 ? STATE_GROUND : STATE_ESC;
+    }
+    if (input->state == STATE_APC) {
+        if (ch == 'G') {
+            input->state = STATE_STRING;
+            input->string[0] = ch;
+            input->string_len = 1;
+            return;
+        }
+        /* Alt+_ typed by hand; the byte after it is handled as usual */
+        ascii_key(input, 27);
+        ascii_key(input, '_');
+        input->state = STATE_GROUND;
+    }
+
     if (ch == 3) {
         /* Ctrl+C - immediate exit */
         atomic_store_explicit(&input->exit_requested, true,
@@ -384,6 +555,9 @@ static void parse_char(input_t *restrict input, char ch)
             input->parm = 0;
             input->parm_count = 0;
             input->parm_prefix = 0;
+        } else if (ch == '_') {
+            /* APC: a graphics reply if a G follows */
+            input->state = STATE_APC;
         } else {
             /* ESC followed by non-sequence character - send standalone ESC */
             ascii_key(input, 27);
@@ -402,8 +576,11 @@ static void parse_char(input_t *restrict input, char ch)
             if (input->parm_count < MAX_PARMS)
                 input->parms[input->parm_count++] = input->parm;
             input->parm = 0;
-        } else if (ch == '?' || ch == '>') {
+        } else if (ch >= '<' && ch <= '?') {
+            /* Private parameter prefix, e.g. '?' for DA, '<' for SGR mouse */
             input->parm_prefix = ch;
+        } else if (ch < '@' || ch > '~') {
+            /* Intermediate or malformed byte; only 0x40-0x7E end a CSI */
         } else {
             if (input->parm_count < MAX_PARMS)
                 input->parms[input->parm_count++] = input->parm;
@@ -428,7 +605,7 @@ static void parse_char(input_t *restrict input, char ch)
                 /* Cursor position report */
                 if (input->parm_count >= 2)
                     position_report(input, input->parms[0], input->parms[1]);
-            } else {
+            } else if (!input->parm_prefix) {
                 csi_key(input, ch, input->parm_count > 0 ? input->parms[0] : 0,
                         input->parm_count > 1 ? input->parms[1] : 0);
             }
@@ -441,14 +618,19 @@ static void parse_char(input_t *restrict input, char ch)
 static void *input_thread_func(void *arg)
 {
     input_t *input = (input_t *) arg;
+    placement_enter(THREAD_INPUT, "input");
+    trace_thread_name("input");
     while (!atomic_load_explicit(&input->exiting, memory_order_relaxed)) {
         /* Process any pending key releases first */
         process_pending_releases(input);
 
         int ch;
 
-        /* If parser is in STATE_ESC, use timeout to detect standalone ESC */
-        if (input->state == STATE_ESC) {
+        /* If parser is in STATE_ESC, use timeout to detect standalone ESC.
+         * A lone ESC _ is Alt+_; a graphics reply that stalls as long is
+         * not one and is dropped.
+         */
+        if (input->state == STATE_ESC || input->state >= STATE_APC) {
             ch = os_getch_timeout(1); /*  1ms timeout for quick polling */
             if (ch < 0) {
                 /* Check if ESC has been waiting too long (100ms) */
@@ -463,7 +645,11 @@ static void *input_thread_func(void *arg)
                         (now.tv_nsec - input->esc_time.tv_nsec) / 1000000;
                     if (elapsed_ms >= 100) {
                         /* Timeout - the ESC was standalone */
-                        ascii_key(input, 27);
+                        if (input->state == STATE_ESC ||
+                            input->state == STATE_APC)
+                            ascii_key(input, 27);
+                        if (input->state == STATE_APC)
+                            ascii_key(input, '_');
                         input->state = STATE_GROUND;
                         input->esc_waiting = false;
                     }
@@ -482,8 +668,12 @@ static void *input_thread_func(void *arg)
             }
         }
 
-        if (ch >= 0)
+        if (ch >= 0) {
+            PROBE(input__byte, ch);
+            trace_instant("input byte", ch);
+            metrics_input_bytes(1);
             parse_char(input, (char) ch);
+        }
     }
     return NULL;
 }
@@ -502,9 +692,9 @@ input_t *input_create(void)
         .has_cursor_pos = false,
         .device_attributes = NULL,
         .da_count = 0,
-        .pending_count = 0,
         .held_keys_bitmap = {0}, /* Initialize bitmap to all zeros */
         .esc_waiting = false,
+        .hud_visible = false,
     };
 
     /* Initialize pthread synchronization primitives */
@@ -519,20 +709,12 @@ input_t *input_create(void)
         return NULL;
     }
 
-    if (pthread_mutex_init(&input->release_mutex, NULL) != 0) {
-        pthread_cond_destroy(&input->query_condition);
-        pthread_mutex_destroy(&input->query_mutex);
-        free(input);
-        return NULL;
-    }
-
     /* Hide the cursor */
     printf("\033[?25l");
     fflush(stdout);
 
     /* Start the keyboard thread */
     if (pthread_create(&input->thread, NULL, input_thread_func, input) != 0) {
-        pthread_mutex_destroy(&input->release_mutex);
         pthread_cond_destroy(&input->query_condition);
         pthread_mutex_destroy(&input->query_mutex);
         free(input);
@@ -569,7 +751,6 @@ void input_destroy(input_t *input)
 
     pthread_mutex_destroy(&input->query_mutex);
     pthread_cond_destroy(&input->query_condition);
-    pthread_mutex_destroy(&input->release_mutex);
 
     free(input->device_attributes);
     free(input);
@@ -581,6 +762,28 @@ bool input_is_running(const input_t *restrict input)
            !atomic_load_explicit(&input->exit_requested, memory_order_relaxed);
 }
 
+/* Take the oldest graphics reply; called from the game thread */
+bool input_graphics_reply(input_t *restrict input,
+                          graphics_reply_t *restrict reply)
+{
+    if (!input)
+        return false;
+
+    const unsigned tail =
+        atomic_load_explicit(&input->reply_tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&input->reply_head, memory_order_acquire))
+        return false;
+    *reply = input->replies[tail % REPLY_SLOTS];
+    atomic_store_explicit(&input->reply_tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool input_hud_visible(const input_t *restrict input)
+{
+    return input &&
+           atomic_load_explicit(&input->hud_visible, memory_order_relaxed);
+}
+
 void input_request_exit(input_t *restrict input)
 {
     if (!input)
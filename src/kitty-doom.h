@@ -8,6 +8,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Common types */
 typedef struct {
@@ -26,14 +27,305 @@ int *input_get_device_attributes(const input_t *restrict input,
                                  int *restrict count);
 int_pair_t input_get_screen_size(const input_t *restrict input);
 int_pair_t input_get_screen_cells(const input_t *restrict input);
+bool input_hud_visible(const input_t *restrict input);
+
+/* Kitty graphics protocol replies (ESC _ G i=...;OK ESC \), decoded by the
+ * input thread instead of being read as keys
+ */
+typedef enum {
+    GRAPHICS_OK,
+    GRAPHICS_ENOENT, /* no such image or frame */
+    GRAPHICS_EINVAL,
+    GRAPHICS_EBADMSG,
+    GRAPHICS_ENODATA,
+    GRAPHICS_EFBIG,
+    GRAPHICS_ENOSPC,
+    GRAPHICS_EOTHER, /* any other code; see message */
+} graphics_error_t;
+
+typedef struct {
+    unsigned image_id;     /* i=, 0 if absent */
+    unsigned image_number; /* I=, 0 if absent */
+    unsigned placement_id; /* p=, 0 if absent */
+    graphics_error_t error;
+    char message[64]; /* reply text, e.g. "ENOENT:No such image" */
+} graphics_reply_t;
+
+bool input_graphics_reply(input_t *restrict input,
+                          graphics_reply_t *restrict reply);
 
 /* Renderer subsystem */
 typedef struct renderer renderer_t;
 
+typedef struct {
+    unsigned long long frames_emitted;
+    unsigned long long frames_skipped; /* identical to the last sent frame */
+    unsigned long long frames_dropped; /* left out to lower the frame rate */
+    unsigned long long bytes;          /* total bytes written to stdout */
+    unsigned long long encode_ns;      /* time spent base64 encoding */
+    unsigned long long write_ns;       /* time spent writing to stdout */
+    unsigned long long frames_paced;   /* held back, terminal behind */
+    unsigned long long acks;           /* frames the terminal confirmed */
+    unsigned long long graphics_errors; /* error replies for our image */
+    unsigned long long frames_overflowed; /* too big to send, dropped */
+    unsigned long long palette_changes; /* sent in full for a new palette */
+    const char *mode;                  /* "animation" or "compat" */
+    const char *transport;             /* output path, e.g. "stdio" */
+} renderer_stats_t;
+
 renderer_t *renderer_create(int screen_rows, int screen_cols);
 void renderer_destroy(renderer_t *restrict r);
 void renderer_render_frame(renderer_t *restrict r,
                            const unsigned char *restrict rgb24_frame);
+renderer_stats_t renderer_get_stats(const renderer_t *restrict r);
+void renderer_set_hud(renderer_t *restrict r, bool visible);
+void renderer_set_source(renderer_t *restrict r,
+                         const unsigned char *indices,
+                         const unsigned char *palette);
+void renderer_graphics_reply(renderer_t *restrict r,
+                             const graphics_reply_t *restrict reply);
+
+/* Degraded output, as instructed by the fair-share supervisor */
+typedef struct {
+    int frame_divisor; /* send every Nth frame, 1 for all */
+    int downscale;     /* 1 for full resolution, 2 for half */
+    bool compress;     /* zlib (o=z) payloads when built with zlib */
+} degrade_t;
+
+void renderer_set_degrade(renderer_t *restrict r,
+                          const degrade_t *restrict degrade);
+
+/* Output backends: whole frames to stdout and mirror fds ("write", "uring",
+ * "vmsplice")
+ * The renderer fills the buffer from output_frame_begin() with one frame's
+ * wire image and hands it back with output_frame_submit().
+ */
+#define OUTPUT_MAX_FDS 16
+
+typedef struct output output_t;
+
+typedef struct {
+    unsigned long long frames;
+    unsigned long long bytes;    /* summed over all fds */
+    unsigned long long syscalls; /* output syscalls, incl. page renewal */
+    unsigned long long waits;    /* frames that waited for a free buffer */
+    unsigned sinks_lost;         /* fds dropped after a write error */
+} output_stats_t;
+
+output_t *output_create(const char *backend, const int *fds, int fd_count);
+void output_destroy(output_t *out);
+void output_drain(output_t *out);
+char *output_frame_begin(output_t *out, size_t *capacity);
+void output_frame_submit(output_t *out, size_t size);
+const char *output_name(const output_t *out);
+bool output_is_pipe(int fd);
+output_stats_t output_get_stats(const output_t *out);
+void renderer_set_output(renderer_t *restrict r, output_t *out);
+
+/* Fair-share supervisor: hosted sessions on one machine split encode CPU
+ * and egress budgets by weight through a shared table file, and each one
+ * degrades its own output to stay within its share.
+ */
+typedef struct fairshare fairshare_t;
+
+typedef struct {
+    int weight;            /* relative share, at least 1 */
+    unsigned cpu_percent;  /* host encode CPU budget, 100 per core; 0 none */
+    unsigned egress_kbytes; /* host output budget in kB/s; 0 none */
+} fairshare_config_t;
+
+fairshare_t *fairshare_join(const char *path,
+                            const fairshare_config_t *config,
+                            unsigned long long now_ns);
+void fairshare_leave(fairshare_t *fs);
+bool fairshare_update(fairshare_t *fs,
+                      unsigned long long now_ns,
+                      unsigned long long encode_ns,
+                      unsigned long long bytes,
+                      degrade_t *degrade);
+int fairshare_level(const fairshare_t *fs);
+unsigned fairshare_level_changes(const fairshare_t *fs);
+
+/* Performance overlay, drawn into the top-left corner of an RGB24 frame */
+#define HUD_WIDTH 64
+#define HUD_HEIGHT 40
+
+void hud_draw(unsigned char *restrict rgb24,
+              int width,
+              const char *const *lines,
+              int count);
+
+/* Metrics subsystem */
+bool metrics_start(const char *path);
+void metrics_stop(void);
+void metrics_record_tics(unsigned long long tics);
+void metrics_record_frame(unsigned long long emit_ns,
+                          const renderer_stats_t *restrict stats);
+void metrics_key_pressed(void);
+void metrics_input_bytes(size_t n);
+void metrics_input_queue_depth(int depth);
+
+/* Trace subsystem (Chrome trace-event JSON timeline)
+ * trace_now() returns 0 while tracing is off, which trace_slice() ignores,
+ * so call sites need no checks of their own.
+ */
+bool trace_start(const char *path);
+void trace_stop(void);
+void trace_thread_name(const char *name);
+unsigned long long trace_now(void);
+void trace_slice(const char *name, unsigned long long start_ns, long long arg);
+void trace_instant(const char *name, long long arg);
+
+/* Flight recorder: per-frame timings for the last ~30 seconds */
+typedef struct {
+    unsigned long long frame;
+    unsigned long long ts_ns; /* CLOCK_MONOTONIC at frame start */
+    unsigned frame_us, tic_us, encode_us, write_us;
+    unsigned bytes;
+    unsigned input_events; /* filled in by recorder_record() */
+    int outq_bytes;        /* filled in by recorder_record() */
+} recorder_frame_t;
+
+bool recorder_start(const char *path, int stall_ms);
+void recorder_record(recorder_frame_t *restrict frame);
+void recorder_dump(const char *reason);
+void recorder_stop(void);
+void recorder_input_event(void);
+
+/* Audio subsystem: engine sound to a WAV file, raw PCM pipe or fd */
+bool audio_start(const char *sink, int gain_percent);
+void audio_pump(void);
+void audio_stop(void);
+
+/* Write-behind file I/O: the engine's doom_set_file_io() callbacks
+ * Files written by the engine are queued in memory and written, fsynced and
+ * renamed into place by a background thread; reads of a queued file see the
+ * queued data. fileio_seek() takes SEEK_SET, SEEK_CUR or SEEK_END.
+ */
+typedef struct {
+    unsigned long long queued;     /* files handed to the writer */
+    unsigned long long superseded; /* replaced while still queued */
+    unsigned long long files_written, bytes_written;
+    unsigned long long failed;
+} fileio_stats_t;
+
+bool fileio_start(void);
+void fileio_flush(void);
+void fileio_stop(void);
+fileio_stats_t fileio_get_stats(void);
+void *fileio_open(const char *path, const char *mode);
+void fileio_close(void *handle);
+int fileio_read(void *handle, void *buf, int count);
+int fileio_write(void *handle, const void *buf, int count);
+int fileio_seek(void *handle, int offset, int origin);
+int fileio_tell(void *handle);
+int fileio_eof(void *handle);
+
+/* Agent control mode: step the game over a Unix socket, observe through a
+ * shared memory ring. The server side is driven by the game loop: call
+ * agent_next() until it returns a step request, run request.tics tics with
+ * request.keys held, then agent_publish() the frame. A reply's observation
+ * can be overwritten AGENT_SLOTS steps later; agent_observation() returns
+ * NULL once it has been. The slot can still be rewritten while it is read,
+ * so a copy is only good if agent_observation_valid() holds after it.
+ */
+#define AGENT_SLOTS 4
+#define AGENT_MAX_KEYS 16
+#define AGENT_MAX_TICS (35 * 60)
+
+enum {
+    AGENT_OP_HELLO = 1, /* reply carries the shared memory fd */
+    AGENT_OP_STEP = 2,
+};
+
+typedef struct {
+    uint32_t op;
+    uint32_t tics; /* 0 only applies the keys and observes */
+    uint32_t key_count;
+    uint8_t keys[AGENT_MAX_KEYS]; /* DOOM key codes held from now on */
+} agent_request_t;
+
+typedef struct {
+    uint32_t status; /* 0 or an errno value */
+    uint32_t slot;   /* ring slot holding the observation */
+    uint64_t seq;    /* observation number, also stored in the slot */
+    uint32_t gametic;
+    int32_t gamestate, episode, map, leveltime;
+} agent_reply_t;
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t width, height;
+    uint32_t slots;
+    uint32_t slot_size;  /* bytes from one slot to the next */
+    uint32_t first_slot; /* offset of slot 0 */
+} agent_shm_header_t;
+
+typedef struct {
+    _Atomic uint64_t seq; /* 0 while the slot is being rewritten */
+    agent_reply_t info;
+    uint8_t palette[256 * 3];
+    uint8_t pixels[]; /* width * height palette indices */
+} agent_slot_t;
+
+typedef struct agent agent_t;
+typedef struct agent_client agent_client_t;
+
+agent_t *agent_create(const char *path, int width, int height);
+void agent_destroy(agent_t *a);
+bool agent_next(agent_t *a, agent_request_t *req);
+void agent_publish(agent_t *a,
+                   const uint8_t *pixels,
+                   const uint8_t *palette,
+                   const agent_reply_t *info);
+
+agent_client_t *agent_connect(const char *path);
+void agent_disconnect(agent_client_t *c);
+const agent_shm_header_t *agent_header(const agent_client_t *c);
+bool agent_send_step(agent_client_t *c,
+                     const uint8_t *keys,
+                     int key_count,
+                     int tics);
+bool agent_recv_step(agent_client_t *c, agent_reply_t *reply);
+const agent_slot_t *agent_observation(const agent_client_t *c,
+                                      const agent_reply_t *reply);
+bool agent_observation_valid(const agent_slot_t *slot,
+                             const agent_reply_t *reply);
+
+/* Runtime control socket: a line protocol to read and change transport and
+ * pacing settings. The game thread calls control_poll() at each frame
+ * boundary; a non-NULL snapshot (valid until the next one) is applied and
+ * answered with control_ack(NULL or what went wrong).
+ */
+#define CONTROL_MAX_FPS 35
+#define CONTROL_MAX_WORKERS 4
+
+typedef struct {
+    char output[16];   /* stdio, write, uring or vmsplice */
+    int fps;           /* frame-rate cap */
+    degrade_t degrade; /* frame divisor, downscale, compression */
+    int workers;       /* precache workers, 0 for one per CPU */
+} control_config_t;
+
+bool control_start(const char *path, const control_config_t *initial);
+void control_stop(void);
+const control_config_t *control_poll(void);
+void control_ack(const char *error);
+
+/* Thread placement: per-role names, CPU affinity and scheduling policy
+ * placement_configure() takes the --cpus and --sched specs (NULL for none);
+ * each thread then calls placement_enter() once, from the thread itself.
+ */
+typedef enum {
+    THREAD_GAME,
+    THREAD_INPUT,
+    THREAD_WRITER, /* audio, trace and metrics I/O */
+    THREAD_WORKER, /* precache pool */
+    THREAD_ROLES,
+} thread_role_t;
+
+bool placement_configure(const char *cpus, const char *sched);
+void placement_enter(thread_role_t role, const char *name);
 
 /* Operating System Abstraction Layer */
 #include <signal.h>
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Hash-indexed lump lookup
+ *
+ * Replaces the engine's linear W_CheckNumForName(), which the header patch
+ * in mk/external.mk renames to W_CheckNumForName_linear(). Every texture,
+ * flat, sprite and sound is looked up by name at startup and level load,
+ * which is quadratic with large PWADs. The index is open addressed over the
+ * 8-byte names and built on first use; it is rebuilt if the directory
+ * grows. Later lumps replace earlier ones with the same name, matching the
+ * engine's back-to-front scan, so PWADs still override the IWAD.
+ *
+ * Included once, by main.c, after the engine; uses its lump directory
+ * (lumpinfo, numlumps) directly.
+ */
+
+#pragma once
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+    int *slots; /* lump number + 1, 0 marks an empty slot */
+    unsigned mask;
+    int numlumps;
+    const lumpinfo_t *lumpinfo;
+} lump_index;
+
+static unsigned lump_hash(const char name[8])
+{
+    uint32_t h = 2166136261u; /* FNV-1a */
+    for (int i = 0; i < 8; i++)
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    return h;
+}
+
+static bool lump_index_build(void)
+{
+    unsigned size = 64;
+    while (size < (unsigned) numlumps * 2)
+        size <<= 1;
+
+    int *slots = calloc(size, sizeof(int));
+    if (!slots)
+        return false;
+
+    for (int lump = 0; lump < numlumps; lump++) {
+        unsigned i = lump_hash(lumpinfo[lump].name) & (size - 1);
+        while (slots[i] &&
+               memcmp(lumpinfo[slots[i] - 1].name, lumpinfo[lump].name, 8))
+            i = (i + 1) & (size - 1);
+        slots[i] = lump + 1;
+    }
+
+    free(lump_index.slots);
+    lump_index.slots = slots;
+    lump_index.mask = size - 1;
+    lump_index.numlumps = numlumps;
+    lump_index.lumpinfo = lumpinfo;
+    return true;
+}
+
+int W_CheckNumForName(char *name)
+{
+    if ((lump_index.numlumps != numlumps ||
+         lump_index.lumpinfo != lumpinfo) &&
+        !lump_index_build())
+        return W_CheckNumForName_linear(name);
+
+    /* Upper-cased and zero padded, like the engine's strncpy + strupr */
+    char key[8] = {0};
+    for (int i = 0; i < 8 && name[i]; i++)
+        key[i] = (char) toupper((unsigned char) name[i]);
+
+    for (unsigned i = lump_hash(key) & lump_index.mask; lump_index.slots[i];
+         i = (i + 1) & lump_index.mask) {
+        const int lump = lump_index.slots[i] - 1;
+        if (!memcmp(lumpinfo[lump].name, key, 8))
+            return lump;
+    }
+    return -1;
+}
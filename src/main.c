@@ -4,9 +4,14 @@
  * "LICENSE" for information on usage and redistribution of this file.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,9 +28,143 @@
 #include "PureDOOM.h"
 
 #include "kitty-doom.h"
+#include "probes.h"
+
+/* Set by the header patch in mk/external.mk */
+#ifdef PUREDOOM_LUMP_HASH_HOOK
+#include "lump-index.h"
+#endif
 
 static const char *last_print_string = NULL;
 
+/* Command line options handled by kitty-doom itself.
+ * They use a "--" prefix so they never clash with DOOM's own "-" options,
+ * and are removed from argv before it is handed to doom_init().
+ */
+typedef struct {
+    const char *metrics_socket;
+    const char *trace_file;
+    const char *recorder_file;
+    int stall_ms;
+    const char *audio_sink;
+    int audio_gain;
+    const char *output;
+    const char *mirrors[OUTPUT_MAX_FDS - 1];
+    int mirror_count;
+    const char *cpus;
+    const char *sched;
+    const char *fair_share;
+    const char *agent_socket;
+    const char *control_socket;
+    int fair_weight;
+    int fair_cpu;
+    int fair_egress;
+    bool precache;
+    bool level_stats;
+    bool startup_profile;
+    bool late_latch;
+} options_t;
+
+static bool parse_int(const char *name, const char *str, int max, int *out)
+{
+    char *end;
+    long v = strtol(str, &end, 10);
+    if (!*str || *end || v < 0 || v > max) {
+        fprintf(stderr, "Invalid %s value: %s\n", name, str);
+        return false;
+    }
+    *out = (int) v;
+    return true;
+}
+
+static bool parse_options(int *argc, char **argv, options_t *opts)
+{
+    int out = 1;
+    for (int i = 1; i < *argc; i++) {
+        const char *name = argv[i];
+        const char *number = NULL;
+        const char **value = NULL;
+        int *int_value = NULL;
+        int max = 0;
+
+        if (!strcmp(name, "--precache")) {
+            opts->precache = true;
+            continue;
+        } else if (!strcmp(name, "--level-stats")) {
+            opts->level_stats = true;
+            continue;
+        } else if (!strcmp(name, "--startup-profile")) {
+            opts->startup_profile = true;
+            continue;
+        } else if (!strcmp(name, "--late-latch")) {
+            opts->late_latch = true;
+            continue;
+        } else if (!strcmp(name, "--metrics-socket")) {
+            value = &opts->metrics_socket;
+        } else if (!strcmp(name, "--trace")) {
+            value = &opts->trace_file;
+        } else if (!strcmp(name, "--flight-recorder")) {
+            value = &opts->recorder_file;
+        } else if (!strcmp(name, "--stall-ms")) {
+            value = &number;
+            int_value = &opts->stall_ms;
+            max = 60000;
+        } else if (!strcmp(name, "--audio")) {
+            value = &opts->audio_sink;
+        } else if (!strcmp(name, "--audio-gain")) {
+            value = &number;
+            int_value = &opts->audio_gain;
+            max = 800;
+        } else if (!strcmp(name, "--cpus")) {
+            value = &opts->cpus;
+        } else if (!strcmp(name, "--sched")) {
+            value = &opts->sched;
+        } else if (!strcmp(name, "--fair-share")) {
+            value = &opts->fair_share;
+        } else if (!strcmp(name, "--fair-weight")) {
+            value = &number;
+            int_value = &opts->fair_weight;
+            max = 1000;
+        } else if (!strcmp(name, "--fair-cpu")) {
+            value = &number;
+            int_value = &opts->fair_cpu;
+            max = 100000;
+        } else if (!strcmp(name, "--fair-egress")) {
+            value = &number;
+            int_value = &opts->fair_egress;
+            max = 100000000;
+        } else if (!strcmp(name, "--control")) {
+            value = &opts->control_socket;
+        } else if (!strcmp(name, "--agent")) {
+            value = &opts->agent_socket;
+        } else if (!strcmp(name, "--output")) {
+            value = &opts->output;
+        } else if (!strcmp(name, "--mirror")) {
+            if (opts->mirror_count == OUTPUT_MAX_FDS - 1) {
+                fprintf(stderr, "At most %d --mirror targets\n",
+                        OUTPUT_MAX_FDS - 1);
+                return false;
+            }
+            value = &opts->mirrors[opts->mirror_count++];
+        }
+
+        if (!value) {
+            argv[out++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= *argc) {
+            fprintf(stderr, "%s requires a value\n", name);
+            return false;
+        }
+        *value = argv[++i];
+        if (int_value && !parse_int(name, number, max, int_value))
+            return false;
+    }
+    argv[out] = NULL;
+    *argc = out;
+    return true;
+}
+
 /* Signal handling for graceful shutdown
  * IMPORTANT: Only sig_atomic_t access is allowed in signal handlers.
  * The handler sets a flag, and shutdown is handled in the main thread.
@@ -38,6 +177,545 @@ static void signal_handler(int signum)
     signal_received = 1;
 }
 
+static inline long long timespec_diff_ns(const struct timespec *from,
+                                        const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000LL +
+           (to->tv_nsec - from->tv_nsec);
+}
+
+/* SIGUSR1 asks for a flight recorder dump at the end of the current frame */
+static volatile sig_atomic_t dump_requested = 0;
+
+static void dump_signal_handler(int signum)
+{
+    (void) signum;
+    dump_requested = 1;
+}
+
+/* Texture precache
+ *
+ * DOOM builds the composite of a multi-patch wall texture the first time one
+ * of its columns is drawn (R_GetColumn -> R_GenerateComposite), so new areas
+ * hitch as they come into view. With --precache every composite the level
+ * can show is built right after it loads, in parallel, into one arena outside
+ * the zone heap. The zone allocator and WAD cache are not thread safe: the
+ * game thread loads and locks the patch lumps, workers only copy columns.
+ */
+#define PRECACHE_MAX_WORKERS 4
+
+typedef struct {
+    int texnum;
+    int first_patch; /* index of the texture's first entry in lumps[] */
+    size_t offset;   /* composite position in the arena */
+} precache_job_t;
+
+static struct {
+    byte *arena;
+    precache_job_t *jobs;
+    int count;
+    patch_t **lumps;
+    int lump_count;
+    atomic_int next;
+    int workers; /* 0 for one per CPU, up to PRECACHE_MAX_WORKERS */
+} precache;
+
+static void compose_texture(const precache_job_t *job)
+{
+    texture_t *texture = textures[job->texnum];
+    const short *collump = texturecolumnlump[job->texnum];
+    const unsigned short *colofs = texturecolumnofs[job->texnum];
+    byte *block = precache.arena + job->offset;
+
+    /* Same walk as R_GenerateComposite, with the lumps already in memory */
+    for (int i = 0; i < texture->patchcount; i++) {
+        const texpatch_t *patch = &texture->patches[i];
+        patch_t *realpatch = precache.lumps[job->first_patch + i];
+        const int x1 = patch->originx;
+        int x2 = x1 + SHORT(realpatch->width);
+        if (x2 > texture->width)
+            x2 = texture->width;
+
+        for (int x = x1 < 0 ? 0 : x1; x < x2; x++) {
+            if (collump[x] >= 0)
+                continue; /* single-patch column, drawn from the lump */
+            column_t *col =
+                (column_t *) ((byte *) realpatch +
+                              LONG(realpatch->columnofs[x - x1]));
+            R_DrawColumnInCache(col, block + colofs[x], patch->originy,
+                                texture->height);
+        }
+    }
+}
+
+static void *precache_worker(void *arg)
+{
+    (void) arg;
+    int i;
+    while ((i = atomic_fetch_add_explicit(&precache.next, 1,
+                                          memory_order_relaxed)) <
+           precache.count)
+        compose_texture(&precache.jobs[i]);
+    return NULL;
+}
+
+static void *precache_thread(void *arg)
+{
+    placement_enter(THREAD_WORKER, "precache");
+    return precache_worker(arg);
+}
+
+/* Detach the previous level's composites before its arena goes away */
+static void precache_release(void)
+{
+    for (int i = 0; i < precache.count; i++)
+        texturecomposite[precache.jobs[i].texnum] = NULL;
+    free(precache.arena);
+    free(precache.jobs);
+    free(precache.lumps);
+    precache.arena = NULL;
+    precache.jobs = NULL;
+    precache.lumps = NULL;
+    precache.count = 0;
+}
+
+static void mark_texture(byte *present, int texnum)
+{
+    if (texnum >= 0 && texnum < numtextures)
+        present[texnum] = 1;
+}
+
+/* Walls, sky, and every frame of animated textures and switches in use */
+static byte *find_level_textures(void)
+{
+    byte *present = calloc(numtextures, 1);
+    if (!present)
+        return NULL;
+
+    for (int i = 0; i < numsides; i++) {
+        mark_texture(present, sides[i].toptexture);
+        mark_texture(present, sides[i].midtexture);
+        mark_texture(present, sides[i].bottomtexture);
+    }
+    mark_texture(present, skytexture);
+
+    for (const anim_t *anim = anims; anim < lastanim; anim++) {
+        if (!anim->istexture)
+            continue;
+        bool used = false;
+        for (int t = anim->basepic; t <= anim->picnum; t++)
+            used |= present[t];
+        for (int t = anim->basepic; used && t <= anim->picnum; t++)
+            present[t] = 1;
+    }
+
+    for (int i = 0; i < numswitches * 2; i++) {
+        if (switchlist[i] >= 0 && present[switchlist[i]])
+            mark_texture(present, switchlist[i ^ 1]);
+    }
+    return present;
+}
+
+/* Returns the number of textures composed, -1 on allocation failure */
+static int precache_level(size_t *bytes)
+{
+    precache_release();
+
+    /* Flats are drawn straight from their lumps; just make them resident.
+     * R_PrecacheLevel does this too, except during demo playback.
+     */
+    for (int i = 0; i < numsectors; i++) {
+        W_CacheLumpNum(firstflat + flattranslation[sectors[i].floorpic],
+                       PU_CACHE);
+        W_CacheLumpNum(firstflat + flattranslation[sectors[i].ceilingpic],
+                       PU_CACHE);
+    }
+
+    byte *present = find_level_textures();
+    if (!present)
+        return -1;
+
+    int count = 0, lump_count = 0;
+    size_t size = 0;
+    for (int t = 0; t < numtextures; t++) {
+        if (!present[t] || texturecompositesize[t] <= 0)
+            continue;
+        count++;
+        lump_count += textures[t]->patchcount;
+        size += texturecompositesize[t];
+    }
+    if (!count) {
+        free(present);
+        *bytes = 0;
+        return 0;
+    }
+
+    precache.jobs = malloc(count * sizeof(precache_job_t));
+    precache.lumps = malloc(lump_count * sizeof(patch_t *));
+    precache.arena = calloc(size, 1);
+    if (!precache.jobs || !precache.lumps || !precache.arena) {
+        free(present);
+        precache_release();
+        return -1;
+    }
+
+    /* Lay out the arena and lock every patch lump on the game thread */
+    size_t offset = 0;
+    int lump = 0;
+    for (int t = 0; t < numtextures; t++) {
+        if (!present[t] || texturecompositesize[t] <= 0)
+            continue;
+        precache.jobs[precache.count++] = (precache_job_t) {
+            .texnum = t,
+            .first_patch = lump,
+            .offset = offset,
+        };
+        for (int i = 0; i < textures[t]->patchcount; i++)
+            precache.lumps[lump++] =
+                W_CacheLumpNum(textures[t]->patches[i].patch, PU_STATIC);
+        offset += texturecompositesize[t];
+    }
+    precache.lump_count = lump;
+    free(present);
+
+    int workers = precache.workers;
+    if (!workers) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > PRECACHE_MAX_WORKERS ? PRECACHE_MAX_WORKERS
+                  : cpus > 1                  ? (int) cpus
+                                              : 1;
+    }
+    pthread_t threads[PRECACHE_MAX_WORKERS];
+    int started = 0;
+    atomic_store_explicit(&precache.next, 0, memory_order_relaxed);
+    while (started < workers - 1 &&
+           pthread_create(&threads[started], NULL, precache_thread, NULL) ==
+               0)
+        started++;
+    precache_worker(NULL); /* the game thread helps instead of idling */
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    /* Publish the composites, replacing any the zone still holds */
+    for (int i = 0; i < precache.count; i++) {
+        const precache_job_t *job = &precache.jobs[i];
+        if (texturecomposite[job->texnum])
+            Z_Free(texturecomposite[job->texnum]);
+        texturecomposite[job->texnum] = precache.arena + job->offset;
+    }
+    for (int i = 0; i < precache.lump_count; i++)
+        Z_ChangeTag(precache.lumps[i], PU_CACHE);
+
+    *bytes = size;
+    return precache.count;
+}
+
+/* Per-level start time and hitch counts, reported at exit (--level-stats).
+ * A hitch is a frame that took longer than one tic, not counting the frame
+ * that loaded the level.
+ */
+#define LEVEL_STATS_MAX 32
+
+typedef struct {
+    int episode, map;
+    unsigned long long start_ns;    /* loading tic plus precache */
+    unsigned long long precache_ns;
+    int textures;
+    size_t bytes;
+    unsigned long frames, hitches;
+} level_stats_t;
+
+static struct {
+    level_stats_t levels[LEVEL_STATS_MAX];
+    unsigned count;
+    bool in_level;
+    bool skip_frame;
+    int episode, map, leveltime;
+} level_stats;
+
+static bool level_started(void)
+{
+    const bool was_in_level = level_stats.in_level;
+    level_stats.in_level = gamestate == GS_LEVEL;
+    if (!level_stats.in_level)
+        return false;
+
+    /* A restart or reloaded save on the same map rewinds leveltime */
+    const bool started = !was_in_level ||
+                         gameepisode != level_stats.episode ||
+                         gamemap != level_stats.map ||
+                         leveltime < level_stats.leveltime;
+    level_stats.episode = gameepisode;
+    level_stats.map = gamemap;
+    level_stats.leveltime = leveltime;
+    return started;
+}
+
+static void level_begin(long long tic_ns, bool do_precache)
+{
+    level_stats_t *level =
+        &level_stats.levels[level_stats.count++ % LEVEL_STATS_MAX];
+    *level = (level_stats_t) {.episode = gameepisode, .map = gamemap};
+
+    trace_instant("level start", gameepisode * 100 + gamemap);
+    if (do_precache) {
+        struct timespec start, end;
+        unsigned long long t0 = trace_now();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        level->textures = precache_level(&level->bytes);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        trace_slice("precache", t0, level->textures);
+        level->precache_ns = timespec_diff_ns(&start, &end);
+    }
+    level->start_ns = tic_ns + level->precache_ns;
+    level_stats.skip_frame = true;
+}
+
+static void level_frame_done(long long elapsed_ns, long long budget_ns)
+{
+    if (!level_stats.in_level || !level_stats.count)
+        return;
+
+    level_stats_t *level =
+        &level_stats.levels[(level_stats.count - 1) % LEVEL_STATS_MAX];
+    level->frames++;
+    if (elapsed_ns > budget_ns && !level_stats.skip_frame)
+        level->hitches++;
+    level_stats.skip_frame = false;
+}
+
+static void level_stats_report(void)
+{
+    const unsigned n = level_stats.count < LEVEL_STATS_MAX
+                           ? level_stats.count
+                           : LEVEL_STATS_MAX;
+    for (unsigned i = level_stats.count - n; i < level_stats.count; i++) {
+        const level_stats_t *l = &level_stats.levels[i % LEVEL_STATS_MAX];
+        char name[16];
+        if (gamemode == commercial)
+            snprintf(name, sizeof(name), "MAP%02d", l->map);
+        else
+            snprintf(name, sizeof(name), "E%dM%d", l->episode, l->map);
+
+        fprintf(stderr, "Level %s: start %.1f ms", name, l->start_ns / 1e6);
+        if (l->textures > 0)
+            fprintf(stderr, " (precache %.1f ms, %d textures, %zu KB)",
+                    l->precache_ns / 1e6, l->textures, l->bytes / 1024);
+        else if (l->textures < 0)
+            fprintf(stderr, " (precache failed)");
+        fprintf(stderr, ", %lu hitches in %lu frames\n", l->hitches,
+                l->frames);
+    }
+}
+
+/* Late-latch scheduling (--late-latch)
+ *
+ * The default loop runs doom_update() and then sleeps out the frame, so a key
+ * pressed during the sleep waits for the next iteration. In this mode the
+ * loop sleeps first and wakes just early enough to finish update, render and
+ * emit by the frame deadline, using a running estimate of that cost (mean
+ * plus two mean deviations, as for TCP retransmit timers).
+ *
+ * The engine is given a clock that starts at latch.origin, so its tic
+ * boundaries are known. Deadlines sit half a tic after each boundary and the
+ * wake-up is never placed before the boundary, so every update runs exactly
+ * the tic that just became due instead of sometimes none and then two.
+ * A frame rate cap from the control socket is kept by skipping tic
+ * boundaries up to the one nearest the capped schedule; the engine runs the
+ * skipped tics in the next update, as it does after the plain sleep.
+ */
+#define LATCH_FRAME_NS 28571428LL
+#define LATCH_MARGIN_NS 1000000LL /* scheduler wake-up slack */
+#define LATCH_GUARD_NS 200000LL   /* keep clear of the tic boundary */
+
+/* The clocks given to the engine start at one second: I_GetTime() takes
+ * the first second it sees as its base unless that is 0, so a clock that
+ * starts at 0 rebases a second later and its tic count falls back by 35.
+ * The base second cancels out, so tic boundaries stay at latch_boundary_ns()
+ * from the clock's origin.
+ */
+#define ENGINE_CLOCK_BASE_NS 1000000000LL
+
+static struct {
+    struct timespec origin;
+    unsigned long long tic; /* next tic to latch */
+    long long next_ns;      /* earliest frame under the fps cap */
+    long long work_ns;      /* average update + render + emit time */
+    long long dev_ns;       /* its mean deviation */
+} latch;
+
+static void latch_gettime(int *sec, int *usec)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long ns =
+        ENGINE_CLOCK_BASE_NS + timespec_diff_ns(&latch.origin, &now);
+    *sec = (int) (ns / 1000000000);
+    *usec = (int) (ns % 1000000000 / 1000);
+}
+
+static void latch_init(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &latch.origin);
+    latch.tic = 1;
+    doom_set_gettime(latch_gettime);
+}
+
+/* I_GetTime() reaches tic n once the microsecond clock passes n * 1e6 / 35 */
+static long long latch_boundary_ns(unsigned long long tic)
+{
+    return (long long) ((tic * 1000000 + 34) / 35) * 1000;
+}
+
+static void latch_wait(long frame_time_ns)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long now_ns = timespec_diff_ns(&latch.origin, &now);
+    const long long budget = latch.work_ns + 2 * latch.dev_ns + LATCH_MARGIN_NS;
+
+    while (latch_boundary_ns(latch.tic) < latch.next_ns - LATCH_FRAME_NS / 2)
+        latch.tic++;
+
+    long long wake;
+    for (;;) {
+        const long long boundary = latch_boundary_ns(latch.tic);
+        wake = boundary + LATCH_FRAME_NS / 2 - budget;
+        if (wake < boundary + LATCH_GUARD_NS)
+            wake = boundary + LATCH_GUARD_NS;
+        /* More than a frame behind: skip ahead, the engine catches up */
+        if (wake + LATCH_FRAME_NS >= now_ns)
+            break;
+        latch.tic++;
+    }
+    /* A frame late against the schedule restarts it rather than bursting */
+    const long long boundary = latch_boundary_ns(latch.tic);
+    if (latch.next_ns < boundary - LATCH_FRAME_NS / 2)
+        latch.next_ns = boundary - LATCH_FRAME_NS / 2;
+    latch.next_ns += frame_time_ns;
+    latch.tic++;
+
+    if (wake <= now_ns)
+        return;
+
+    const long long abs_ns = latch.origin.tv_sec * 1000000000LL +
+                             latch.origin.tv_nsec + wake;
+    const struct timespec until = {
+        .tv_sec = abs_ns / 1000000000,
+        .tv_nsec = abs_ns % 1000000000,
+    };
+    unsigned long long t0 = trace_now();
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) ==
+               EINTR &&
+           !signal_received)
+        ;
+    trace_slice("latch wait", t0, wake - now_ns);
+}
+
+static void latch_record(long long work_ns)
+{
+    if (!latch.work_ns) {
+        latch.work_ns = work_ns;
+        return;
+    }
+    const long long err = work_ns - latch.work_ns;
+    latch.work_ns += err / 8;
+    latch.dev_ns += ((err < 0 ? -err : err) - latch.dev_ns) / 4;
+}
+
+/* Startup profile (--startup-profile)
+ *
+ * startup_phase() closes the running phase and opens the next one; NULL
+ * closes the last. doom_init() is split into sub-phases at each "X_Init:"
+ * style message the engine prints. The table is printed at exit so it does
+ * not scribble over the game.
+ */
+#define STARTUP_MAX_PHASES 48
+
+typedef struct {
+    char name[32];
+    long long start_ns; /* relative to the first phase */
+    long long dur_ns;
+} startup_phase_t;
+
+static struct {
+    bool enabled;
+    bool done;
+    int count;
+    struct timespec origin, phase_start;
+    unsigned long long trace_start;
+    startup_phase_t phases[STARTUP_MAX_PHASES];
+} startup;
+
+static void startup_phase(const char *name)
+{
+    if (!startup.enabled || startup.done)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (startup.count == 0) {
+        startup.origin = now;
+    } else {
+        /* Out of slots: the last phase absorbs the rest */
+        if (name && startup.count == STARTUP_MAX_PHASES)
+            return;
+        startup_phase_t *prev = &startup.phases[startup.count - 1];
+        prev->dur_ns = timespec_diff_ns(&startup.phase_start, &now);
+        trace_slice(prev->name, startup.trace_start, 0);
+    }
+
+    if (!name) {
+        startup.done = true;
+        return;
+    }
+
+    startup_phase_t *phase = &startup.phases[startup.count++];
+    snprintf(phase->name, sizeof(phase->name), "%s", name);
+    phase->start_ns = timespec_diff_ns(&startup.origin, &now);
+    startup.phase_start = now;
+    startup.trace_start = trace_now();
+}
+
+/* Engine init messages look like "R_Init: Init DOOM refresh daemon" */
+static void startup_doom_message(const char *s)
+{
+    if (!startup.enabled || startup.done)
+        return;
+
+    const char *colon = strchr(s, ':');
+    if (!colon || colon == s || colon - s > 16 || !isupper((unsigned char) *s))
+        return;
+    for (const char *c = s; c < colon; c++) {
+        if (!isalnum((unsigned char) *c) && *c != '_')
+            return;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "doom_init: %.*s", (int) (colon - s), s);
+    startup_phase(name);
+}
+
+static void startup_report(void)
+{
+    if (!startup.enabled || !startup.count)
+        return;
+    startup_phase(NULL);
+
+    const startup_phase_t *last = &startup.phases[startup.count - 1];
+    const long long total = last->start_ns + last->dur_ns;
+
+    fprintf(stderr, "Startup profile:\n  %-28s %10s %10s %6s\n", "phase",
+            "start ms", "ms", "%");
+    for (int i = 0; i < startup.count; i++) {
+        const startup_phase_t *p = &startup.phases[i];
+        fprintf(stderr, "  %-28s %10.3f %10.3f %5.1f%%\n", p->name,
+                p->start_ns / 1e6, p->dur_ns / 1e6,
+                total ? 100.0 * p->dur_ns / total : 0.0);
+    }
+    fprintf(stderr, "  %-28s %10s %10.3f\n", "total", "", total / 1e6);
+}
+
 static void print_handler(const char *s)
 {
     /* Track the last print string to display as an error message when an exit
@@ -45,6 +723,7 @@ static void print_handler(const char *s)
      */
     if (*s != '\n')
         last_print_string = s;
+    startup_doom_message(s);
 }
 
 static int exit_code_global = -1; /* -1 means "not exited" */
@@ -69,6 +748,173 @@ static void exit_handler(int exit_code)
     }
 }
 
+/* doom_seek_t values match SEEK_SET, SEEK_CUR and SEEK_END */
+static int fileio_seek_handler(void *handle, int offset, doom_seek_t origin)
+{
+    return fileio_seek(handle, offset, (int) origin);
+}
+
+/* Savegames and the config are written behind the game loop; without the
+ * writer thread the engine's own synchronous stdio is kept.
+ */
+static void install_file_io(void)
+{
+    if (fileio_start())
+        doom_set_file_io(fileio_open, fileio_close, fileio_read, fileio_write,
+                         fileio_seek_handler, fileio_tell, fileio_eof);
+}
+
+/* Agent control mode (--agent)
+ *
+ * An external process steps the game through agent.c; there is no terminal,
+ * input thread or renderer. The engine runs on a clock that only moves when
+ * a step asks for tics, one tic per doom_update(), so a run is reproducible
+ * from its requests and is as fast as the engine can simulate and draw.
+ */
+static unsigned long long agent_tic;
+
+static void agent_gettime(int *sec, int *usec)
+{
+    const long long ns = ENGINE_CLOCK_BASE_NS + latch_boundary_ns(agent_tic);
+    *sec = (int) (ns / 1000000000);
+    *usec = (int) (ns % 1000000000 / 1000);
+}
+
+/* Press newly listed keys and release the ones no longer listed */
+static void agent_hold_keys(const agent_request_t *req)
+{
+    static bool held[256];
+    bool wanted[256] = {false};
+    for (uint32_t i = 0; i < req->key_count; i++)
+        wanted[req->keys[i]] = true;
+
+    for (int key = 1; key < 256; key++) {
+        if (wanted[key] == held[key])
+            continue;
+        if (wanted[key])
+            doom_key_down((doom_key_t) key);
+        else
+            doom_key_up((doom_key_t) key);
+        held[key] = wanted[key];
+    }
+}
+
+static int run_agent(const char *path, int argc, char **argv)
+{
+    agent_t *agent = agent_create(path, 320, 200);
+    if (!agent)
+        return EXIT_FAILURE;
+
+    doom_set_print(print_handler);
+    doom_set_exit(exit_handler);
+    doom_set_gettime(agent_gettime);
+    install_file_io();
+    startup_phase("doom_init");
+    doom_init(argc, argv, 0);
+    startup_report();
+    if (exit_requested) {
+        if (last_print_string)
+            printf("%s\n", last_print_string);
+        agent_destroy(agent);
+        fileio_stop();
+        return exit_code_global == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "Agent socket ready at %s\n", path);
+    unsigned long long steps = 0;
+    agent_request_t req;
+    while (!exit_requested && !signal_received) {
+        if (!agent_next(agent, &req))
+            continue;
+
+        unsigned long long t0 = trace_now();
+        agent_hold_keys(&req);
+        for (uint32_t i = 0; i < req.tics && !exit_requested; i++) {
+            agent_tic++;
+            doom_update();
+        }
+        trace_slice("agent step", t0, req.tics);
+        metrics_record_tics(gametic);
+
+        agent_publish(agent, doom_get_framebuffer(1), screen_palette,
+                      &(agent_reply_t) {
+                          .gametic = (uint32_t) gametic,
+                          .gamestate = gamestate,
+                          .episode = gameepisode,
+                          .map = gamemap,
+                          .leveltime = leveltime,
+                      });
+        steps++;
+    }
+
+    fprintf(stderr, "Agent: %llu steps, %llu tics\n", steps, agent_tic);
+    agent_destroy(agent);
+    metrics_stop();
+    fileio_stop();
+    trace_stop();
+    if (exit_requested && last_print_string)
+        printf("%s\n", last_print_string);
+    return exit_code_global == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Both the control socket and the fair-share supervisor ask for degraded
+ * output. The renderer gets the stronger of the two setting by setting, so
+ * neither undoes the other: the supervisor's share is a floor that control
+ * can only degrade further.
+ */
+static struct {
+    degrade_t control, fair;
+} degrade_request = {
+    .control = {.frame_divisor = 1, .downscale = 1},
+    .fair = {.frame_divisor = 1, .downscale = 1},
+};
+
+static void apply_degrade(renderer_t *r)
+{
+    const degrade_t *a = &degrade_request.control, *b = &degrade_request.fair;
+    const degrade_t degrade = {
+        .frame_divisor = a->frame_divisor > b->frame_divisor
+                             ? a->frame_divisor
+                             : b->frame_divisor,
+        .downscale = a->downscale > b->downscale ? a->downscale : b->downscale,
+        .compress = a->compress || b->compress,
+    };
+    renderer_set_degrade(r, &degrade);
+}
+
+/* Settings from the control socket, applied between frames. Returns NULL or
+ * what went wrong; the other settings still apply when the output fails.
+ */
+static const char *apply_control(const control_config_t *config,
+                                 renderer_t *r,
+                                 output_t **out,
+                                 const int *fds,
+                                 int fd_count,
+                                 long *frame_time_ns)
+{
+    *frame_time_ns = 1000000000L / config->fps;
+    precache.workers = config->workers;
+    degrade_request.control = config->degrade;
+    apply_degrade(r);
+
+    if (!strcmp(config->output, output_name(*out)))
+        return NULL;
+
+    output_t *next = NULL;
+    if (strcmp(config->output, "stdio")) {
+        signal(SIGPIPE, SIG_IGN);
+        next = output_create(config->output, fds, fd_count);
+        if (!next)
+            return "cannot create output backend";
+    }
+    renderer_set_output(r, next);
+    output_destroy(*out);
+    *out = next;
+    if (strcmp(config->output, output_name(next)))
+        return "output backend unavailable, fell back";
+    return NULL;
+}
+
 /* Check if terminal supports Kitty Graphics Protocol
  * Returns: true if supported, false if unsupported and should abort
  */
@@ -163,6 +1009,18 @@ fallback_warning:
 
 int main(int argc, char **argv)
 {
+    options_t opts = {.stall_ms = 100, .audio_gain = 100, .fair_weight = 1};
+    if (!parse_options(&argc, argv, &opts))
+        return EXIT_FAILURE;
+
+    startup.enabled = opts.startup_profile;
+
+    /* Threads started from here on pick up their role's placement */
+    if (!placement_configure(opts.cpus, opts.sched))
+        return EXIT_FAILURE;
+    placement_enter(THREAD_GAME, NULL);
+    startup_phase("signal handlers");
+
     /* Signal handlers are installed for graceful shutdown */
     struct sigaction sa;
     sa.sa_handler = signal_handler;
@@ -178,16 +1036,45 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    if (opts.recorder_file) {
+        if (!recorder_start(opts.recorder_file, opts.stall_ms))
+            return EXIT_FAILURE;
+        sa.sa_handler = dump_signal_handler;
+        sa.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+            fprintf(stderr, "Failed to install SIGUSR1 handler\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    startup_phase("trace setup");
+
+    /* Tracing starts first so the input thread is named in the timeline */
+    if (opts.trace_file) {
+        trace_start(opts.trace_file);
+        trace_thread_name("main");
+    }
+
+    /* Agents step the game themselves and need no terminal */
+    if (opts.agent_socket) {
+        if (opts.metrics_socket)
+            metrics_start(opts.metrics_socket);
+        return run_agent(opts.agent_socket, argc, argv);
+    }
+
     /* Check terminal compatibility before initialization */
+    startup_phase("terminal probe");
     if (!check_supported_term())
         return EXIT_FAILURE;
 
+    startup_phase("os_create");
     os_t *os = os_create();
     if (!os) {
         fprintf(stderr, "Failed to initialize OS layer\n");
         return EXIT_FAILURE;
     }
 
+    startup_phase("input_create");
     input_t *input = input_create();
     if (!input) {
         fprintf(stderr, "Failed to initialize input\n");
@@ -197,18 +1084,26 @@ int main(int argc, char **argv)
 
     doom_set_print(print_handler);
     doom_set_exit(exit_handler);
+    install_file_io();
+    if (opts.late_latch)
+        latch_init();
+    startup_phase("doom_init");
     doom_init(argc, argv, 0);
 
     /* doom_init may have triggered an exit */
     if (exit_requested) {
+        startup_report();
         if (last_print_string)
             printf("%s\n", last_print_string);
+        fileio_stop();
         input_destroy(input);
         os_destroy(os);
         return exit_code_global == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
+    startup_phase("screen cell query");
     const int_pair_t cells = input_get_screen_cells(input);
+    startup_phase("renderer_create");
     renderer_t *r = renderer_create(cells.first, cells.second);
     if (!r) {
         fprintf(stderr, "Failed to initialize renderer\n");
@@ -217,29 +1112,182 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    /* Optional output backend, which also fans the stream out to mirrors.
+     * Opening a FIFO mirror waits until a reader attaches. A pipe on stdout
+     * (ssh, capture tools) gets a backend unless told otherwise: write for
+     * one pipe, where copying into the grown pipe is cheaper than renewing
+     * gifted pages, and vmsplice once the frame goes to several pipes and
+     * one renewal replaces a copy per pipe.
+     */
+    output_t *out = NULL;
+    int out_fds[OUTPUT_MAX_FDS] = {STDOUT_FILENO};
+    int out_fd_count = 1;
+    const bool stdout_pipe = output_is_pipe(STDOUT_FILENO);
+    if (opts.output && !strcmp(opts.output, "stdio")) {
+        if (opts.mirror_count)
+            fprintf(stderr, "--mirror needs an output backend, ignored\n");
+    } else if (opts.output || opts.mirror_count || stdout_pipe) {
+        for (int i = 0; i < opts.mirror_count; i++) {
+            int fd = open(opts.mirrors[i], O_WRONLY | O_CREAT | O_TRUNC |
+                          O_CLOEXEC, 0644);
+            if (fd < 0) {
+                fprintf(stderr, "Cannot open mirror %s: %s\n",
+                        opts.mirrors[i], strerror(errno));
+                continue;
+            }
+            out_fds[out_fd_count++] = fd;
+        }
+
+        /* A spectator closing its pipe must not end the game */
+        signal(SIGPIPE, SIG_IGN);
+        const char *backend = opts.output;
+        if (!backend) {
+            int pipes = 0;
+            for (int i = 0; i < out_fd_count; i++)
+                pipes += output_is_pipe(out_fds[i]);
+            backend = pipes > 1 ? "vmsplice" : "write";
+        }
+        out = output_create(backend, out_fds, out_fd_count);
+        if (!out)
+            fprintf(stderr, "Falling back to stdio output\n");
+        renderer_set_output(r, out);
+    }
+
+    startup_phase("audio/metrics setup");
+    if (opts.audio_sink)
+        audio_start(opts.audio_sink, opts.audio_gain);
+
+    /* The metrics endpoint is optional; the game runs without it */
+    if (opts.metrics_socket)
+        metrics_start(opts.metrics_socket);
+
     /* Main game loop - 35 FPS (28.57ms per frame) */
-    const long frame_time_ns = 28571428; /* 1000ms / 35fps = 28.571ms */
+    const long tic_ns = 28571428; /* 1000ms / 35fps = 28.571ms */
+    long frame_time_ns = tic_ns;  /* lowered by the control socket */
     struct timespec frame_start, frame_end, sleep_time;
 
+    /* Hosted sessions sharing a machine degrade themselves to a fair share
+     * of its encode CPU and egress
+     */
+    fairshare_t *fair = NULL;
+    if (opts.fair_share) {
+        clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        fair = fairshare_join(opts.fair_share,
+                              &(fairshare_config_t) {
+                                  .weight = opts.fair_weight,
+                                  .cpu_percent = opts.fair_cpu,
+                                  .egress_kbytes = opts.fair_egress,
+                              },
+                              frame_start.tv_sec * 1000000000ULL +
+                                  frame_start.tv_nsec);
+    }
+
+    /* Transport and pacing can be changed while running */
+    if (opts.control_socket) {
+        control_config_t initial = {
+            .fps = 35,
+            .degrade = {.frame_divisor = 1, .downscale = 1},
+        };
+        snprintf(initial.output, sizeof(initial.output), "%s",
+                 output_name(out));
+        control_start(opts.control_socket, &initial);
+    }
+
+    unsigned long frame_index = 0;
+    renderer_stats_t prev_stats = renderer_get_stats(r);
+    startup_phase("first frame");
+
     while (input_is_running(input) && !exit_requested && !signal_received) {
+        const control_config_t *control = control_poll();
+        if (control) {
+            control_ack(apply_control(control, r, &out, out_fds, out_fd_count,
+                                      &frame_time_ns));
+            trace_instant("control", control->fps);
+        }
+
+        if (opts.late_latch)
+            latch_wait(frame_time_ns);
         clock_gettime(CLOCK_MONOTONIC, &frame_start);
+        PROBE(frame__start, frame_index);
 
+        PROBE(update__begin, gametic);
+        unsigned long long t0 = trace_now();
         doom_update();
+        audio_pump();
+        struct timespec tic_end;
+        clock_gettime(CLOCK_MONOTONIC, &tic_end);
+        trace_slice("tic", t0, gametic);
+        PROBE(update__end, gametic);
+
+        if (level_started())
+            level_begin(timespec_diff_ns(&frame_start, &tic_end),
+                        opts.precache);
 
         /* RGB24 format is obtained directly from PureDOOM */
+        t0 = trace_now();
         const unsigned char *frame = doom_get_framebuffer(3);
+        trace_slice("palette", t0, 0);
+        struct timespec emit_start;
+        clock_gettime(CLOCK_MONOTONIC, &emit_start);
+        renderer_set_hud(r, input_hud_visible(input));
+        graphics_reply_t reply;
+        while (input_graphics_reply(input, &reply))
+            renderer_graphics_reply(r, &reply);
+        renderer_set_source(r, doom_get_framebuffer(1), screen_palette);
         renderer_render_frame(r, frame);
+        clock_gettime(CLOCK_MONOTONIC, &frame_end);
+        if (frame_index == 0)
+            startup_phase(NULL);
+
+        const renderer_stats_t stats = renderer_get_stats(r);
+        metrics_record_tics(gametic);
+        metrics_record_frame(timespec_diff_ns(&emit_start, &frame_end),
+                             &stats);
+
+        if (fairshare_update(fair,
+                             frame_end.tv_sec * 1000000000ULL +
+                                 frame_end.tv_nsec,
+                             stats.encode_ns, stats.bytes,
+                             &degrade_request.fair)) {
+            apply_degrade(r);
+            trace_instant("degrade", fairshare_level(fair));
+        }
 
         /* Frame timing: sleep to maintain 35 FPS */
-        clock_gettime(CLOCK_MONOTONIC, &frame_end);
-        long elapsed_ns = (frame_end.tv_sec - frame_start.tv_sec) * 1000000000L +
-                         (frame_end.tv_nsec - frame_start.tv_nsec);
+        long elapsed_ns = (long) timespec_diff_ns(&frame_start, &frame_end);
+        PROBE(frame__end, frame_index, elapsed_ns);
+        level_frame_done(elapsed_ns, tic_ns);
+
+        recorder_record(&(recorder_frame_t) {
+            .frame = frame_index,
+            .ts_ns = frame_start.tv_sec * 1000000000ULL + frame_start.tv_nsec,
+            .frame_us = elapsed_ns / 1000,
+            .tic_us = timespec_diff_ns(&frame_start, &tic_end) / 1000,
+            .encode_us = (stats.encode_ns - prev_stats.encode_ns) / 1000,
+            .write_us = (stats.write_ns - prev_stats.write_ns) / 1000,
+            .bytes = stats.bytes - prev_stats.bytes,
+        });
+        if (dump_requested) {
+            dump_requested = 0;
+            recorder_dump("signal");
+        }
+        prev_stats = stats;
+        frame_index++;
+
+        /* Late latching sleeps before the next update instead */
+        if (opts.late_latch) {
+            latch_record(elapsed_ns);
+            continue;
+        }
+
         long sleep_ns = frame_time_ns - elapsed_ns;
 
         if (sleep_ns > 0) {
             sleep_time.tv_sec = 0;
             sleep_time.tv_nsec = sleep_ns;
+            t0 = trace_now();
             nanosleep(&sleep_time, NULL);
+            trace_slice("sleep", t0, sleep_ns);
         }
     }
 
@@ -250,9 +1298,29 @@ int main(int argc, char **argv)
     input_request_exit(input);
 
     /* Resources are cleaned up in reverse order */
+    control_stop();
+    metrics_stop();
+    audio_stop();
     renderer_destroy(r);
+    if (output_get_stats(out).sinks_lost)
+        fprintf(stderr, "Output: %u mirror(s) dropped after write errors\n",
+                output_get_stats(out).sinks_lost);
+    output_destroy(out);
+    for (int i = 1; i < out_fd_count; i++)
+        close(out_fds[i]);
+    if (fair)
+        fprintf(stderr, "Fair share: level %d at exit, %u level changes\n",
+                fairshare_level(fair), fairshare_level_changes(fair));
+    fairshare_leave(fair);
+    fileio_stop();
+    recorder_stop();
     input_destroy(input);
     os_destroy(os);
+    trace_stop();
+
+    if (opts.level_stats)
+        level_stats_report();
+    startup_report();
 
     if (exit_requested && last_print_string)
         printf("%s\n", last_print_string);
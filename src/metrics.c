@@ -0,0 +1,414 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Live metrics endpoint
+ *
+ * Each producing thread owns one cache-line aligned block of counters and is
+ * its only writer, so updates are plain relaxed load + store pairs with no
+ * read-modify-write or lock on the hot path. The server thread only performs
+ * relaxed loads when a client connects, which never stalls the game loop.
+ * Values read from different counters may be a few updates apart; that is
+ * acceptable for scraping.
+ *
+ * The snapshot is written in Prometheus text exposition format to every
+ * client that connects to the Unix socket, e.g.:
+ *   socat - UNIX-CONNECT:/tmp/kitty-doom.sock
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+/* Log2 microsecond buckets: bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) */
+#define METRICS_BUCKETS 24
+
+typedef _Atomic uint64_t counter_t;
+
+/* Written by the game thread only */
+typedef struct {
+    counter_t tics;
+    counter_t frames_emitted;
+    counter_t frames_skipped;
+    counter_t output_bytes;
+    counter_t emit_count;
+    counter_t emit_sum_us;
+    counter_t emit_hist[METRICS_BUCKETS];
+    counter_t key_count;
+    counter_t key_sum_us;
+    counter_t key_hist[METRICS_BUCKETS];
+    _Atomic(const char *) transport;
+    _Atomic(const char *) mode;
+} __attribute__((aligned(64))) game_metrics_t;
+
+/* Written by the input thread only */
+typedef struct {
+    counter_t input_bytes;
+    counter_t queue_depth;
+} __attribute__((aligned(64))) input_metrics_t;
+
+static game_metrics_t game_metrics;
+static input_metrics_t input_metrics;
+
+/* Time of the oldest key press not yet visible in an emitted frame.
+ * Set by the input thread when zero and consumed by the game thread; it is
+ * the only cross-thread handoff and lives on its own cache line.
+ */
+static _Atomic uint64_t pending_key_ns __attribute__((aligned(64)));
+
+static struct {
+    pthread_t thread;
+    int listen_fd;
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    uint64_t start_ns;
+    atomic_bool stop;
+    bool running;
+} server = {.listen_fd = -1};
+
+static atomic_bool metrics_enabled;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Single-writer update: no atomic RMW needed */
+static inline void counter_add(counter_t *c, uint64_t n)
+{
+    atomic_store_explicit(
+        c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static inline void counter_set(counter_t *c, uint64_t v)
+{
+    atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(counter_t *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static inline int bucket_of(uint64_t us)
+{
+    if (us == 0)
+        return 0;
+    int b = 64 - __builtin_clzll(us);
+    return b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1;
+}
+
+/* Upper bound of bucket b in seconds */
+static inline double bucket_le(int b)
+{
+    return (double) (1ULL << b) / 1e6;
+}
+
+static void hist_record(counter_t *hist,
+                        counter_t *sum_us,
+                        counter_t *count,
+                        uint64_t ns)
+{
+    const uint64_t us = ns / 1000;
+    counter_add(&hist[bucket_of(us)], 1);
+    counter_add(sum_us, us);
+    counter_add(count, 1);
+}
+
+void metrics_record_tics(unsigned long long tics)
+{
+    counter_set(&game_metrics.tics, tics);
+}
+
+void metrics_record_frame(unsigned long long emit_ns,
+                          const renderer_stats_t *restrict stats)
+{
+    game_metrics_t *g = &game_metrics;
+    const bool emitted =
+        stats->frames_emitted != counter_get(&g->frames_emitted);
+
+    counter_set(&g->frames_emitted, stats->frames_emitted);
+    counter_set(&g->frames_skipped, stats->frames_skipped);
+    counter_set(&g->output_bytes, stats->bytes);
+    atomic_store_explicit(&g->transport, stats->transport,
+                          memory_order_relaxed);
+    atomic_store_explicit(&g->mode, stats->mode, memory_order_relaxed);
+
+    if (!emitted)
+        return;
+
+    hist_record(g->emit_hist, &g->emit_sum_us, &g->emit_count, emit_ns);
+
+    /* The first frame written after a key press closes its latency window */
+    uint64_t pressed = atomic_exchange_explicit(&pending_key_ns, 0,
+                                                memory_order_relaxed);
+    if (pressed) {
+        const uint64_t now = get_time_ns();
+        hist_record(g->key_hist, &g->key_sum_us, &g->key_count,
+                    now > pressed ? now - pressed : 0);
+    }
+}
+
+void metrics_key_pressed(void)
+{
+    if (!atomic_load_explicit(&metrics_enabled, memory_order_relaxed))
+        return;
+
+    uint64_t expected = 0;
+    atomic_compare_exchange_strong_explicit(&pending_key_ns, &expected,
+                                            get_time_ns(), memory_order_relaxed,
+                                            memory_order_relaxed);
+}
+
+void metrics_input_bytes(size_t n)
+{
+    counter_add(&input_metrics.input_bytes, n);
+}
+
+void metrics_input_queue_depth(int depth)
+{
+    counter_set(&input_metrics.queue_depth, (uint64_t) depth);
+}
+
+/* Estimate quantile q as the upper bound of the bucket that reaches it */
+static double hist_quantile(const uint64_t *hist, uint64_t total, double q)
+{
+    if (total == 0)
+        return 0.0;
+
+    const uint64_t target = (uint64_t) (q * (double) total + 0.5);
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        cumulative += hist[b];
+        if (cumulative >= target && cumulative > 0)
+            return bucket_le(b);
+    }
+    return bucket_le(METRICS_BUCKETS - 1);
+}
+
+static void load_hist(uint64_t *dst, counter_t *src)
+{
+    for (int b = 0; b < METRICS_BUCKETS; b++)
+        dst[b] = counter_get(&src[b]);
+}
+
+static void write_snapshot(FILE *out, uint64_t *prev_ns,
+                           uint64_t *prev_tics, uint64_t *prev_bytes)
+{
+    game_metrics_t *g = &game_metrics;
+    const uint64_t now = get_time_ns();
+    const uint64_t tics = counter_get(&g->tics);
+    const uint64_t bytes = counter_get(&g->output_bytes);
+    const double interval = (now - *prev_ns) / 1e9;
+
+    /* Rates cover the time since the previous scrape (or since start) */
+    const double tic_rate =
+        interval > 0 ? (tics - *prev_tics) / interval : 0.0;
+    const double byte_rate =
+        interval > 0 ? (bytes - *prev_bytes) / interval : 0.0;
+    *prev_ns = now;
+    *prev_tics = tics;
+    *prev_bytes = bytes;
+
+    fprintf(out,
+            "# HELP kitty_doom_tics_total Game tics run.\n"
+            "# TYPE kitty_doom_tics_total counter\n"
+            "kitty_doom_tics_total %llu\n"
+            "# HELP kitty_doom_tic_rate Game tics per second.\n"
+            "# TYPE kitty_doom_tic_rate gauge\n"
+            "kitty_doom_tic_rate %.2f\n",
+            (unsigned long long) tics, tic_rate);
+
+    fprintf(out,
+            "# HELP kitty_doom_frames_emitted_total Frames written to the "
+            "terminal.\n"
+            "# TYPE kitty_doom_frames_emitted_total counter\n"
+            "kitty_doom_frames_emitted_total %llu\n"
+            "# HELP kitty_doom_frames_skipped_total Frames skipped as "
+            "unchanged.\n"
+            "# TYPE kitty_doom_frames_skipped_total counter\n"
+            "kitty_doom_frames_skipped_total %llu\n"
+            "# HELP kitty_doom_output_bytes_total Bytes written to the "
+            "terminal.\n"
+            "# TYPE kitty_doom_output_bytes_total counter\n"
+            "kitty_doom_output_bytes_total %llu\n"
+            "# HELP kitty_doom_output_bytes_per_second Terminal output rate.\n"
+            "# TYPE kitty_doom_output_bytes_per_second gauge\n"
+            "kitty_doom_output_bytes_per_second %.0f\n",
+            (unsigned long long) counter_get(&g->frames_emitted),
+            (unsigned long long) counter_get(&g->frames_skipped),
+            (unsigned long long) bytes, byte_rate);
+
+    uint64_t hist[METRICS_BUCKETS];
+    load_hist(hist, g->emit_hist);
+    uint64_t count = counter_get(&g->emit_count);
+    fprintf(out,
+            "# HELP kitty_doom_frame_emit_seconds Time to encode and write "
+            "one frame.\n"
+            "# TYPE kitty_doom_frame_emit_seconds summary\n");
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "kitty_doom_frame_emit_seconds{quantile=\"%g\"} %g\n",
+                quantiles[i], hist_quantile(hist, count, quantiles[i]));
+    }
+    fprintf(out,
+            "kitty_doom_frame_emit_seconds_sum %g\n"
+            "kitty_doom_frame_emit_seconds_count %llu\n",
+            counter_get(&g->emit_sum_us) / 1e6, (unsigned long long) count);
+
+    fprintf(out,
+            "# HELP kitty_doom_input_bytes_total Bytes read from the "
+            "terminal.\n"
+            "# TYPE kitty_doom_input_bytes_total counter\n"
+            "kitty_doom_input_bytes_total %llu\n"
+            "# HELP kitty_doom_input_queue_depth Keys awaiting release.\n"
+            "# TYPE kitty_doom_input_queue_depth gauge\n"
+            "kitty_doom_input_queue_depth %llu\n",
+            (unsigned long long) counter_get(&input_metrics.input_bytes),
+            (unsigned long long) counter_get(&input_metrics.queue_depth));
+
+    load_hist(hist, g->key_hist);
+    count = counter_get(&g->key_count);
+    fprintf(out,
+            "# HELP kitty_doom_key_latency_seconds Key press to next emitted "
+            "frame.\n"
+            "# TYPE kitty_doom_key_latency_seconds histogram\n");
+    uint64_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKETS - 1; b++) {
+        cumulative += hist[b];
+        fprintf(out, "kitty_doom_key_latency_seconds_bucket{le=\"%g\"} %llu\n",
+                bucket_le(b), (unsigned long long) cumulative);
+    }
+    fprintf(out,
+            "kitty_doom_key_latency_seconds_bucket{le=\"+Inf\"} %llu\n"
+            "kitty_doom_key_latency_seconds_sum %g\n"
+            "kitty_doom_key_latency_seconds_count %llu\n",
+            (unsigned long long) count, counter_get(&g->key_sum_us) / 1e6,
+            (unsigned long long) count);
+
+    const char *transport =
+        atomic_load_explicit(&g->transport, memory_order_relaxed);
+    const char *mode = atomic_load_explicit(&g->mode, memory_order_relaxed);
+    fprintf(out,
+            "# HELP kitty_doom_transport_info Active output transport.\n"
+            "# TYPE kitty_doom_transport_info gauge\n"
+            "kitty_doom_transport_info{transport=\"%s\",mode=\"%s\"} 1\n",
+            transport ? transport : "none", mode ? mode : "none");
+}
+
+static void *server_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "metrics");
+    uint64_t prev_ns = server.start_ns, prev_tics = 0, prev_bytes = 0;
+
+    while (!atomic_load_explicit(&server.stop, memory_order_relaxed)) {
+        struct pollfd pfd = {.fd = server.listen_fd, .events = POLLIN};
+
+        /* Wake periodically to notice shutdown */
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        int fd = accept(server.listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        /* Format first, then send without SIGPIPE: a scraper that hangs
+         * up before reading must not kill the game
+         */
+        char *snapshot = NULL;
+        size_t size = 0;
+        FILE *out = open_memstream(&snapshot, &size);
+        if (out) {
+            write_snapshot(out, &prev_ns, &prev_tics, &prev_bytes);
+            fclose(out);
+            for (size_t sent = 0; sent < size;) {
+                const ssize_t n =
+                    send(fd, snapshot + sent, size - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                sent += (size_t) n;
+            }
+            free(snapshot);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+bool metrics_start(const char *path)
+{
+    if (!path || server.running)
+        return false;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Metrics socket path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Metrics socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    /* Replace a stale socket left behind by a previous run */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(fd, 4) < 0) {
+        fprintf(stderr, "Metrics socket %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    server.listen_fd = fd;
+    strcpy(server.path, path);
+    server.start_ns = get_time_ns();
+    atomic_store_explicit(&server.stop, false, memory_order_relaxed);
+
+    if (pthread_create(&server.thread, NULL, server_thread_func, NULL) != 0) {
+        close(fd);
+        unlink(path);
+        server.listen_fd = -1;
+        return false;
+    }
+
+    server.running = true;
+    atomic_store_explicit(&metrics_enabled, true, memory_order_relaxed);
+    fprintf(stderr, "Serving metrics on %s\n", path);
+    return true;
+}
+
+void metrics_stop(void)
+{
+    if (!server.running)
+        return;
+
+    atomic_store_explicit(&metrics_enabled, false, memory_order_relaxed);
+    atomic_store_explicit(&server.stop, true, memory_order_relaxed);
+    pthread_join(server.thread, NULL);
+
+    close(server.listen_fd);
+    unlink(server.path);
+    server.listen_fd = -1;
+    server.running = false;
+}
@@ -0,0 +1,624 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Frame output backends
+ *
+ * By default the renderer writes through stdio. With a backend selected, it
+ * instead assembles each frame's complete wire image (escape headers and
+ * base64 chunks) in one of a few frame buffers owned by this module, which
+ * then sends it to stdout and any mirror fds:
+ *
+ *   write     a write(2) loop per fd on the game thread, for comparison
+ *   uring     io_uring with the frame buffers registered; per fd, a frame is
+ *             a chain of linked WRITE_FIXED SQEs submitted without waiting.
+ *             Completions release frame buffers, so the game thread only
+ *             blocks when every buffer is still in flight to some fd.
+ *   vmsplice  pipes get the buffer pages themselves (vmsplice with
+ *             SPLICE_F_GIFT) instead of a copy; other fds use write(2).
+ *             Gifted pages belong to the pipe and may still be referenced
+ *             after the reader has seen them (a reader that splices or
+ *             tees), so they are never written again: once its frame is
+ *             sent, the buffer drops its pages with MADV_DONTNEED and the
+ *             next frame faults in fresh zeroed ones.
+ *
+ * Pipe sinks are grown to OUTPUT_PIPE_SIZE with every backend, so a frame
+ * fits without waiting for the reader.
+ *
+ * Each fd has at most one chain in flight, so frames reach it in order, and
+ * later frames queue behind it. A short write restarts the rest of the
+ * frame as a new chain; an fd that fails (e.g. a closed spectator pipe) is
+ * dropped without affecting the others.
+ */
+
+#define _GNU_SOURCE /* vmsplice, F_SETPIPE_SZ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_URING 1
+#endif
+#endif
+
+#if defined(__linux__) && defined(SPLICE_F_GIFT)
+#define HAVE_VMSPLICE 1
+#endif
+
+#define OUTPUT_BUFFERS 4
+#define OUTPUT_BUFFER_SIZE (320 * 1024) /* one frame plus escape headers */
+#define OUTPUT_SEGMENT (64 * 1024)      /* bytes per linked write */
+#define OUTPUT_RING_ENTRIES 256
+#define OUTPUT_PIPE_SIZE (1024 * 1024) /* a few frames in flight per pipe */
+
+typedef enum { BACKEND_WRITE, BACKEND_URING, BACKEND_VMSPLICE } backend_t;
+
+typedef struct {
+    int fd;
+    bool dead;
+    bool pipe;     /* vmsplice: fd is a pipe */
+    int buf;       /* frame of the chain in flight, -1 when idle */
+    int inflight;  /* completions still expected for that chain */
+    bool short_write; /* chain cut short, restart it at resume */
+    size_t resume;
+    int queue[OUTPUT_BUFFERS]; /* frames waiting behind the chain */
+    int queue_head, queue_count;
+} sink_t;
+
+typedef struct {
+    char *data;
+    size_t size;
+    int refs; /* sinks that still have to send this frame */
+} frame_buffer_t;
+
+struct output {
+    const char *name;
+    backend_t backend;
+    sink_t sinks[OUTPUT_MAX_FDS];
+    int sink_count;
+    frame_buffer_t bufs[OUTPUT_BUFFERS];
+    int current; /* buffer handed out by output_frame_begin() */
+    output_stats_t stats;
+
+#ifdef HAVE_URING
+    int ring_fd;
+    bool fixed; /* buffers registered, WRITE_FIXED usable */
+    void *ring_map; /* SQ and CQ rings share one mapping */
+    size_t ring_map_size;
+    struct io_uring_sqe *sqes;
+    _Atomic unsigned *sq_head, *sq_tail, *cq_head, *cq_tail;
+    unsigned *sq_array, sq_mask, sq_entries;
+    struct io_uring_cqe *cqes;
+    unsigned cq_mask;
+    unsigned to_submit;
+#endif
+};
+
+static void sink_drop(output_t *out, sink_t *s)
+{
+    if (s->buf >= 0)
+        out->bufs[s->buf].refs--;
+    while (s->queue_count) {
+        out->bufs[s->queue[s->queue_head]].refs--;
+        s->queue_head = (s->queue_head + 1) % OUTPUT_BUFFERS;
+        s->queue_count--;
+    }
+    s->buf = -1;
+    s->dead = true;
+    out->stats.sinks_lost++;
+}
+
+/* Blocking write of the whole frame, used by the write backend */
+static void sink_write(output_t *out, sink_t *s, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(s->fd, data, size);
+        out->stats.syscalls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = {.fd = s->fd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            sink_drop(out, s);
+            return;
+        }
+        data += n;
+        size -= n;
+        out->stats.bytes += n;
+    }
+}
+
+#ifdef HAVE_VMSPLICE
+/* Move the frame's pages into a pipe; blocks while the pipe is full */
+static void sink_vmsplice(output_t *out, sink_t *s, char *data, size_t size)
+{
+    while (size > 0) {
+        struct iovec iov = {data, size};
+        ssize_t n = vmsplice(s->fd, &iov, 1, SPLICE_F_GIFT);
+        out->stats.syscalls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = {.fd = s->fd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            sink_drop(out, s);
+            return;
+        }
+        data += n;
+        size -= n;
+        out->stats.bytes += n;
+    }
+}
+
+/* Detach buffer b from its pages; the gifted ones stay with the pipes
+ * that hold them, and the next write faults in fresh ones. If that fails
+ * the buffer is left out from then on.
+ */
+static void vmsplice_renew(output_t *out, int b)
+{
+    out->stats.syscalls++;
+    if (madvise(out->bufs[b].data, OUTPUT_BUFFER_SIZE, MADV_DONTNEED)) {
+        munmap(out->bufs[b].data, OUTPUT_BUFFER_SIZE);
+        out->bufs[b].data = NULL;
+    }
+}
+#endif /* HAVE_VMSPLICE */
+
+#ifdef HAVE_URING
+
+/* user_data layout: sink, buffer, offset and length of one write */
+#define UD_SINK(ud) ((int) ((ud) >> 56))
+#define UD_OFF(ud) ((size_t) (((ud) >> 24) & 0xFFFFFF))
+#define UD_LEN(ud) ((size_t) ((ud) & 0xFFFFFF))
+
+static inline uint64_t ud_pack(int sink, int buf, size_t off, size_t len)
+{
+    return (uint64_t) sink << 56 | (uint64_t) buf << 48 | (uint64_t) off << 24 |
+           len;
+}
+
+static int uring_enter(output_t *out, unsigned to_submit, unsigned wait)
+{
+    out->stats.syscalls++;
+    return (int) syscall(__NR_io_uring_enter, out->ring_fd, to_submit, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* Hand everything prepared so far to the kernel; with wait set, also block
+ * until at least one completion is available.
+ */
+static void uring_submit(output_t *out, bool wait)
+{
+    for (;;) {
+        int ret = uring_enter(out, out->to_submit, wait ? 1 : 0);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret > 0)
+            out->to_submit -= (unsigned) ret;
+        return;
+    }
+}
+
+static unsigned uring_sq_space(const output_t *out)
+{
+    const unsigned head =
+        atomic_load_explicit(out->sq_head, memory_order_acquire);
+    const unsigned tail =
+        atomic_load_explicit(out->sq_tail, memory_order_relaxed);
+    return out->sq_entries - (tail - head);
+}
+
+static void uring_queue_write(output_t *out,
+                              int sink,
+                              int buf,
+                              size_t off,
+                              size_t len,
+                              bool link)
+{
+    const unsigned tail =
+        atomic_load_explicit(out->sq_tail, memory_order_relaxed);
+    const unsigned idx = tail & out->sq_mask;
+    struct io_uring_sqe *sqe = &out->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = out->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = out->sinks[sink].fd;
+    sqe->addr = (uint64_t) (uintptr_t) (out->bufs[buf].data + off);
+    sqe->len = (uint32_t) len;
+    sqe->off = (uint64_t) -1; /* current position; ignored for pipes */
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->buf_index = out->fixed ? (uint16_t) buf : 0;
+    sqe->user_data = ud_pack(sink, buf, off, len);
+
+    out->sq_array[idx] = idx;
+    atomic_store_explicit(out->sq_tail, tail + 1, memory_order_release);
+    out->to_submit++;
+}
+
+/* Queue the rest of a frame for one sink as a chain of linked writes */
+static void uring_start_chain(output_t *out, int sink, int buf, size_t from)
+{
+    sink_t *s = &out->sinks[sink];
+    const size_t size = out->bufs[buf].size;
+    const unsigned segments =
+        (unsigned) ((size - from + OUTPUT_SEGMENT - 1) / OUTPUT_SEGMENT);
+
+    /* Links only hold within one submission, so never split a chain */
+    if (uring_sq_space(out) < segments)
+        uring_submit(out, false);
+
+    s->buf = buf;
+    s->inflight = (int) segments;
+    s->short_write = false;
+    for (size_t off = from; off < size; off += OUTPUT_SEGMENT) {
+        const size_t len = size - off < OUTPUT_SEGMENT ? size - off
+                                                       : OUTPUT_SEGMENT;
+        uring_queue_write(out, sink, buf, off, len, off + len < size);
+    }
+}
+
+/* The chain of a sink has fully completed: restart, advance or release */
+static void uring_chain_done(output_t *out, int sink)
+{
+    sink_t *s = &out->sinks[sink];
+
+    if (s->short_write) {
+        uring_start_chain(out, sink, s->buf, s->resume);
+        return;
+    }
+
+    out->bufs[s->buf].refs--;
+    s->buf = -1;
+    if (s->queue_count) {
+        const int next = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % OUTPUT_BUFFERS;
+        s->queue_count--;
+        uring_start_chain(out, sink, next, 0);
+    }
+}
+
+static void uring_reap(output_t *out)
+{
+    unsigned head = atomic_load_explicit(out->cq_head, memory_order_relaxed);
+    const unsigned tail =
+        atomic_load_explicit(out->cq_tail, memory_order_acquire);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &out->cqes[head & out->cq_mask];
+        const uint64_t ud = cqe->user_data;
+        const int res = cqe->res;
+        sink_t *s = &out->sinks[UD_SINK(ud)];
+
+        if (s->dead)
+            continue;
+
+        if (res >= 0) {
+            out->stats.bytes += res;
+            /* A short write cancels the rest of the chain; resume after the
+             * bytes that made it out.
+             */
+            if ((size_t) res < UD_LEN(ud) && !s->short_write) {
+                s->short_write = true;
+                s->resume = UD_OFF(ud) + res;
+            }
+        } else if (res != -ECANCELED) {
+            sink_drop(out, s);
+            continue;
+        }
+
+        if (--s->inflight == 0)
+            uring_chain_done(out, UD_SINK(ud));
+    }
+
+    atomic_store_explicit(out->cq_head, head, memory_order_release);
+}
+
+static bool uring_setup(output_t *out)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    out->ring_fd = (int) syscall(__NR_io_uring_setup, OUTPUT_RING_ENTRIES, &p);
+    if (out->ring_fd < 0)
+        return false;
+
+    /* Writes at the current file position need 5.6+ (RW_CUR_POS) */
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(out->ring_fd);
+        return false;
+    }
+
+    const size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    const size_t cq_size =
+        p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    out->ring_map_size = sq_size > cq_size ? sq_size : cq_size;
+    out->ring_map = mmap(NULL, out->ring_map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, out->ring_fd,
+                         IORING_OFF_SQ_RING);
+    if (out->ring_map == MAP_FAILED) {
+        close(out->ring_fd);
+        return false;
+    }
+
+    out->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     out->ring_fd, IORING_OFF_SQES);
+    if (out->sqes == MAP_FAILED) {
+        munmap(out->ring_map, out->ring_map_size);
+        close(out->ring_fd);
+        return false;
+    }
+
+    char *sq = out->ring_map, *cq = out->ring_map;
+    out->sq_head = (_Atomic unsigned *) (sq + p.sq_off.head);
+    out->sq_tail = (_Atomic unsigned *) (sq + p.sq_off.tail);
+    out->sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    out->sq_entries = p.sq_entries;
+    out->sq_array = (unsigned *) (sq + p.sq_off.array);
+    out->cq_head = (_Atomic unsigned *) (cq + p.cq_off.head);
+    out->cq_tail = (_Atomic unsigned *) (cq + p.cq_off.tail);
+    out->cq_mask = *(unsigned *) (cq + p.cq_off.ring_mask);
+    out->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    /* Registered buffers save the per-write page pinning. Registration can
+     * fail under a small RLIMIT_MEMLOCK; plain writes still work then.
+     */
+    struct iovec iov[OUTPUT_BUFFERS];
+    for (int i = 0; i < OUTPUT_BUFFERS; i++)
+        iov[i] = (struct iovec) {out->bufs[i].data, OUTPUT_BUFFER_SIZE};
+    out->fixed = syscall(__NR_io_uring_register, out->ring_fd,
+                         IORING_REGISTER_BUFFERS, iov, OUTPUT_BUFFERS) == 0;
+    return true;
+}
+
+static void uring_teardown(output_t *out)
+{
+    munmap(out->sqes, out->sq_entries * sizeof(struct io_uring_sqe));
+    munmap(out->ring_map, out->ring_map_size);
+    close(out->ring_fd);
+}
+
+#endif /* HAVE_URING */
+
+bool output_is_pipe(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static const char *const backend_names[] = {
+    [BACKEND_WRITE] = "write",
+    [BACKEND_URING] = "uring",
+    [BACKEND_VMSPLICE] = "vmsplice",
+};
+
+output_t *output_create(const char *backend, const int *fds, int fd_count)
+{
+    if (fd_count < 1 || fd_count > OUTPUT_MAX_FDS)
+        return NULL;
+
+    backend_t kind;
+    if (!strcmp(backend, "write")) {
+        kind = BACKEND_WRITE;
+    } else if (!strcmp(backend, "uring")) {
+        kind = BACKEND_URING;
+    } else if (!strcmp(backend, "vmsplice")) {
+        kind = BACKEND_VMSPLICE;
+    } else {
+        fprintf(stderr, "Unknown output backend: %s\n", backend);
+        return NULL;
+    }
+#ifndef HAVE_URING
+    if (kind == BACKEND_URING) {
+        fprintf(stderr, "io_uring output is not available in this build\n");
+        return NULL;
+    }
+#endif
+#ifndef HAVE_VMSPLICE
+    if (kind == BACKEND_VMSPLICE) {
+        fprintf(stderr, "vmsplice output is not available on this system\n");
+        return NULL;
+    }
+#endif
+
+    output_t *out = calloc(1, sizeof(output_t));
+    if (!out)
+        return NULL;
+    out->name = backend_names[kind];
+    out->backend = kind;
+    out->current = -1;
+
+    /* Page-aligned, so registration pins exactly the frame buffers and
+     * vmsplice hands over whole pages
+     */
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        void *p = mmap(NULL, OUTPUT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            output_destroy(out);
+            return NULL;
+        }
+        out->bufs[i].data = p;
+    }
+
+    for (int i = 0; i < fd_count; i++) {
+        out->sinks[i] = (sink_t) {.fd = fds[i], .buf = -1};
+
+        if (output_is_pipe(fds[i])) {
+            out->sinks[i].pipe = kind == BACKEND_VMSPLICE;
+            /* Room for several frames; capped by fs.pipe-max-size */
+            fcntl(fds[i], F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+        }
+    }
+    out->sink_count = fd_count;
+
+#ifdef HAVE_URING
+    if (kind == BACKEND_URING && !uring_setup(out)) {
+        fprintf(stderr, "io_uring setup failed: %s\n", strerror(errno));
+        out->backend = BACKEND_WRITE;
+        output_destroy(out);
+        return NULL;
+    }
+#endif
+
+    return out;
+}
+
+void output_drain(output_t *out)
+{
+    if (!out)
+        return;
+
+#ifdef HAVE_URING
+    if (out->backend == BACKEND_URING) {
+        for (;;) {
+            uring_reap(out);
+            bool busy = false;
+            for (int i = 0; i < OUTPUT_BUFFERS; i++)
+                busy |= out->bufs[i].refs > 0;
+            if (!busy)
+                break;
+            uring_submit(out, true);
+        }
+    }
+#endif
+}
+
+void output_destroy(output_t *out)
+{
+    if (!out)
+        return;
+
+    output_drain(out);
+#ifdef HAVE_URING
+    if (out->backend == BACKEND_URING)
+        uring_teardown(out);
+#endif
+    /* Pages still queued in a pipe stay valid after munmap */
+    for (int i = 0; i < OUTPUT_BUFFERS; i++) {
+        if (out->bufs[i].data)
+            munmap(out->bufs[i].data, OUTPUT_BUFFER_SIZE);
+    }
+    free(out);
+}
+
+char *output_frame_begin(output_t *out, size_t *capacity)
+{
+    int free_buf = -1;
+    for (;;) {
+#ifdef HAVE_URING
+        if (out->backend == BACKEND_URING)
+            uring_reap(out);
+#endif
+        bool any = false;
+        for (int i = 0; i < OUTPUT_BUFFERS && free_buf < 0; i++) {
+            any |= out->bufs[i].data != NULL;
+            if (out->bufs[i].data && out->bufs[i].refs == 0)
+                free_buf = i;
+        }
+        if (free_buf >= 0)
+            break;
+        if (!any)
+            return NULL; /* out of memory for fresh pages: use stdio */
+
+        /* Every buffer is still in flight: wait for one completion */
+        out->stats.waits++;
+#ifdef HAVE_URING
+        if (out->backend == BACKEND_URING)
+            uring_submit(out, true);
+#endif
+    }
+
+    out->current = free_buf;
+    *capacity = OUTPUT_BUFFER_SIZE;
+    return out->bufs[free_buf].data;
+}
+
+void output_frame_submit(output_t *out, size_t size)
+{
+    const int b = out->current;
+    if (b < 0)
+        return;
+    out->current = -1;
+    out->bufs[b].size = size;
+    out->stats.frames++;
+    if (!size)
+        return;
+
+    bool gifted = false;
+    for (int i = 0; i < out->sink_count; i++) {
+        sink_t *s = &out->sinks[i];
+        if (s->dead)
+            continue;
+
+#ifdef HAVE_VMSPLICE
+        if (s->pipe) {
+            sink_vmsplice(out, s, out->bufs[b].data, size);
+            gifted = true;
+            continue;
+        }
+#endif
+        if (out->backend != BACKEND_URING) {
+            sink_write(out, s, out->bufs[b].data, size);
+            continue;
+        }
+
+#ifdef HAVE_URING
+        out->bufs[b].refs++;
+        if (s->buf < 0) {
+            uring_start_chain(out, i, b, 0);
+        } else {
+            s->queue[(s->queue_head + s->queue_count) % OUTPUT_BUFFERS] = b;
+            s->queue_count++;
+        }
+#endif
+    }
+
+#ifdef HAVE_URING
+    if (out->backend == BACKEND_URING)
+        uring_submit(out, false);
+#endif
+#ifdef HAVE_VMSPLICE
+    if (gifted)
+        vmsplice_renew(out, b);
+#else
+    (void) gifted;
+#endif
+}
+
+const char *output_name(const output_t *out)
+{
+    return out ? out->name : "stdio";
+}
+
+output_stats_t output_get_stats(const output_t *out)
+{
+    return out ? out->stats : (output_stats_t) {0};
+}
@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Thread placement
+ *
+ * Every thread calls placement_enter() with its role as it starts. That
+ * names the thread for top/perf/gdb and, when --cpus or --sched configured
+ * the role, pins it to a CPU set and switches its scheduling policy.
+ *
+ * Threads inherit affinity, policy and nice level from their creator, and
+ * most are created by the game thread. A role without settings of its own
+ * is therefore put back to the process defaults saved at configure time,
+ * so pinning the game thread does not drag every helper onto its core.
+ *
+ * SCHED_FIFO and negative nice levels need CAP_SYS_NICE or an rlimit; when
+ * the kernel refuses, the role keeps running with the default policy and a
+ * warning is printed once per role. The same goes for lowering a positive
+ * nice level again, so a role whose creator was niced may stay niced too.
+ */
+
+#define _GNU_SOURCE /* pthread_setaffinity_np, pthread_setname_np */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+typedef enum {
+    POLICY_DEFAULT,
+    POLICY_FIFO,
+    POLICY_NICE,
+} policy_t;
+
+typedef struct {
+    bool pinned;
+    cpu_set_t cpus;
+    policy_t policy;
+    int value; /* FIFO priority or nice level */
+    atomic_bool warned;
+} role_config_t;
+
+static const char *const role_names[THREAD_ROLES] = {
+    [THREAD_GAME] = "game",
+    [THREAD_INPUT] = "input",
+    [THREAD_WRITER] = "writer",
+    [THREAD_WORKER] = "worker",
+};
+
+static struct {
+    bool configured;
+    bool any_pinned, any_fifo, any_nice;
+    cpu_set_t initial_cpus;
+    int initial_nice;
+    role_config_t roles[THREAD_ROLES];
+} placement;
+
+static int find_role(const char *name, size_t len)
+{
+    for (int i = 0; i < THREAD_ROLES; i++) {
+        if (strlen(role_names[i]) == len && !strncmp(role_names[i], name, len))
+            return i;
+    }
+    return -1;
+}
+
+/* "N" or "N-M", added to the role's CPU set */
+static bool parse_cpu_range(const char *str, cpu_set_t *cpus)
+{
+    char *end;
+    long first = strtol(str, &end, 10), last = first;
+    if (end == str)
+        return false;
+    if (*end == '-') {
+        const char *next = end + 1;
+        last = strtol(next, &end, 10);
+        if (end == next)
+            return false;
+    }
+    if (*end || first < 0 || last < first || last >= CPU_SETSIZE)
+        return false;
+
+    for (long cpu = first; cpu <= last; cpu++) {
+        if (!CPU_ISSET(cpu, &placement.initial_cpus)) {
+            fprintf(stderr, "CPU %ld is not available to this process\n",
+                    cpu);
+            return false;
+        }
+        CPU_SET(cpu, cpus);
+    }
+    return true;
+}
+
+/* "fifo", "fifo:PRIO", "nice:N" or "default" */
+static bool parse_policy(const char *str, role_config_t *role)
+{
+    char *end;
+    if (!strcmp(str, "default")) {
+        role->policy = POLICY_DEFAULT;
+        return true;
+    }
+    if (!strncmp(str, "fifo", 4) && (!str[4] || str[4] == ':')) {
+        const int lo = sched_get_priority_min(SCHED_FIFO);
+        const int hi = sched_get_priority_max(SCHED_FIFO);
+        long prio = lo + 9; /* above the default RLIMIT_RTPRIO users */
+        if (str[4]) {
+            prio = strtol(str + 5, &end, 10);
+            if (end == str + 5 || *end || prio < lo || prio > hi)
+                return false;
+        }
+        role->policy = POLICY_FIFO;
+        role->value = (int) prio;
+        return true;
+    }
+    if (!strncmp(str, "nice:", 5)) {
+        const long nice_level = strtol(str + 5, &end, 10);
+        if (end == str + 5 || *end || nice_level < -20 || nice_level > 19)
+            return false;
+        role->policy = POLICY_NICE;
+        role->value = (int) nice_level;
+        return true;
+    }
+    return false;
+}
+
+/* Comma separated ROLE=VALUE list. In a CPU list a bare value continues the
+ * previous role, so "worker=2-3,6" gives the workers CPUs 2, 3 and 6.
+ */
+static bool parse_spec(const char *option, const char *spec, bool cpus)
+{
+    char *copy = strdup(spec);
+    if (!copy)
+        return false;
+
+    bool ok = true;
+    int role = -1;
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && ok;
+         tok = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(tok, '=');
+        if (value) {
+            role = find_role(tok, (size_t) (value - tok));
+            value++;
+            if (role < 0) {
+                fprintf(stderr, "%s: unknown thread role in \"%s\"\n",
+                        option, tok);
+                ok = false;
+                break;
+            }
+        } else if (cpus && role >= 0) {
+            value = tok;
+        } else {
+            fprintf(stderr, "%s: expected ROLE=VALUE, got \"%s\"\n", option,
+                    tok);
+            ok = false;
+            break;
+        }
+
+        role_config_t *config = &placement.roles[role];
+        if (cpus) {
+            ok = parse_cpu_range(value, &config->cpus);
+            config->pinned = true;
+        } else {
+            ok = parse_policy(value, config);
+        }
+        if (!ok)
+            fprintf(stderr, "%s: invalid value \"%s\" for %s\n", option,
+                    value, role_names[role]);
+    }
+
+    free(copy);
+    return ok;
+}
+
+bool placement_configure(const char *cpus, const char *sched)
+{
+    memset(&placement, 0, sizeof(placement));
+    if (!cpus && !sched)
+        return true;
+
+    /* Process defaults, restored for roles without settings of their own */
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &placement.initial_cpus)) {
+        CPU_ZERO(&placement.initial_cpus);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &placement.initial_cpus);
+    }
+    errno = 0;
+    placement.initial_nice = getpriority(PRIO_PROCESS, 0);
+    if (errno)
+        placement.initial_nice = 0;
+
+    if ((cpus && !parse_spec("--cpus", cpus, true)) ||
+        (sched && !parse_spec("--sched", sched, false)))
+        return false;
+
+    for (int i = 0; i < THREAD_ROLES; i++) {
+        const role_config_t *role = &placement.roles[i];
+        placement.any_pinned |= role->pinned;
+        placement.any_fifo |= role->policy == POLICY_FIFO;
+        placement.any_nice |= role->policy == POLICY_NICE;
+    }
+    placement.configured = true;
+    return true;
+}
+
+static void warn_once(role_config_t *role, const char *role_name,
+                      const char *what, int err)
+{
+    /* Several threads can share a role, e.g. the writers */
+    if (atomic_exchange_explicit(&role->warned, true, memory_order_relaxed))
+        return;
+    fprintf(stderr, "Thread placement: cannot %s for %s threads: %s\n", what,
+            role_name, strerror(err));
+}
+
+void placement_enter(thread_role_t role, const char *name)
+{
+    if (name) {
+        /* 15 characters plus NUL is the kernel's limit */
+        char comm[16];
+        snprintf(comm, sizeof(comm), "kd-%s", name);
+        pthread_setname_np(pthread_self(), comm);
+    }
+
+    if (!placement.configured || (unsigned) role >= THREAD_ROLES)
+        return;
+
+    role_config_t *config = &placement.roles[role];
+    const pthread_t self = pthread_self();
+    const id_t tid = (id_t) syscall(SYS_gettid);
+    int err;
+
+    if (config->pinned || placement.any_pinned) {
+        const cpu_set_t *cpus =
+            config->pinned ? &config->cpus : &placement.initial_cpus;
+        err = pthread_setaffinity_np(self, sizeof(cpu_set_t), cpus);
+        if (err)
+            warn_once(config, role_names[role], "set CPU affinity", err);
+    }
+
+    struct sched_param param = {.sched_priority = 0};
+    if (config->policy == POLICY_FIFO) {
+        param.sched_priority = config->value;
+        err = pthread_setschedparam(self, SCHED_FIFO, &param);
+        if (err)
+            warn_once(config, role_names[role], "use SCHED_FIFO", err);
+    } else if (placement.any_fifo) {
+        pthread_setschedparam(self, SCHED_OTHER, &param);
+    }
+
+    /* Nice levels are per thread on Linux, addressed by TID */
+    if (config->policy == POLICY_NICE) {
+        if (setpriority(PRIO_PROCESS, tid, config->value))
+            warn_once(config, role_names[role], "set the nice level", errno);
+    } else if (placement.any_nice) {
+        /* Undoing a creator's positive nice also needs CAP_SYS_NICE */
+        if (setpriority(PRIO_PROCESS, tid, placement.initial_nice))
+            warn_once(config, role_names[role], "restore the nice level",
+                      errno);
+    }
+}
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * USDT static tracepoints
+ *
+ * Probes are emitted through <sys/sdt.h> when it is available (systemtap-sdt
+ * development headers) and compile to nothing otherwise, or when built with
+ * -DNO_PROBES. Every probe carries a CLOCK_MONOTONIC timestamp in
+ * nanoseconds as its first argument.
+ *
+ * Each probe is guarded by a USDT semaphore, so the timestamp and arguments
+ * are only computed while a tracer (bpftrace, perf, stap) is attached; an
+ * unattached probe costs one predictable load and branch. List them with:
+ *   bpftrace -l 'usdt:./build/kitty-doom:*'
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__has_include) && !defined(NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* Semaphores are incremented by the tracer when a probe is attached.
+ * Weak definitions let every translation unit that fires a probe share one
+ * copy without a dedicated source file.
+ */
+#define PROBE_SEMAPHORE(name) kitty_doom_##name##_semaphore
+#define PROBE_DECLARE(name)                        \
+    unsigned short PROBE_SEMAPHORE(name)           \
+        __attribute__((weak, section(".probes")))
+
+PROBE_DECLARE(frame__start); /* (ts, frame_index) */
+PROBE_DECLARE(frame__end);   /* (ts, frame_index, elapsed_ns) */
+PROBE_DECLARE(update__begin); /* (ts, gametic) */
+PROBE_DECLARE(update__end);  /* (ts, gametic) */
+PROBE_DECLARE(encode__begin); /* (ts, input_bytes) */
+PROBE_DECLARE(encode__end);  /* (ts, encoded_bytes) */
+PROBE_DECLARE(chunk__write); /* (ts, chunk_bytes, offset) */
+PROBE_DECLARE(frame__skip);  /* (ts, frame_number) */
+PROBE_DECLARE(input__byte);  /* (ts, byte) */
+PROBE_DECLARE(key__down);    /* (ts, doom_key) */
+PROBE_DECLARE(key__up);      /* (ts, doom_key) */
+
+static inline uint64_t probe_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+
+#define PROBE_1(name, ts, a) DTRACE_PROBE2(kitty_doom, name, ts, a)
+#define PROBE_2(name, ts, a, b) DTRACE_PROBE3(kitty_doom, name, ts, a, b)
+#define PROBE_3(name, ts, a, b, c) \
+    DTRACE_PROBE4(kitty_doom, name, ts, a, b, c)
+
+#define PROBE_NARGS(...) PROBE_NARGS_(__VA_ARGS__, 3, 2, 1)
+#define PROBE_NARGS_(_1, _2, _3, n, ...) n
+#define PROBE_CAT(a, b) PROBE_CAT_(a, b)
+#define PROBE_CAT_(a, b) a##b
+
+/* PROBE(name, args...): fire probe "name" with a timestamp and 1-3 args */
+#define PROBE(name, ...)                                                 \
+    do {                                                                 \
+        if (PROBE_ENABLED(name))                                         \
+            PROBE_CAT(PROBE_, PROBE_NARGS(__VA_ARGS__))(                 \
+                name, probe_now_ns(), __VA_ARGS__);                      \
+    } while (0)
+
+#else /* !HAVE_PROBES */
+
+#define PROBE_ENABLED(name) 0
+#define PROBE(name, ...) \
+    do {                 \
+    } while (0)
+
+#endif /* HAVE_PROBES */
@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Flight recorder
+ *
+ * Keeps per-frame timings for the last ~30 seconds in a fixed ring. Frames
+ * are recorded by the game thread only, so the steady-state cost is one
+ * struct copy and a TIOCOUTQ ioctl per frame. A dump appends the ring as CSV
+ * to the recorder file, either on request (SIGUSR1) or automatically when a
+ * frame takes longer than the stall threshold. The game thread only copies
+ * the ring; a writer thread formats and appends it, so a dump adds no file
+ * I/O right after a hitch. What was dumped is reported at exit.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#define RECORDER_FRAMES 1024 /* 29 seconds at 35 FPS, power of two */
+#define RECORDER_MIN_DUMP_INTERVAL_NS 1000000000ULL
+
+static struct {
+    const char *path;
+    unsigned long long stall_ns;
+    recorder_frame_t frames[RECORDER_FRAMES];
+    unsigned long long count; /* frames recorded so far */
+    unsigned long long last_auto_dump_ns;
+    unsigned dumps;
+    bool enabled;
+
+    /* Dump handed to the writer thread; a newer dump replaces one that has
+     * not been taken yet
+     */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool running, stop, queued;
+    recorder_frame_t pending[RECORDER_FRAMES];
+    unsigned long long pending_count;
+    const char *pending_reason;
+    unsigned pending_dump;
+
+    /* Writer thread only */
+    recorder_frame_t writing[RECORDER_FRAMES];
+    unsigned written, stall_dumps, failed;
+} recorder = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+/* Bumped by the input thread, sampled once per frame by the game thread */
+static _Atomic unsigned long input_events;
+static unsigned long input_events_seen;
+
+/* Append one dump as CSV */
+static void write_dump(const recorder_frame_t *frames,
+                       unsigned long long n,
+                       unsigned dump,
+                       const char *reason)
+{
+    FILE *f = fopen(recorder.path, "a");
+    if (!f) {
+        recorder.failed++;
+        return;
+    }
+
+    const uint64_t origin = frames[0].ts_ns;
+    fprintf(f, "# dump %u reason=%s frames=%llu\n", dump, reason, n);
+    fprintf(f,
+            "frame,time_ms,frame_us,tic_us,encode_us,write_us,bytes,"
+            "input_events,outq_bytes\n");
+    for (unsigned long long i = 0; i < n; i++) {
+        const recorder_frame_t *fr = &frames[i];
+        fprintf(f, "%llu,%.3f,%u,%u,%u,%u,%u,%u,%d\n", fr->frame,
+                (fr->ts_ns - origin) / 1e6, fr->frame_us, fr->tic_us,
+                fr->encode_us, fr->write_us, fr->bytes, fr->input_events,
+                fr->outq_bytes);
+    }
+    fputc('\n', f);
+    if (fclose(f)) {
+        recorder.failed++;
+        return;
+    }
+
+    recorder.written++;
+    if (!strcmp(reason, "stall"))
+        recorder.stall_dumps++;
+}
+
+static void *writer_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "recorder");
+    trace_thread_name("recorder");
+
+    pthread_mutex_lock(&recorder.lock);
+    for (;;) {
+        while (!recorder.queued && !recorder.stop)
+            pthread_cond_wait(&recorder.wake, &recorder.lock);
+        if (!recorder.queued)
+            break;
+
+        const unsigned long long n = recorder.pending_count;
+        const char *reason = recorder.pending_reason;
+        const unsigned dump = recorder.pending_dump;
+        memcpy(recorder.writing, recorder.pending,
+               n * sizeof(recorder.pending[0]));
+        recorder.queued = false;
+
+        pthread_mutex_unlock(&recorder.lock);
+        write_dump(recorder.writing, n, dump, reason);
+        pthread_mutex_lock(&recorder.lock);
+    }
+    pthread_mutex_unlock(&recorder.lock);
+    return NULL;
+}
+
+bool recorder_start(const char *path, int stall_ms)
+{
+    if (!path)
+        return false;
+
+    /* Fail early rather than at the first hitch */
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        fprintf(stderr, "Cannot open flight recorder file %s\n", path);
+        return false;
+    }
+    fclose(f);
+
+    recorder.path = path;
+    recorder.stall_ns = (unsigned long long) stall_ms * 1000000ULL;
+    recorder.count = 0;
+    recorder.enabled = true;
+
+    /* Without the writer thread, dumps are written by the caller */
+    recorder.stop = false;
+    recorder.running =
+        pthread_create(&recorder.thread, NULL, writer_thread_func, NULL) == 0;
+    return true;
+}
+
+/* Write what is still queued, then report the dumps made during the run */
+void recorder_stop(void)
+{
+    if (!recorder.enabled)
+        return;
+
+    if (recorder.running) {
+        pthread_mutex_lock(&recorder.lock);
+        recorder.stop = true;
+        pthread_cond_signal(&recorder.wake);
+        pthread_mutex_unlock(&recorder.lock);
+        pthread_join(recorder.thread, NULL);
+        recorder.running = false;
+    }
+    recorder.enabled = false;
+
+    if (recorder.written)
+        fprintf(stderr, "Flight recorder: %u dump(s), %u on stalls, in %s\n",
+                recorder.written, recorder.stall_dumps, recorder.path);
+    if (recorder.failed)
+        fprintf(stderr, "Flight recorder: %u dump(s) could not be written\n",
+                recorder.failed);
+}
+
+void recorder_input_event(void)
+{
+    atomic_fetch_add_explicit(&input_events, 1, memory_order_relaxed);
+}
+
+void recorder_dump(const char *reason)
+{
+    if (!recorder.enabled || recorder.count == 0)
+        return;
+
+    const unsigned long long n = recorder.count < RECORDER_FRAMES
+                                     ? recorder.count
+                                     : RECORDER_FRAMES;
+    const unsigned long long first = recorder.count - n;
+    const unsigned dump = ++recorder.dumps;
+
+    /* Oldest first; the ring wraps at most once within the copy */
+    recorder_frame_t *frames =
+        recorder.running ? recorder.pending : recorder.writing;
+    if (recorder.running)
+        pthread_mutex_lock(&recorder.lock);
+    const unsigned long long start = first % RECORDER_FRAMES;
+    const unsigned long long head = n < RECORDER_FRAMES - start
+                                        ? n
+                                        : RECORDER_FRAMES - start;
+    memcpy(frames, recorder.frames + start, head * sizeof(*frames));
+    memcpy(frames + head, recorder.frames, (n - head) * sizeof(*frames));
+    if (!recorder.running) {
+        write_dump(frames, n, dump, reason);
+        return;
+    }
+
+    recorder.pending_count = n;
+    recorder.pending_reason = reason;
+    recorder.pending_dump = dump;
+    recorder.queued = true;
+    pthread_cond_signal(&recorder.wake);
+    pthread_mutex_unlock(&recorder.lock);
+}
+
+void recorder_record(recorder_frame_t *restrict frame)
+{
+    if (!recorder.enabled)
+        return;
+
+    const unsigned long events =
+        atomic_load_explicit(&input_events, memory_order_relaxed);
+    frame->input_events = (unsigned) (events - input_events_seen);
+    input_events_seen = events;
+
+    /* Bytes the terminal has not consumed yet (only meaningful on a tty) */
+    int outq = 0;
+    frame->outq_bytes = ioctl(STDOUT_FILENO, TIOCOUTQ, &outq) == 0 ? outq : -1;
+
+    recorder.frames[recorder.count % RECORDER_FRAMES] = *frame;
+    recorder.count++;
+
+    /* Auto dumps are rate limited so a bad patch does not flood the disk */
+    if (recorder.stall_ns &&
+        (unsigned long long) frame->frame_us * 1000 > recorder.stall_ns &&
+        frame->ts_ns - recorder.last_auto_dump_ns >=
+            RECORDER_MIN_DUMP_INTERVAL_NS) {
+        recorder.last_auto_dump_ns = frame->ts_ns;
+        recorder_dump("stall");
+    }
+}
@@ -4,38 +4,255 @@
  * "LICENSE" for information on usage and redistribution of this file.
  */
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "base64.h"
 #include "kitty-doom.h"
+#include "probes.h"
 
 #define WIDTH 320
 #define HEIGHT 200
+#define PALETTE_SIZE (256 * 3)
+
+#define HUD_LINES 6
+#define HUD_REFRESH_NS 500000000ULL /* overlay text changes at most 2 Hz */
+
+/* Acknowledgement-driven pacing: at most this many a=f frames in flight,
+ * unless the terminal has gone quiet for ACK_TIMEOUT_NS
+ */
+#define MAX_UNACKED 3
+#define ACK_TIMEOUT_NS 250000000ULL
+
+/* Error replies in a row, with no acknowledgement between them, after which
+ * a=f frames are given up for the compatibility path
+ */
+#define MAX_ERROR_STREAK 3
+
+#define CACHE_LINE 64
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+/* Measurement window behind the overlay text */
+typedef struct {
+    uint64_t start_ns;
+    unsigned long long frame_number, frames_skipped, bytes, encode_ns;
+    unsigned calls;
+    uint64_t render_ns;
+} hud_window_t;
 
 struct renderer {
     int screen_rows, screen_cols;
     long kitty_id;
     int frame_number;
     size_t encoded_buffer_size;
+    bool encoded_buffer_huge; /* mapped from a huge page, not malloc'd */
     bool use_animation; /* true for Kitty (a=f), false for others (a=T) */
-    char encoded_buffer[];
+    unsigned long long frames_skipped;
+    unsigned long long bytes_written;
+    unsigned long long encode_ns, write_ns; /* time spent, all frames */
+    unsigned char *last_frame; /* last frame actually sent */
+
+    /* Performance overlay */
+    bool hud_visible;
+    unsigned char *composed; /* game frame with the overlay drawn in */
+    unsigned char *hud_rect; /* packed overlay pixels for partial updates */
+    hud_window_t hud_window;
+    char hud_text[HUD_LINES][16];
+
+    /* Wire image of the current frame, cache-line aligned */
+    char *encoded_buffer;
+
+    /* Degrade settings, see renderer_set_degrade() */
+    degrade_t degrade;
+    unsigned degrade_tick;
+    unsigned long long frames_dropped;
+    int image_w, image_h;   /* size of the image the terminal holds */
+    unsigned char *scaled;  /* downscaled frame */
+    unsigned char *packed;  /* zlib stream of the payload, if compressing */
+
+    /* Output backend; NULL writes through stdio. While a frame is being
+     * transmitted, emitted bytes are assembled in the backend's buffer and
+     * the payload is encoded straight into it. A frame that does not fit
+     * is not sent at all rather than cut mid-sequence.
+     */
+    output_t *out;
+    char *out_buf;
+    size_t out_size, out_capacity;
+    bool out_overflow;
+    unsigned long long frames_overflowed;
+
+    /* Terminal replies, see renderer_graphics_reply() */
+    unsigned long long acks, graphics_errors, frames_paced;
+    bool recreate;     /* the terminal lost our image: send a new one */
+    bool acks_seen;    /* the terminal acknowledges a=f frames */
+    unsigned unacked;  /* a=f frames sent and not yet acknowledged */
+    unsigned error_streak; /* error replies since the last acknowledgement */
+    uint64_t ack_ns;   /* time of the last acknowledgement */
+
+    /* Indexed source of the frame being rendered, see renderer_set_source(),
+     * and what the last frame sent was made of. palette_valid holds while
+     * last_palette is that frame's palette; indices_valid while last_frame
+     * is exactly last_indices through it, i.e. without the overlay.
+     */
+    const unsigned char *src_indices, *src_palette;
+    unsigned char *last_indices;
+    unsigned char last_palette[PALETTE_SIZE];
+    bool palette_valid, indices_valid;
+    unsigned long long palette_changes;
 };
 
+/* Formatted output to the terminal, counted for renderer_get_stats() */
+static void emitf(renderer_t *restrict r, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n;
+    if (r->out_buf) {
+        const size_t room = r->out_capacity - r->out_size;
+        n = vsnprintf(r->out_buf + r->out_size, room, fmt, ap);
+        if (n > 0 && (size_t) n >= room) {
+            r->out_overflow = true;
+            n = 0;
+        }
+        r->out_size += n > 0 ? n : 0;
+    } else {
+        n = vprintf(fmt, ap);
+    }
+    va_end(ap);
+    if (n > 0)
+        r->bytes_written += n;
+}
+
+static void emit(renderer_t *restrict r, const char *data, size_t size)
+{
+    if (!r->out_buf) {
+        r->bytes_written += fwrite(data, 1, size, stdout);
+        return;
+    }
+    if (size > r->out_capacity - r->out_size) {
+        r->out_overflow = true;
+        return;
+    }
+    memcpy(r->out_buf + r->out_size, data, size);
+    r->out_size += size;
+    r->bytes_written += size;
+}
+
+/* Emit encoded_size bytes of the payload's base64 from encoded_offset, a
+ * multiple of 4. With an output backend they are encoded in place, which
+ * saves writing the wire image twice; otherwise they were encoded up front.
+ */
+static void emit_encoded(renderer_t *restrict r,
+                         const unsigned char *payload,
+                         size_t payload_size,
+                         size_t encoded_offset,
+                         size_t encoded_size)
+{
+    if (!r->out_buf) {
+        emit(r, r->encoded_buffer + encoded_offset, encoded_size);
+        return;
+    }
+    if (encoded_size > r->out_capacity - r->out_size) {
+        r->out_overflow = true;
+        return;
+    }
+    const size_t start = encoded_offset / 4 * 3;
+    size_t end = (encoded_offset + encoded_size) / 4 * 3;
+    if (end > payload_size)
+        end = payload_size;
+    const size_t n = base64_encode_auto(payload + start, end - start,
+                                        (uint8_t *) r->out_buf + r->out_size);
+    r->out_size += n;
+    r->bytes_written += n;
+}
+
+/* Push emitted bytes towards the terminal. With an output backend the
+ * whole frame is submitted at once instead.
+ */
+static void emit_flush(renderer_t *restrict r)
+{
+    if (!r->out_buf)
+        fflush(stdout);
+}
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* The encoded frame is written once per frame with streaming stores and
+ * read once by write(). A huge page is used when the system has one
+ * reserved, saving ~60 TLB entries; otherwise a cache-line aligned block.
+ */
+static char *wire_buffer_alloc(size_t size, bool *huge)
+{
+#ifdef MAP_HUGETLB
+    if (size <= HUGE_PAGE_SIZE) {
+        void *p = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *huge = true;
+            return p;
+        }
+    }
+#endif
+
+    void *buf = NULL;
+    *huge = false;
+    if (posix_memalign(&buf, CACHE_LINE, size) != 0)
+        return NULL;
+    return buf;
+}
+
+static void wire_buffer_free(char *buf, bool huge)
+{
+    if (huge)
+        munmap(buf, HUGE_PAGE_SIZE);
+    else
+        free(buf);
+}
+
 renderer_t *renderer_create(int screen_rows, int screen_cols)
 {
     /* Calculate base64 encoded size (4 * ceil(input_size / 3)) */
     const size_t bitmap_size = WIDTH * HEIGHT * 3;
     const size_t encoded_buffer_size = 4 * ((bitmap_size + 2) / 3) + 1;
 
-    renderer_t *r = malloc(sizeof(renderer_t) + encoded_buffer_size);
+    renderer_t *r = malloc(sizeof(renderer_t));
     if (!r)
         return NULL;
 
+    bool encoded_buffer_huge;
+    char *encoded_buffer =
+        wire_buffer_alloc(encoded_buffer_size, &encoded_buffer_huge);
+    if (!encoded_buffer) {
+        free(r);
+        return NULL;
+    }
+
+    /* Last sent frame, composed frame, overlay rectangle, downscaled frame
+     * and last sent indices share one block
+     */
+    const size_t hud_rect_size = HUD_WIDTH * HUD_HEIGHT * 3;
+    unsigned char *last_frame = malloc(2 * bitmap_size + hud_rect_size +
+                                       bitmap_size / 4 + WIDTH * HEIGHT);
+    if (!last_frame) {
+        wire_buffer_free(encoded_buffer, encoded_buffer_huge);
+        free(r);
+        return NULL;
+    }
+
     /* Detect terminal type to choose rendering mode */
     const char *term = getenv("TERM");
     const char *term_program = getenv("TERM_PROGRAM");
@@ -55,8 +272,24 @@ renderer_t *renderer_create(int screen_rows, int screen_cols)
         .screen_cols = screen_cols,
         .frame_number = 0,
         .encoded_buffer_size = encoded_buffer_size,
+        .encoded_buffer_huge = encoded_buffer_huge,
         .kitty_id = 0,            /* Will be set below */
         .use_animation = use_animation,
+        .frames_skipped = 0,
+        .bytes_written = 0,
+        .encode_ns = 0,
+        .write_ns = 0,
+        .last_frame = last_frame,
+        .hud_visible = false,
+        .composed = last_frame + bitmap_size,
+        .hud_rect = last_frame + 2 * bitmap_size,
+        .encoded_buffer = encoded_buffer,
+        .degrade = {.frame_divisor = 1, .downscale = 1},
+        .image_w = WIDTH,
+        .image_h = HEIGHT,
+        .scaled = last_frame + 2 * bitmap_size + hud_rect_size,
+        .last_indices =
+            last_frame + 2 * bitmap_size + hud_rect_size + bitmap_size / 4,
     };
 
     /* Generate random image ID for Kitty protocol */
@@ -64,10 +297,10 @@ renderer_t *renderer_create(int screen_rows, int screen_cols)
     r->kitty_id = rand();
 
     /* Set the window title */
-    printf("\033]21;Kitty DOOM\033\\");
+    emitf(r, "\033]21;Kitty DOOM\033\\");
 
     /* Clear the screen and move cursor to home */
-    printf("\033[2J\033[H");
+    emitf(r, "\033[2J\033[H");
     fflush(stdout);
 
     /* Log the active base64 implementation */
@@ -81,6 +314,9 @@ void renderer_destroy(renderer_t *restrict r)
     if (!r)
         return;
 
+    /* Queued frames go out before the teardown sequences */
+    output_drain(r->out);
+
     /* Delete the Kitty graphics image */
     printf("\033_Ga=d,i=%ld;\033\\", r->kitty_id);
     fflush(stdout);
@@ -93,101 +329,281 @@ void renderer_destroy(renderer_t *restrict r)
     printf("\033]21\033\\");
     fflush(stdout);
 
+    wire_buffer_free(r->encoded_buffer, r->encoded_buffer_huge);
+    free(r->last_frame);
+    free(r->packed);
     free(r);
 }
 
-void renderer_render_frame(renderer_t *restrict r,
-                           const unsigned char *restrict rgb24_frame)
+/* True if two frames only differ inside the overlay rectangle */
+static bool differs_only_in_hud(const unsigned char *restrict a,
+                                const unsigned char *restrict b)
 {
-    if (!r || !rgb24_frame)
-        return;
+    const size_t row_size = WIDTH * 3;
+    const size_t hud_row_size = HUD_WIDTH * 3;
+    const size_t below = HUD_HEIGHT * row_size;
+
+    if (memcmp(a + below, b + below, WIDTH * HEIGHT * 3 - below))
+        return false;
+    for (int y = 0; y < HUD_HEIGHT; y++) {
+        const size_t off = y * row_size + hud_row_size;
+        if (memcmp(a + off, b + off, row_size - hud_row_size))
+            return false;
+    }
+    return true;
+}
+
+/* 2x2 box filter to half width and height */
+static void downscale_half(unsigned char *restrict dst,
+                           const unsigned char *restrict src)
+{
+    const size_t row_size = WIDTH * 3;
+    for (int y = 0; y < HEIGHT / 2; y++) {
+        const unsigned char *a = src + (size_t) y * 2 * row_size;
+        const unsigned char *b = a + row_size;
+        for (int x = 0; x < WIDTH / 2; x++, a += 6, b += 6) {
+            for (int c = 0; c < 3; c++)
+                *dst++ = (unsigned char) ((a[c] + a[c + 3] + b[c] +
+                                           b[c + 3] + 2) >> 2);
+        }
+    }
+}
+
+/* zlib at its fastest level, kept only when it saves bytes (o=z) */
+static bool compress_payload(renderer_t *restrict r,
+                             const unsigned char **payload,
+                             size_t *size)
+{
+#ifdef HAVE_ZLIB
+    if (!r->degrade.compress || !r->packed)
+        return false;
+
+    uLongf packed_size = WIDTH * HEIGHT * 3;
+    if (compress2(r->packed, &packed_size, *payload, *size, Z_BEST_SPEED) !=
+            Z_OK ||
+        packed_size >= *size)
+        return false;
+    *payload = r->packed;
+    *size = packed_size;
+    return true;
+#else
+    (void) r;
+    (void) payload;
+    (void) size;
+    return false;
+#endif
+}
 
+static void transmit_frame(renderer_t *restrict r,
+                           const unsigned char *restrict rgb24_frame)
+{
     /* rgb24_frame is already in RGB24 format from doom_get_framebuffer(3) */
     const size_t bitmap_size = WIDTH * HEIGHT * 3;
 
+    /* Unchanged frames are not retransmitted; the terminal keeps showing
+     * the last one. This is common in menus, on the intermission screen and
+     * whenever the player stands still.
+     *
+     * With an indexed source, palette and indices are compared apart. A new
+     * palette (damage, pickup and radiation suit tints) changes every RGB
+     * pixel, so that frame goes out in full without a diff that is certain
+     * to fail; otherwise the indices are compared, a third of the bytes.
+     * The overlay is not in the indices, so while it shows the RGB frames
+     * are compared instead.
+     */
+    const unsigned char *indices = r->src_indices;
+    const unsigned char *palette = r->src_palette;
+    unsigned long long t0 = trace_now();
+    const bool palette_changed =
+        indices && r->palette_valid &&
+        memcmp(palette, r->last_palette, PALETTE_SIZE);
+    bool unchanged = false;
+    if (palette_changed) {
+        r->palette_changes++;
+    } else if (r->frame_number > 0 && !r->recreate) {
+        unchanged = indices && r->indices_valid && !r->hud_visible
+                        ? !memcmp(indices, r->last_indices, WIDTH * HEIGHT)
+                        : !memcmp(rgb24_frame, r->last_frame, bitmap_size);
+    }
+    trace_slice("diff", t0, unchanged);
+    if (unchanged) {
+        r->frames_skipped++;
+        PROBE(frame__skip, r->frame_number);
+        return;
+    }
+
+    /* Kitty keeps one image per size, so a new downscale factor starts a
+     * new image, just like the first frame does
+     */
+    const int scale = r->degrade.downscale;
+    const int image_w = WIDTH / scale, image_h = HEIGHT / scale;
+    const bool create =
+        r->frame_number == 0 || image_w != r->image_w || r->recreate;
+
+    /* When only the overlay changed, Kitty gets just that rectangle. The
+     * compatibility path replaces the whole image, so it always sends the
+     * full frame; the overlay text changes at most twice per second.
+     */
+    const unsigned char *payload = rgb24_frame;
+    size_t payload_size = bitmap_size;
+    int update_w = image_w, update_h = image_h;
+    if (r->use_animation && !create && scale == 1 && !palette_changed &&
+        differs_only_in_hud(rgb24_frame, r->last_frame)) {
+        for (int y = 0; y < HUD_HEIGHT; y++) {
+            memcpy(r->hud_rect + y * HUD_WIDTH * 3, rgb24_frame + y * WIDTH * 3,
+                   HUD_WIDTH * 3);
+        }
+        payload = r->hud_rect;
+        payload_size = HUD_WIDTH * HUD_HEIGHT * 3;
+        update_w = HUD_WIDTH;
+        update_h = HUD_HEIGHT;
+    }
+    memcpy(r->last_frame, rgb24_frame, bitmap_size);
+    r->palette_valid = indices != NULL;
+    r->indices_valid = indices && !r->hud_visible;
+    if (indices) {
+        memcpy(r->last_palette, palette, PALETTE_SIZE);
+        memcpy(r->last_indices, indices, WIDTH * HEIGHT);
+    }
+
+    if (r->out) {
+        r->out_buf = output_frame_begin(r->out, &r->out_capacity);
+        r->out_size = 0;
+        r->out_overflow = false;
+    }
+    const unsigned long long bytes_before_frame = r->bytes_written;
+
     /* On first frame, ensure cursor is at home position */
     if (r->frame_number == 0) {
-        printf("\033[H");
-        fflush(stdout);
+        emitf(r, "\033[H");
+        emit_flush(r);
     }
 
     /* Encode RGB data to base64 */
-    size_t encoded_size =
-        base64_encode_auto((const uint8_t *) rgb24_frame, bitmap_size,
-                           (uint8_t *) r->encoded_buffer);
-    r->encoded_buffer[encoded_size] = '\0';
+    PROBE(encode__begin, payload_size);
+    t0 = trace_now();
+    const uint64_t encode_start = get_time_ns();
+    if (scale == 2) {
+        downscale_half(r->scaled, payload);
+        payload = r->scaled;
+        payload_size = (size_t) image_w * image_h * 3;
+    }
+    const char *zlib = compress_payload(r, &payload, &payload_size) ? "o=z,"
+                                                                    : "";
+    /* With a backend the chunks below encode in place, so assembling the
+     * frame counts as encoding and only the submit as writing.
+     */
+    const size_t encoded_size = 4 * ((payload_size + 2) / 3);
+    uint64_t write_start_ns = 0;
+    if (!r->out_buf) {
+        base64_encode_stream((const uint8_t *) payload, payload_size,
+                             (uint8_t *) r->encoded_buffer);
+        r->encoded_buffer[encoded_size] = '\0';
+        write_start_ns = get_time_ns();
+        r->encode_ns += write_start_ns - encode_start;
+        trace_slice("encode", t0, encoded_size);
+        PROBE(encode__end, encoded_size);
+    }
+    bool awaits_ack = false;
 
     /* Send Kitty Graphics Protocol escape sequence with base64 data */
     const size_t chunk_size = 4096;
 
     if (r->use_animation) {
         /* Animation mode (a=f) for Kitty terminal - efficient frame updates */
+        if (create && r->frame_number > 0) {
+            emitf(r, "\033[H\033_Ga=d,d=I,i=%ld;\033\\", r->kitty_id);
+            emit_flush(r);
+        }
+        /* Frames of the old image will not be acknowledged any more */
+        if (create)
+            r->unacked = 0;
+
         for (size_t encoded_offset = 0; encoded_offset < encoded_size;) {
             bool more_chunks = (encoded_offset + chunk_size) < encoded_size;
+            const unsigned long long write_start = trace_now();
+            const unsigned long long bytes_before = r->bytes_written;
 
             if (encoded_offset == 0) {
                 /* First chunk includes all image metadata */
-                if (r->frame_number == 0) {
-                    /* First frame: create new image */
-                    printf("\033_Ga=T,i=%ld,f=24,s=%d,v=%d,q=2,c=%d,r=%d,m=%d;",
-                           r->kitty_id, WIDTH, HEIGHT, r->screen_cols,
-                           r->screen_rows, more_chunks ? 1 : 0);
+                if (create) {
+                    /* First frame or new size: create new image */
+                    emitf(r,
+                          "\033_Ga=T,i=%ld,f=24,s=%d,v=%d,%sq=1,c=%d,r=%d,"
+                          "m=%d;",
+                          r->kitty_id, image_w, image_h, zlib,
+                          r->screen_cols, r->screen_rows,
+                          more_chunks ? 1 : 0);
                 } else {
                     /* Subsequent frames: use frame action */
-                    printf("\033_Ga=f,r=1,i=%ld,f=24,x=0,y=0,s=%d,v=%d,m=%d;",
-                           r->kitty_id, WIDTH, HEIGHT, more_chunks ? 1 : 0);
+                    emitf(r,
+                          "\033_Ga=f,r=1,i=%ld,f=24,x=0,y=0,s=%d,v=%d,%sm=%d;",
+                          r->kitty_id, update_w, update_h, zlib,
+                          more_chunks ? 1 : 0);
                 }
             } else {
                 /* Continuation chunks */
-                if (r->frame_number == 0) {
-                    printf("\033_Gm=%d;", more_chunks ? 1 : 0);
+                if (create) {
+                    emitf(r, "\033_Gm=%d;", more_chunks ? 1 : 0);
                 } else {
-                    printf("\033_Ga=f,r=1,m=%d;", more_chunks ? 1 : 0);
+                    emitf(r, "\033_Ga=f,r=1,m=%d;", more_chunks ? 1 : 0);
                 }
             }
 
             /* Transfer payload */
             const size_t this_size =
                 more_chunks ? chunk_size : encoded_size - encoded_offset;
-            fwrite(r->encoded_buffer + encoded_offset, 1, this_size, stdout);
-            printf("\033\\");
-            fflush(stdout);
+            PROBE(chunk__write, this_size, encoded_offset);
+            emit_encoded(r, payload, payload_size, encoded_offset,
+                         this_size);
+            emitf(r, "\033\\");
+            emit_flush(r);
+            trace_slice("write", write_start, r->bytes_written - bytes_before);
 
             encoded_offset += this_size;
         }
 
-        /* For Kitty mode, animate the frame after first frame */
-        if (r->frame_number > 0) {
-            printf("\033_Ga=a,c=1,i=%ld;\033\\", r->kitty_id);
-            fflush(stdout);
+        /* For Kitty mode, animate the frame after first frame. The a=f
+         * above is acknowledged; this one only reports errors.
+         */
+        if (!create) {
+            emitf(r, "\033_Ga=a,c=1,i=%ld,q=1;\033\\", r->kitty_id);
+            emit_flush(r);
+            awaits_ack = true;
         }
     } else {
         /* Compatibility mode (a=T) for Ghostty and other terminals */
         /* Delete old image before transmitting new one (except frame 0) */
         if (r->frame_number > 0) {
-            printf("\033[H\033_Ga=d,i=%ld;\033\\", r->kitty_id);
-            fflush(stdout);
+            emitf(r, "\033[H\033_Ga=d,i=%ld;\033\\", r->kitty_id);
+            emit_flush(r);
         }
 
         for (size_t encoded_offset = 0; encoded_offset < encoded_size;) {
             bool more_chunks = (encoded_offset + chunk_size) < encoded_size;
+            const unsigned long long write_start = trace_now();
+            const unsigned long long bytes_before = r->bytes_written;
 
             if (encoded_offset == 0) {
                 /* Use a=T (transmit) for all frames */
-                printf("\033_Ga=T,i=%ld,f=24,s=%d,v=%d,q=2,c=%d,r=%d,m=%d;",
-                       r->kitty_id, WIDTH, HEIGHT, r->screen_cols,
-                       r->screen_rows, more_chunks ? 1 : 0);
+                emitf(r,
+                      "\033_Ga=T,i=%ld,f=24,s=%d,v=%d,%sq=1,c=%d,r=%d,m=%d;",
+                      r->kitty_id, image_w, image_h, zlib, r->screen_cols,
+                      r->screen_rows, more_chunks ? 1 : 0);
             } else {
                 /* Continuation chunks */
-                printf("\033_Gm=%d;", more_chunks ? 1 : 0);
+                emitf(r, "\033_Gm=%d;", more_chunks ? 1 : 0);
             }
 
             /* Transfer payload */
             const size_t this_size =
                 more_chunks ? chunk_size : encoded_size - encoded_offset;
-            fwrite(r->encoded_buffer + encoded_offset, 1, this_size, stdout);
-            printf("\033\\");
-            fflush(stdout);
+            PROBE(chunk__write, this_size, encoded_offset);
+            emit_encoded(r, payload, payload_size, encoded_offset,
+                         this_size);
+            emitf(r, "\033\\");
+            emit_flush(r);
+            trace_slice("write", write_start, r->bytes_written - bytes_before);
 
             encoded_offset += this_size;
         }
@@ -195,9 +611,256 @@ void renderer_render_frame(renderer_t *restrict r,
 
     /* On first frame, add newline to move cursor below image */
     if (r->frame_number == 0) {
-        printf("\r\n");
-        fflush(stdout);
+        emitf(r, "\r\n");
+        emit_flush(r);
     }
 
+    bool sent = true;
+    if (r->out_buf) {
+        write_start_ns = get_time_ns();
+        r->encode_ns += write_start_ns - encode_start;
+        trace_slice("encode", t0, encoded_size);
+        PROBE(encode__end, encoded_size);
+
+        /* Submit nothing rather than a frame cut mid-sequence */
+        sent = !r->out_overflow;
+        if (!sent) {
+            r->frames_overflowed++;
+            r->bytes_written = bytes_before_frame;
+            r->out_size = 0;
+        }
+        const unsigned long long submit_start = trace_now();
+        output_frame_submit(r->out, r->out_size);
+        trace_slice("submit", submit_start, r->out_size);
+        r->out_buf = NULL;
+    }
+    r->write_ns += get_time_ns() - write_start_ns;
+    if (awaits_ack && sent)
+        r->unacked++;
+
+    r->image_w = image_w;
+    r->image_h = image_h;
+    /* The terminal never saw this frame: the next one starts afresh */
+    r->recreate = !sent;
     r->frame_number++;
 }
+
+/* Refresh the overlay text from the window once it is old enough */
+static void hud_update(renderer_t *restrict r, uint64_t start_ns)
+{
+    hud_window_t *w = &r->hud_window;
+    const uint64_t now = get_time_ns();
+
+    w->calls++;
+    w->render_ns += now - start_ns;
+    if (now - w->start_ns < HUD_REFRESH_NS)
+        return;
+
+    const double secs = (now - w->start_ns) / 1e9;
+    const unsigned long long emitted = r->frame_number - w->frame_number;
+    const unsigned long long skipped = r->frames_skipped - w->frames_skipped;
+    const unsigned long long bytes = r->bytes_written - w->bytes;
+
+    snprintf(r->hud_text[0], sizeof(r->hud_text[0]), "FPS %.1f",
+             w->calls / secs);
+    snprintf(r->hud_text[1], sizeof(r->hud_text[1]), "FRAME %.2fMS",
+             w->render_ns / 1e6 / w->calls);
+    snprintf(r->hud_text[2], sizeof(r->hud_text[2]), "ENC %.2fMS",
+             emitted ? (r->encode_ns - w->encode_ns) / 1e6 / emitted : 0.0);
+    snprintf(r->hud_text[3], sizeof(r->hud_text[3]), "KB/F %.1f",
+             emitted ? bytes / 1024.0 / emitted : 0.0);
+    snprintf(r->hud_text[4], sizeof(r->hud_text[4]), "SKIP %llu%%",
+             skipped * 100 / w->calls);
+    snprintf(r->hud_text[5], sizeof(r->hud_text[5]), "%s/%s",
+             output_name(r->out), r->use_animation ? "ANIM" : "COMPAT");
+
+    *w = (hud_window_t) {
+        .start_ns = now,
+        .frame_number = r->frame_number,
+        .frames_skipped = r->frames_skipped,
+        .bytes = r->bytes_written,
+        .encode_ns = r->encode_ns,
+    };
+}
+
+static void render_frame(renderer_t *restrict r,
+                         const unsigned char *restrict rgb24_frame)
+{
+    /* Lowered frame rate: only every Nth frame goes out */
+    if (r->degrade.frame_divisor > 1 &&
+        r->degrade_tick++ % r->degrade.frame_divisor) {
+        r->frames_dropped++;
+        return;
+    }
+
+    /* The terminal is more than MAX_UNACKED frames behind: let it catch up
+     * rather than queueing more. Replies that never come, e.g. from a
+     * terminal that stopped acknowledging, stop counting after a while.
+     */
+    if (r->acks_seen && r->unacked >= MAX_UNACKED) {
+        if (get_time_ns() - r->ack_ns < ACK_TIMEOUT_NS) {
+            r->frames_paced++;
+            return;
+        }
+        r->unacked = 0;
+    }
+
+    if (!r->hud_visible) {
+        transmit_frame(r, rgb24_frame);
+        return;
+    }
+
+    /* Draw into a copy: the engine's framebuffer is not ours to modify */
+    const uint64_t start_ns = get_time_ns();
+    const char *lines[HUD_LINES];
+    for (int i = 0; i < HUD_LINES; i++)
+        lines[i] = r->hud_text[i];
+
+    memcpy(r->composed, rgb24_frame, WIDTH * HEIGHT * 3);
+    hud_draw(r->composed, WIDTH, lines, HUD_LINES);
+    transmit_frame(r, r->composed);
+    hud_update(r, start_ns);
+}
+
+void renderer_render_frame(renderer_t *restrict r,
+                           const unsigned char *restrict rgb24_frame)
+{
+    if (!r || !rgb24_frame)
+        return;
+
+    render_frame(r, rgb24_frame);
+    r->src_indices = r->src_palette = NULL;
+}
+
+/* The indexed frame and palette (256 RGB triplets) behind the RGB frame
+ * passed to the next renderer_render_frame() call. Optional: it lets the
+ * renderer tell palette changes from picture changes.
+ */
+void renderer_set_source(renderer_t *restrict r,
+                         const unsigned char *indices,
+                         const unsigned char *palette)
+{
+    if (!r)
+        return;
+
+    r->src_indices = indices && palette ? indices : NULL;
+    r->src_palette = indices && palette ? palette : NULL;
+}
+
+void renderer_set_hud(renderer_t *restrict r, bool visible)
+{
+    if (!r || visible == r->hud_visible)
+        return;
+
+    r->hud_visible = visible;
+    if (!visible)
+        return;
+
+    /* Start a fresh measurement window; text appears after the first one */
+    r->hud_window = (hud_window_t) {
+        .start_ns = get_time_ns(),
+        .frame_number = r->frame_number,
+        .frames_skipped = r->frames_skipped,
+        .bytes = r->bytes_written,
+        .encode_ns = r->encode_ns,
+    };
+    for (int i = 0; i < HUD_LINES; i++)
+        snprintf(r->hud_text[i], sizeof(r->hud_text[i]), "%s",
+                 i == 0 ? "..." : "");
+}
+
+/* A graphics reply from the terminal, as decoded by the input thread.
+ * Acknowledgements pace a=f frames; an error means the terminal no longer
+ * shows what we last sent (e.g. ENOENT after it dropped the image on a
+ * reset), so the next frame creates the image afresh even if unchanged.
+ * Errors acknowledge nothing, and a terminal that keeps rejecting frames
+ * gets the compatibility path, which replaces the image every frame and
+ * needs no replies.
+ */
+void renderer_graphics_reply(renderer_t *restrict r,
+                             const graphics_reply_t *restrict reply)
+{
+    if (!r || !reply || (long) reply->image_id != r->kitty_id)
+        return;
+
+    if (reply->error == GRAPHICS_OK) {
+        if (r->unacked)
+            r->unacked--;
+        r->error_streak = 0;
+        r->acks++;
+        r->acks_seen = true;
+        r->ack_ns = get_time_ns();
+        return;
+    }
+
+    r->graphics_errors++;
+    r->recreate = true;
+    trace_instant("graphics error", reply->error);
+    if (r->use_animation && ++r->error_streak >= MAX_ERROR_STREAK) {
+        r->use_animation = false;
+        r->unacked = 0;
+        r->acks_seen = false;
+        trace_instant("compat fallback", r->graphics_errors);
+    }
+}
+
+/* Trade picture quality for encode CPU and egress: send only every Nth
+ * frame, at half resolution, or zlib compressed. Compression is ignored
+ * when built without zlib.
+ */
+void renderer_set_degrade(renderer_t *restrict r,
+                          const degrade_t *restrict degrade)
+{
+    if (!r || !degrade)
+        return;
+
+    degrade_t next = *degrade;
+    if (next.frame_divisor < 1)
+        next.frame_divisor = 1;
+    next.downscale = next.downscale == 2 ? 2 : 1;
+#ifdef HAVE_ZLIB
+    if (next.compress && !r->packed) {
+        r->packed = malloc(WIDTH * HEIGHT * 3);
+        next.compress = r->packed != NULL;
+    }
+#else
+    next.compress = false;
+#endif
+    r->degrade = next;
+    r->degrade_tick = 0;
+}
+
+/* Route frames through an output backend (NULL for stdio). The backend must
+ * outlive the renderer.
+ */
+void renderer_set_output(renderer_t *restrict r, output_t *out)
+{
+    if (!r)
+        return;
+
+    /* Anything still buffered in stdio goes first */
+    fflush(stdout);
+    r->out = out;
+}
+
+renderer_stats_t renderer_get_stats(const renderer_t *restrict r)
+{
+    if (!r)
+        return (renderer_stats_t) {0};
+
+    return (renderer_stats_t) {
+        .frames_emitted = r->frame_number,
+        .frames_skipped = r->frames_skipped,
+        .frames_dropped = r->frames_dropped,
+        .frames_paced = r->frames_paced,
+        .acks = r->acks,
+        .graphics_errors = r->graphics_errors,
+        .frames_overflowed = r->frames_overflowed,
+        .palette_changes = r->palette_changes,
+        .bytes = r->bytes_written,
+        .encode_ns = r->encode_ns,
+        .write_ns = r->write_ns,
+        .mode = r->use_animation ? "animation" : "compat",
+        .transport = output_name(r->out),
+    };
+}
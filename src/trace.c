@@ -0,0 +1,367 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * kitty-doom is freely redistributable under the GNU GPL. See the file
+ * "LICENSE" for information on usage and redistribution of this file.
+ */
+
+/*
+ * Chrome trace-event timeline export
+ *
+ * Every thread that records an event gets its own single-producer ring on
+ * first use. A writer thread drains all rings periodically into the JSON
+ * file, so recording is a few stores and one release store of the head
+ * index, with no lock or system call. When a ring is full (the writer fell
+ * behind) the event is dropped and counted rather than blocking the game.
+ * Rings of threads that exit are handed to new threads once drained, so
+ * threads recreated per level (the precache workers) keep being traced.
+ *
+ * Open the resulting file in https://ui.perfetto.dev or chrome://tracing.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kitty-doom.h"
+
+#define TRACE_RING_SIZE (1 << 14) /* events per thread, power of two */
+#define TRACE_MAX_THREADS 16
+#define TRACE_DRAIN_MS 50
+
+typedef struct {
+    const char *name;
+    uint64_t ts_ns;
+    uint64_t dur_ns; /* 0 for instant events */
+    long long arg;
+    bool instant;
+} trace_event_t;
+
+/* Ring life cycle: a thread that exits marks its ring exited; the writer
+ * drains it, writes its thread name and marks it free for the next thread.
+ */
+enum { RING_ACTIVE, RING_EXITED, RING_FREE };
+
+typedef struct {
+    _Atomic uint32_t head __attribute__((aligned(64))); /* producer */
+    _Atomic uint32_t tail __attribute__((aligned(64))); /* writer */
+    _Atomic uint64_t dropped;
+    _Atomic(const char *) thread_name;
+    atomic_int state;
+    long tid;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static struct {
+    FILE *out;
+    pthread_t thread;
+    atomic_bool stop;
+    bool first_event;
+    uint64_t origin_ns;
+    _Atomic(trace_ring_t *) rings[TRACE_MAX_THREADS];
+    atomic_int ring_count;
+} tracer;
+
+static atomic_bool trace_enabled;
+static __thread trace_ring_t *thread_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Thread exit: the writer takes it from here */
+static void ring_release(void *ring)
+{
+    atomic_store_explicit(&((trace_ring_t *) ring)->state, RING_EXITED,
+                          memory_order_release);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/* Claim a drained ring left by a thread that exited */
+static trace_ring_t *reuse_ring(void)
+{
+    int count = atomic_load_explicit(&tracer.ring_count, memory_order_relaxed);
+    if (count > TRACE_MAX_THREADS)
+        count = TRACE_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        trace_ring_t *ring =
+            atomic_load_explicit(&tracer.rings[i], memory_order_acquire);
+        int state = RING_FREE;
+        if (ring && atomic_compare_exchange_strong_explicit(
+                        &ring->state, &state, RING_ACTIVE,
+                        memory_order_acquire, memory_order_relaxed)) {
+            atomic_store_explicit(&ring->thread_name, NULL,
+                                  memory_order_relaxed);
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+/* Register a ring for the calling thread; NULL if out of slots or memory */
+static trace_ring_t *get_thread_ring(void)
+{
+    if (thread_ring)
+        return thread_ring;
+
+    pthread_once(&ring_key_once, ring_key_create);
+    trace_ring_t *ring = reuse_ring();
+    if (!ring) {
+        int idx = atomic_fetch_add_explicit(&tracer.ring_count, 1,
+                                            memory_order_relaxed);
+        if (idx >= TRACE_MAX_THREADS)
+            return NULL;
+
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (!ring)
+            return NULL;
+        atomic_store_explicit(&tracer.rings[idx], ring, memory_order_release);
+    }
+    ring->tid = syscall(SYS_gettid);
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static void push_event(const trace_event_t *ev)
+{
+    trace_ring_t *ring = get_thread_ring();
+    if (!ring)
+        return;
+
+    const uint32_t head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const uint32_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= TRACE_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    ring->events[head & (TRACE_RING_SIZE - 1)] = *ev;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+unsigned long long trace_now(void)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return 0;
+    return get_time_ns();
+}
+
+void trace_slice(const char *name, unsigned long long start_ns, long long arg)
+{
+    if (!start_ns ||
+        !atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+
+    const uint64_t now = get_time_ns();
+    push_event(&(trace_event_t) {
+        .name = name,
+        .ts_ns = start_ns,
+        .dur_ns = now - start_ns,
+        .arg = arg,
+        .instant = false,
+    });
+}
+
+void trace_instant(const char *name, long long arg)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+
+    push_event(&(trace_event_t) {
+        .name = name,
+        .ts_ns = get_time_ns(),
+        .arg = arg,
+        .instant = true,
+    });
+}
+
+void trace_thread_name(const char *name)
+{
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return;
+
+    trace_ring_t *ring = get_thread_ring();
+    if (ring)
+        atomic_store_explicit(&ring->thread_name, name, memory_order_relaxed);
+}
+
+static void write_separator(void)
+{
+    if (!tracer.first_event)
+        fputs(",\n", tracer.out);
+    tracer.first_event = false;
+}
+
+static void drain_ring(trace_ring_t *ring)
+{
+    const uint32_t head =
+        atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const int pid = getpid();
+
+    for (; tail != head; tail++) {
+        const trace_event_t *ev = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+        const double ts_us = (ev->ts_ns - tracer.origin_ns) / 1e3;
+
+        write_separator();
+        if (ev->instant) {
+            fprintf(tracer.out,
+                    "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                    "\"pid\":%d,\"tid\":%ld,\"args\":{\"value\":%lld}}",
+                    ev->name, ts_us, pid, ring->tid, ev->arg);
+        } else {
+            fprintf(tracer.out,
+                    "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%ld,\"args\":{\"value\":%lld}}",
+                    ev->name, ts_us, ev->dur_ns / 1e3, pid, ring->tid,
+                    ev->arg);
+        }
+    }
+
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+static void write_thread_name(const trace_ring_t *ring)
+{
+    const char *name =
+        atomic_load_explicit(&ring->thread_name, memory_order_relaxed);
+    write_separator();
+    fprintf(tracer.out,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+            (int) getpid(), ring->tid, name ? name : "thread");
+}
+
+static void drain_all(void)
+{
+    int count = atomic_load_explicit(&tracer.ring_count, memory_order_relaxed);
+    if (count > TRACE_MAX_THREADS)
+        count = TRACE_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        trace_ring_t *ring =
+            atomic_load_explicit(&tracer.rings[i], memory_order_acquire);
+        if (!ring)
+            continue;
+
+        /* Check for exit first: events pushed before it are then drained */
+        const bool exited = atomic_load_explicit(&ring->state,
+                                                 memory_order_acquire) ==
+                            RING_EXITED;
+        drain_ring(ring);
+        if (exited) {
+            write_thread_name(ring);
+            atomic_store_explicit(&ring->state, RING_FREE,
+                                  memory_order_release);
+        }
+    }
+}
+
+static void *writer_thread_func(void *arg)
+{
+    (void) arg;
+    placement_enter(THREAD_WRITER, "trace");
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = TRACE_DRAIN_MS * 1000000L,
+    };
+
+    while (!atomic_load_explicit(&tracer.stop, memory_order_relaxed)) {
+        nanosleep(&interval, NULL);
+        drain_all();
+    }
+    return NULL;
+}
+
+bool trace_start(const char *path)
+{
+    if (!path || tracer.out)
+        return false;
+
+    tracer.out = fopen(path, "w");
+    if (!tracer.out) {
+        fprintf(stderr, "Cannot open trace file %s\n", path);
+        return false;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", tracer.out);
+    tracer.first_event = true;
+    tracer.origin_ns = get_time_ns();
+    atomic_store_explicit(&tracer.stop, false, memory_order_relaxed);
+    atomic_store_explicit(&trace_enabled, true, memory_order_relaxed);
+
+    if (pthread_create(&tracer.thread, NULL, writer_thread_func, NULL) != 0) {
+        atomic_store_explicit(&trace_enabled, false, memory_order_relaxed);
+        fclose(tracer.out);
+        tracer.out = NULL;
+        return false;
+    }
+
+    static bool atexit_registered = false;
+    if (!atexit_registered)
+        atexit_registered = atexit(trace_stop) == 0;
+
+    fprintf(stderr, "Writing trace to %s\n", path);
+    return true;
+}
+
+/* Flush remaining events and finish the JSON document. Also registered with
+ * atexit() so error exits from inside the engine still leave a valid file.
+ * Rings are not freed: a thread that is still running may hold a pointer to
+ * its ring, and the memory goes away with the process anyway.
+ */
+void trace_stop(void)
+{
+    if (!tracer.out)
+        return;
+
+    atomic_store_explicit(&trace_enabled, false, memory_order_relaxed);
+    atomic_store_explicit(&tracer.stop, true, memory_order_relaxed);
+    pthread_join(tracer.thread, NULL);
+    drain_all();
+
+    /* Thread names and drop counts as metadata events */
+    unsigned long long dropped = 0;
+    int count = atomic_load_explicit(&tracer.ring_count, memory_order_relaxed);
+    if (count > TRACE_MAX_THREADS)
+        count = TRACE_MAX_THREADS;
+
+    for (int i = 0; i < count; i++) {
+        trace_ring_t *ring =
+            atomic_load_explicit(&tracer.rings[i], memory_order_acquire);
+        if (!ring)
+            continue;
+
+        /* Free rings had their name written when their thread exited */
+        if (atomic_load_explicit(&ring->state, memory_order_relaxed) !=
+            RING_FREE)
+            write_thread_name(ring);
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+
+    fputs("\n]}\n", tracer.out);
+    fclose(tracer.out);
+    tracer.out = NULL;
+
+    if (dropped)
+        fprintf(stderr, "Trace: %llu events dropped (writer fell behind)\n",
+                dropped);
+}
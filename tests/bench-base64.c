@@ -17,6 +17,7 @@
 #if defined(__aarch64__) || defined(__ARM_NEON)
 #include "../src/arch/neon-base64.h"
 #endif
+#include "../src/arch/vec-base64.h"
 
 /* Correctness Tests */
 
@@ -216,6 +217,55 @@ static bool test_large_data(const char *name,
     return all_passed;
 }
 
+/* Streaming-store encoder: same bytes as the scalar path for sizes around
+ * the streaming threshold, on aligned and unaligned output
+ */
+static bool test_stream(void)
+{
+    const size_t sizes[] = {
+        BASE64_STREAM_MIN - 1, BASE64_STREAM_MIN,     BASE64_STREAM_MIN + 1,
+        BASE64_STREAM_MIN + 2, BASE64_STREAM_MIN + 13, 192000,
+        192001,                192002,
+    };
+    const size_t max_size = 192002;
+    const size_t out_size = 4 * ((max_size + 2) / 3) + 64;
+
+    uint8_t *input = malloc(max_size);
+    uint8_t *output = NULL;
+    uint8_t *expected = malloc(out_size);
+    bool all_passed = input && expected &&
+                      posix_memalign((void **) &output, 64, out_size + 64) == 0;
+
+    printf("Testing Streaming implementation:\n");
+    for (size_t i = 0; all_passed && i < max_size; i++)
+        input[i] = (uint8_t) (i * 131 + (i >> 7));
+
+    for (size_t s = 0; all_passed && s < sizeof(sizes) / sizeof(sizes[0]);
+         s++) {
+        const size_t n = sizes[s];
+        const size_t expected_len = base64_encode_scalar(input, n, expected);
+
+        for (size_t offset = 0; offset <= 1; offset++) {
+            memset(output, 0xA5, out_size + 64);
+            const size_t len =
+                base64_encode_stream(input, n, output + offset);
+            if (len != expected_len ||
+                memcmp(output + offset, expected, len) != 0 ||
+                output[offset + len] != 0xA5) {
+                printf("  [FAIL] %zu bytes, output offset %zu\n", n, offset);
+                all_passed = false;
+            }
+        }
+    }
+    if (all_passed)
+        printf("  [PASS] Matches scalar around the streaming threshold\n");
+
+    free(input);
+    free(output);
+    free(expected);
+    return all_passed;
+}
+
 /* Run all correctness tests */
 static bool test_correctness(void)
 {
@@ -230,6 +280,21 @@ static bool test_correctness(void)
 
     printf("\n");
 
+    /* Portable paths, checked on every architecture */
+    all_passed &= test_impl("Pair table", base64_encode_pairs);
+    all_passed &= test_boundary("Pair table", base64_encode_pairs);
+    all_passed &= test_large_data("Pair table", base64_encode_pairs);
+
+    printf("\n");
+
+#ifdef VEC_AVAILABLE
+    all_passed &= test_impl("Vector", base64_encode_vec);
+    all_passed &= test_boundary("Vector", base64_encode_vec);
+    all_passed &= test_large_data("Vector", base64_encode_vec);
+
+    printf("\n");
+#endif
+
     /* Test NEON implementation if available */
 #if defined(__aarch64__) || defined(__ARM_NEON)
     all_passed &= test_impl("NEON", base64_encode_neon);
@@ -247,6 +312,9 @@ static bool test_correctness(void)
     all_passed &= test_boundary("Auto", base64_encode_auto);
     all_passed &= test_large_data("Auto", base64_encode_auto);
 
+    printf("\n");
+    all_passed &= test_stream();
+
     printf("\n=== Correctness Summary ===\n");
     if (all_passed) {
         printf("All tests PASSED\n");
@@ -417,6 +485,15 @@ static void bench_perf(void)
             bench_impl("Scalar", base64_encode_scalar, size);
         print_res(&results[result_count - 1]);
 
+        /* Benchmark portable paths */
+        results[result_count++] =
+            bench_impl("Pair table", base64_encode_pairs, size);
+        print_res(&results[result_count - 1]);
+#ifdef VEC_AVAILABLE
+        results[result_count++] = bench_impl("Vector", base64_encode_vec, size);
+        print_res(&results[result_count - 1]);
+#endif
+
 #if defined(__aarch64__) || defined(__ARM_NEON)
         /* Benchmark NEON */
         results[result_count++] = bench_impl("NEON", base64_encode_neon, size);
@@ -468,6 +545,104 @@ static void bench_perf(void)
     printf("  Saved:      %.2f%% of frame time\n", scalar_pct - auto_pct);
 }
 
+/* Engine tic stand-in: a dependent walk over every cache line of a
+ * level-sized working set, in random order so the prefetcher cannot hide
+ * misses. Its time after an encode shows how much of the set the encoder
+ * evicted.
+ */
+#define TIC_WORKING_SET (1024 * 1024)
+#define TIC_LINES (TIC_WORKING_SET / 64)
+#define CACHE_ITERATIONS 300
+
+typedef struct {
+    uint32_t next;
+    uint32_t pad[15];
+} tic_line_t;
+
+static uint32_t tic_walk(const tic_line_t *lines)
+{
+    uint32_t i = 0;
+    for (int n = 0; n < TIC_LINES; n++)
+        i = lines[i].next;
+    return i;
+}
+
+static void bench_cache_effect(void)
+{
+    const size_t frame_size = 192000;
+    tic_line_t *lines = malloc(TIC_LINES * sizeof(tic_line_t));
+    uint8_t *frame = malloc(frame_size);
+    uint8_t *output = NULL;
+    if (!lines || !frame ||
+        posix_memalign((void **) &output, 64, frame_size * 2) != 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(lines);
+        free(frame);
+        return;
+    }
+
+    /* One random cycle through all lines (Sattolo's algorithm) */
+    uint32_t *order = malloc(TIC_LINES * sizeof(uint32_t));
+    if (!order) {
+        free(lines);
+        free(frame);
+        free(output);
+        return;
+    }
+    for (uint32_t i = 0; i < TIC_LINES; i++)
+        order[i] = i;
+    srand(1);
+    for (uint32_t i = TIC_LINES - 1; i > 0; i--) {
+        const uint32_t j = (uint32_t) rand() % i;
+        const uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (uint32_t i = 0; i < TIC_LINES; i++)
+        lines[i].next = order[i];
+    free(order);
+
+    for (size_t i = 0; i < frame_size; i++)
+        frame[i] = (uint8_t) (i * 17 + 42);
+
+    printf("\n=== Encode Cache Footprint (frame encode, then engine tic) ===\n");
+    printf("Tic working set: %d KB, %d iterations\n",
+           TIC_WORKING_SET / 1024, CACHE_ITERATIONS);
+
+    static const struct {
+        const char *name;
+        base64_encode_func_t fn;
+    } variants[] = {
+        {"Cached stores", base64_encode_auto},
+        {"Streaming stores", base64_encode_stream},
+    };
+    double tic_us[2];
+    volatile uint32_t sink = 0;
+
+    for (size_t v = 0; v < 2; v++) {
+        uint64_t encode_ns = 0, tic_ns = 0;
+        sink += tic_walk(lines);
+        for (int i = 0; i < CACHE_ITERATIONS; i++) {
+            const uint64_t t0 = get_time_ns();
+            variants[v].fn(frame, frame_size, output);
+            const uint64_t t1 = get_time_ns();
+            sink += tic_walk(lines);
+            const uint64_t t2 = get_time_ns();
+            encode_ns += t1 - t0;
+            tic_ns += t2 - t1;
+        }
+        tic_us[v] = tic_ns / 1000.0 / CACHE_ITERATIONS;
+        printf("  %-18s encode %7.2f us, tic %7.2f us\n", variants[v].name,
+               encode_ns / 1000.0 / CACHE_ITERATIONS, tic_us[v]);
+    }
+    printf("  Tic time with streaming stores: %.2fx\n", tic_us[1] / tic_us[0]);
+    (void) sink;
+
+    free(lines);
+    free(frame);
+    free(output);
+}
+
 int main(void)
 {
     /* Run correctness tests first */
@@ -481,6 +656,7 @@ int main(void)
 
     /* Run performance benchmarks */
     bench_perf();
+    bench_cache_effect();
 
     return 0;
 }
@@ -2,7 +2,8 @@
 /*
  * Frame differencing benchmark
  *
- * Measures the performance of NEON-accelerated frame difference detection
+ * Measures the performance of SIMD frame difference detection and checks
+ * the portable vector kernel against an exact scalar count
  */
 
 #include <stddef.h>
@@ -21,6 +22,8 @@
 #include "../src/arch/sse-framediff.h"
 #endif
 
+#include "../src/arch/vec-framediff.h"
+
 #define WIDTH 320
 #define HEIGHT 200
 #define PIXEL_COUNT (WIDTH * HEIGHT)
@@ -56,7 +59,25 @@ static void modify_frame(uint8_t *dest,
     }
 }
 
+/* Exact scalar reference */
+static int framediff_percentage_scalar(const uint8_t *frame1,
+                                       const uint8_t *frame2,
+                                       size_t pixel_count)
+{
+    size_t diff_pixels = 0;
+    for (size_t j = 0; j < pixel_count * 3; j += 3) {
+        if (frame1[j] != frame2[j] || frame1[j + 1] != frame2[j + 1] ||
+            frame1[j + 2] != frame2[j + 2]) {
+            diff_pixels++;
+        }
+    }
+    return (int) ((diff_pixels * 100) / pixel_count);
+}
+
+typedef int (*framediff_func_t)(const uint8_t *, const uint8_t *, size_t);
+
 static void bench_framediff(const char *impl_name,
+                            framediff_func_t impl,
                             int change_percent,
                             uint8_t *frame1,
                             uint8_t *frame2)
@@ -69,26 +90,7 @@ static void bench_framediff(const char *impl_name,
 
     for (int i = 0; i < iterations; i++) {
         uint64_t start = get_time_ns();
-
-#if defined(__aarch64__) || defined(__ARM_NEON)
-        detected_percent =
-            framediff_percentage_neon(frame1, frame2, PIXEL_COUNT);
-#elif defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
-    defined(_M_IX86)
-        detected_percent =
-            framediff_percentage_sse(frame1, frame2, PIXEL_COUNT);
-#else
-        /* Scalar fallback */
-        size_t diff_pixels = 0;
-        for (size_t j = 0; j < FRAME_SIZE; j += 3) {
-            if (frame1[j] != frame2[j] || frame1[j + 1] != frame2[j + 1] ||
-                frame1[j + 2] != frame2[j + 2]) {
-                diff_pixels++;
-            }
-        }
-        detected_percent = (int) ((diff_pixels * 100) / PIXEL_COUNT);
-#endif
-
+        detected_percent = impl(frame1, frame2, PIXEL_COUNT);
         uint64_t elapsed = get_time_ns() - start;
         if (elapsed < min_time)
             min_time = elapsed;
@@ -106,6 +108,43 @@ static void bench_framediff(const char *impl_name,
     printf("\n");
 }
 
+#ifdef VEC_AVAILABLE
+/* The vector kernel counts whole pixels, so it must match the reference
+ * exactly, including odd pixel counts that end in the scalar tail
+ */
+static int verify_vec(void)
+{
+    int failures = 0;
+    uint8_t *a = malloc(FRAME_SIZE);
+    uint8_t *b = malloc(FRAME_SIZE);
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return 1;
+    }
+
+    fill_random_frame(a, FRAME_SIZE);
+    const int changes[] = {0, 1, 5, 50, 100};
+    for (size_t c = 0; c < sizeof(changes) / sizeof(changes[0]); c++) {
+        modify_frame(b, a, FRAME_SIZE, changes[c]);
+        for (size_t pixels = PIXEL_COUNT - 7; pixels <= PIXEL_COUNT;
+             pixels++) {
+            size_t expected = 0;
+            for (size_t j = 0; j < pixels * 3; j += 3)
+                expected += memcmp(a + j, b + j, 3) != 0;
+            if (framediff_count_vec(a, b, pixels) != expected)
+                failures++;
+        }
+    }
+
+    printf("Vector kernel vs scalar reference: %s\n\n",
+           failures ? "[FAIL]" : "[PASS]");
+    free(a);
+    free(b);
+    return failures;
+}
+#endif
+
 int main(void)
 {
     srand(time(NULL));
@@ -124,11 +163,19 @@ int main(void)
 
 #if defined(__aarch64__) || defined(__ARM_NEON)
     const char *impl = "NEON";
+    framediff_func_t func = framediff_percentage_neon;
 #elif defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
     defined(_M_IX86)
     const char *impl = "SSE2";
+    framediff_func_t func = framediff_percentage_sse;
 #else
     const char *impl = "Scalar";
+    framediff_func_t func = framediff_percentage_scalar;
+#endif
+
+    int failures = 0;
+#ifdef VEC_AVAILABLE
+    failures += verify_vec();
 #endif
 
     /* Test various change percentages */
@@ -136,27 +183,42 @@ int main(void)
 
     /* 0% change (identical frames) */
     memcpy(frame2, frame1, FRAME_SIZE);
-    bench_framediff(impl, 0, frame1, frame2);
+    bench_framediff(impl, func, 0, frame1, frame2);
 
     /* 1% change (typical menu/idle) */
     modify_frame(frame2, frame1, FRAME_SIZE, 1);
-    bench_framediff(impl, 1, frame1, frame2);
+    bench_framediff(impl, func, 1, frame1, frame2);
 
     /* 5% change (slow movement) */
     modify_frame(frame2, frame1, FRAME_SIZE, 5);
-    bench_framediff(impl, 5, frame1, frame2);
+    bench_framediff(impl, func, 5, frame1, frame2);
 
     /* 20% change (active gameplay) */
     modify_frame(frame2, frame1, FRAME_SIZE, 20);
-    bench_framediff(impl, 20, frame1, frame2);
+    bench_framediff(impl, func, 20, frame1, frame2);
 
     /* 50% change (intense action) */
     modify_frame(frame2, frame1, FRAME_SIZE, 50);
-    bench_framediff(impl, 50, frame1, frame2);
+    bench_framediff(impl, func, 50, frame1, frame2);
 
     /* 100% change (scene transition) */
     fill_random_frame(frame2, FRAME_SIZE);
-    bench_framediff(impl, 100, frame1, frame2);
+    bench_framediff(impl, func, 100, frame1, frame2);
+
+    /* Portable kernels on the same data; the scalar loop stops at the
+     * first differing byte of a pixel, so identical frames are its worst
+     * case
+     */
+    bench_framediff("Scalar", framediff_percentage_scalar, 100, frame1,
+                    frame2);
+#ifdef VEC_AVAILABLE
+    bench_framediff("Vector", framediff_percentage_vec, 100, frame1, frame2);
+#endif
+    memcpy(frame2, frame1, FRAME_SIZE);
+    bench_framediff("Scalar", framediff_percentage_scalar, 0, frame1, frame2);
+#ifdef VEC_AVAILABLE
+    bench_framediff("Vector", framediff_percentage_vec, 0, frame1, frame2);
+#endif
 
     free(frame1);
     free(frame2);
@@ -164,5 +226,5 @@ int main(void)
     printf("Frame skip threshold: 5%%\n");
     printf("Frames with < 5%% change will be skipped, saving bandwidth.\n");
 
-    return 0;
+    return failures ? 1 : 0;
 }
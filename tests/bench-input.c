@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Input parser and key-state microbenchmark
+ *
+ * Feeds synthetic terminal streams (key-repeat bursts, pasted text, terminal
+ * replies, graphics acknowledgements and SGR mouse reports) through the real
+ * parser in src/input.c and checks the key events and graphics replies it
+ * produces, then times parsing per byte and the release scheduler against
+ * the previous mutex-protected release list.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/input.c"
+#include "check.h"
+
+#define PARSE_ROUNDS 200
+#define SCHED_ITERATIONS 1000000
+
+/* Engine and subsystem stubs: count key events, ignore the rest */
+static unsigned long keys_down, keys_up;
+
+void doom_key_down(doom_key_t key)
+{
+    (void) key;
+    keys_down++;
+}
+
+void doom_key_up(doom_key_t key)
+{
+    (void) key;
+    keys_up++;
+}
+
+void metrics_key_pressed(void) {}
+void metrics_input_bytes(size_t n)
+{
+    (void) n;
+}
+void metrics_input_queue_depth(int depth)
+{
+    (void) depth;
+}
+void trace_instant(const char *name, long long arg)
+{
+    (void) name;
+    (void) arg;
+}
+void trace_thread_name(const char *name)
+{
+    (void) name;
+}
+void placement_enter(thread_role_t role, const char *name)
+{
+    (void) role;
+    (void) name;
+}
+void recorder_input_event(void) {}
+
+/* Parser state as input_create() leaves it, without the reader thread */
+static void input_init(input_t *input)
+{
+    memset(input, 0, sizeof(*input));
+    input->state = STATE_GROUND;
+    pthread_mutex_init(&input->query_mutex, NULL);
+    pthread_cond_init(&input->query_condition, NULL);
+}
+
+static void input_fini(input_t *input)
+{
+    free(input->device_attributes);
+    pthread_cond_destroy(&input->query_condition);
+    pthread_mutex_destroy(&input->query_mutex);
+}
+
+static void feed(input_t *input, const char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        parse_char(input, buf[i]);
+}
+
+static void sleep_ms(int ms)
+{
+    const struct timespec ts = {.tv_sec = 0, .tv_nsec = ms * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/* Synthetic streams, each repeated to a few KiB */
+typedef struct {
+    const char *name;
+    size_t len;
+    char buf[8192];
+} stream_t;
+
+static void stream_fill(stream_t *s, const char *name, const char *unit)
+{
+    const size_t n = strlen(unit);
+    s->name = name;
+    s->len = 0;
+    while (s->len + n <= sizeof(s->buf)) {
+        memcpy(s->buf + s->len, unit, n);
+        s->len += n;
+    }
+}
+
+static inline uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (uint64_t) (end.tv_sec - start->tv_sec) * 1000000000ULL +
+           (uint64_t) (end.tv_nsec - start->tv_nsec);
+}
+
+/* Graphics replies reach the queue decoded, with keys around them intact */
+static bool test_graphics_replies(void)
+{
+    bool ok = true;
+    static input_t input;
+    graphics_reply_t reply;
+    input_init(&input);
+    keys_down = 0;
+
+    const char *stream = "a\033_Gi=31,p=7;ENOENT:No such image\033\\b"
+                         "\033_GI=4;OK\033\\\033_Gi=9;ETOODEEP:x\033\\";
+    feed(&input, stream, strlen(stream));
+    ok &= check(keys_down == 2, "keys around graphics replies still count");
+    ok &= check(input_graphics_reply(&input, &reply) &&
+                    reply.image_id == 31 && reply.placement_id == 7 &&
+                    reply.error == GRAPHICS_ENOENT &&
+                    !strcmp(reply.message, "ENOENT:No such image"),
+                "error reply decoded with image id and code");
+    ok &= check(input_graphics_reply(&input, &reply) &&
+                    reply.image_number == 4 && reply.image_id == 0 &&
+                    reply.error == GRAPHICS_OK,
+                "acknowledgement decoded");
+    ok &= check(input_graphics_reply(&input, &reply) &&
+                    reply.error == GRAPHICS_EOTHER,
+                "unknown error code kept as other");
+    ok &= check(!input_graphics_reply(&input, &reply), "queue drained");
+
+    /* A reply that does not fit is dropped, not decoded from a prefix */
+    char big[MAX_STRING + 32];
+    const int n = snprintf(big, sizeof(big), "\033_Gi=5;EINVAL:%0*d\033\\",
+                           MAX_STRING, 0);
+    feed(&input, big, (size_t) n);
+    ok &= check(input.state == STATE_GROUND &&
+                    !input_graphics_reply(&input, &reply),
+                "oversized reply ignored");
+
+    /* ESC without ST cuts the string short and starts a key sequence */
+    const char *cut = "\033_Gi=6;OK\033[A";
+    keys_down = 0;
+    feed(&input, cut, strlen(cut));
+    ok &= check(keys_down == 1 && !input_graphics_reply(&input, &reply),
+                "unterminated reply gives way to the next key");
+
+    /* Nobody draining: the ring keeps the oldest and counts the rest */
+    const char *ack = "\033_Gi=1;OK\033\\";
+    for (int i = 0; i < REPLY_SLOTS + 4; i++)
+        feed(&input, ack, strlen(ack));
+    int queued = 0;
+    while (input_graphics_reply(&input, &reply))
+        queued++;
+    ok &= check(queued == REPLY_SLOTS && input.replies_dropped == 4,
+                "full queue drops new replies");
+
+    input_fini(&input);
+    return ok;
+}
+
+static bool test_events(void)
+{
+    bool passed = true;
+    input_t input;
+
+    /* Terminal replies and mouse reports must not become key presses */
+    static const char *const silent[] = {
+        "\033[?62;22c",        "\033[4;800;1280t",  "\033[50;120R",
+        "\033[<0;10;20M",      "\033[<0;10;20m",    "\033[<35;200;48M",
+        "\033[<64;1;1M",       "\033[>1;4000;29c",  "\033[=1;2c",
+        "\033[ q",
+        "\033_Gi=31;OK\033\\",
+        "\033_Gi=7,p=2;ENOENT:No such image\033\\",
+        "\033_Gi=1;EINVAL:bad \003 in text\033\\",
+        "\033_Gi=1;OK\030",
+    };
+    for (size_t i = 0; i < sizeof(silent) / sizeof(silent[0]); i++) {
+        input_init(&input);
+        keys_down = keys_up = 0;
+        feed(&input, silent[i], strlen(silent[i]));
+        if (keys_down || input.state != STATE_GROUND ||
+            input.exit_requested) {
+            printf("  [FAIL] \"\\033%s\" produced %lu key presses\n",
+                   silent[i] + 1, keys_down);
+            passed = false;
+        }
+        input_fini(&input);
+    }
+    if (passed)
+        printf("  [PASS] Terminal replies and mouse reports are not keys\n");
+
+    passed &= test_graphics_replies();
+
+    /* Only ESC _ G opens a string: Alt with P, X, ^, ] and _ are keys and
+     * the input after them is not swallowed
+     */
+    static const char *const alt[] = {
+        "\033Pa", "\033Xa", "\033^a", "\033]a", "\033_a",
+    };
+    bool alt_ok = true;
+    for (size_t i = 0; i < sizeof(alt) / sizeof(alt[0]); i++) {
+        input_init(&input);
+        keys_down = 0;
+        feed(&input, alt[i], strlen(alt[i]));
+        alt_ok &= input.state == STATE_GROUND && keys_down == 3;
+        input_fini(&input);
+    }
+    passed &= check(alt_ok, "Alt+P, Alt+X, Alt+^, Alt+] and Alt+_ are keys");
+
+    /* A repeat burst is one press; the release follows once it stops */
+    input_init(&input);
+    keys_down = keys_up = 0;
+    for (int i = 0; i < 50; i++)
+        feed(&input, "\033[A", 3);
+    process_pending_releases(&input);
+    const bool burst_ok = keys_down == 1 && keys_up == 0;
+    sleep_ms(200);
+    process_pending_releases(&input);
+    if (!burst_ok || keys_up != 1) {
+        printf("  [FAIL] Repeat burst: %lu down, %lu up\n", keys_down,
+               keys_up);
+        passed = false;
+    } else {
+        printf("  [PASS] Repeat burst is a single press and release\n");
+    }
+    input_fini(&input);
+
+    /* More distinct keys than the old 16-entry list held are all released */
+    input_init(&input);
+    keys_down = keys_up = 0;
+    const char *typed = "abcdeghjklmnopqrstuvwxyz0123456789";
+    feed(&input, typed, strlen(typed));
+    sleep_ms(100);
+    process_pending_releases(&input);
+    if (keys_down != strlen(typed) || keys_up != keys_down) {
+        printf("  [FAIL] %zu distinct keys: %lu down, %lu up\n",
+               strlen(typed), keys_down, keys_up);
+        passed = false;
+    } else {
+        printf("  [PASS] %zu distinct keys are all released\n",
+               strlen(typed));
+    }
+    input_fini(&input);
+
+    /* UTF-8 bytes in pasted text are not forwarded as key codes */
+    input_init(&input);
+    keys_down = keys_up = 0;
+    feed(&input, "\xc3\xa9\xe2\x82\xac", 5);
+    if (keys_down) {
+        printf("  [FAIL] UTF-8 text produced %lu key presses\n", keys_down);
+        passed = false;
+    } else {
+        printf("  [PASS] UTF-8 text is ignored\n");
+    }
+    input_fini(&input);
+
+    return passed;
+}
+
+static void bench_parser(void)
+{
+    static stream_t streams[5];
+    stream_fill(&streams[0], "Arrow repeat", "\033[A\033[A\033[C\033[A");
+    stream_fill(&streams[1], "Pasted text",
+                "the quick brown fox jumps over the lazy dog\n");
+    stream_fill(&streams[2], "CSI replies",
+                "\033[?62;22c\033[4;800;1280t\033[50;120R");
+    stream_fill(&streams[3], "SGR mouse", "\033[<35;118;42M\033[<0;9;7m");
+    stream_fill(&streams[4], "Graphics acks",
+                "\033_Gi=1804289383;OK\033\\");
+
+    printf("\n  %-14s %10s %14s\n", "Stream", "ns/byte", "key events/s");
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+        const stream_t *s = &streams[i];
+        input_t input;
+        input_init(&input);
+        keys_down = 0;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < PARSE_ROUNDS; r++) {
+            feed(&input, s->buf, s->len);
+            /* Every round starts with all keys up, as after a pause */
+            memset(input.held_keys_bitmap, 0,
+                   sizeof(input.held_keys_bitmap));
+            graphics_reply_t reply;
+            while (input_graphics_reply(&input, &reply))
+                ;
+        }
+        const uint64_t ns = elapsed_ns(&start);
+
+        const double bytes = (double) s->len * PARSE_ROUNDS;
+        printf("  %-14s %10.2f %14.0f\n", s->name, ns / bytes,
+               keys_down * 1e9 / ns);
+        input_fini(&input);
+    }
+}
+
+/*
+ * Release scheduler before the per-key deadline table (baseline): a fixed
+ * list guarded by a mutex, searched linearly on every schedule and compacted
+ * on every release.
+ */
+#define LEGACY_MAX_PENDING 16
+
+static struct {
+    struct {
+        int key;
+        struct timespec release_time;
+    } pending[LEGACY_MAX_PENDING];
+    int count;
+    pthread_mutex_t mutex;
+} legacy = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void legacy_sched(int key, int delay_ms)
+{
+    pthread_mutex_lock(&legacy.mutex);
+
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_nsec += delay_ms * 1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec += t.tv_nsec / 1000000000L;
+        t.tv_nsec %= 1000000000L;
+    }
+
+    for (int i = 0; i < legacy.count; i++) {
+        if (legacy.pending[i].key == key) {
+            legacy.pending[i].release_time = t;
+            pthread_mutex_unlock(&legacy.mutex);
+            return;
+        }
+    }
+    if (legacy.count < LEGACY_MAX_PENDING) {
+        legacy.pending[legacy.count].key = key;
+        legacy.pending[legacy.count].release_time = t;
+        legacy.count++;
+    }
+
+    pthread_mutex_unlock(&legacy.mutex);
+}
+
+static void legacy_process(void)
+{
+    pthread_mutex_lock(&legacy.mutex);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = legacy.count - 1; i >= 0; i--) {
+        const struct timespec *t = &legacy.pending[i].release_time;
+        if (now.tv_sec > t->tv_sec ||
+            (now.tv_sec == t->tv_sec && now.tv_nsec >= t->tv_nsec)) {
+            doom_key_up(legacy.pending[i].key);
+            for (int j = i; j < legacy.count - 1; j++)
+                legacy.pending[j] = legacy.pending[j + 1];
+            legacy.count--;
+        }
+    }
+
+    pthread_mutex_unlock(&legacy.mutex);
+}
+
+/* Eight keys held (movement, fire, modifiers), as in a busy firefight */
+static const int held_keys[] = {
+    DOOM_KEY_UP_ARROW, DOOM_KEY_LEFT_ARROW, DOOM_KEY_RIGHT_ARROW,
+    DOOM_KEY_CTRL,     DOOM_KEY_SHIFT,      DOOM_KEY_ALT,
+    'e',               'w',
+};
+#define HELD_COUNT (int) (sizeof(held_keys) / sizeof(held_keys[0]))
+
+static void bench_releases(void)
+{
+    static input_t input;
+    input_init(&input);
+
+    struct timespec start;
+    uint64_t ns;
+
+    printf("\n  %-22s %12s %12s\n", "Release scheduler", "sched ns",
+           "process ns");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SCHED_ITERATIONS; i++)
+        legacy_sched(held_keys[i % HELD_COUNT], 150);
+    const double legacy_sched_ns = (double) elapsed_ns(&start) /
+                                   SCHED_ITERATIONS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SCHED_ITERATIONS; i++)
+        legacy_process();
+    const double legacy_process_ns = (double) elapsed_ns(&start) /
+                                     SCHED_ITERATIONS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SCHED_ITERATIONS; i++)
+        sched_key_release(&input, held_keys[i % HELD_COUNT], 150);
+    ns = elapsed_ns(&start);
+    const double table_sched_ns = (double) ns / SCHED_ITERATIONS;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SCHED_ITERATIONS; i++)
+        process_pending_releases(&input);
+    ns = elapsed_ns(&start);
+    const double table_process_ns = (double) ns / SCHED_ITERATIONS;
+
+    printf("  %-22s %12.1f %12.1f\n", "Mutex list (baseline)",
+           legacy_sched_ns, legacy_process_ns);
+    printf("  %-22s %12.1f %12.1f\n", "Deadline table", table_sched_ns,
+           table_process_ns);
+    printf("  Speedup: %.2fx schedule, %.2fx release pass\n",
+           legacy_sched_ns / table_sched_ns,
+           legacy_process_ns / table_process_ns);
+
+    input_fini(&input);
+}
+
+int main(void)
+{
+    printf("Input Parser Tests and Benchmark\n");
+    printf("================================\n\n");
+
+    const bool passed = test_events();
+    bench_parser();
+    bench_releases();
+
+    return check_summary(passed);
+}
@@ -0,0 +1,376 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Thread placement tests and benchmark
+ *
+ * Checks the --cpus/--sched spec parser, thread naming, and that roles
+ * without settings drop the affinity and nice level they inherited from a
+ * configured creator. Then runs a paced frame loop next to cache-thrashing
+ * noise threads and compares tail frame latency and core migrations with
+ * the game thread unpinned and pinned.
+ */
+
+#define _GNU_SOURCE /* sched_getcpu, pthread_getname_np */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+
+#define FRAMES 250
+#define FRAME_PERIOD_NS 4000000L
+#define WORKING_SET (2 << 20) /* framebuffers plus engine state */
+#define NOISE_SET (16 << 20)
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Run a configure call with its diagnostics silenced */
+static bool configure_quiet(const char *cpus, const char *sched)
+{
+    fflush(stderr);
+    const int saved = dup(STDERR_FILENO);
+    const int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    const bool ok = placement_configure(cpus, sched);
+    fflush(stderr);
+    if (saved >= 0) {
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+    }
+    return ok;
+}
+
+static bool test_parser(void)
+{
+    static const struct {
+        const char *cpus, *sched;
+        bool ok;
+    } cases[] = {
+        {"game=0", NULL, true},
+        {"worker=0-0,0", NULL, true},
+        {"game=0,input=0,writer=0,worker=0", NULL, true},
+        {NULL, "input=fifo:20,writer=nice:5,game=default", true},
+        {NULL, "worker=fifo", true},
+        {"gpu=0", NULL, false},
+        {"game=", NULL, false},
+        {"game=x", NULL, false},
+        {"0", NULL, false},
+        {"game=1-0", NULL, false},
+        {"game=100000", NULL, false},
+        {NULL, "input=fifo:100", false},
+        {NULL, "writer=nice:30", false},
+        {NULL, "writer=nice", false},
+        {NULL, "input=rr", false},
+        {NULL, "game=nice:1,0", false},
+    };
+
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (configure_quiet(cases[i].cpus, cases[i].sched) != cases[i].ok) {
+            printf("  [FAIL] --cpus %s --sched %s %s\n",
+                   cases[i].cpus ? cases[i].cpus : "-",
+                   cases[i].sched ? cases[i].sched : "-",
+                   cases[i].ok ? "rejected" : "accepted");
+            passed = false;
+        }
+    }
+
+    /* A CPU outside the process mask is refused up front */
+    cpu_set_t mask;
+    sched_getaffinity(0, sizeof(mask), &mask);
+    for (int cpu = 0; cpu < 1024; cpu++) {
+        if (CPU_ISSET(cpu, &mask))
+            continue;
+        char spec[32];
+        snprintf(spec, sizeof(spec), "input=%d", cpu);
+        if (configure_quiet(spec, NULL)) {
+            printf("  [FAIL] --cpus %s accepted an unavailable CPU\n", spec);
+            passed = false;
+        }
+        break;
+    }
+
+    if (passed)
+        printf("  [PASS] --cpus and --sched specs are parsed and validated\n");
+    placement_configure(NULL, NULL);
+    return passed;
+}
+
+/* Helper threads enter a role and report what they ended up with */
+typedef struct {
+    thread_role_t role;
+    const char *name;
+    char comm[16];
+    cpu_set_t cpus;
+    int nice_level;
+    int policy;
+} probe_t;
+
+static void *probe_thread(void *arg)
+{
+    probe_t *p = arg;
+    placement_enter(p->role, p->name);
+    pthread_getname_np(pthread_self(), p->comm, sizeof(p->comm));
+    pthread_getaffinity_np(pthread_self(), sizeof(p->cpus), &p->cpus);
+    errno = 0;
+    p->nice_level = getpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid));
+    struct sched_param param;
+    pthread_getschedparam(pthread_self(), &p->policy, &param);
+    return NULL;
+}
+
+static void run_probe(probe_t *p)
+{
+    pthread_t t;
+    if (pthread_create(&t, NULL, probe_thread, p) == 0)
+        pthread_join(t, NULL);
+}
+
+/* A configured writer that starts an unconfigured input thread */
+static probe_t nested;
+
+static void *nice_parent(void *arg)
+{
+    probe_thread(arg);
+    run_probe(&nested);
+    return NULL;
+}
+
+static bool test_roles(void)
+{
+    bool passed = true;
+    cpu_set_t initial;
+    sched_getaffinity(0, sizeof(initial), &initial);
+    int first_cpu = 0;
+    while (!CPU_ISSET(first_cpu, &initial))
+        first_cpu++;
+
+    /* Names carry the kd- prefix and are cut to the kernel's 15 bytes */
+    probe_t named = {.role = THREAD_INPUT, .name = "input"};
+    probe_t long_name = {.role = THREAD_WORKER, .name = "precache-worker"};
+    run_probe(&named);
+    run_probe(&long_name);
+    if (strcmp(named.comm, "kd-input") ||
+        strcmp(long_name.comm, "kd-precache-wor")) {
+        printf("  [FAIL] Thread names \"%s\", \"%s\"\n", named.comm,
+               long_name.comm);
+        passed = false;
+    } else {
+        printf("  [PASS] Threads are named kd-<role>\n");
+    }
+
+    /* The pinned game thread's mask is not passed on to other roles */
+    char spec[32];
+    snprintf(spec, sizeof(spec), "game=%d", first_cpu);
+    placement_configure(spec, NULL);
+    placement_enter(THREAD_GAME, NULL);
+    probe_t writer = {.role = THREAD_WRITER};
+    probe_t game = {.role = THREAD_GAME};
+    run_probe(&writer);
+    run_probe(&game);
+    if (!CPU_EQUAL(&writer.cpus, &initial) || CPU_COUNT(&game.cpus) != 1 ||
+        !CPU_ISSET(first_cpu, &game.cpus)) {
+        printf("  [FAIL] Affinity: writer %d CPUs, game %d CPUs\n",
+               CPU_COUNT(&writer.cpus), CPU_COUNT(&game.cpus));
+        passed = false;
+    } else {
+        printf("  [PASS] Game pinned to CPU %d, unpinned roles keep %d CPUs\n",
+               first_cpu, CPU_COUNT(&initial));
+    }
+    sched_setaffinity(0, sizeof(initial), &initial);
+
+    /* Nice levels apply per thread and are reset for other roles */
+    errno = 0;
+    const int initial_nice = getpriority(PRIO_PROCESS, 0);
+    placement_configure(NULL, "writer=nice:5");
+    probe_t nice_writer = {.role = THREAD_WRITER};
+    nested = (probe_t) {.role = THREAD_INPUT};
+    pthread_t t;
+    if (pthread_create(&t, NULL, nice_parent, &nice_writer) == 0)
+        pthread_join(t, NULL);
+    const bool can_raise = geteuid() == 0;
+    if (nice_writer.nice_level != 5 ||
+        (can_raise && nested.nice_level != initial_nice)) {
+        printf("  [FAIL] Nice: writer %d, input started by it %d\n",
+               nice_writer.nice_level, nested.nice_level);
+        passed = false;
+    } else {
+        printf("  [PASS] Writer runs at nice 5, input started by it at %d\n",
+               nested.nice_level);
+    }
+
+    /* SCHED_FIFO only where permitted; otherwise the role runs as before */
+    configure_quiet(NULL, "input=fifo:10");
+    probe_t fifo = {.role = THREAD_INPUT};
+    fflush(stderr);
+    run_probe(&fifo);
+    if (fifo.policy == SCHED_FIFO)
+        printf("  [PASS] Input thread runs SCHED_FIFO\n");
+    else
+        printf("  [SKIP] SCHED_FIFO not permitted here, input stays "
+               "SCHED_OTHER\n");
+
+    placement_configure(NULL, NULL);
+    return passed;
+}
+
+/* Noise: threads streaming through a large buffer, evicting the caches */
+static atomic_bool noise_stop;
+static atomic_int noise_ready;
+
+static void *noise_thread(void *arg)
+{
+    (void) arg;
+    uint8_t *buf = malloc(NOISE_SET);
+    if (!buf)
+        return NULL;
+    memset(buf, 1, NOISE_SET);
+    atomic_fetch_add(&noise_ready, 1);
+    unsigned sum = 0;
+    while (!atomic_load_explicit(&noise_stop, memory_order_relaxed)) {
+        for (size_t i = 0; i < NOISE_SET; i += 64)
+            sum += buf[i]++;
+    }
+    free(buf);
+    return (void *) (uintptr_t) sum;
+}
+
+/* Keeps the frame work from being optimized away */
+static volatile unsigned work_sink;
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint64_t p50, p99, max;
+    int migrations;
+} latency_t;
+
+/* One tic of work over the working set, paced like the game loop */
+static latency_t run_frames(uint8_t *state)
+{
+    static uint64_t frame_ns[FRAMES];
+    latency_t result = {0};
+    int cpu = sched_getcpu();
+    unsigned sum = 0;
+
+    uint64_t next = get_time_ns();
+    for (int f = 0; f < FRAMES; f++) {
+        const uint64_t start = get_time_ns();
+        for (size_t i = 0; i < WORKING_SET; i += 64)
+            sum += state[i] ^ (uint8_t) f;
+        for (size_t i = 0; i < WORKING_SET; i += 256)
+            state[i] = (uint8_t) sum;
+        frame_ns[f] = get_time_ns() - start;
+
+        const int now_cpu = sched_getcpu();
+        result.migrations += now_cpu != cpu;
+        cpu = now_cpu;
+
+        next += FRAME_PERIOD_NS;
+        const uint64_t now = get_time_ns();
+        if (next > now) {
+            const struct timespec ts = {
+                .tv_sec = 0,
+                .tv_nsec = (long) (next - now),
+            };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    qsort(frame_ns, FRAMES, sizeof(uint64_t), cmp_u64);
+    result.p50 = frame_ns[FRAMES / 2];
+    result.p99 = frame_ns[FRAMES * 99 / 100];
+    result.max = frame_ns[FRAMES - 1];
+    work_sink = sum;
+    return result;
+}
+
+static void bench_pinning(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const int noise_count = cpus > 1 ? (int) cpus : 1;
+    uint8_t *state = malloc(WORKING_SET);
+    if (!state)
+        return;
+    memset(state, 0, WORKING_SET);
+
+    cpu_set_t initial;
+    sched_getaffinity(0, sizeof(initial), &initial);
+    int last_cpu = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &initial))
+            last_cpu = cpu;
+
+    pthread_t noise[64];
+    int started = 0;
+    atomic_store(&noise_stop, false);
+    atomic_store(&noise_ready, 0);
+    while (started < noise_count && started < 64 &&
+           pthread_create(&noise[started], NULL, noise_thread, NULL) == 0)
+        started++;
+
+    /* Measure against steady noise, not its start-up page faults */
+    while (atomic_load(&noise_ready) < started)
+        sched_yield();
+
+    printf("\n  %d frames, %.0f ms pace, %d noise threads on %ld CPUs\n",
+           FRAMES, FRAME_PERIOD_NS / 1e6, started, cpus);
+    printf("  %-10s %10s %10s %10s %11s\n", "Game", "p50 us", "p99 us",
+           "max us", "migrations");
+
+    run_frames(state); /* warm-up, so neither variant pays for it */
+    for (int pinned = 0; pinned < 2; pinned++) {
+        char spec[32];
+        snprintf(spec, sizeof(spec), "game=%d", last_cpu);
+        placement_configure(pinned ? spec : NULL, NULL);
+        placement_enter(THREAD_GAME, NULL);
+
+        const latency_t l = run_frames(state);
+        printf("  %-10s %10.1f %10.1f %10.1f %11d\n",
+               pinned ? "pinned" : "unpinned", l.p50 / 1e3, l.p99 / 1e3,
+               l.max / 1e3, l.migrations);
+        sched_setaffinity(0, sizeof(initial), &initial);
+    }
+
+    atomic_store(&noise_stop, true);
+    for (int i = 0; i < started; i++)
+        pthread_join(noise[i], NULL);
+    placement_configure(NULL, NULL);
+    free(state);
+}
+
+int main(void)
+{
+    printf("Thread Placement Tests and Benchmark\n");
+    printf("====================================\n\n");
+
+    bool passed = test_parser();
+    passed &= test_roles();
+    bench_pinning();
+
+    printf("\n%s\n", passed ? "All tests PASSED" : "Some tests FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,769 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * End-to-end renderer benchmark
+ *
+ * Drives renderer_render_frame() with a frame corpus while stdout is
+ * redirected into a pipe (or a pty pair) that is drained by a reader thread.
+ * Unlike bench-base64, this covers the full emission path: base64 encoding,
+ * escape formatting, chunking and stdio flushing.
+ *
+ * Usage: bench-render [--pty] [--frames N] [--drain-mbps N] [corpus.rgb]
+ *
+ * The optional corpus file holds raw 320x200 RGB24 frames back to back.
+ * Without it, a synthetic corpus (static, scrolling and noisy frames) is used.
+ *
+ * A second pass sends the stream to several spectator pipes through each
+ * output backend, checks that every spectator received the same bytes as
+ * through stdio (where the frame is encoded before it is emitted, not in the
+ * backend's buffer), and compares encode time, syscalls and context switches
+ * of the game thread. A reader that tees the vmsplice pipe must keep seeing
+ * each frame as it was sent.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+
+#define WIDTH 320
+#define HEIGHT 200
+#define FRAME_SIZE (WIDTH * HEIGHT * 3)
+#define CORPUS_FRAMES 64
+#define DEFAULT_ITERATIONS 300
+#define READ_BUFFER_SIZE 65536
+
+typedef enum { TRANSPORT_PIPE, TRANSPORT_PTY } transport_t;
+
+typedef struct {
+    int fd;
+    long drain_bytes_per_sec; /* 0 = drain as fast as possible */
+    _Atomic uint64_t bytes;
+    uint64_t hash; /* FNV-1a of everything read but image ids */
+    bool in_id;    /* between "i=" and the end of its value */
+    char last;
+} reader_t;
+
+typedef struct {
+    const char *transport;
+    const char *mode;
+    int frames;
+    double ns_per_frame;
+    double max_ns;
+    double syscalls_per_frame; /* < 0 when /proc accounting is unavailable */
+    double bytes_per_frame;
+} bench_result_t;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Read the write counters (syscalls and bytes) of the calling thread.
+ * /proc/thread-self/io excludes the reader thread, so only the writes issued
+ * by the renderer are counted. Returns false if task I/O accounting is missing.
+ */
+static bool read_io_counters(long *syscw, long *wchar)
+{
+    FILE *f = fopen("/proc/thread-self/io", "r");
+    if (!f)
+        return false;
+
+    char line[128];
+    int found = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "syscw: %ld", syscw) == 1 ||
+            sscanf(line, "wchar: %ld", wchar) == 1)
+            found++;
+    }
+    fclose(f);
+    return found == 2;
+}
+
+/* Drain the read end, optionally throttled to emulate a slow terminal */
+static void *reader_thread(void *arg)
+{
+    reader_t *rd = (reader_t *) arg;
+    char *buf = malloc(READ_BUFFER_SIZE);
+    if (!buf)
+        return NULL;
+
+    const uint64_t start = get_time_ns();
+    for (;;) {
+        ssize_t n = read(rd->fd, buf, READ_BUFFER_SIZE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; /* EOF (pipe) or EIO (pty slave closed) */
+
+        uint64_t total = atomic_fetch_add_explicit(&rd->bytes, (uint64_t) n,
+                                                   memory_order_relaxed) +
+                         n;
+        /* Image ids are random per renderer; leave them out so streams of
+         * different renderers compare equal
+         */
+        for (ssize_t i = 0; i < n; i++) {
+            const char c = buf[i];
+            if (rd->in_id)
+                rd->in_id = c != ',' && c != ';';
+            else
+                rd->in_id = rd->last == 'i' && c == '=';
+            rd->last = c;
+            if (!rd->in_id)
+                rd->hash = (rd->hash ^ (uint8_t) c) * 0x100000001b3ULL;
+        }
+
+        if (rd->drain_bytes_per_sec > 0) {
+            /* Sleep until the cumulative byte count matches the drain rate */
+            uint64_t due = start + total * 1000000000ULL /
+                                       (uint64_t) rd->drain_bytes_per_sec;
+            uint64_t now = get_time_ns();
+            if (due > now) {
+                struct timespec ts = {
+                    .tv_sec = (due - now) / 1000000000ULL,
+                    .tv_nsec = (due - now) % 1000000000ULL,
+                };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/* Open the transport. Returns the write end in *wfd and read end in *rfd. */
+static bool open_transport(transport_t transport, int *wfd, int *rfd)
+{
+    if (transport == TRANSPORT_PIPE) {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return false;
+        *rfd = fds[0];
+        *wfd = fds[1];
+        return true;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0)
+        return false;
+    if (grantpt(master) != 0 || unlockpt(master) != 0) {
+        close(master);
+        return false;
+    }
+
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        close(master);
+        return false;
+    }
+
+    /* Raw mode so the line discipline does not rewrite the byte stream */
+    struct termios tio;
+    if (tcgetattr(slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    *rfd = master;
+    *wfd = slave;
+    return true;
+}
+
+static void make_corpus(uint8_t *corpus)
+{
+    for (int f = 0; f < CORPUS_FRAMES; f++) {
+        uint8_t *frame = corpus + (size_t) f * FRAME_SIZE;
+
+        if (f % 4 == 0) {
+            /* Static frame: flat menu-like background */
+            memset(frame, 0x40, FRAME_SIZE);
+        } else if (f % 4 == 3) {
+            /* Noise: worst case for any later compression */
+            for (size_t i = 0; i < FRAME_SIZE; i++)
+                frame[i] = (uint8_t) rand();
+        } else {
+            /* Scrolling gradient: typical turning motion */
+            for (int y = 0; y < HEIGHT; y++) {
+                for (int x = 0; x < WIDTH; x++) {
+                    uint8_t *p = frame + (y * WIDTH + x) * 3;
+                    p[0] = (uint8_t) (x + f * 4);
+                    p[1] = (uint8_t) (y + f * 2);
+                    p[2] = (uint8_t) ((x ^ y) + f);
+                }
+            }
+        }
+    }
+}
+
+static int load_corpus(const char *path, uint8_t **corpus)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+
+    int count = 0;
+    uint8_t *buf = NULL;
+    for (;;) {
+        uint8_t *grown = realloc(buf, (size_t) (count + 1) * FRAME_SIZE);
+        if (!grown)
+            break;
+        buf = grown;
+        if (fread(buf + (size_t) count * FRAME_SIZE, 1, FRAME_SIZE, f) !=
+            FRAME_SIZE)
+            break;
+        count++;
+    }
+    fclose(f);
+
+    if (count == 0) {
+        free(buf);
+        return 0;
+    }
+    *corpus = buf;
+    return count;
+}
+
+static bool bench_render(transport_t transport,
+                         bool animation,
+                         const uint8_t *corpus,
+                         int corpus_frames,
+                         int iterations,
+                         long drain_bytes_per_sec,
+                         bench_result_t *result)
+{
+    int wfd, rfd;
+    if (!open_transport(transport, &wfd, &rfd))
+        return false;
+
+    /* The renderer picks its mode from TERM */
+    setenv("TERM", animation ? "xterm-kitty" : "xterm-256color", 1);
+    unsetenv("TERM_PROGRAM");
+
+    reader_t rd = {.fd = rfd, .drain_bytes_per_sec = drain_bytes_per_sec};
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reader_thread, &rd) != 0) {
+        close(wfd);
+        close(rfd);
+        return false;
+    }
+
+    /* Point stdout at the transport */
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(wfd, STDOUT_FILENO);
+
+    renderer_t *r = renderer_create(24, 80);
+    if (!r) {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(wfd);
+        pthread_join(thread, NULL);
+        close(rfd);
+        return false;
+    }
+
+    /* Frame 0 creates the image; measure the steady state only */
+    renderer_render_frame(r, corpus);
+    long syscw_before = 0, wchar_before = 0;
+    const bool have_io = read_io_counters(&syscw_before, &wchar_before);
+
+    uint64_t total_ns = 0, max_ns = 0;
+    for (int i = 1; i <= iterations; i++) {
+        const uint8_t *frame = corpus + (size_t) (i % corpus_frames) * FRAME_SIZE;
+
+        uint64_t start = get_time_ns();
+        renderer_render_frame(r, frame);
+        uint64_t elapsed = get_time_ns() - start;
+
+        total_ns += elapsed;
+        if (elapsed > max_ns)
+            max_ns = elapsed;
+    }
+
+    long syscw_after = 0, wchar_after = 0;
+    read_io_counters(&syscw_after, &wchar_after);
+
+    /* Wait until the reader has seen everything that was written */
+    fflush(stdout);
+    renderer_destroy(r);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(wfd);
+    pthread_join(thread, NULL);
+    close(rfd);
+
+    /* Without I/O accounting, fall back to what the reader received. That
+     * also counts frame 0 and the teardown sequences, so it is approximate.
+     */
+    const double bytes = have_io ? (double) (wchar_after - wchar_before)
+                                 : (double) atomic_load(&rd.bytes);
+
+    *result = (bench_result_t) {
+        .transport = transport == TRANSPORT_PIPE ? "pipe" : "pty",
+        .mode = animation ? "animation (a=f)" : "compat (a=T)",
+        .frames = iterations,
+        .ns_per_frame = (double) total_ns / iterations,
+        .max_ns = (double) max_ns,
+        .syscalls_per_frame =
+            have_io ? (double) (syscw_after - syscw_before) / iterations : -1.0,
+        .bytes_per_frame = bytes / iterations,
+    };
+    return true;
+}
+
+#define FANOUT_MAX 8
+#define FANOUT_FRAMES 100
+#define FANOUT_PACE_NS 4000000 /* gap between frames, as the game sleeps */
+
+typedef struct {
+    const char *backend;
+    int spectators;
+    double ns_per_frame;
+    double encode_ns_per_frame;
+    double syscalls_per_frame;
+    double switches_per_frame;
+    bool identical;
+    uint64_t hash; /* of the stream, as the first spectator read it */
+} fanout_result_t;
+
+static long context_switches(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0)
+        return 0;
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+/* Gifted pages are shared with whatever the reader tee()s or splice()s them
+ * into; a later frame must not show up in such a copy. Returns -1 when the
+ * vmsplice backend is not available.
+ */
+static int check_vmsplice_tee(void)
+{
+    const size_t size = 64 * 1024;
+    int pipe_fds[2], copy_fds[2];
+    if (pipe(pipe_fds) != 0)
+        return -1;
+    if (pipe(copy_fds) != 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    output_t *out = output_create("vmsplice", &pipe_fds[1], 1);
+    int result = -1;
+    char *buf = malloc(size);
+    if (out && buf) {
+        /* Frame 'A', teed aside and then consumed by the reader */
+        size_t capacity;
+        memset(output_frame_begin(out, &capacity), 'A', size);
+        output_frame_submit(out, size);
+        const ssize_t teed = tee(pipe_fds[0], copy_fds[1], size, 0);
+        size_t got = 0;
+        while (got < size) {
+            const ssize_t n = read(pipe_fds[0], buf, size - got);
+            if (n <= 0)
+                break;
+            got += (size_t) n;
+        }
+
+        /* Every buffer gets a new frame */
+        for (int i = 0; i < 4; i++) {
+            memset(output_frame_begin(out, &capacity), 'B', size);
+            output_frame_submit(out, size);
+            while (got < size * (size_t) (i + 2)) {
+                const ssize_t n = read(pipe_fds[0], buf, size);
+                if (n <= 0)
+                    break;
+                got += (size_t) n;
+            }
+        }
+
+        const ssize_t n = teed > 0 ? read(copy_fds[0], buf, (size_t) teed) : 0;
+        result = n > 0 && !memchr(buf, 'B', (size_t) n);
+    }
+    output_destroy(out);
+    free(buf);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(copy_fds[0]);
+    close(copy_fds[1]);
+    return result;
+}
+
+/* Render the corpus once to every spectator pipe through one backend, or
+ * "stdio" to a single pipe through stdout
+ */
+static bool bench_fanout(const char *backend,
+                         int spectators,
+                         const uint8_t *corpus,
+                         int corpus_frames,
+                         int iterations,
+                         fanout_result_t *result)
+{
+    reader_t readers[FANOUT_MAX];
+    pthread_t threads[FANOUT_MAX];
+    int fds[FANOUT_MAX];
+    int started = 0;
+    bool ok = true;
+
+    for (; started < spectators; started++) {
+        int p[2];
+        if (pipe(p) != 0) {
+            ok = false;
+            break;
+        }
+        readers[started] = (reader_t) {
+            .fd = p[0],
+            .hash = 0xcbf29ce484222325ULL,
+        };
+        fds[started] = p[1];
+        if (pthread_create(&threads[started], NULL, reader_thread,
+                           &readers[started]) != 0) {
+            close(p[0]);
+            close(p[1]);
+            ok = false;
+            break;
+        }
+    }
+
+    const bool stdio = !strcmp(backend, "stdio");
+    output_t *out =
+        ok && !stdio ? output_create(backend, fds, spectators) : NULL;
+    renderer_t *r = NULL;
+    int saved_stdout = -1;
+    if (ok && stdio) {
+        setenv("TERM", "xterm-kitty", 1);
+        fflush(stdout);
+        saved_stdout = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        r = renderer_create(24, 80);
+        fflush(stdout);
+        dup2(fds[0], STDOUT_FILENO);
+        close(devnull);
+    } else if (out) {
+        /* Setup sequences from renderer_create() are not part of the run */
+        setenv("TERM", "xterm-kitty", 1);
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        r = renderer_create(24, 80);
+        renderer_set_output(r, out);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    if (r) {
+        renderer_render_frame(r, corpus);
+        const output_stats_t before = output_get_stats(out);
+        const renderer_stats_t stats_before = renderer_get_stats(r);
+        const long switches_before = context_switches();
+
+        uint64_t total_ns = 0;
+        const struct timespec pace = {.tv_nsec = FANOUT_PACE_NS};
+        for (int i = 1; i <= iterations; i++) {
+            const uint8_t *frame =
+                corpus + (size_t) (i % corpus_frames) * FRAME_SIZE;
+            const uint64_t start = get_time_ns();
+            renderer_render_frame(r, frame);
+            total_ns += get_time_ns() - start;
+            nanosleep(&pace, NULL);
+        }
+
+        const long switches = context_switches() - switches_before;
+        const output_stats_t after = output_get_stats(out);
+        const renderer_stats_t stats = renderer_get_stats(r);
+        *result = (fanout_result_t) {
+            .backend = backend,
+            .spectators = spectators,
+            .ns_per_frame = (double) total_ns / iterations,
+            .encode_ns_per_frame =
+                (double) (stats.encode_ns - stats_before.encode_ns) /
+                iterations,
+            /* stdio writes are not counted by the renderer */
+            .syscalls_per_frame =
+                stdio ? -1
+                      : (double) (after.syscalls - before.syscalls) /
+                            iterations,
+            /* Minus the one voluntary switch of each pacing sleep */
+            .switches_per_frame = (double) switches / iterations - 1.0,
+        };
+
+        /* Drain without the teardown sequences, which only go to stdout */
+        if (out) {
+            output_drain(out);
+        } else {
+            fflush(stdout);
+            dup2(saved_stdout, STDOUT_FILENO);
+        }
+    } else {
+        if (saved_stdout >= 0) {
+            dup2(saved_stdout, STDOUT_FILENO);
+            close(saved_stdout);
+        }
+        ok = false;
+    }
+
+    for (int i = 0; i < started; i++)
+        close(fds[i]);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        close(readers[i].fd);
+    }
+
+    if (ok) {
+        result->hash = readers[0].hash;
+        result->identical = !out || output_get_stats(out).sinks_lost == 0;
+        for (int i = 1; i < spectators; i++) {
+            result->identical &= readers[i].hash == readers[0].hash &&
+                                 atomic_load(&readers[i].bytes) ==
+                                     atomic_load(&readers[0].bytes);
+        }
+    }
+
+    if (r) {
+        /* The pipes are gone; send the teardown sequences nowhere */
+        renderer_set_output(r, NULL);
+        fflush(stdout);
+        if (saved_stdout < 0)
+            saved_stdout = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+    output_destroy(out);
+    return ok;
+}
+
+/* Degrade ladder of the fair-share supervisor: cost per game frame of each
+ * setting, relative to full output, with the renderer writing to /dev/null
+ */
+static void bench_degrade(const uint8_t *corpus, int corpus_frames)
+{
+    static const struct {
+        const char *name;
+        degrade_t degrade;
+    } ladder[] = {
+        {"full", {1, 1, false}},      {"zlib", {1, 1, true}},
+        {"half", {1, 2, false}},      {"half+zlib", {1, 2, true}},
+        {"half /2", {2, 2, false}},   {"half+zlib /2", {2, 2, true}},
+        {"half /3", {3, 2, false}},   {"half+zlib /3", {3, 2, true}},
+    };
+    const int frames = corpus_frames * 4;
+
+    setenv("TERM", "xterm-kitty", 1);
+    fflush(stdout);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    const int devnull = open("/dev/null", O_WRONLY);
+    double base_ns = 0, base_bytes = 0;
+    double ns[16], bytes[16];
+    const size_t count = sizeof(ladder) / sizeof(ladder[0]);
+
+    for (size_t l = 0; l < count; l++) {
+        dup2(devnull, STDOUT_FILENO);
+        renderer_t *r = renderer_create(24, 80);
+        if (r) {
+            renderer_set_degrade(r, &ladder[l].degrade);
+            for (int f = 0; f < frames; f++)
+                renderer_render_frame(
+                    r, corpus + (size_t) (f % corpus_frames) * FRAME_SIZE);
+            const renderer_stats_t s = renderer_get_stats(r);
+            ns[l] = (double) s.encode_ns / frames;
+            bytes[l] = (double) s.bytes / frames;
+            renderer_destroy(r);
+        }
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        if (!r)
+            return;
+        if (l == 0) {
+            base_ns = ns[0];
+            base_bytes = bytes[0];
+        }
+    }
+    close(devnull);
+    close(saved_stdout);
+
+    printf("\n=== Degrade Ladder (%d frames, per game frame) ===\n", frames);
+    printf("  %-14s %10s %8s %10s %8s\n", "Setting", "encode us", "x full",
+           "KB", "x full");
+    for (size_t l = 0; l < count; l++) {
+        printf("  %-14s %10.1f %8.2f %10.1f %8.3f\n", ladder[l].name,
+               ns[l] / 1000.0, ns[l] / base_ns, bytes[l] / 1024.0,
+               bytes[l] / base_bytes);
+    }
+}
+
+static void print_res(const bench_result_t *r)
+{
+    printf("  %-5s %-16s %8.1f us/frame (max %8.1f us)  ", r->transport,
+           r->mode, r->ns_per_frame / 1000.0, r->max_ns / 1000.0);
+    if (r->syscalls_per_frame >= 0)
+        printf("%6.1f syscalls/frame  ", r->syscalls_per_frame);
+    else
+        printf("   n/a syscalls/frame  ");
+    printf("%9.0f bytes/frame\n", r->bytes_per_frame);
+}
+
+int main(int argc, char **argv)
+{
+    bool use_pty = false;
+    int iterations = DEFAULT_ITERATIONS;
+    long drain_mbps = 0;
+    const char *corpus_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--pty")) {
+            use_pty = true;
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--drain-mbps") && i + 1 < argc) {
+            drain_mbps = atol(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            corpus_path = argv[i];
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--pty] [--frames N] [--drain-mbps N] "
+                    "[corpus.rgb]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0)
+        iterations = DEFAULT_ITERATIONS;
+
+    srand(42);
+
+    uint8_t *corpus = NULL;
+    int corpus_frames = 0;
+    if (corpus_path) {
+        corpus_frames = load_corpus(corpus_path, &corpus);
+        if (corpus_frames == 0) {
+            fprintf(stderr, "Failed to load corpus from %s\n", corpus_path);
+            return 1;
+        }
+    } else {
+        corpus = malloc((size_t) CORPUS_FRAMES * FRAME_SIZE);
+        if (!corpus) {
+            fprintf(stderr, "Failed to allocate frame corpus\n");
+            return 1;
+        }
+        make_corpus(corpus);
+        corpus_frames = CORPUS_FRAMES;
+    }
+
+    bench_result_t results[4];
+    int result_count = 0;
+
+    const transport_t transports[] = {TRANSPORT_PIPE, TRANSPORT_PTY};
+    const int transport_count = use_pty ? 2 : 1;
+
+    for (int t = 0; t < transport_count; t++) {
+        for (int mode = 0; mode < 2; mode++) {
+            bool animation = mode == 0;
+            if (!bench_render(transports[t], animation, corpus, corpus_frames,
+                              iterations, drain_mbps * 1000000L,
+                              &results[result_count])) {
+                fprintf(stderr, "Failed to set up %s transport\n",
+                        transports[t] == TRANSPORT_PIPE ? "pipe" : "pty");
+                free(corpus);
+                return 1;
+            }
+            result_count++;
+        }
+    }
+
+    printf("=== Renderer End-to-End Benchmark ===\n");
+    printf("Frame size: %dx%d RGB24, corpus: %d frames (%s), %d frames/run\n",
+           WIDTH, HEIGHT, corpus_frames, corpus_path ? corpus_path : "synthetic",
+           iterations);
+    if (drain_mbps > 0)
+        printf("Reader drain rate: %ld MB/s\n", drain_mbps);
+    else
+        printf("Reader drain rate: unthrottled\n");
+    printf("\n");
+
+    for (int i = 0; i < result_count; i++)
+        print_res(&results[i]);
+
+    /* Frame time budget (35 FPS = 28.57 ms/frame) */
+    printf("\nFrame time budget (35 FPS = 28.57 ms/frame):\n");
+    for (int i = 0; i < result_count; i++) {
+        printf("  %-5s %-16s %.2f%% of frame time\n", results[i].transport,
+               results[i].mode,
+               results[i].ns_per_frame / 1000000.0 / 28.57 * 100.0);
+    }
+
+    /* Fan-out to spectators through the output backends */
+    printf("\n=== Spectator Fan-out (animation mode, pipes, %d frames "
+           "%d ms apart) ===\n",
+           FANOUT_FRAMES, FANOUT_PACE_NS / 1000000);
+    static const char *const backends[] = {"write", "uring", "vmsplice"};
+    const size_t backend_count = sizeof(backends) / sizeof(backends[0]);
+    static const int spectator_counts[] = {1, FANOUT_MAX};
+    fanout_result_t ref;
+    bool identical = bench_fanout("stdio", 1, corpus, corpus_frames,
+                                  FANOUT_FRAMES, &ref);
+    if (identical) {
+        printf("  %-8s x1  %8.1f us/frame  %6.1f enc us/frame  "
+               "   n/a syscalls/frame  %6.2f switches/frame\n",
+               ref.backend, ref.ns_per_frame / 1000.0,
+               ref.encode_ns_per_frame / 1000.0, ref.switches_per_frame);
+    }
+    for (size_t n = 0; n < 2; n++) {
+        for (size_t b = 0; b < backend_count; b++) {
+            fanout_result_t fr;
+            if (!bench_fanout(backends[b], spectator_counts[n], corpus,
+                              corpus_frames, FANOUT_FRAMES, &fr)) {
+                printf("  %-8s backend unavailable, skipped\n", backends[b]);
+                continue;
+            }
+            /* Encoded in the backend's buffer, byte for byte as via stdio */
+            fr.identical &= fr.hash == ref.hash;
+            printf("  %-8s x%d  %8.1f us/frame  %6.1f enc us/frame  "
+                   "%6.1f syscalls/frame  %6.2f switches/frame  %s\n",
+                   fr.backend, fr.spectators, fr.ns_per_frame / 1000.0,
+                   fr.encode_ns_per_frame / 1000.0, fr.syscalls_per_frame,
+                   fr.switches_per_frame,
+                   fr.identical ? "[PASS] same stream as stdio"
+                                : "[FAIL] streams differ");
+            identical &= fr.identical;
+        }
+    }
+
+    const int teed = check_vmsplice_tee();
+    if (teed >= 0) {
+        printf("  %s vmsplice frames stay intact in a tee'd copy\n",
+               teed ? "[PASS]" : "[FAIL]");
+        identical &= teed;
+    }
+
+    bench_degrade(corpus, corpus_frames);
+
+    free(corpus);
+    return identical ? 0 : 1;
+}
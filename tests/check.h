@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Test result reporting
+ *
+ * Shared by the unit tests so every one prints the same PASS/FAIL lines and
+ * the same closing verdict. A test accumulates the results of check() calls
+ * and returns check_summary() from main().
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Print one named result and pass the condition through */
+static inline bool check(bool cond, const char *name)
+{
+    printf("  [%s] %s\n", cond ? "PASS" : "FAIL", name);
+    return cond;
+}
+
+/* Print the verdict; returns the process exit status */
+static inline int check_summary(bool ok)
+{
+    printf("\n%s\n", ok ? "All tests PASSED" : "Some tests FAILED");
+    return ok ? 0 : 1;
+}
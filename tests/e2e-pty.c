@@ -0,0 +1,430 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Pseudo-terminal end-to-end harness
+ *
+ * Spawns kitty-doom on a pty pair and plays the terminal with the mock Kitty
+ * terminal: it answers the graphics probe, DA1, cell size and cursor queries,
+ * decodes every displayed frame and injects scripted keys. It reports:
+ *   - time to first frame (spawn to first displayed image)
+ *   - sustained frame rate and output bytes per second
+ *   - keypress-to-frame latency (key written to first changed frame)
+ *
+ * Usage: e2e-pty [options] [kitty-doom-path] [-- game args]
+ *   --term NAME     TERM for the child (default xterm-kitty; other values
+ *                   make kitty-doom probe the terminal)
+ *   --duration S    Seconds to run after the first frame (default 10)
+ *   --script FILE   Key script, one "<ms after first frame> <key>" per line
+ *   --no-acks       Do not send graphics acknowledgements
+ *   --rows N --cols N
+ *
+ * Keys: up, down, left, right, enter, esc, space, tab or a single character.
+ * Without -- game args, the game is started with "-warp 1 1" and the default
+ * script turns right every 500 ms, which changes the view on every press.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock-kitty.h"
+
+#define MAX_KEYS 256
+#define MAX_ARGS 64
+
+typedef struct {
+    uint64_t at_ms; /* Relative to the first frame */
+    char seq[8];    /* VT sequence to inject */
+    char name[16];
+} script_key_t;
+
+typedef struct {
+    int master;
+    mock_kitty_t *mk;
+
+    uint64_t spawn_ns;
+    uint64_t first_frame_ns;
+    uint64_t last_frame_ns;
+    uint64_t frames;
+    uint64_t frame_hash;
+
+    /* Pending keypress waiting for a changed frame */
+    bool key_pending;
+    uint64_t key_ns;
+    uint64_t key_hash;
+    double latencies_ms[MAX_KEYS];
+    int latency_count;
+    int missed_keys;
+} harness_t;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t hash_frame(const mock_kitty_frame_t *frame)
+{
+    /* FNV-1a over 64-bit words; enough to tell frames apart */
+    const uint64_t *p = (const uint64_t *) frame->rgba;
+    const size_t words = (size_t) frame->width * frame->height * 4 / 8;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < words; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= (size_t) n;
+    }
+}
+
+static void on_reply(void *ctx, const char *data, size_t len)
+{
+    write_all(((harness_t *) ctx)->master, data, len);
+}
+
+static void on_display(void *ctx, const mock_kitty_frame_t *frame)
+{
+    harness_t *h = (harness_t *) ctx;
+    const uint64_t now = get_time_ns();
+
+    if (h->frames == 0)
+        h->first_frame_ns = now;
+    h->last_frame_ns = now;
+    h->frames++;
+    h->frame_hash = hash_frame(frame);
+
+    if (h->key_pending && h->frame_hash != h->key_hash) {
+        if (h->latency_count < MAX_KEYS)
+            h->latencies_ms[h->latency_count++] = (now - h->key_ns) / 1e6;
+        h->key_pending = false;
+    }
+}
+
+static bool parse_key(const char *name, script_key_t *key)
+{
+    static const struct {
+        const char *name;
+        const char *seq;
+    } named[] = {
+        {"up", "\033[A"},   {"down", "\033[B"}, {"right", "\033[C"},
+        {"left", "\033[D"}, {"enter", "\r"},    {"esc", "\033"},
+        {"space", " "},     {"tab", "\t"},
+    };
+
+    snprintf(key->name, sizeof(key->name), "%s", name);
+    for (size_t i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+        if (!strcmp(name, named[i].name)) {
+            snprintf(key->seq, sizeof(key->seq), "%s", named[i].seq);
+            return true;
+        }
+    }
+    if (strlen(name) == 1) {
+        key->seq[0] = name[0];
+        key->seq[1] = '\0';
+        return true;
+    }
+    return false;
+}
+
+static int load_script(const char *path, script_key_t *keys)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    int count = 0;
+    char line[128], name[32];
+    unsigned long long at;
+    while (count < MAX_KEYS && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%llu %31s", &at, name) != 2)
+            continue;
+        if (!parse_key(name, &keys[count])) {
+            fprintf(stderr, "Unknown key '%s' in %s\n", name, path);
+            continue;
+        }
+        keys[count++].at_ms = at;
+    }
+    fclose(f);
+    return count;
+}
+
+static pid_t spawn_on_pty(const char *path,
+                          char **args,
+                          const char *term,
+                          int rows,
+                          int cols,
+                          int *master_out)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        return -1;
+
+    struct winsize ws = {
+        .ws_row = rows,
+        .ws_col = cols,
+        .ws_xpixel = cols * 10,
+        .ws_ypixel = rows * 20,
+    };
+    ioctl(master, TIOCSWINSZ, &ws);
+
+    const char *slave_name = ptsname(master);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(master);
+        return -1;
+    }
+
+    if (pid == 0) {
+        setsid();
+        int slave = open(slave_name, O_RDWR);
+        if (slave < 0)
+            _exit(127);
+        ioctl(slave, TIOCSCTTY, 0);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        if (slave > STDERR_FILENO)
+            close(slave);
+        close(master);
+
+        setenv("TERM", term, 1);
+        unsetenv("TERM_PROGRAM");
+        execv(path, args);
+        _exit(127);
+    }
+
+    *master_out = master;
+    return pid;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "build/kitty-doom";
+    const char *term = "xterm-kitty";
+    const char *script_path = NULL;
+    double duration_s = 10.0;
+    bool acks = true;
+    int rows = 24, cols = 80;
+    char *game_args[MAX_ARGS] = {NULL};
+    int game_argc = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--")) {
+            for (i++; i < argc && game_argc < MAX_ARGS - 2; i++)
+                game_args[1 + game_argc++] = argv[i];
+            break;
+        } else if (!strcmp(argv[i], "--term") && i + 1 < argc) {
+            term = argv[++i];
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            duration_s = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--script") && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (!strcmp(argv[i], "--no-acks")) {
+            acks = false;
+        } else if (!strcmp(argv[i], "--rows") && i + 1 < argc) {
+            rows = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cols") && i + 1 < argc) {
+            cols = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--term NAME] [--duration S] [--script FILE] "
+                    "[--no-acks] [--rows N] [--cols N] [kitty-doom] "
+                    "[-- game args]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (game_argc == 0) {
+        static char *default_args[] = {"-warp", "1", "1"};
+        for (int i = 0; i < 3; i++)
+            game_args[1 + game_argc++] = default_args[i];
+    }
+    game_args[0] = (char *) path;
+
+    static script_key_t keys[MAX_KEYS];
+    int key_count;
+    if (script_path) {
+        key_count = load_script(script_path, keys);
+        if (key_count < 0) {
+            fprintf(stderr, "Cannot read script %s\n", script_path);
+            return 1;
+        }
+    } else {
+        key_count = 0;
+        for (uint64_t at = 2000; at + 500 < duration_s * 1000 && key_count < 16;
+             at += 500) {
+            parse_key("right", &keys[key_count]);
+            keys[key_count++].at_ms = at;
+        }
+    }
+
+    harness_t h = {0};
+    mock_kitty_config_t cfg = {
+        .rows = rows,
+        .cols = cols,
+        .answer_queries = true,
+        .send_acks = acks,
+        .reply = on_reply,
+        .display = on_display,
+        .ctx = &h,
+    };
+    h.mk = mock_kitty_create(&cfg);
+    if (!h.mk) {
+        fprintf(stderr, "Failed to create mock terminal\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    h.spawn_ns = get_time_ns();
+    pid_t pid = spawn_on_pty(path, game_args, term, rows, cols, &h.master);
+    if (pid < 0) {
+        fprintf(stderr, "Failed to spawn %s on a pty\n", path);
+        return 1;
+    }
+
+    static char buf[1 << 16];
+    int next_key = 0;
+    bool child_exited = false;
+    const uint64_t startup_timeout_ns = 30ULL * 1000000000ULL;
+
+    for (;;) {
+        const uint64_t now = get_time_ns();
+        int timeout_ms = 100;
+
+        if (h.frames == 0) {
+            if (now - h.spawn_ns > startup_timeout_ns)
+                break;
+        } else {
+            const uint64_t elapsed_ms = (now - h.first_frame_ns) / 1000000;
+            if (elapsed_ms >= duration_s * 1000)
+                break;
+
+            /* Inject keys that are due */
+            while (next_key < key_count && keys[next_key].at_ms <= elapsed_ms) {
+                if (h.key_pending)
+                    h.missed_keys++;
+                h.key_pending = true;
+                h.key_ns = get_time_ns();
+                h.key_hash = h.frame_hash;
+                write_all(h.master, keys[next_key].seq,
+                          strlen(keys[next_key].seq));
+                next_key++;
+            }
+            if (next_key < key_count) {
+                uint64_t wait = keys[next_key].at_ms - elapsed_ms;
+                if (wait < (uint64_t) timeout_ms)
+                    timeout_ms = (int) wait;
+            }
+        }
+
+        struct pollfd pfd = {.fd = h.master, .events = POLLIN};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (ready > 0) {
+            ssize_t n = read(h.master, buf, sizeof(buf));
+            if (n <= 0) {
+                child_exited = true; /* EIO once the child closes the pty */
+                break;
+            }
+            mock_kitty_feed(h.mk, buf, (size_t) n);
+        }
+    }
+    if (h.key_pending)
+        h.missed_keys++;
+
+    const uint64_t end_ns = get_time_ns();
+    const mock_kitty_stats_t *s = mock_kitty_get_stats(h.mk);
+
+    /* Ask the game to stop, then reap it */
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 50; i++) {
+        /* Keep draining so the child never blocks on a full pty */
+        struct pollfd pfd = {.fd = h.master, .events = POLLIN};
+        if (poll(&pfd, 1, 20) > 0 && read(h.master, buf, sizeof(buf)) <= 0)
+            break;
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            pid = -1;
+            break;
+        }
+    }
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    close(h.master);
+
+    printf("=== kitty-doom PTY End-to-End ===\n");
+    printf("Binary: %s (TERM=%s, %dx%d cells, acks %s)\n", path, term, cols,
+           rows, acks ? "on" : "off");
+
+    if (h.frames == 0) {
+        printf("No frame displayed%s\n",
+               child_exited ? " (child exited)" : " within 30 s");
+        mock_kitty_destroy(h.mk);
+        return 1;
+    }
+
+    const double run_s = (end_ns - h.first_frame_ns) / 1e9;
+    printf("Time to first frame: %.1f ms\n",
+           (h.first_frame_ns - h.spawn_ns) / 1e6);
+    printf("Sustained rate:      %.1f frames/sec (%llu frames in %.1f s)\n",
+           h.frames > 1 ? (h.frames - 1) /
+                              ((h.last_frame_ns - h.first_frame_ns) / 1e9)
+                        : 0.0,
+           (unsigned long long) h.frames, run_s);
+    printf("Throughput:          %.2f MB/s (%llu bytes total)\n",
+           s->bytes / ((end_ns - h.spawn_ns) / 1e9) / (1024.0 * 1024.0),
+           (unsigned long long) s->bytes);
+    printf("Queries answered:    %llu, graphics replies: %llu, errors: %llu\n",
+           (unsigned long long) s->queries,
+           (unsigned long long) (s->replies - s->queries),
+           (unsigned long long) s->errors);
+
+    if (h.latency_count > 0) {
+        qsort(h.latencies_ms, h.latency_count, sizeof(double), cmp_double);
+        const int p95 = (h.latency_count * 95 + 99) / 100 - 1;
+        printf("Key-to-frame latency (%d keys, %d without visible change):\n",
+               h.latency_count, h.missed_keys);
+        printf("  min %.1f ms, median %.1f ms, p95 %.1f ms, max %.1f ms\n",
+               h.latencies_ms[0], h.latencies_ms[h.latency_count / 2],
+               h.latencies_ms[p95], h.latencies_ms[h.latency_count - 1]);
+    } else if (key_count > 0) {
+        printf("Key-to-frame latency: no key produced a visible change\n");
+    }
+
+    mock_kitty_destroy(h.mk);
+    return child_exited && run_s < duration_s ? 1 : 0;
+}
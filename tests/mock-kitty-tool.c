@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * mock-kitty: replay a captured terminal stream through the mock terminal
+ *
+ * Usage: mock-kitty [-o frame.ppm] [capture-file]
+ *
+ * Reads the byte stream from the file (or stdin), decodes it as a Kitty
+ * terminal would and reports protocol statistics and decode speed. With -o,
+ * the last displayed frame is written as a binary PPM.
+ *
+ * Example:
+ *   TERM=xterm-kitty ./build/kitty-doom > capture.bin
+ *   ./build/tests/mock-kitty -o last.ppm capture.bin
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mock-kitty.h"
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static bool write_ppm(const char *path, const mock_kitty_frame_t *frame)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    fprintf(f, "P6\n%d %d\n255\n", frame->width, frame->height);
+    for (int i = 0; i < frame->width * frame->height; i++)
+        fwrite(frame->rgba + i * 4, 1, 3, f);
+    return fclose(f) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ppm_path = NULL;
+    const char *input_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            ppm_path = argv[++i];
+        } else if (argv[i][0] != '-' || !strcmp(argv[i], "-")) {
+            input_path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-o frame.ppm] [capture-file]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *in = stdin;
+    if (input_path && strcmp(input_path, "-")) {
+        in = fopen(input_path, "rb");
+        if (!in) {
+            fprintf(stderr, "Cannot open %s\n", input_path);
+            return 1;
+        }
+    }
+
+    mock_kitty_t *mk = mock_kitty_create(NULL);
+    if (!mk) {
+        fprintf(stderr, "Failed to create mock terminal\n");
+        return 1;
+    }
+
+    static uint8_t buf[1 << 16];
+    uint64_t decode_ns = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        uint64_t start = get_time_ns();
+        mock_kitty_feed(mk, buf, n);
+        decode_ns += get_time_ns() - start;
+    }
+    if (in != stdin)
+        fclose(in);
+
+    const mock_kitty_stats_t *s = mock_kitty_get_stats(mk);
+    printf("Bytes:             %llu\n", (unsigned long long) s->bytes);
+    printf("Graphics commands: %llu (%llu payload chunks)\n",
+           (unsigned long long) s->commands, (unsigned long long) s->chunks);
+    printf("Transmissions:     %llu\n", (unsigned long long) s->transmissions);
+    printf("Frames displayed:  %llu\n",
+           (unsigned long long) s->frames_displayed);
+    printf("Images held:       %d\n", mock_kitty_image_count(mk));
+    if (s->errors)
+        printf("Errors:            %llu (last: %s)\n",
+               (unsigned long long) s->errors, s->last_error);
+    else
+        printf("Errors:            0\n");
+    if (decode_ns > 0 && s->frames_displayed > 0) {
+        printf("Decode:            %.1f frames/sec, %.1f MB/s\n",
+               s->frames_displayed * 1e9 / (double) decode_ns,
+               s->bytes / (decode_ns / 1e9) / (1024.0 * 1024.0));
+    }
+
+    int status = 0;
+    if (ppm_path) {
+        mock_kitty_frame_t frame;
+        if (!mock_kitty_get_frame(mk, &frame)) {
+            fprintf(stderr, "No frame is displayed at end of stream\n");
+            status = 1;
+        } else if (!write_ppm(ppm_path, &frame)) {
+            fprintf(stderr, "Cannot write %s\n", ppm_path);
+            status = 1;
+        } else {
+            printf("Wrote %dx%d frame to %s\n", frame.width, frame.height,
+                   ppm_path);
+        }
+    }
+
+    mock_kitty_destroy(mk);
+    return status;
+}
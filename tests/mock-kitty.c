@@ -0,0 +1,1096 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mock Kitty terminal: byte-stream parser, graphics command decoder and
+ * image state. See mock-kitty.h for the supported feature set.
+ */
+
+#define _GNU_SOURCE
+
+#include "mock-kitty.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define MAX_CSI_PARMS 16
+
+typedef enum {
+    ST_GROUND,
+    ST_ESC,
+    ST_CSI,
+    ST_APC,     /* ESC _ ... */
+    ST_STRING,  /* OSC, DCS, PM, SOS: skipped until ST or BEL */
+    ST_STR_ESC, /* ESC seen inside a string, expecting '\' */
+} parse_state_t;
+
+typedef struct {
+    uint32_t id;
+    int width, height;
+    int frame_count;
+    uint8_t **frames; /* RGBA, width * height * 4 bytes each */
+    int current_frame;
+    bool placed;
+} mk_image_t;
+
+/* Parsed control data of one graphics command. Integer keys are indexed by
+ * their ASCII key character; character-valued keys (a, t, o, d) are stored
+ * as the character code.
+ */
+typedef struct {
+    int value[128];
+    bool present[128];
+} gfx_keys_t;
+
+struct mock_kitty {
+    mock_kitty_config_t cfg;
+    mock_kitty_stats_t stats;
+
+    parse_state_t state;
+    bool string_is_apc;
+
+    /* CSI parameters */
+    int parms[MAX_CSI_PARMS];
+    int parm_count;
+    int parm;
+    char parm_prefix;
+
+    /* APC body being accumulated */
+    char *apc;
+    size_t apc_len, apc_cap;
+
+    /* Chunked transmission in progress */
+    bool in_transfer;
+    gfx_keys_t transfer_keys;
+    char *payload;
+    size_t payload_len, payload_cap;
+
+    mk_image_t *images;
+    int image_count, image_cap;
+    uint32_t displayed_id;
+
+    int cursor_row, cursor_col; /* 1-based */
+};
+
+/* Growable buffers */
+
+static bool buf_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return true;
+    size_t new_cap = *cap ? *cap : 4096;
+    while (new_cap < need)
+        new_cap *= 2;
+    char *grown = realloc(*buf, new_cap);
+    if (!grown)
+        return false;
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+static void send_reply(mock_kitty_t *mk, const char *fmt, ...)
+{
+    if (!mk->cfg.reply)
+        return;
+
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n <= 0)
+        return;
+    if ((size_t) n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+
+    mk->cfg.reply(mk->cfg.ctx, buf, (size_t) n);
+    mk->stats.replies++;
+}
+
+/* Image store */
+
+static mk_image_t *find_image(mock_kitty_t *mk, uint32_t id)
+{
+    for (int i = 0; i < mk->image_count; i++) {
+        if (mk->images[i].id == id)
+            return &mk->images[i];
+    }
+    return NULL;
+}
+
+static void free_image_frames(mk_image_t *img)
+{
+    for (int f = 0; f < img->frame_count; f++)
+        free(img->frames[f]);
+    free(img->frames);
+    img->frames = NULL;
+    img->frame_count = 0;
+}
+
+static void remove_image(mock_kitty_t *mk, mk_image_t *img)
+{
+    if (mk->displayed_id == img->id)
+        mk->displayed_id = 0;
+    free_image_frames(img);
+    *img = mk->images[--mk->image_count];
+}
+
+static mk_image_t *new_image(mock_kitty_t *mk, uint32_t id)
+{
+    mk_image_t *img = find_image(mk, id);
+    if (img) {
+        free_image_frames(img);
+        img->placed = false;
+        img->current_frame = 0;
+        return img;
+    }
+
+    if (mk->image_count == mk->image_cap) {
+        int new_cap = mk->image_cap ? mk->image_cap * 2 : 8;
+        mk_image_t *grown = realloc(mk->images, new_cap * sizeof(*grown));
+        if (!grown)
+            return NULL;
+        mk->images = grown;
+        mk->image_cap = new_cap;
+    }
+
+    img = &mk->images[mk->image_count++];
+    *img = (mk_image_t) {.id = id};
+    return img;
+}
+
+static bool append_frame(mk_image_t *img, uint8_t *rgba)
+{
+    uint8_t **grown =
+        realloc(img->frames, (img->frame_count + 1) * sizeof(*grown));
+    if (!grown)
+        return false;
+    img->frames = grown;
+    img->frames[img->frame_count++] = rgba;
+    return true;
+}
+
+static void notify_display(mock_kitty_t *mk)
+{
+    mk->stats.frames_displayed++;
+    if (!mk->cfg.display)
+        return;
+
+    mock_kitty_frame_t frame;
+    if (mock_kitty_get_frame(mk, &frame))
+        mk->cfg.display(mk->cfg.ctx, &frame);
+}
+
+/* Payload decoding */
+
+static size_t base64_decode(const char *in, size_t len, uint8_t *out)
+{
+    static int8_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        const char *alphabet =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        memset(table, -1, sizeof(table));
+        for (int i = 0; i < 64; i++)
+            table[(unsigned char) alphabet[i]] = (int8_t) i;
+        table_ready = true;
+    }
+
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        int v = table[(unsigned char) in[i]];
+        if (v < 0)
+            continue; /* Padding and whitespace */
+        acc = (acc << 6) | (uint32_t) v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (uint8_t) (acc >> bits);
+        }
+    }
+    return n;
+}
+
+#ifdef HAVE_ZLIB
+/* Inflate a zlib stream into a newly allocated buffer */
+static uint8_t *inflate_all(const uint8_t *in, size_t len, size_t *out_len)
+{
+    size_t cap = len * 4 + 1024;
+    uint8_t *out = malloc(cap);
+    if (!out)
+        return NULL;
+
+    z_stream zs = {0};
+    if (inflateInit(&zs) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = (uInt) len;
+
+    int ret;
+    do {
+        if (zs.total_out == cap) {
+            uint8_t *grown = realloc(out, cap * 2);
+            if (!grown) {
+                inflateEnd(&zs);
+                free(out);
+                return NULL;
+            }
+            out = grown;
+            cap *= 2;
+        }
+        zs.next_out = out + zs.total_out;
+        zs.avail_out = (uInt) (cap - zs.total_out);
+        ret = inflate(&zs, Z_NO_FLUSH);
+    } while (ret == Z_OK);
+
+    *out_len = zs.total_out;
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static inline uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/* Decode an 8-bit, non-interlaced PNG (grey, RGB, palette or RGBA) to RGBA */
+static uint8_t *png_decode(const uint8_t *data,
+                           size_t len,
+                           int *width,
+                           int *height,
+                           const char **err)
+{
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G',
+                                         '\r', '\n', 0x1a, '\n'};
+    if (len < 8 || memcmp(data, signature, 8) != 0) {
+        *err = "EBADPNG:bad signature";
+        return NULL;
+    }
+
+    uint32_t w = 0, h = 0;
+    int color_type = -1;
+    uint8_t palette[256 * 4];
+    memset(palette, 0xff, sizeof(palette));
+    uint8_t *idat = NULL;
+    size_t idat_len = 0;
+
+    for (size_t pos = 8; pos + 12 <= len;) {
+        uint32_t chunk_len = be32(data + pos);
+        const uint8_t *type = data + pos + 4;
+        const uint8_t *body = data + pos + 8;
+        if (pos + 12 + chunk_len > len)
+            break;
+
+        if (!memcmp(type, "IHDR", 4) && chunk_len >= 13) {
+            w = be32(body);
+            h = be32(body + 4);
+            if (body[8] != 8 || body[12] != 0) {
+                *err = "EBADPNG:unsupported bit depth or interlace";
+                free(idat);
+                return NULL;
+            }
+            color_type = body[9];
+        } else if (!memcmp(type, "PLTE", 4)) {
+            for (uint32_t i = 0; i < chunk_len / 3 && i < 256; i++) {
+                palette[i * 4 + 0] = body[i * 3 + 0];
+                palette[i * 4 + 1] = body[i * 3 + 1];
+                palette[i * 4 + 2] = body[i * 3 + 2];
+            }
+        } else if (!memcmp(type, "tRNS", 4) && color_type == 3) {
+            for (uint32_t i = 0; i < chunk_len && i < 256; i++)
+                palette[i * 4 + 3] = body[i];
+        } else if (!memcmp(type, "IDAT", 4)) {
+            uint8_t *grown = realloc(idat, idat_len + chunk_len);
+            if (!grown) {
+                free(idat);
+                *err = "ENOMEM:idat";
+                return NULL;
+            }
+            idat = grown;
+            memcpy(idat + idat_len, body, chunk_len);
+            idat_len += chunk_len;
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
+        }
+        pos += 12 + chunk_len;
+    }
+
+    int channels;
+    switch (color_type) {
+    case 0:
+        channels = 1;
+        break;
+    case 2:
+        channels = 3;
+        break;
+    case 3:
+        channels = 1;
+        break;
+    case 6:
+        channels = 4;
+        break;
+    default:
+        free(idat);
+        *err = "EBADPNG:unsupported color type";
+        return NULL;
+    }
+
+    size_t raw_len = 0;
+    uint8_t *raw = idat ? inflate_all(idat, idat_len, &raw_len) : NULL;
+    free(idat);
+    const size_t stride = (size_t) w * channels;
+    if (!raw || w == 0 || h == 0 || raw_len < (stride + 1) * h) {
+        free(raw);
+        *err = "EBADPNG:truncated image data";
+        return NULL;
+    }
+
+    /* Undo per-scanline filters in place */
+    for (uint32_t y = 0; y < h; y++) {
+        uint8_t *line = raw + y * (stride + 1);
+        const uint8_t filter = line[0];
+        uint8_t *cur = line + 1;
+        const uint8_t *prev = y ? raw + (y - 1) * (stride + 1) + 1 : NULL;
+
+        for (size_t x = 0; x < stride; x++) {
+            int a = x >= (size_t) channels ? cur[x - channels] : 0;
+            int b = prev ? prev[x] : 0;
+            int c = (prev && x >= (size_t) channels) ? prev[x - channels] : 0;
+            switch (filter) {
+            case 1:
+                cur[x] += a;
+                break;
+            case 2:
+                cur[x] += b;
+                break;
+            case 3:
+                cur[x] += (a + b) / 2;
+                break;
+            case 4:
+                cur[x] += paeth(a, b, c);
+                break;
+            }
+        }
+    }
+
+    uint8_t *rgba = malloc((size_t) w * h * 4);
+    if (!rgba) {
+        free(raw);
+        *err = "ENOMEM:png";
+        return NULL;
+    }
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint8_t *src = raw + y * (stride + 1) + 1;
+        uint8_t *dst = rgba + (size_t) y * w * 4;
+        for (uint32_t x = 0; x < w; x++, dst += 4) {
+            switch (color_type) {
+            case 0:
+                dst[0] = dst[1] = dst[2] = src[x];
+                dst[3] = 0xff;
+                break;
+            case 2:
+                dst[0] = src[x * 3];
+                dst[1] = src[x * 3 + 1];
+                dst[2] = src[x * 3 + 2];
+                dst[3] = 0xff;
+                break;
+            case 3:
+                memcpy(dst, palette + src[x] * 4, 4);
+                break;
+            case 6:
+                memcpy(dst, src + x * 4, 4);
+                break;
+            }
+        }
+    }
+
+    free(raw);
+    *width = (int) w;
+    *height = (int) h;
+    return rgba;
+}
+#endif /* HAVE_ZLIB */
+
+/* Read transmission media other than direct (t=f, t=t, t=s) */
+static uint8_t *read_medium(char medium,
+                            const char *name,
+                            const gfx_keys_t *k,
+                            size_t *out_len,
+                            const char **err)
+{
+    const size_t offset = k->present['O'] ? (size_t) k->value['O'] : 0;
+    size_t size = k->present['S'] ? (size_t) k->value['S'] : 0;
+
+    int fd = medium == 's' ? shm_open(name, O_RDONLY, 0)
+                           : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *err = "EBADF:cannot open medium";
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < offset) {
+        close(fd);
+        *err = "EBADF:cannot stat medium";
+        return NULL;
+    }
+    if (size == 0 || offset + size > (size_t) st.st_size)
+        size = (size_t) st.st_size - offset;
+
+    uint8_t *data = malloc(size ? size : 1);
+    if (!data) {
+        close(fd);
+        *err = "ENOMEM:medium";
+        return NULL;
+    }
+
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, data + got, size - got, (off_t) (offset + got));
+        if (n <= 0)
+            break;
+        got += (size_t) n;
+    }
+    close(fd);
+
+    /* The terminal owns temporary media once read */
+    if (medium == 's')
+        shm_unlink(name);
+    else if (medium == 't' && strstr(name, "tty-graphics-protocol"))
+        unlink(name);
+
+    *out_len = got;
+    return data;
+}
+
+/* Turn a completed transmission into RGBA pixels.
+ * Returns NULL and sets *err on failure.
+ */
+static uint8_t *decode_pixels(mock_kitty_t *mk,
+                              const gfx_keys_t *k,
+                              int *width,
+                              int *height,
+                              const char **err)
+{
+    const int format = k->present['f'] ? k->value['f'] : 32;
+    const char medium = k->present['t'] ? (char) k->value['t'] : 'd';
+
+    uint8_t *data = malloc(mk->payload_len * 3 / 4 + 4);
+    if (!data) {
+        *err = "ENOMEM:payload";
+        return NULL;
+    }
+    size_t len = base64_decode(mk->payload, mk->payload_len, data);
+
+    if (medium != 'd') {
+        char name[512];
+        if (len >= sizeof(name)) {
+            free(data);
+            *err = "EINVAL:medium name too long";
+            return NULL;
+        }
+        memcpy(name, data, len);
+        name[len] = '\0';
+        free(data);
+        data = read_medium(medium, name, k, &len, err);
+        if (!data)
+            return NULL;
+    }
+
+    if (k->present['o'] && k->value['o'] == 'z') {
+#ifdef HAVE_ZLIB
+        size_t inflated_len;
+        uint8_t *inflated = inflate_all(data, len, &inflated_len);
+        free(data);
+        if (!inflated) {
+            *err = "EINVAL:zlib inflate failed";
+            return NULL;
+        }
+        data = inflated;
+        len = inflated_len;
+#else
+        free(data);
+        *err = "ENOTSUP:built without zlib";
+        return NULL;
+#endif
+    }
+
+    if (format == 100) {
+#ifdef HAVE_ZLIB
+        uint8_t *rgba = png_decode(data, len, width, height, err);
+        free(data);
+        if (rgba)
+            mk->stats.decoded_bytes += (uint64_t) *width * *height * 4;
+        return rgba;
+#else
+        free(data);
+        *err = "ENOTSUP:built without zlib";
+        return NULL;
+#endif
+    }
+
+    if (format != 24 && format != 32) {
+        free(data);
+        *err = "EINVAL:unknown format";
+        return NULL;
+    }
+
+    const int w = k->value['s'], h = k->value['v'];
+    const size_t bpp = format == 24 ? 3 : 4;
+    if (w <= 0 || h <= 0 || len != (size_t) w * h * bpp) {
+        free(data);
+        *err = "ENODATA:size mismatch";
+        return NULL;
+    }
+
+    uint8_t *rgba = malloc((size_t) w * h * 4);
+    if (!rgba) {
+        free(data);
+        *err = "ENOMEM:pixels";
+        return NULL;
+    }
+    if (bpp == 4) {
+        memcpy(rgba, data, len);
+    } else {
+        for (size_t i = 0; i < (size_t) w * h; i++) {
+            rgba[i * 4 + 0] = data[i * 3 + 0];
+            rgba[i * 4 + 1] = data[i * 3 + 1];
+            rgba[i * 4 + 2] = data[i * 3 + 2];
+            rgba[i * 4 + 3] = 0xff;
+        }
+    }
+    free(data);
+
+    mk->stats.decoded_bytes += (uint64_t) w * h * 4;
+    *width = w;
+    *height = h;
+    return rgba;
+}
+
+/* Graphics command handling */
+
+static void parse_keys(const char *s, size_t len, gfx_keys_t *k)
+{
+    memset(k, 0, sizeof(*k));
+    size_t i = 0;
+    while (i < len) {
+        unsigned char key = (unsigned char) s[i];
+        if (i + 1 >= len || s[i + 1] != '=' || key >= 128)
+            break;
+        i += 2;
+
+        int value = 0;
+        if (i < len && (s[i] == '-' || (s[i] >= '0' && s[i] <= '9'))) {
+            bool negative = s[i] == '-';
+            if (negative)
+                i++;
+            while (i < len && s[i] >= '0' && s[i] <= '9')
+                value = value * 10 + (s[i++] - '0');
+            if (negative)
+                value = -value;
+        } else if (i < len) {
+            value = (unsigned char) s[i++];
+        }
+        k->value[key] = value;
+        k->present[key] = true;
+
+        while (i < len && s[i] != ',')
+            i++;
+        i++; /* Skip ',' */
+    }
+}
+
+static void reply_status(mock_kitty_t *mk,
+                         const gfx_keys_t *k,
+                         const char *err)
+{
+    const int quiet = k->present['q'] ? k->value['q'] : 0;
+    if (!mk->cfg.send_acks || (!k->present['i'] && !k->present['I']))
+        return;
+    if (err ? quiet >= 2 : quiet >= 1)
+        return;
+
+    if (k->present['I'])
+        send_reply(mk, "\033_Gi=%d,I=%d;%s\033\\", k->value['i'],
+                   k->value['I'], err ? err : "OK");
+    else
+        send_reply(mk, "\033_Gi=%d;%s\033\\", k->value['i'],
+                   err ? err : "OK");
+}
+
+static void fail(mock_kitty_t *mk, const gfx_keys_t *k, const char *err)
+{
+    mk->stats.errors++;
+    snprintf(mk->stats.last_error, sizeof(mk->stats.last_error), "%s", err);
+    reply_status(mk, k, err);
+}
+
+/* a=f: compose transmitted data into an animation frame */
+static const char *edit_frame(mock_kitty_t *mk,
+                              const gfx_keys_t *k,
+                              uint8_t *rgba,
+                              int w,
+                              int h,
+                              bool *display_changed)
+{
+    mk_image_t *img = find_image(mk, (uint32_t) k->value['i']);
+    if (!img || img->frame_count == 0)
+        return "ENOENT:no such image";
+
+    const size_t frame_size = (size_t) img->width * img->height * 4;
+    int target;
+    if (k->present['r'] && k->value['r'] > 0) {
+        target = k->value['r'] - 1;
+        if (target >= img->frame_count)
+            return "ENOENT:no such frame";
+    } else {
+        /* New frame, optionally starting from a base frame (c=) */
+        uint8_t *canvas = calloc(1, frame_size);
+        if (!canvas)
+            return "ENOMEM:frame";
+        int base = k->present['c'] ? k->value['c'] - 1 : -1;
+        if (base >= 0 && base < img->frame_count)
+            memcpy(canvas, img->frames[base], frame_size);
+        if (!append_frame(img, canvas)) {
+            free(canvas);
+            return "ENOMEM:frame";
+        }
+        target = img->frame_count - 1;
+    }
+
+    const int x0 = k->present['x'] ? k->value['x'] : 0;
+    const int y0 = k->present['y'] ? k->value['y'] : 0;
+    if (x0 < 0 || y0 < 0 || x0 + w > img->width || y0 + h > img->height)
+        return "EINVAL:frame data out of bounds";
+
+    uint8_t *dst = img->frames[target];
+    for (int y = 0; y < h; y++) {
+        memcpy(dst + ((size_t) (y0 + y) * img->width + x0) * 4,
+               rgba + (size_t) y * w * 4, (size_t) w * 4);
+    }
+
+    if (img->placed && mk->displayed_id == img->id &&
+        target == img->current_frame)
+        *display_changed = true;
+    return NULL;
+}
+
+static void complete_transmission(mock_kitty_t *mk, const gfx_keys_t *k)
+{
+    const char action = k->present['a'] ? (char) k->value['a'] : 't';
+    bool display_changed = false;
+    const char *err = NULL;
+
+    mk->stats.transmissions++;
+
+    int w = 0, h = 0;
+    uint8_t *rgba = decode_pixels(mk, k, &w, &h, &err);
+    if (!rgba) {
+        fail(mk, k, err);
+        return;
+    }
+
+    switch (action) {
+    case 'q':
+        /* Query: validate only, never store */
+        free(rgba);
+        break;
+    case 't':
+    case 'T': {
+        mk_image_t *img = new_image(mk, (uint32_t) k->value['i']);
+        if (!img || !append_frame(img, rgba)) {
+            free(rgba);
+            err = "ENOMEM:image";
+            break;
+        }
+        img->width = w;
+        img->height = h;
+        if (action == 'T') {
+            img->placed = true;
+            mk->displayed_id = img->id;
+            display_changed = true;
+        } else if (mk->displayed_id == img->id) {
+            mk->displayed_id = 0;
+        }
+        break;
+    }
+    case 'f':
+        err = edit_frame(mk, k, rgba, w, h, &display_changed);
+        free(rgba);
+        break;
+    default:
+        free(rgba);
+        err = "EINVAL:unknown action";
+        break;
+    }
+
+    if (err) {
+        fail(mk, k, err);
+        return;
+    }
+    reply_status(mk, k, NULL);
+    if (display_changed)
+        notify_display(mk);
+}
+
+static void delete_images(mock_kitty_t *mk, const gfx_keys_t *k)
+{
+    const char what = k->present['d'] ? (char) k->value['d'] : 'a';
+    const bool free_data = what >= 'A' && what <= 'Z';
+
+    for (int i = mk->image_count - 1; i >= 0; i--) {
+        mk_image_t *img = &mk->images[i];
+        bool match = what == 'a' || what == 'A' ||
+                     ((what == 'i' || what == 'I') &&
+                      img->id == (uint32_t) k->value['i']);
+        if (!match)
+            continue;
+
+        img->placed = false;
+        if (mk->displayed_id == img->id)
+            mk->displayed_id = 0;
+        if (free_data)
+            remove_image(mk, img);
+    }
+}
+
+static void handle_graphics(mock_kitty_t *mk, const char *body, size_t len)
+{
+    mk->stats.commands++;
+
+    const char *semi = memchr(body, ';', len);
+    const size_t keys_len = semi ? (size_t) (semi - body) : len;
+    const char *data = semi ? semi + 1 : body + len;
+    const size_t data_len = semi ? len - keys_len - 1 : 0;
+
+    gfx_keys_t k;
+    parse_keys(body, keys_len, &k);
+
+    const int more = k.present['m'] ? k.value['m'] : 0;
+
+    if (mk->in_transfer) {
+        /* Continuation chunk: only m (and q) are meaningful */
+        if (k.present['q'])
+            mk->transfer_keys.value['q'] = k.value['q'];
+    } else {
+        const char action = k.present['a'] ? (char) k.value['a'] : 't';
+
+        if (action == 'p') {
+            mk_image_t *img = find_image(mk, (uint32_t) k.value['i']);
+            if (!img) {
+                fail(mk, &k, "ENOENT:no such image");
+                return;
+            }
+            img->placed = true;
+            mk->displayed_id = img->id;
+            reply_status(mk, &k, NULL);
+            notify_display(mk);
+            return;
+        }
+        if (action == 'd') {
+            delete_images(mk, &k);
+            return;
+        }
+        if (action == 'a') {
+            mk_image_t *img = find_image(mk, (uint32_t) k.value['i']);
+            if (!img) {
+                fail(mk, &k, "ENOENT:no such image");
+                return;
+            }
+            if (k.present['c'] && k.value['c'] > 0 &&
+                k.value['c'] <= img->frame_count &&
+                img->current_frame != k.value['c'] - 1) {
+                img->current_frame = k.value['c'] - 1;
+                if (img->placed && mk->displayed_id == img->id)
+                    notify_display(mk);
+            }
+            return;
+        }
+
+        mk->transfer_keys = k;
+        mk->payload_len = 0;
+    }
+
+    if (data_len > 0) {
+        mk->stats.chunks++;
+        if (!buf_reserve(&mk->payload, &mk->payload_cap,
+                         mk->payload_len + data_len)) {
+            mk->in_transfer = false;
+            fail(mk, &mk->transfer_keys, "ENOMEM:payload");
+            return;
+        }
+        memcpy(mk->payload + mk->payload_len, data, data_len);
+        mk->payload_len += data_len;
+    }
+
+    if (more) {
+        mk->in_transfer = true;
+        return;
+    }
+
+    mk->in_transfer = false;
+    complete_transmission(mk, &mk->transfer_keys);
+}
+
+/* Terminal queries and cursor tracking */
+
+static void clamp_cursor(mock_kitty_t *mk)
+{
+    if (mk->cursor_row < 1)
+        mk->cursor_row = 1;
+    if (mk->cursor_row > mk->cfg.rows)
+        mk->cursor_row = mk->cfg.rows;
+    if (mk->cursor_col < 1)
+        mk->cursor_col = 1;
+    if (mk->cursor_col > mk->cfg.cols)
+        mk->cursor_col = mk->cfg.cols;
+}
+
+static void handle_csi(mock_kitty_t *mk, char final)
+{
+    const int p0 = mk->parm_count > 0 ? mk->parms[0] : 0;
+    const int p1 = mk->parm_count > 1 ? mk->parms[1] : 0;
+
+    switch (final) {
+    case 'H':
+    case 'f':
+        mk->cursor_row = p0 ? p0 : 1;
+        mk->cursor_col = p1 ? p1 : 1;
+        clamp_cursor(mk);
+        break;
+    case 'c':
+        if (mk->parm_prefix == 0 && p0 == 0 && mk->cfg.answer_queries) {
+            mk->stats.queries++;
+            send_reply(mk, "\033[?62;22c");
+        }
+        break;
+    case 'n':
+        if (p0 == 6 && mk->cfg.answer_queries) {
+            mk->stats.queries++;
+            send_reply(mk, "\033[%d;%dR", mk->cursor_row, mk->cursor_col);
+        }
+        break;
+    case 't':
+        if (!mk->cfg.answer_queries)
+            break;
+        if (p0 == 14) {
+            mk->stats.queries++;
+            send_reply(mk, "\033[4;%d;%dt", mk->cfg.rows * mk->cfg.cell_height,
+                       mk->cfg.cols * mk->cfg.cell_width);
+        } else if (p0 == 16) {
+            mk->stats.queries++;
+            send_reply(mk, "\033[6;%d;%dt", mk->cfg.cell_height,
+                       mk->cfg.cell_width);
+        } else if (p0 == 18) {
+            mk->stats.queries++;
+            send_reply(mk, "\033[8;%d;%dt", mk->cfg.rows, mk->cfg.cols);
+        }
+        break;
+    }
+}
+
+static void feed_byte(mock_kitty_t *mk, char ch)
+{
+    switch (mk->state) {
+    case ST_GROUND:
+        if (ch == 27) {
+            mk->state = ST_ESC;
+        } else if (ch == '\r') {
+            mk->cursor_col = 1;
+        } else if (ch == '\n') {
+            mk->cursor_row++;
+            clamp_cursor(mk);
+        }
+        break;
+    case ST_ESC:
+        if (ch == '[') {
+            mk->state = ST_CSI;
+            mk->parm_count = 0;
+            mk->parm = 0;
+            mk->parm_prefix = 0;
+        } else if (ch == '_') {
+            mk->state = ST_APC;
+            mk->apc_len = 0;
+        } else if (ch == ']' || ch == 'P' || ch == '^' || ch == 'X') {
+            mk->state = ST_STRING;
+        } else {
+            mk->state = ch == 27 ? ST_ESC : ST_GROUND;
+        }
+        break;
+    case ST_CSI:
+        if (ch >= '0' && ch <= '9') {
+            mk->parm = mk->parm * 10 + (ch - '0');
+        } else if (ch == ';') {
+            if (mk->parm_count < MAX_CSI_PARMS)
+                mk->parms[mk->parm_count++] = mk->parm;
+            mk->parm = 0;
+        } else if (ch == '?' || ch == '>' || ch == '=') {
+            mk->parm_prefix = ch;
+        } else if (ch >= 0x40 && ch <= 0x7e) {
+            if (mk->parm_count < MAX_CSI_PARMS)
+                mk->parms[mk->parm_count++] = mk->parm;
+            handle_csi(mk, ch);
+            mk->state = ST_GROUND;
+        }
+        break;
+    case ST_APC:
+        if (ch == 27) {
+            mk->string_is_apc = true;
+            mk->state = ST_STR_ESC;
+        } else if (buf_reserve(&mk->apc, &mk->apc_cap, mk->apc_len + 1)) {
+            mk->apc[mk->apc_len++] = ch;
+        }
+        break;
+    case ST_STRING:
+        if (ch == 27) {
+            mk->string_is_apc = false;
+            mk->state = ST_STR_ESC;
+        } else if (ch == 7) {
+            mk->state = ST_GROUND; /* BEL terminates OSC */
+        }
+        break;
+    case ST_STR_ESC:
+        if (ch == '\\' && mk->string_is_apc && mk->apc_len > 0 &&
+            mk->apc[0] == 'G')
+            handle_graphics(mk, mk->apc + 1, mk->apc_len - 1);
+        mk->state = ch == 27 ? ST_ESC : ST_GROUND;
+        break;
+    }
+}
+
+/* Public API */
+
+mock_kitty_t *mock_kitty_create(const mock_kitty_config_t *config)
+{
+    mock_kitty_t *mk = calloc(1, sizeof(*mk));
+    if (!mk)
+        return NULL;
+
+    if (config)
+        mk->cfg = *config;
+    if (mk->cfg.rows <= 0)
+        mk->cfg.rows = 24;
+    if (mk->cfg.cols <= 0)
+        mk->cfg.cols = 80;
+    if (mk->cfg.cell_width <= 0)
+        mk->cfg.cell_width = 10;
+    if (mk->cfg.cell_height <= 0)
+        mk->cfg.cell_height = 20;
+
+    mk->state = ST_GROUND;
+    mk->cursor_row = 1;
+    mk->cursor_col = 1;
+    return mk;
+}
+
+void mock_kitty_destroy(mock_kitty_t *mk)
+{
+    if (!mk)
+        return;
+
+    for (int i = 0; i < mk->image_count; i++)
+        free_image_frames(&mk->images[i]);
+    free(mk->images);
+    free(mk->apc);
+    free(mk->payload);
+    free(mk);
+}
+
+void mock_kitty_feed(mock_kitty_t *mk, const void *data, size_t len)
+{
+    const char *p = (const char *) data;
+    mk->stats.bytes += len;
+
+    for (size_t i = 0; i < len; i++) {
+        /* Fast path: bulk-copy APC payload bytes up to the next ESC */
+        if (mk->state == ST_APC) {
+            const char *esc = memchr(p + i, 27, len - i);
+            size_t run = esc ? (size_t) (esc - (p + i)) : len - i;
+            if (run > 0 &&
+                buf_reserve(&mk->apc, &mk->apc_cap, mk->apc_len + run)) {
+                memcpy(mk->apc + mk->apc_len, p + i, run);
+                mk->apc_len += run;
+                i += run;
+                if (i >= len)
+                    break;
+            }
+        }
+        feed_byte(mk, p[i]);
+    }
+}
+
+bool mock_kitty_get_frame(const mock_kitty_t *mk, mock_kitty_frame_t *frame)
+{
+    if (!mk->displayed_id)
+        return false;
+
+    const mk_image_t *img = find_image((mock_kitty_t *) mk, mk->displayed_id);
+    if (!img || !img->placed || img->current_frame >= img->frame_count)
+        return false;
+
+    *frame = (mock_kitty_frame_t) {
+        .image_id = img->id,
+        .width = img->width,
+        .height = img->height,
+        .frame_index = img->current_frame,
+        .rgba = img->frames[img->current_frame],
+        .seq = mk->stats.frames_displayed,
+    };
+    return true;
+}
+
+bool mock_kitty_frame_equals_rgb24(const mock_kitty_frame_t *frame,
+                                   const uint8_t *rgb24,
+                                   int width,
+                                   int height)
+{
+    if (frame->width != width || frame->height != height)
+        return false;
+
+    const size_t pixels = (size_t) width * height;
+    for (size_t i = 0; i < pixels; i++) {
+        if (frame->rgba[i * 4 + 0] != rgb24[i * 3 + 0] ||
+            frame->rgba[i * 4 + 1] != rgb24[i * 3 + 1] ||
+            frame->rgba[i * 4 + 2] != rgb24[i * 3 + 2])
+            return false;
+    }
+    return true;
+}
+
+const mock_kitty_stats_t *mock_kitty_get_stats(const mock_kitty_t *mk)
+{
+    return &mk->stats;
+}
+
+int mock_kitty_image_count(const mock_kitty_t *mk)
+{
+    return mk->image_count;
+}
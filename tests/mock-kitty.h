@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mock Kitty terminal
+ *
+ * A stand-in terminal for tests and benchmarks. It consumes the byte stream a
+ * program writes to its terminal, decodes Kitty Graphics Protocol commands
+ * (APC G ... ST) and keeps enough image state to reconstruct the frame that a
+ * real terminal would display. It can also answer the terminal queries that
+ * kitty-doom issues (DA1, cell size, cursor position, graphics query) and send
+ * graphics acknowledgements, through a reply callback.
+ *
+ * Supported graphics features:
+ *   actions  a=t/T/q/p/d/f/a
+ *   formats  f=24, f=32, f=100 (PNG, needs zlib)
+ *   media    t=d (direct), t=f (file), t=t (temp file), t=s (shared memory)
+ *   chunking m=0/1, compression o=z (needs zlib)
+ *
+ * Only one placement per image is modelled, and the displayed frame is the
+ * current frame of the most recently placed image.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mock_kitty mock_kitty_t;
+
+/* Snapshot of what the terminal currently displays (RGBA, row-major) */
+typedef struct {
+    uint32_t image_id;
+    int width, height;
+    int frame_index; /* 0-based current animation frame */
+    const uint8_t *rgba;
+    uint64_t seq; /* Number of display updates so far, starting at 1 */
+} mock_kitty_frame_t;
+
+/* Bytes the terminal sends back to the program (replies to queries and
+ * graphics acknowledgements)
+ */
+typedef void (*mock_kitty_reply_fn)(void *ctx, const char *data, size_t len);
+
+/* Called whenever the displayed frame changes */
+typedef void (*mock_kitty_display_fn)(void *ctx,
+                                      const mock_kitty_frame_t *frame);
+
+typedef struct {
+    int rows, cols;            /* Screen size in cells (default 24x80) */
+    int cell_width, cell_height; /* Cell size in pixels (default 10x20) */
+    bool answer_queries;       /* Reply to DA1, CSI t and CPR queries */
+    bool send_acks;            /* Send graphics OK/error replies */
+    mock_kitty_reply_fn reply;
+    mock_kitty_display_fn display;
+    void *ctx;
+} mock_kitty_config_t;
+
+typedef struct {
+    uint64_t bytes;          /* Total bytes fed */
+    uint64_t commands;       /* Graphics commands (chunks included) */
+    uint64_t transmissions;  /* Completed image data transmissions */
+    uint64_t chunks;         /* Payload-carrying chunks */
+    uint64_t frames_displayed;
+    uint64_t errors;         /* Graphics commands that failed */
+    uint64_t replies;        /* Replies sent through the reply callback */
+    uint64_t queries;        /* Terminal (non-graphics) queries answered */
+    uint64_t decoded_bytes;  /* Pixel bytes produced by decoding */
+    char last_error[64];
+} mock_kitty_stats_t;
+
+mock_kitty_t *mock_kitty_create(const mock_kitty_config_t *config);
+void mock_kitty_destroy(mock_kitty_t *mk);
+
+/* Feed terminal output. May be called with arbitrary split points. */
+void mock_kitty_feed(mock_kitty_t *mk, const void *data, size_t len);
+
+/* Current display contents. Returns false if no image is displayed. */
+bool mock_kitty_get_frame(const mock_kitty_t *mk, mock_kitty_frame_t *frame);
+
+/* Compare a displayed frame against an RGB24 buffer of the same size */
+bool mock_kitty_frame_equals_rgb24(const mock_kitty_frame_t *frame,
+                                   const uint8_t *rgb24,
+                                   int width,
+                                   int height);
+
+const mock_kitty_stats_t *mock_kitty_get_stats(const mock_kitty_t *mk);
+
+/* Number of images currently held by the terminal */
+int mock_kitty_image_count(const mock_kitty_t *mk);
@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Agent control mode test and benchmark
+ *
+ * Runs the server side of agent.c in threads around a stand-in engine whose
+ * frame is a function of its tic count and whose palette records the keys
+ * held, and drives them through the client API: stepping, observing without
+ * stepping, the observation ring, key release when a client goes away, and
+ * one client batching steps across several environments.
+ *
+ * The benchmark measures steps per second with the stand-in engine, i.e.
+ * the protocol and shared memory overhead that comes on top of the engine's
+ * own tic and render time.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+#include "check.h"
+
+#define WIDTH 320
+#define HEIGHT 200
+#define ENVS 4
+
+typedef struct {
+    agent_t *agent;
+    char path[64];
+    pthread_t thread;
+    atomic_bool stop;
+    unsigned tic;
+    uint8_t frame[WIDTH * HEIGHT];
+    uint8_t palette[256 * 3];
+} env_t;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void *env_thread(void *arg)
+{
+    env_t *env = (env_t *) arg;
+    agent_request_t req;
+    while (!atomic_load_explicit(&env->stop, memory_order_relaxed)) {
+        if (!agent_next(env->agent, &req))
+            continue;
+
+        env->tic += req.tics;
+        for (int i = 0; i < WIDTH * HEIGHT; i++)
+            env->frame[i] = (uint8_t) (i + env->tic);
+        memset(env->palette, 0, sizeof(env->palette));
+        env->palette[0] = (uint8_t) req.key_count;
+        memcpy(env->palette + 1, req.keys, req.key_count);
+
+        agent_publish(env->agent, env->frame, env->palette,
+                      &(agent_reply_t) {.gametic = env->tic});
+    }
+    return NULL;
+}
+
+static bool env_start(env_t *env, int index)
+{
+    snprintf(env->path, sizeof(env->path), "/tmp/kitty-doom-agent-%d-%d",
+             (int) getpid(), index);
+    env->agent = agent_create(env->path, WIDTH, HEIGHT);
+    return env->agent &&
+           pthread_create(&env->thread, NULL, env_thread, env) == 0;
+}
+
+static void env_stop(env_t *env)
+{
+    if (!env->agent)
+        return;
+    atomic_store_explicit(&env->stop, true, memory_order_relaxed);
+
+    /* Wake the server from accept() or recv() with a connection that ends */
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, env->path);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    close(fd);
+    pthread_join(env->thread, NULL);
+    agent_destroy(env->agent);
+}
+
+static bool frame_is(const agent_slot_t *slot, unsigned tic)
+{
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        if (slot->pixels[i] != (uint8_t) (i + tic))
+            return false;
+    }
+    return true;
+}
+
+static bool step(agent_client_t *c, const uint8_t *keys, int key_count,
+                 int tics, agent_reply_t *reply)
+{
+    return agent_send_step(c, keys, key_count, tics) &&
+           agent_recv_step(c, reply);
+}
+
+static bool test_single(env_t *env)
+{
+    bool ok = true;
+    printf("Single environment:\n");
+
+    agent_client_t *c = agent_connect(env->path);
+    ok &= check(c != NULL, "client connects and maps the ring");
+    if (!c)
+        return false;
+    const agent_shm_header_t *header = agent_header(c);
+    ok &= check(header->width == WIDTH && header->height == HEIGHT &&
+                    header->slots == AGENT_SLOTS,
+                "ring geometry");
+
+    const uint8_t forward[] = {0xad, 0x80 + 0x1d}; /* up arrow, ctrl */
+    agent_reply_t first, reply;
+    ok &= check(step(c, forward, 2, 3, &first) && first.gametic == 3,
+                "step runs the requested tics");
+    const agent_slot_t *slot = agent_observation(c, &first);
+    ok &= check(slot && frame_is(slot, 3) && slot->info.gametic == 3,
+                "observation holds the frame after the step");
+    ok &= check(slot && slot->palette[0] == 2 && slot->palette[1] == 0xad &&
+                    slot->palette[2] == 0x80 + 0x1d,
+                "held keys reach the engine");
+
+    ok &= check(step(c, NULL, 0, 0, &reply) && reply.gametic == 3 &&
+                    reply.seq == first.seq + 1,
+                "zero tics observes without stepping");
+
+    for (int i = 0; i < AGENT_SLOTS - 1; i++)
+        step(c, NULL, 0, 1, &reply);
+    ok &= check(!agent_observation(c, &first),
+                "overwritten observation is reported gone");
+    slot = agent_observation(c, &reply);
+    ok &= check(slot && frame_is(slot, reply.gametic) &&
+                    agent_observation_valid(slot, &reply),
+                "latest observation stays readable");
+
+    /* A slot rewritten while it was being copied must fail the re-check */
+    const agent_reply_t held = reply;
+    for (int i = 0; i < AGENT_SLOTS; i++)
+        step(c, NULL, 0, 0, &reply);
+    ok &= check(slot && !agent_observation_valid(slot, &held),
+                "copy of a rewritten slot is reported stale");
+
+    ok &= check(!agent_send_step(c, NULL, 0, AGENT_MAX_TICS + 1),
+                "oversized step is refused");
+
+    /* Hold a key, go away, come back: the key must have been released */
+    step(c, forward, 1, 1, &reply);
+    agent_disconnect(c);
+    c = agent_connect(env->path);
+    ok &= check(c && step(c, NULL, 0, 0, &reply) &&
+                    (slot = agent_observation(c, &reply)) &&
+                    slot->palette[0] == 0,
+                "keys are released when a client goes away");
+    agent_disconnect(c);
+    return ok;
+}
+
+static bool test_batch(env_t *envs)
+{
+    bool ok = true;
+    printf("\nBatched environments:\n");
+
+    agent_client_t *c[ENVS];
+    bool connected = true;
+    for (int i = 0; i < ENVS; i++)
+        connected &= (c[i] = agent_connect(envs[i].path)) != NULL;
+    ok &= check(connected, "one client connects to every environment");
+    if (!connected)
+        return false;
+
+    unsigned expect[ENVS];
+    for (int i = 0; i < ENVS; i++)
+        expect[i] = envs[i].tic;
+
+    bool all = true;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < ENVS; i++) {
+            all &= agent_send_step(c[i], NULL, 0, i + 1);
+            expect[i] += (unsigned) i + 1;
+        }
+        for (int i = 0; i < ENVS; i++) {
+            agent_reply_t reply;
+            const agent_slot_t *slot;
+            all &= agent_recv_step(c[i], &reply) &&
+                   reply.gametic == expect[i] &&
+                   (slot = agent_observation(c[i], &reply)) &&
+                   frame_is(slot, expect[i]) &&
+                   agent_observation_valid(slot, &reply);
+        }
+    }
+    ok &= check(all, "every environment steps independently");
+
+    for (int i = 0; i < ENVS; i++)
+        agent_disconnect(c[i]);
+    return ok;
+}
+
+/* Steps per second over about half a second */
+static double bench_rate(env_t *envs, int count)
+{
+    agent_client_t *c[ENVS];
+    for (int i = 0; i < count; i++) {
+        c[i] = agent_connect(envs[i].path);
+        if (!c[i])
+            return 0;
+    }
+
+    unsigned long long steps = 0;
+    const uint64_t start = get_time_ns();
+    uint64_t now = start;
+    while (now - start < 500000000ULL) {
+        for (int round = 0; round < 100; round++) {
+            for (int i = 0; i < count; i++)
+                agent_send_step(c[i], NULL, 0, 1);
+            for (int i = 0; i < count; i++) {
+                agent_reply_t reply;
+                agent_recv_step(c[i], &reply);
+            }
+            steps += (unsigned long long) count;
+        }
+        now = get_time_ns();
+    }
+
+    for (int i = 0; i < count; i++)
+        agent_disconnect(c[i]);
+    return steps / ((now - start) / 1e9);
+}
+
+int main(void)
+{
+    printf("Agent Control Mode Test\n");
+    printf("=======================\n\n");
+
+    env_t *envs = calloc(ENVS, sizeof(env_t));
+    bool ok = envs != NULL;
+    for (int i = 0; ok && i < ENVS; i++)
+        ok &= env_start(&envs[i], i);
+    if (!check(ok, "environments start")) {
+        free(envs);
+        return 1;
+    }
+
+    ok &= test_single(&envs[0]);
+    ok &= test_batch(envs);
+
+    printf("\nProtocol overhead (stand-in engine, 1 tic per step):\n");
+    const double single = bench_rate(envs, 1);
+    const double batched = bench_rate(envs, ENVS);
+    printf("  1 environment:   %8.0f steps/s\n", single);
+    printf("  %d environments:  %8.0f steps/s\n", ENVS, batched);
+    ok &= check(single >= 2000, "thousands of steps per second");
+
+    for (int i = 0; i < ENVS; i++)
+        env_stop(&envs[i]);
+    free(envs);
+
+    return check_summary(ok);
+}
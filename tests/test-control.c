@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Runtime control socket test
+ *
+ * A stand-in game thread polls for snapshots once per millisecond, as the
+ * real loop does once per frame, and can be paused to let several changes
+ * pile up. The test talks the line protocol over the socket: reading
+ * settings, changing several at once, refusing bad values as a whole,
+ * reporting a change the game could not apply, coalescing changes made
+ * between two frame boundaries into one snapshot, and serving other
+ * clients while one waits for the game. It also times the frame
+ * boundary check when nothing is pending, which is all the hot path pays.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+#include "check.h"
+
+static struct {
+    pthread_t thread;
+    atomic_bool stop, paused;
+    atomic_int taken; /* snapshots taken */
+    control_config_t seen; /* last snapshot, read once the game is idle */
+} game;
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void *game_thread(void *arg)
+{
+    (void) arg;
+    while (!atomic_load(&game.stop)) {
+        if (!atomic_load(&game.paused)) {
+            const control_config_t *config = control_poll();
+            if (config) {
+                game.seen = *config;
+                atomic_fetch_add(&game.taken, 1);
+                /* This stand-in has no io_uring backend */
+                control_ack(strcmp(config->output, "uring")
+                                ? NULL
+                                : "cannot create output backend");
+            }
+        }
+        nanosleep(&(struct timespec) {.tv_nsec = 1000000}, NULL);
+    }
+    return NULL;
+}
+
+static int client_connect(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Read replies up to a line starting "ok" or "error" */
+static const char *response(int fd)
+{
+    static char buf[1024];
+    size_t used = 0;
+    for (;;) {
+        const ssize_t n = recv(fd, buf + used, sizeof(buf) - 1 - used, 0);
+        if (n <= 0)
+            return "";
+        used += (size_t) n;
+        buf[used] = '\0';
+
+        /* Find the start of the last complete line */
+        if (used < 1 || buf[used - 1] != '\n')
+            continue;
+        const char *last = buf + used - 1;
+        while (last > buf && last[-1] != '\n')
+            last--;
+        if (!strncmp(last, "ok", 2) || !strncmp(last, "error", 5))
+            return buf;
+    }
+}
+
+/* Send one command and read its reply */
+static const char *command(int fd, const char *line)
+{
+    send(fd, line, strlen(line), 0);
+    send(fd, "\n", 1, 0);
+    return response(fd);
+}
+
+static bool starts(const char *s, const char *prefix)
+{
+    return !strncmp(s, prefix, strlen(prefix));
+}
+
+/* Wait until the stand-in game is between polls */
+static void pause_game(void)
+{
+    atomic_store(&game.paused, true);
+    nanosleep(&(struct timespec) {.tv_nsec = 5000000}, NULL);
+}
+
+int main(void)
+{
+    printf("Runtime Control Socket Test\n");
+    printf("===========================\n\n");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kitty-doom-control-%d",
+             (int) getpid());
+    const control_config_t initial = {
+        .output = "write",
+        .fps = 35,
+        .degrade = {.frame_divisor = 1, .downscale = 1},
+    };
+    bool ok = check(control_start(path, &initial), "control socket starts");
+    const int fd = ok ? client_connect(path) : -1;
+    ok &= check(fd >= 0, "client connects");
+    if (!ok)
+        return 1;
+    pthread_create(&game.thread, NULL, game_thread, NULL);
+
+    const char *r = command(fd, "get");
+    ok &= check(strstr(r, "output write\n") && strstr(r, "fps 35\n") &&
+                    strstr(r, "frame-divisor 1\n") &&
+                    strstr(r, "generation 0 applied 0\n"),
+                "get lists the current settings");
+
+    r = command(fd, "set fps 20 frame-divisor 2");
+    ok &= check(starts(r, "ok 1"), "set takes several settings");
+    r = command(fd, "wait");
+    pause_game();
+    ok &= check(starts(r, "ok 1") && game.seen.fps == 20 &&
+                    game.seen.degrade.frame_divisor == 2,
+                "game applies them in one snapshot");
+    atomic_store(&game.paused, false);
+
+    ok &= check(starts(command(fd, "set fps 99"), "error"),
+                "out of range value refused");
+    ok &= check(starts(command(fd, "set fps 10 downscale 3"), "error") &&
+                    starts(command(fd, "get fps"), "fps 20\n"),
+                "one bad value refuses the whole set");
+    ok &= check(starts(command(fd, "set nosuch 1"), "error") &&
+                    starts(command(fd, "set fps"), "error") &&
+                    starts(command(fd, "frobnicate"), "error"),
+                "unknown settings and commands refused");
+
+    command(fd, "set output uring");
+    r = command(fd, "wait");
+    ok &= check(starts(r, "error cannot create output"),
+                "failure to apply is reported");
+    command(fd, "set output write");
+    ok &= check(starts(command(fd, "wait"), "ok"), "later change clears it");
+
+    /* Three changes between two frame boundaries */
+    pause_game();
+    const int taken = atomic_load(&game.taken);
+    command(fd, "set fps 5");
+    command(fd, "set fps 6\r");
+    command(fd, "set fps 7");
+    atomic_store(&game.paused, false);
+    r = command(fd, "wait");
+    pause_game();
+    ok &= check(starts(r, "ok") && atomic_load(&game.taken) == taken + 1 &&
+                    game.seen.fps == 7,
+                "changes between frames coalesce into one snapshot");
+
+    /* A wait holds up its own client only, and what follows it runs after */
+    pause_game();
+    command(fd, "set fps 9");
+    send(fd, "wait\nget fps\n", 13, 0);
+    const int other = client_connect(path);
+    const uint64_t t1 = get_time_ns();
+    r = command(other, "get fps");
+    const double wait_ms = (double) (get_time_ns() - t1) / 1e6;
+    ok &= check(starts(r, "fps 9\n") && wait_ms < 100,
+                "a pending wait does not stall other clients");
+    close(other);
+    atomic_store(&game.paused, false);
+    r = response(fd);
+    ok &= check(starts(r, "ok") &&
+                    (strstr(r, "\nfps 9\nok\n") ||
+                     starts(response(fd), "fps 9\nok\n")),
+                "lines after a wait are answered once it returns");
+    pause_game();
+
+    /* The frame boundary check with nothing pending; the game is paused */
+    const int calls = 10000000;
+    bool none = true;
+    const uint64_t t0 = get_time_ns();
+    for (int i = 0; i < calls; i++)
+        none &= control_poll() == NULL;
+    const double ns = (double) (get_time_ns() - t0) / calls;
+    printf("  Frame boundary check: %.2f ns\n", ns);
+    ok &= check(none && ns < 50, "idle check is a single load");
+
+    close(fd);
+    atomic_store(&game.stop, true);
+    pthread_join(game.thread, NULL);
+    control_stop();
+
+    return check_summary(ok);
+}
@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Fair-share supervisor test
+ *
+ * Simulates hosted sessions sharing one table on a virtual clock. Heavy
+ * sessions must be degraded to their weighted share of the egress budget
+ * while light ones keep full quality, the host must stay busy without
+ * being oversubscribed, levels must settle instead of flapping, and the
+ * share of a session that stops reporting must go back to the others.
+ *
+ * The simulated cost of each degrade setting deliberately differs from the
+ * supervisor's own estimates, as real frames would.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+#include "check.h"
+
+#define TIC_NS 28571428ULL
+#define SESSIONS 6
+#define EGRESS_KBYTES 8000
+
+typedef struct {
+    const char *name;
+    int weight;
+    double cpu_demand;  /* encode ns per second at full quality */
+    double byte_demand; /* bytes per second at full quality */
+    fairshare_t *fs;
+    degrade_t degrade;
+    unsigned long long encode_ns, bytes;
+    unsigned changes_late; /* level changes once settled */
+    bool stopped;
+} session_t;
+
+/* What a degrade setting really costs, unlike fairshare.c's estimates */
+static void session_cost(const session_t *s, double *cpu, double *bytes)
+{
+    double c = 1, b = 1;
+    if (s->degrade.compress) {
+        c *= 40;
+        b *= 0.5;
+    }
+    if (s->degrade.downscale == 2) {
+        c *= 0.35;
+        b *= 0.25;
+    }
+    *cpu = s->cpu_demand * c / s->degrade.frame_divisor;
+    *bytes = s->byte_demand * b / s->degrade.frame_divisor;
+}
+
+static int quality_rank(const degrade_t *d)
+{
+    /* Larger is worse, in the supervisor's order */
+    return (d->frame_divisor - 1) * 4 + (d->downscale - 1) * 2 + d->compress;
+}
+
+/* Advance every running session by seconds of virtual time; returns the
+ * mean total egress over the last half of the interval
+ */
+static double run(session_t *s, unsigned long long *now, double seconds,
+                  bool count_changes)
+{
+    const unsigned long long tics = (unsigned long long) (seconds * 35);
+    double late_bytes = 0;
+    for (unsigned long long t = 0; t < tics; t++) {
+        *now += TIC_NS;
+        for (int i = 0; i < SESSIONS; i++) {
+            if (s[i].stopped)
+                continue;
+            double cpu, bytes;
+            session_cost(&s[i], &cpu, &bytes);
+            s[i].encode_ns += (unsigned long long) (cpu / 35);
+            s[i].bytes += (unsigned long long) (bytes / 35);
+            if (t >= tics / 2)
+                late_bytes += bytes / 35;
+
+            degrade_t next;
+            if (fairshare_update(s[i].fs, *now, s[i].encode_ns, s[i].bytes,
+                                 &next)) {
+                s[i].degrade = next;
+                if (count_changes && t >= tics / 2)
+                    s[i].changes_late++;
+            }
+        }
+    }
+    return late_bytes / (seconds / 2);
+}
+
+int main(void)
+{
+    printf("Fair-Share Supervisor Test\n");
+    printf("==========================\n\n");
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kitty-doom-fair-%d", (int) getpid());
+    unlink(path);
+
+    session_t s[SESSIONS] = {
+        {.name = "heavy", .weight = 1,
+         .cpu_demand = 2e6, .byte_demand = 8e6},
+        {.name = "heavy x2", .weight = 2,
+         .cpu_demand = 2e6, .byte_demand = 4.5e6},
+        {.name = "light 1", .weight = 1,
+         .cpu_demand = 1e6, .byte_demand = 5e5},
+        {.name = "light 2", .weight = 1,
+         .cpu_demand = 1e6, .byte_demand = 5e5},
+        {.name = "light 3", .weight = 1,
+         .cpu_demand = 1e6, .byte_demand = 5e5},
+        {.name = "light 4", .weight = 1,
+         .cpu_demand = 1e6, .byte_demand = 5e5},
+    };
+    unsigned long long now = 1000000000ULL;
+    bool ok = true;
+
+    for (int i = 0; i < SESSIONS; i++) {
+        s[i].fs = fairshare_join(path,
+                                 &(fairshare_config_t) {
+                                     .weight = s[i].weight,
+                                     .egress_kbytes = EGRESS_KBYTES,
+                                 },
+                                 now);
+        s[i].degrade = (degrade_t) {1, 1, false};
+        if (!s[i].fs) {
+            check(false, "join the table");
+            unlink(path);
+            return 1;
+        }
+    }
+
+    /* Settle, then watch a further 20 seconds */
+    run(s, &now, 10, false);
+    const double egress = run(s, &now, 20, true);
+
+    printf("  %-9s %6s %10s %10s %8s\n", "Session", "weight", "demand KB",
+           "sent KB", "setting");
+    for (int i = 0; i < SESSIONS; i++) {
+        double cpu, bytes;
+        session_cost(&s[i], &cpu, &bytes);
+        printf("  %-9s %6d %10.0f %10.0f %3s%s%s\n", s[i].name, s[i].weight,
+               s[i].byte_demand / 1000, bytes / 1000,
+               s[i].degrade.downscale == 2 ? "1/2" : "1/1",
+               s[i].degrade.compress ? " z" : "",
+               s[i].degrade.frame_divisor > 1 ? " /N" : "");
+    }
+    printf("  Egress %.0f of %d KB/s\n\n", egress / 1000, EGRESS_KBYTES);
+
+    bool lights_full = true;
+    unsigned changes = 0;
+    for (int i = 0; i < SESSIONS; i++) {
+        if (i >= 2 && quality_rank(&s[i].degrade) != 0)
+            lights_full = false;
+        changes += s[i].changes_late;
+    }
+    ok &= check(lights_full, "light sessions keep full quality");
+    ok &= check(quality_rank(&s[0].degrade) > 0 &&
+                    quality_rank(&s[1].degrade) > 0,
+                "heavy sessions are degraded");
+#ifdef HAVE_ZLIB
+    /* Without zlib both land on the same (half resolution) level */
+    ok &= check(quality_rank(&s[1].degrade) < quality_rank(&s[0].degrade),
+                "double weight gets the better picture");
+#endif
+    ok &= check(egress <= EGRESS_KBYTES * 1000 * 1.05,
+                "egress stays within the host budget");
+    ok &= check(egress >= EGRESS_KBYTES * 1000 * 0.6,
+                "host egress stays well used");
+    ok &= check(changes <= 2, "levels settle instead of flapping");
+
+    /* The heaviest session stops reporting, as if it had crashed */
+    const int before = quality_rank(&s[1].degrade);
+    s[0].stopped = true;
+    run(s, &now, 10, false);
+    ok &= check(quality_rank(&s[1].degrade) < before,
+                "a stalled session's share goes to the others");
+
+    /* A new session can take its slot over */
+    fairshare_t *crashed = s[0].fs;
+    s[0].fs = fairshare_join(path,
+                             &(fairshare_config_t) {
+                                 .weight = 1,
+                                 .egress_kbytes = EGRESS_KBYTES,
+                             },
+                             now);
+    ok &= check(s[0].fs != NULL, "a new session joins");
+
+    fairshare_leave(crashed);
+    for (int i = 0; i < SESSIONS; i++)
+        fairshare_leave(s[i].fs);
+    unlink(path);
+
+    return check_summary(ok);
+}
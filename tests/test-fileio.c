@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Write-behind file I/O test and benchmark
+ *
+ * Drives the file callbacks the way the engine does: M_WriteFile-style
+ * savegames, a config written in many small pieces, and M_ReadFile-style
+ * loads (seek to the end, tell, seek back, read). Files written before the
+ * writer thread starts stay queued, which makes it possible to check that
+ * reads see queued data, that a second save replaces a queued one, and that
+ * nothing reaches the disk until the writer runs. A save/load loop against
+ * the running writer checks that a load always returns the latest save.
+ *
+ * The benchmark compares what a save costs the calling (game) thread with
+ * stdio as the engine does it, stdio plus fsync, and write-behind.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/kitty-doom.h"
+#include "check.h"
+
+#define SAVE_SIZE (180 * 1024) /* a late-episode savegame */
+#define BENCH_SAVES 20
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static char dir[64];
+
+static void fill(unsigned char *buf, size_t size, unsigned seed)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (unsigned char) ((i * 131 + seed * 7919) >> 3);
+}
+
+static const char *path_of(const char *name)
+{
+    static char path[2][128];
+    static int which;
+    which ^= 1;
+    snprintf(path[which], sizeof(path[which]), "%s/%s", dir, name);
+    return path[which];
+}
+
+/* M_WriteFile */
+static bool save(const char *path, const void *data, size_t size)
+{
+    void *f = fileio_open(path, "wb");
+    if (!f)
+        return false;
+    const bool ok = fileio_write(f, data, (int) size) == (int) size;
+    fileio_close(f);
+    return ok;
+}
+
+/* M_ReadFile; returns a malloc'd buffer or NULL */
+static unsigned char *load(const char *path, size_t *size)
+{
+    void *f = fileio_open(path, "rb");
+    if (!f)
+        return NULL;
+    fileio_seek(f, 0, SEEK_END);
+    const int length = fileio_tell(f);
+    fileio_seek(f, 0, SEEK_SET);
+    unsigned char *buf = malloc(length > 0 ? (size_t) length : 1);
+    if (buf && fileio_read(f, buf, length) != length) {
+        free(buf);
+        buf = NULL;
+    }
+    fileio_close(f);
+    *size = (size_t) length;
+    return buf;
+}
+
+static bool loads_as(const char *path, const void *data, size_t size)
+{
+    size_t got;
+    unsigned char *buf = load(path, &got);
+    const bool ok = buf && got == size && !memcmp(buf, data, size);
+    free(buf);
+    return ok;
+}
+
+/* Contents on disk, bypassing the queue */
+static bool disk_has(const char *path, const void *data, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    unsigned char *buf = malloc(size + 1);
+    const size_t got = buf ? fread(buf, 1, size + 1, f) : 0;
+    const bool ok = buf && got == size && !memcmp(buf, data, size);
+    free(buf);
+    fclose(f);
+    return ok;
+}
+
+static bool exists(const char *path)
+{
+    return access(path, F_OK) == 0;
+}
+
+static bool test_queued(unsigned char *v1, unsigned char *v2)
+{
+    bool ok = true;
+    const char *save0 = path_of("doomsav0.dsg");
+    const char *config = path_of("default.cfg");
+
+    printf("Queued writes (writer not running):\n");
+    ok &= check(save(save0, v1, SAVE_SIZE), "savegame written");
+    ok &= check(!exists(save0), "nothing reaches the disk yet");
+    ok &= check(loads_as(save0, v1, SAVE_SIZE), "load sees the queued save");
+
+    save(save0, v2, SAVE_SIZE);
+    ok &= check(loads_as(save0, v2, SAVE_SIZE), "load sees the newest save");
+    ok &= check(fileio_get_stats().superseded == 1,
+                "second save replaces the queued one");
+
+    /* M_SaveDefaults writes one line per setting */
+    void *f = fileio_open(config, "w");
+    char line[64];
+    size_t config_size = 0;
+    for (int i = 0; i < 40; i++) {
+        const int n = snprintf(line, sizeof(line), "key_%d\t\t%d\n", i, i * 3);
+        config_size += (size_t) fileio_write(f, line, n);
+    }
+    fileio_close(f);
+    f = fileio_open(config, "a");
+    config_size += (size_t) fileio_write(f, "appended\t\t1\n", 12);
+    fileio_close(f);
+
+    size_t got;
+    unsigned char *buf = load(config, &got);
+    ok &= check(buf && got == config_size && !memcmp(buf, "key_0\t\t0\n", 9) &&
+                    !memcmp(buf + got - 12, "appended\t\t1\n", 12),
+                "append extends the queued config");
+    free(buf);
+
+    /* feof only after a read runs past the end, as with stdio */
+    f = fileio_open(save0, "rb");
+    unsigned char byte;
+    fileio_seek(f, -1, SEEK_END);
+    const bool at_last = fileio_read(f, &byte, 1) == 1 && !fileio_eof(f);
+    const bool past_end = fileio_read(f, &byte, 1) == 0 && fileio_eof(f);
+    fileio_close(f);
+    ok &= check(at_last && past_end, "end of file reported like stdio");
+
+    ok &= check(!fileio_open(path_of("missing.dsg"), "rb"),
+                "missing file fails to open");
+    return ok;
+}
+
+static bool test_drained(const unsigned char *v2)
+{
+    bool ok = true;
+    const char *save0 = path_of("doomsav0.dsg");
+
+    printf("\nWriter running:\n");
+    ok &= check(fileio_start(), "writer thread starts");
+    fileio_flush();
+
+    const fileio_stats_t stats = fileio_get_stats();
+    ok &= check(stats.files_written == 2 && !stats.failed,
+                "queued files written once each");
+    ok &= check(disk_has(save0, v2, SAVE_SIZE), "disk has the newest save");
+    ok &= check(!exists(path_of("doomsav0.dsg.tmp")),
+                "temporary file renamed into place");
+    ok &= check(loads_as(save0, v2, SAVE_SIZE), "load reads it back from disk");
+
+    /* Saves and loads racing the writer: a load always sees the last save */
+    unsigned char *buf = malloc(SAVE_SIZE);
+    bool latest = buf != NULL;
+    for (unsigned i = 0; latest && i < 200; i++) {
+        fill(buf, SAVE_SIZE, i);
+        latest = save(save0, buf, SAVE_SIZE) && loads_as(save0, buf, SAVE_SIZE);
+    }
+    fileio_flush();
+    ok &= check(latest, "load during write-behind sees the last save");
+    ok &= check(buf && disk_has(save0, buf, SAVE_SIZE),
+                "disk ends with the last save");
+    free(buf);
+    return ok;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+typedef enum { BENCH_STDIO, BENCH_FSYNC, BENCH_BEHIND } bench_mode_t;
+
+static void bench_mode(const char *label, bench_mode_t mode,
+                       const unsigned char *data)
+{
+    uint64_t ns[BENCH_SAVES];
+    for (int i = 0; i < BENCH_SAVES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench%d.dsg", i % 6);
+        const char *path = path_of(name);
+
+        const uint64_t t0 = get_time_ns();
+        if (mode == BENCH_BEHIND) {
+            save(path, data, SAVE_SIZE);
+        } else {
+            FILE *f = fopen(path, "wb");
+            if (f) {
+                fwrite(data, 1, SAVE_SIZE, f);
+                if (mode == BENCH_FSYNC) {
+                    fflush(f);
+                    fsync(fileno(f));
+                }
+                fclose(f);
+            }
+        }
+        ns[i] = get_time_ns() - t0;
+
+        /* One save per level at most: let the writer catch up off the clock */
+        if (mode == BENCH_BEHIND)
+            fileio_flush();
+    }
+    qsort(ns, BENCH_SAVES, sizeof(ns[0]), cmp_u64);
+    printf("  %-14s %9.1f %9.1f\n", label, ns[BENCH_SAVES / 2] / 1e3,
+           ns[BENCH_SAVES - 1] / 1e3);
+}
+
+static void bench(void)
+{
+    unsigned char *data = malloc(SAVE_SIZE);
+    if (!data)
+        return;
+    fill(data, SAVE_SIZE, 42);
+
+    printf("\nGame-thread cost of a %d KB save (%d saves):\n",
+           SAVE_SIZE / 1024, BENCH_SAVES);
+    printf("  %-14s %9s %9s\n", "Mode", "median us", "max us");
+    bench_mode("stdio", BENCH_STDIO, data);
+    bench_mode("stdio + fsync", BENCH_FSYNC, data);
+    bench_mode("write-behind", BENCH_BEHIND, data);
+    free(data);
+}
+
+static void cleanup(void)
+{
+    static const char *const names[] = {
+        "doomsav0.dsg", "default.cfg", "bench0.dsg", "bench1.dsg",
+        "bench2.dsg",   "bench3.dsg",  "bench4.dsg", "bench5.dsg",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        unlink(path_of(names[i]));
+    rmdir(dir);
+}
+
+int main(void)
+{
+    printf("Write-Behind File I/O Test\n");
+    printf("==========================\n\n");
+
+    snprintf(dir, sizeof(dir), "/tmp/kitty-doom-fileio-%d", (int) getpid());
+    if (mkdir(dir, 0700)) {
+        perror(dir);
+        return 1;
+    }
+
+    unsigned char *v1 = malloc(SAVE_SIZE), *v2 = malloc(SAVE_SIZE);
+    if (!v1 || !v2)
+        return 1;
+    fill(v1, SAVE_SIZE, 1);
+    fill(v2, SAVE_SIZE, 2);
+
+    bool ok = test_queued(v1, v2);
+    ok &= test_drained(v2);
+    bench();
+    fileio_stop();
+    free(v1);
+    free(v2);
+    cleanup();
+
+    return check_summary(ok);
+}
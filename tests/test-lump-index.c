@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Hash-indexed lump lookup test
+ *
+ * Builds a lump directory the way the engine's W_AddFile() does, an IWAD
+ * followed by PWADs appended behind it, and checks that the hash lookup of
+ * src/lump-index.h returns what the engine's linear back-to-front scan
+ * returns for every name: the last lump of that name, so PWAD lumps override
+ * same-named IWAD lumps and a map's lumps come from the last file that has
+ * the map.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+
+/* The parts of the engine's WAD directory the lookup uses */
+typedef struct {
+    char name[8];
+    void *handle;
+    int position;
+    int size;
+} lumpinfo_t;
+
+static lumpinfo_t *lumpinfo;
+static int numlumps;
+
+/* The engine's scan: upper-cased, zero padded, last match wins */
+static int W_CheckNumForName_linear(char *name)
+{
+    char key[9] = {0};
+    strncpy(key, name, 8);
+    for (int i = 0; i < 8 && key[i]; i++)
+        key[i] = (char) toupper((unsigned char) key[i]);
+
+    for (int lump = numlumps - 1; lump >= 0; lump--) {
+        if (!memcmp(lumpinfo[lump].name, key, 8))
+            return lump;
+    }
+    return -1;
+}
+
+#include "../src/lump-index.h"
+
+#define MAX_LUMPS 8192
+
+/* Append one file's directory, as W_AddFile() does */
+static void add_lumps(const char *const *names, int count, int file)
+{
+    for (int i = 0; i < count; i++) {
+        lumpinfo_t *l = &lumpinfo[numlumps++];
+        memset(l, 0, sizeof(*l));
+        strncpy(l->name, names[i], 8);
+        l->position = file;
+    }
+}
+
+/* Every name in the directory, plus some that are not, in several spellings */
+static bool lookups_match(void)
+{
+    static char *const extra[] = {
+        "playpal", "e1m1", "Things", "texture1", "TEXTURE1X", "STBAR",
+        "NOSUCH",  "",     "E1M10",  "newtex",
+    };
+    for (int lump = 0; lump < numlumps; lump++) {
+        char name[9] = {0};
+        memcpy(name, lumpinfo[lump].name, 8);
+        if (W_CheckNumForName(name) != W_CheckNumForName_linear(name)) {
+            printf("    %s: hash %d, linear %d\n", name,
+                   W_CheckNumForName(name), W_CheckNumForName_linear(name));
+            return false;
+        }
+    }
+    for (size_t i = 0; i < sizeof(extra) / sizeof(extra[0]); i++) {
+        if (W_CheckNumForName(extra[i]) !=
+            W_CheckNumForName_linear(extra[i])) {
+            printf("    %s: hash %d, linear %d\n", extra[i],
+                   W_CheckNumForName(extra[i]),
+                   W_CheckNumForName_linear(extra[i]));
+            return false;
+        }
+    }
+    return true;
+}
+
+static int file_of(char *name)
+{
+    const int lump = W_CheckNumForName(name);
+    return lump < 0 ? -1 : lumpinfo[lump].position;
+}
+
+int main(void)
+{
+    printf("Lump Lookup Test\n");
+    printf("================\n\n");
+
+    static const char *const iwad[] = {
+        "PLAYPAL", "COLORMAP", "ENDOOM",   "E1M1",     "THINGS",
+        "LINEDEFS", "SECTORS", "E1M2",     "THINGS",   "LINEDEFS",
+        "SECTORS",  "TEXTURE1", "PNAMES",  "STBAR",    "F_START",
+        "FLOOR4_8", "F_END",    "D_E1M1",  "DSPISTOL",
+    };
+    static const char *const pwad1[] = {
+        "E1M1", "THINGS", "LINEDEFS", "SECTORS", "STBAR", "NEWTEX",
+    };
+    static const char *const pwad2[] = {
+        "TEXTURE1", "E1M1", "THINGS", "LINEDEFS", "SECTORS",
+    };
+    const int iwad_count = (int) (sizeof(iwad) / sizeof(iwad[0]));
+
+    lumpinfo = calloc(MAX_LUMPS, sizeof(lumpinfo_t));
+    if (!check(lumpinfo != NULL, "directory allocated"))
+        return 1;
+
+    bool ok = true;
+    add_lumps(iwad, iwad_count, 0);
+    ok &= check(lookups_match(), "IWAD: same lumps as the linear scan");
+    ok &= check(W_CheckNumForName("THINGS") == 8,
+                "IWAD: repeated map lump resolves to the last one");
+
+    /* Same directory, more lumps: the index must notice and rebuild */
+    add_lumps(pwad1, (int) (sizeof(pwad1) / sizeof(pwad1[0])), 1);
+    ok &= check(lookups_match(), "PWAD: same lumps as the linear scan");
+    ok &= check(file_of("STBAR") == 1 && file_of("things") == 1 &&
+                    file_of("E1M1") == 1 && file_of("PLAYPAL") == 0,
+                "PWAD: overrides same-named IWAD lumps only");
+    ok &= check(file_of("NEWTEX") == 1 && file_of("NOSUCH") == -1,
+                "PWAD: new lumps found, missing ones are not");
+
+    /* A second PWAD into a reallocated directory, as W_AddFile() grows it */
+    lumpinfo_t *moved = malloc(MAX_LUMPS * sizeof(lumpinfo_t));
+    if (moved) {
+        memcpy(moved, lumpinfo, numlumps * sizeof(lumpinfo_t));
+        free(lumpinfo);
+        lumpinfo = moved;
+    }
+    add_lumps(pwad2, (int) (sizeof(pwad2) / sizeof(pwad2[0])), 2);
+    ok &= check(lookups_match(), "second PWAD: same lumps as the linear scan");
+    ok &= check(file_of("TEXTURE1") == 2 && file_of("STBAR") == 1 &&
+                    file_of("SECTORS") == 2,
+                "second PWAD: the last file with a name wins");
+
+    /* Enough names that probe sequences collide and wrap */
+    char generated[4096][9];
+    const char *gen[4096];
+    for (int i = 0; i < 4096; i++) {
+        snprintf(generated[i], sizeof(generated[i]), "L%05d", i % 3000);
+        gen[i] = generated[i];
+    }
+    add_lumps(gen, 4096, 3);
+    ok &= check(lookups_match(), "4096 more lumps: same as the linear scan");
+    ok &= check(numlumps == iwad_count + 6 + 5 + 4096 &&
+                    W_CheckNumForName("L00042") ==
+                        iwad_count + 6 + 5 + 3000 + 42,
+                "duplicates within one file: the last one wins");
+
+    free(lump_index.slots);
+    free(lumpinfo);
+    return check_summary(ok);
+}
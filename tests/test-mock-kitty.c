@@ -0,0 +1,1059 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Mock Kitty terminal tests
+ *
+ * - Protocol tests: hand-built graphics streams exercising each supported
+ *   action, format, medium and compression
+ * - Renderer round trip: every frame the renderer emits, in every mode, must
+ *   be displayed by the mock terminal exactly as produced
+ * - Graphics replies fed back to the renderer: recovery from a lost image
+ *   and acknowledgement-driven pacing
+ * - Indexed source: palette changes and index changes told apart
+ * - Decode throughput of the mock terminal (frames per second)
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "../src/base64.h"
+#include "../src/kitty-doom.h"
+#include "check.h"
+#include "mock-kitty.h"
+
+#define WIDTH 320
+#define HEIGHT 200
+#define FRAME_SIZE (WIDTH * HEIGHT * 3)
+#define ROUND_TRIP_FRAMES 24
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Collects replies and display updates */
+typedef struct {
+    char replies[1024];
+    size_t reply_len;
+    int displays;
+} capture_t;
+
+static void capture_reply(void *ctx, const char *data, size_t len)
+{
+    capture_t *c = (capture_t *) ctx;
+    if (c->reply_len + len < sizeof(c->replies)) {
+        memcpy(c->replies + c->reply_len, data, len);
+        c->reply_len += len;
+        c->replies[c->reply_len] = '\0';
+    }
+}
+
+static void capture_display(void *ctx, const mock_kitty_frame_t *frame)
+{
+    (void) frame;
+    ((capture_t *) ctx)->displays++;
+}
+
+static mock_kitty_t *new_mock(capture_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    mock_kitty_config_t cfg = {
+        .answer_queries = true,
+        .send_acks = true,
+        .reply = capture_reply,
+        .display = capture_display,
+        .ctx = c,
+    };
+    return mock_kitty_create(&cfg);
+}
+
+static void feed_str(mock_kitty_t *mk, const char *s)
+{
+    mock_kitty_feed(mk, s, strlen(s));
+}
+
+/* Send a graphics command with a base64 payload split into chunks */
+static void send_graphics(mock_kitty_t *mk,
+                          const char *keys,
+                          const uint8_t *data,
+                          size_t len,
+                          size_t chunk)
+{
+    uint8_t *b64 = malloc(4 * ((len + 2) / 3) + 1);
+    size_t b64_len = base64_encode_scalar(data, len, b64);
+    char head[256];
+
+    if (b64_len == 0) {
+        snprintf(head, sizeof(head), "\033_G%s;\033\\", keys);
+        feed_str(mk, head);
+    }
+    for (size_t off = 0; off < b64_len; off += chunk) {
+        size_t n = b64_len - off < chunk ? b64_len - off : chunk;
+        bool more = off + n < b64_len;
+        if (off == 0)
+            snprintf(head, sizeof(head), "\033_G%s,m=%d;", keys, more);
+        else
+            snprintf(head, sizeof(head), "\033_Gm=%d;", more);
+        feed_str(mk, head);
+        mock_kitty_feed(mk, b64 + off, n);
+        feed_str(mk, "\033\\");
+    }
+    free(b64);
+}
+
+static void make_pattern(uint8_t *rgb, int w, int h, int seed)
+{
+    for (int i = 0; i < w * h; i++) {
+        rgb[i * 3 + 0] = (uint8_t) (i * 7 + seed);
+        rgb[i * 3 + 1] = (uint8_t) (i / w * 3 + seed * 5);
+        rgb[i * 3 + 2] = (uint8_t) (i ^ seed);
+    }
+}
+
+static bool displayed_equals(mock_kitty_t *mk, const uint8_t *rgb, int w, int h)
+{
+    mock_kitty_frame_t frame;
+    return mock_kitty_get_frame(mk, &frame) &&
+           mock_kitty_frame_equals_rgb24(&frame, rgb, w, h);
+}
+
+/* Protocol tests */
+
+static bool test_direct_chunked(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+    uint8_t rgb[16 * 8 * 3];
+    make_pattern(rgb, 16, 8, 1);
+
+    send_graphics(mk, "a=T,i=7,f=24,s=16,v=8,q=2", rgb, sizeof(rgb), 64);
+    bool ok = check(displayed_equals(mk, rgb, 16, 8) && c.displays == 1 &&
+                        c.reply_len == 0,
+                    "a=T f=24 chunked, q=2 suppresses ack");
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+
+static bool test_animation_frames(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+    uint8_t base[16 * 8 * 3], patch[4 * 2 * 3], expected[16 * 8 * 3];
+    make_pattern(base, 16, 8, 2);
+    make_pattern(patch, 4, 2, 9);
+
+    send_graphics(mk, "a=T,i=3,f=24,s=16,v=8,q=2", base, sizeof(base), 4096);
+
+    /* Edit the displayed frame in place: visible immediately */
+    send_graphics(mk, "a=f,r=1,i=3,f=24,x=5,y=3,s=4,v=2", patch,
+                  sizeof(patch), 8);
+    memcpy(expected, base, sizeof(base));
+    for (int y = 0; y < 2; y++)
+        memcpy(expected + ((3 + y) * 16 + 5) * 3, patch + y * 4 * 3, 4 * 3);
+    bool ok = check(displayed_equals(mk, expected, 16, 8) && c.displays == 2,
+                    "a=f r=1 edits the current frame");
+    ok &= check(strstr(c.replies, "\033_Gi=3;OK\033\\") != NULL,
+                "a=f without q acknowledges");
+
+    /* New frame from base frame 1, shown after a=a c=2 */
+    send_graphics(mk, "a=f,c=1,i=3,f=24,x=0,y=0,s=4,v=2,q=1", patch,
+                  sizeof(patch), 4096);
+    ok &= check(c.displays == 2, "a=f new frame is not displayed");
+    feed_str(mk, "\033_Ga=a,c=2,i=3;\033\\");
+    memcpy(expected + 0, patch, 4 * 3);
+    memcpy(expected + 16 * 3, patch + 4 * 3, 4 * 3);
+    ok &= check(displayed_equals(mk, expected, 16, 8) && c.displays == 3,
+                "a=a c=2 switches the current frame");
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+
+static bool test_place_delete_query(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+    uint8_t rgba[4 * 4 * 4];
+    memset(rgba, 0x80, sizeof(rgba));
+
+    send_graphics(mk, "a=t,i=11,f=32,s=4,v=4,q=2", rgba, sizeof(rgba), 4096);
+    mock_kitty_frame_t frame;
+    bool ok = check(!mock_kitty_get_frame(mk, &frame) &&
+                        mock_kitty_image_count(mk) == 1,
+                    "a=t stores without displaying");
+
+    feed_str(mk, "\033_Ga=p,i=11,q=2;\033\\");
+    ok &= check(mock_kitty_get_frame(mk, &frame) && frame.image_id == 11,
+                "a=p places the image");
+
+    feed_str(mk, "\033_Ga=d,d=i,i=11;\033\\");
+    ok &= check(!mock_kitty_get_frame(mk, &frame) &&
+                    mock_kitty_image_count(mk) == 1,
+                "a=d d=i removes placement, keeps data");
+
+    feed_str(mk, "\033_Ga=d,d=I,i=11;\033\\");
+    ok &= check(mock_kitty_image_count(mk) == 0, "a=d d=I frees image data");
+
+    c.reply_len = 0;
+    feed_str(mk, "\033_Gi=31,s=1,v=1,a=q,t=d,f=24;AAAA\033\\");
+    ok &= check(!strcmp(c.replies, "\033_Gi=31;OK\033\\") &&
+                    mock_kitty_image_count(mk) == 0,
+                "a=q replies OK and stores nothing");
+
+    c.reply_len = 0;
+    feed_str(mk, "\033_Ga=f,r=1,i=99,f=24,s=1,v=1;AAAA\033\\");
+    ok &= check(!strncmp(c.replies, "\033_Gi=99;ENOENT:", 15),
+                "a=f on unknown image reports ENOENT");
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+
+static bool test_media(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+    uint8_t rgb[8 * 8 * 3];
+    bool ok = true;
+
+    /* t=s: shared memory object, unlinked by the terminal */
+    make_pattern(rgb, 8, 8, 3);
+    const char *shm_name = "/mock-kitty-test";
+    int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd >= 0 && write(fd, rgb, sizeof(rgb)) == (ssize_t) sizeof(rgb)) {
+        close(fd);
+        send_graphics(mk, "a=T,i=1,f=24,s=8,v=8,t=s,q=2",
+                      (const uint8_t *) shm_name, strlen(shm_name), 4096);
+        int again = shm_open(shm_name, O_RDONLY, 0);
+        ok &= check(displayed_equals(mk, rgb, 8, 8) && again < 0,
+                    "t=s reads and unlinks shared memory");
+        if (again >= 0) {
+            close(again);
+            shm_unlink(shm_name);
+        }
+    } else {
+        if (fd >= 0)
+            close(fd);
+        printf("  [SKIP] t=s (shm_open unavailable)\n");
+    }
+
+    /* t=t: temporary file, deleted by the terminal */
+    make_pattern(rgb, 8, 8, 4);
+    char path[] = "/tmp/tty-graphics-protocol-XXXXXX";
+    fd = mkstemp(path);
+    if (fd >= 0 && write(fd, rgb, sizeof(rgb)) == (ssize_t) sizeof(rgb)) {
+        close(fd);
+        send_graphics(mk, "a=T,i=2,f=24,s=8,v=8,t=t,q=2",
+                      (const uint8_t *) path, strlen(path), 4096);
+        ok &= check(displayed_equals(mk, rgb, 8, 8) && access(path, F_OK) != 0,
+                    "t=t reads and deletes the temporary file");
+    } else {
+        if (fd >= 0)
+            close(fd);
+        printf("  [SKIP] t=t (mkstemp unavailable)\n");
+    }
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+
+#ifdef HAVE_ZLIB
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static size_t png_chunk(uint8_t *out,
+                        const char *type,
+                        const uint8_t *body,
+                        uint32_t len)
+{
+    put_be32(out, len);
+    memcpy(out + 4, type, 4);
+    if (len)
+        memcpy(out + 8, body, len);
+    put_be32(out + 8 + len, (uint32_t) crc32(crc32(0, out + 4, 4), body, len));
+    return 12 + len;
+}
+
+/* Encode an RGB PNG, cycling through all five filter types per scanline */
+static size_t png_encode_rgb(const uint8_t *rgb, int w, int h, uint8_t *out)
+{
+    const size_t stride = (size_t) w * 3;
+    uint8_t *raw = malloc((stride + 1) * h);
+    for (int y = 0; y < h; y++) {
+        const uint8_t *cur = rgb + y * stride;
+        const uint8_t *prev = y ? cur - stride : NULL;
+        uint8_t *dst = raw + y * (stride + 1);
+        dst[0] = (uint8_t) (y % 5);
+        for (size_t x = 0; x < stride; x++) {
+            int a = x >= 3 ? cur[x - 3] : 0;
+            int b = prev ? prev[x] : 0;
+            int c = (prev && x >= 3) ? prev[x - 3] : 0;
+            int pred = 0;
+            switch (dst[0]) {
+            case 1:
+                pred = a;
+                break;
+            case 2:
+                pred = b;
+                break;
+            case 3:
+                pred = (a + b) / 2;
+                break;
+            case 4: {
+                int p = a + b - c;
+                int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                break;
+            }
+            }
+            dst[1 + x] = (uint8_t) (cur[x] - pred);
+        }
+    }
+
+    uLongf zlen = compressBound((stride + 1) * h);
+    uint8_t *z = malloc(zlen);
+    compress(z, &zlen, raw, (stride + 1) * h);
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G',
+                                         '\r', '\n', 0x1a, '\n'};
+    uint8_t ihdr[13] = {0};
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = 8; /* bit depth */
+    ihdr[9] = 2; /* RGB */
+
+    size_t n = 0;
+    memcpy(out, signature, 8);
+    n += 8;
+    n += png_chunk(out + n, "IHDR", ihdr, 13);
+    n += png_chunk(out + n, "IDAT", z, (uint32_t) zlen);
+    n += png_chunk(out + n, "IEND", NULL, 0);
+
+    free(raw);
+    free(z);
+    return n;
+}
+
+static bool test_compression(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+    uint8_t rgb[32 * 16 * 3];
+    bool ok = true;
+
+    /* o=z over raw RGB */
+    make_pattern(rgb, 32, 16, 5);
+    uLongf zlen = compressBound(sizeof(rgb));
+    uint8_t *z = malloc(zlen);
+    compress(z, &zlen, rgb, sizeof(rgb));
+    send_graphics(mk, "a=T,i=4,f=24,s=32,v=16,o=z,q=2", z, zlen, 128);
+    ok &= check(displayed_equals(mk, rgb, 32, 16), "o=z inflates payload");
+    free(z);
+
+    /* f=100 PNG with every filter type */
+    make_pattern(rgb, 32, 16, 6);
+    uint8_t *png = malloc(sizeof(rgb) * 2 + 1024);
+    size_t png_len = png_encode_rgb(rgb, 32, 16, png);
+    send_graphics(mk, "a=T,i=5,f=100,q=2", png, png_len, 256);
+    ok &= check(displayed_equals(mk, rgb, 32, 16), "f=100 decodes PNG");
+    free(png);
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+#endif /* HAVE_ZLIB */
+
+static bool test_queries(void)
+{
+    capture_t c;
+    mock_kitty_t *mk = new_mock(&c);
+
+    feed_str(mk, "\033[c");
+    bool ok = check(!strcmp(c.replies, "\033[?62;22c"), "DA1 reply");
+
+    c.reply_len = 0;
+    feed_str(mk, "\033[9999;9999H\033[6n");
+    ok &= check(!strcmp(c.replies, "\033[24;80R"), "CPR clamps to screen");
+
+    c.reply_len = 0;
+    feed_str(mk, "\033[16t");
+    ok &= check(!strcmp(c.replies, "\033[6;20;10t"), "cell size reply");
+
+    mock_kitty_destroy(mk);
+    return ok;
+}
+
+/* Renderer round trip */
+
+typedef struct {
+    int fd;
+    mock_kitty_t *mk;
+    const uint8_t *corpus;
+    int displayed;
+    int mismatches;
+    int acks;
+    uint8_t *capture; /* Optional copy of the stream */
+    size_t capture_len, capture_cap;
+} round_trip_t;
+
+static void round_trip_display(void *ctx, const mock_kitty_frame_t *frame)
+{
+    round_trip_t *rt = (round_trip_t *) ctx;
+    const uint8_t *expected = rt->corpus + (size_t) rt->displayed * FRAME_SIZE;
+    if (rt->displayed >= ROUND_TRIP_FRAMES ||
+        !mock_kitty_frame_equals_rgb24(frame, expected, WIDTH, HEIGHT))
+        rt->mismatches++;
+    rt->displayed++;
+}
+
+static void round_trip_reply(void *ctx, const char *data, size_t len)
+{
+    if (len > 4 && !memcmp(data + len - 4, "OK\033\\", 4))
+        ((round_trip_t *) ctx)->acks++;
+}
+
+static void *round_trip_reader(void *arg)
+{
+    round_trip_t *rt = (round_trip_t *) arg;
+    uint8_t buf[65536];
+    ssize_t n;
+    while ((n = read(rt->fd, buf, sizeof(buf))) > 0) {
+        mock_kitty_feed(rt->mk, buf, (size_t) n);
+        if (rt->capture) {
+            if (rt->capture_len + n > rt->capture_cap)
+                continue;
+            memcpy(rt->capture + rt->capture_len, buf, (size_t) n);
+            rt->capture_len += (size_t) n;
+        }
+    }
+    return NULL;
+}
+
+static bool run_round_trip(const char *term,
+                           const uint8_t *corpus,
+                           round_trip_t *rt,
+                           mock_kitty_stats_t *stats)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    mock_kitty_config_t cfg = {
+        .send_acks = true,
+        .reply = round_trip_reply,
+        .display = round_trip_display,
+        .ctx = rt,
+    };
+    rt->fd = fds[0];
+    rt->mk = mock_kitty_create(&cfg);
+    rt->corpus = corpus;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, round_trip_reader, rt);
+
+    setenv("TERM", term, 1);
+    unsetenv("TERM_PROGRAM");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+
+    renderer_t *r = renderer_create(24, 80);
+    for (int i = 0; r && i < ROUND_TRIP_FRAMES; i++)
+        renderer_render_frame(r, corpus + (size_t) i * FRAME_SIZE);
+    fflush(stdout);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+
+    /* Tear down after the reader is done so renderer_destroy output is not
+     * counted as part of the displayed frames
+     */
+    if (r) {
+        int devnull = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    *stats = *mock_kitty_get_stats(rt->mk);
+    mock_kitty_destroy(rt->mk);
+    return r != NULL;
+}
+
+static bool test_renderer_round_trip(const uint8_t *corpus)
+{
+    static const struct {
+        const char *name;
+        const char *term;
+    } modes[] = {
+        {"animation (a=f)", "xterm-kitty"},
+        {"compat (a=T)", "xterm-256color"},
+    };
+
+    bool ok = true;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        round_trip_t rt = {0};
+        mock_kitty_stats_t stats;
+        char name[128];
+
+        if (!run_round_trip(modes[m].term, corpus, &rt, &stats)) {
+            ok &= check(false, "renderer setup");
+            continue;
+        }
+        snprintf(name, sizeof(name),
+                 "%s: %d/%d frames displayed, %d mismatches, %d acks",
+                 modes[m].name, rt.displayed, ROUND_TRIP_FRAMES,
+                 rt.mismatches, rt.acks);
+        ok &= check(rt.displayed == ROUND_TRIP_FRAMES && rt.mismatches == 0 &&
+                        stats.errors == 0,
+                    name);
+    }
+    return ok;
+}
+
+/* Unchanged frames are skipped and overlay-only changes become a partial
+ * a=f update of the overlay rectangle
+ */
+static bool test_renderer_skip_and_hud(const uint8_t *corpus)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return check(false, "pipe");
+
+    round_trip_t rt = {.fd = fds[0]};
+    rt.mk = mock_kitty_create(NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, round_trip_reader, &rt);
+
+    setenv("TERM", "xterm-kitty", 1);
+    unsetenv("TERM_PROGRAM");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+
+    renderer_t *r = renderer_create(24, 80);
+    renderer_stats_t after_skip = {0}, after_hud = {0}, after_off = {0};
+    if (r) {
+        renderer_render_frame(r, corpus);
+        renderer_render_frame(r, corpus);
+        after_skip = renderer_get_stats(r);
+
+        renderer_set_hud(r, true);
+        renderer_render_frame(r, corpus);
+        renderer_render_frame(r, corpus);
+        after_hud = renderer_get_stats(r);
+        fflush(stdout);
+    }
+
+    /* Snapshot the displayed frame once the reader has caught up */
+    uint8_t *expected = malloc(FRAME_SIZE);
+    bool hud_shown = false;
+    if (r && expected) {
+        memcpy(expected, corpus, FRAME_SIZE);
+        const char *lines[] = {"..."};
+        hud_draw(expected, WIDTH, lines, 1);
+        for (int i = 0; i < 200 && !hud_shown; i++) {
+            hud_shown = displayed_equals(rt.mk, expected, WIDTH, HEIGHT);
+            if (!hud_shown)
+                usleep(5000);
+        }
+
+        renderer_set_hud(r, false);
+        renderer_render_frame(r, corpus);
+        after_off = renderer_get_stats(r);
+        fflush(stdout);
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+
+    const bool created = r != NULL;
+    if (r) {
+        int devnull = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    bool ok = true;
+    ok &= check(created && after_skip.frames_emitted == 1 &&
+                    after_skip.frames_skipped == 1,
+                "identical frame is skipped");
+    ok &= check(after_hud.frames_emitted == 2 &&
+                    after_hud.frames_skipped == 2 &&
+                    after_hud.bytes - after_skip.bytes < 16384,
+                "overlay change sends only its rectangle");
+    ok &= check(hud_shown, "overlay is drawn over the unchanged frame");
+    ok &= check(after_off.frames_emitted == 3 &&
+                    after_off.bytes - after_hud.bytes < 16384 &&
+                    displayed_equals(rt.mk, corpus, WIDTH, HEIGHT) &&
+                    mock_kitty_get_stats(rt.mk)->errors == 0,
+                "hiding the overlay restores the frame");
+
+    free(expected);
+    mock_kitty_destroy(rt.mk);
+    return ok;
+}
+
+/* Same 2x2 box filter as the renderer's half-resolution output */
+static void half_size(uint8_t *dst, const uint8_t *src)
+{
+    for (int y = 0; y < HEIGHT / 2; y++) {
+        for (int x = 0; x < WIDTH / 2; x++) {
+            const uint8_t *a = src + ((size_t) y * 2 * WIDTH + x * 2) * 3;
+            const uint8_t *b = a + WIDTH * 3;
+            for (int c = 0; c < 3; c++)
+                *dst++ = (uint8_t) ((a[c] + a[c + 3] + b[c] + b[c + 3] + 2) >>
+                                    2);
+        }
+    }
+}
+
+static bool wait_displayed(mock_kitty_t *mk, const uint8_t *rgb, int w, int h)
+{
+    for (int i = 0; i < 200; i++) {
+        if (displayed_equals(mk, rgb, w, h))
+            return true;
+        usleep(5000);
+    }
+    return false;
+}
+
+/* Degraded output for the fair-share supervisor: half resolution (with
+ * zlib when available) replaces the image and full resolution brings it
+ * back; a frame divisor drops frames in between
+ */
+static bool test_renderer_degrade(const uint8_t *corpus, const char *term)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return check(false, "pipe");
+
+    round_trip_t rt = {.fd = fds[0]};
+    rt.mk = mock_kitty_create(NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, round_trip_reader, &rt);
+
+    setenv("TERM", term, 1);
+    unsetenv("TERM_PROGRAM");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+
+    uint8_t *half = malloc(FRAME_SIZE / 4);
+    renderer_t *r = renderer_create(24, 80);
+    bool half_shown = false, full_shown = false;
+    renderer_stats_t stats = {0};
+    if (r && half) {
+        renderer_render_frame(r, corpus);
+
+        renderer_set_degrade(r, &(degrade_t) {1, 2, true});
+        renderer_render_frame(r, corpus + FRAME_SIZE);
+        renderer_render_frame(r, corpus + 2 * FRAME_SIZE);
+        fflush(stdout);
+        half_size(half, corpus + 2 * FRAME_SIZE);
+        half_shown = wait_displayed(rt.mk, half, WIDTH / 2, HEIGHT / 2);
+
+        renderer_set_degrade(r, &(degrade_t) {2, 1, false});
+        renderer_render_frame(r, corpus + 3 * FRAME_SIZE);
+        renderer_render_frame(r, corpus + 4 * FRAME_SIZE);
+        fflush(stdout);
+        full_shown =
+            wait_displayed(rt.mk, corpus + 3 * FRAME_SIZE, WIDTH, HEIGHT);
+        stats = renderer_get_stats(r);
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+
+    const bool created = r != NULL;
+    if (r) {
+        int devnull = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    char name[96];
+    bool ok = true;
+    snprintf(name, sizeof(name), "%s: half resolution frame displayed",
+             term);
+    ok &= check(created && half_shown, name);
+    snprintf(name, sizeof(name), "%s: full resolution restored", term);
+    ok &= check(full_shown, name);
+    snprintf(name, sizeof(name), "%s: every other frame dropped", term);
+    ok &= check(stats.frames_emitted == 4 && stats.frames_dropped == 1 &&
+                    mock_kitty_get_stats(rt.mk)->errors == 0,
+                name);
+
+    free(half);
+    mock_kitty_destroy(rt.mk);
+    return ok;
+}
+
+/* Image id of the last error reply from the mock terminal */
+static atomic_uint error_image;
+
+static void error_reply(void *ctx, const char *data, size_t len)
+{
+    (void) ctx;
+    char buf[128];
+    unsigned id;
+    snprintf(buf, sizeof(buf), "%.*s", (int) len, data);
+    if (!strstr(buf, ";OK") && sscanf(buf, "\033_Gi=%u;", &id) == 1)
+        atomic_store(&error_image, id);
+}
+
+/* The terminal drops every image behind the renderer's back; the error reply
+ * for the next a=f, passed back as the input thread would, makes the
+ * renderer create the image again even though the frame did not change.
+ * Then acknowledgements that stop coming hold frames back for a while.
+ */
+static bool test_renderer_replies(const uint8_t *corpus)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return check(false, "pipe");
+
+    mock_kitty_config_t cfg = {.send_acks = true, .reply = error_reply};
+    round_trip_t rt = {.fd = fds[0]};
+    rt.mk = mock_kitty_create(&cfg);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, round_trip_reader, &rt);
+
+    setenv("TERM", "xterm-kitty", 1);
+    unsetenv("TERM_PROGRAM");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+
+    renderer_t *r = renderer_create(24, 80);
+    bool error_seen = false, recreated = false;
+    renderer_stats_t recovered = {0}, paced = {0}, resumed = {0};
+    renderer_stats_t rejected = {0}, fallback = {0};
+    bool fallback_shown = false;
+    if (r) {
+        renderer_render_frame(r, corpus);
+        printf("\033_Ga=d,d=A;\033\\");
+        renderer_render_frame(r, corpus + FRAME_SIZE);
+        fflush(stdout);
+        for (int i = 0; i < 200 && !error_seen; i++) {
+            error_seen = atomic_load(&error_image) != 0;
+            if (!error_seen)
+                usleep(5000);
+        }
+
+        renderer_graphics_reply(r, &(graphics_reply_t) {
+                                       .image_id = atomic_load(&error_image),
+                                       .error = GRAPHICS_ENOENT,
+                                   });
+        renderer_render_frame(r, corpus + FRAME_SIZE);
+        fflush(stdout);
+        recreated =
+            wait_displayed(rt.mk, corpus + FRAME_SIZE, WIDTH, HEIGHT);
+        recovered = renderer_get_stats(r);
+
+        /* One acknowledgement, then silence */
+        renderer_graphics_reply(r, &(graphics_reply_t) {
+                                       .image_id = atomic_load(&error_image),
+                                   });
+        for (int i = 2; i < 8; i++)
+            renderer_render_frame(r, corpus + (size_t) i * FRAME_SIZE);
+        paced = renderer_get_stats(r);
+        usleep(300000);
+        renderer_render_frame(r, corpus + 8 * FRAME_SIZE);
+        resumed = renderer_get_stats(r);
+        fflush(stdout);
+
+        /* A terminal that rejects every frame: the third error in a row
+         * switches to replacing the whole image
+         */
+        const graphics_reply_t reject = {
+            .image_id = atomic_load(&error_image),
+            .error = GRAPHICS_EINVAL,
+        };
+        renderer_graphics_reply(r, &reject);
+        renderer_graphics_reply(r, &reject);
+        rejected = renderer_get_stats(r);
+        renderer_graphics_reply(r, &reject);
+        renderer_render_frame(r, corpus + 9 * FRAME_SIZE);
+        fflush(stdout);
+        fallback_shown =
+            wait_displayed(rt.mk, corpus + 9 * FRAME_SIZE, WIDTH, HEIGHT);
+        fallback = renderer_get_stats(r);
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+
+    const bool created = r != NULL;
+    if (r) {
+        int devnull = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    bool ok = true;
+    ok &= check(created && error_seen, "lost image reported with its id");
+    ok &= check(recreated && recovered.graphics_errors == 1 &&
+                    recovered.frames_emitted == 3 &&
+                    recovered.frames_skipped == 0,
+                "error reply re-creates the unchanged frame");
+    ok &= check(paced.frames_emitted == recovered.frames_emitted + 3 &&
+                    paced.frames_paced == 3 && paced.acks == 1,
+                "frames held back beyond three unacknowledged");
+    ok &= check(resumed.frames_emitted == paced.frames_emitted + 1,
+                "silent terminal stops holding frames back");
+    ok &= check(!strcmp(rejected.mode, "animation"),
+                "two errors in a row keep animation mode");
+    ok &= check(fallback_shown && !strcmp(fallback.mode, "compat") &&
+                    fallback.graphics_errors == resumed.graphics_errors + 3,
+                "repeated errors fall back to the compatibility path");
+
+    mock_kitty_destroy(rt.mk);
+    return ok;
+}
+
+static void expand_palette(uint8_t *rgb,
+                           const uint8_t *indices,
+                           const uint8_t *palette)
+{
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        memcpy(rgb + i * 3, palette + indices[i] * 3, 3);
+}
+
+/* A damage tint: same indices, new palette. The renderer must send the
+ * frame in full without diffing it, skip a repeat by comparing indices, and
+ * still notice a change of a single index.
+ */
+static bool test_renderer_palette(void)
+{
+    uint8_t *indices = malloc(WIDTH * HEIGHT);
+    uint8_t *rgb = malloc(FRAME_SIZE);
+    uint8_t normal[256 * 3], tinted[256 * 3];
+    if (!indices || !rgb) {
+        free(indices);
+        free(rgb);
+        return check(false, "allocation");
+    }
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        indices[i] = (uint8_t) ((i % WIDTH) ^ (i / WIDTH));
+    for (int i = 0; i < 256; i++) {
+        normal[i * 3] = normal[i * 3 + 1] = normal[i * 3 + 2] = (uint8_t) i;
+        tinted[i * 3] = (uint8_t) (128 + i / 2);
+        tinted[i * 3 + 1] = tinted[i * 3 + 2] = (uint8_t) (i / 2);
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        free(indices);
+        free(rgb);
+        return check(false, "pipe");
+    }
+
+    round_trip_t rt = {.fd = fds[0]};
+    rt.mk = mock_kitty_create(NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, round_trip_reader, &rt);
+
+    setenv("TERM", "xterm-kitty", 1);
+    unsetenv("TERM_PROGRAM");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(fds[1], STDOUT_FILENO);
+
+    renderer_t *r = renderer_create(24, 80);
+    renderer_stats_t repeat = {0}, tint = {0}, edit = {0};
+    bool tint_shown = false, edit_shown = false;
+    if (r) {
+        expand_palette(rgb, indices, normal);
+        for (int i = 0; i < 2; i++) {
+            renderer_set_source(r, indices, normal);
+            renderer_render_frame(r, rgb);
+        }
+        repeat = renderer_get_stats(r);
+
+        expand_palette(rgb, indices, tinted);
+        renderer_set_source(r, indices, tinted);
+        renderer_render_frame(r, rgb);
+        tint = renderer_get_stats(r);
+        fflush(stdout);
+        tint_shown = wait_displayed(rt.mk, rgb, WIDTH, HEIGHT);
+
+        indices[WIDTH * HEIGHT - 1] ^= 1;
+        expand_palette(rgb, indices, tinted);
+        renderer_set_source(r, indices, tinted);
+        renderer_render_frame(r, rgb);
+        edit = renderer_get_stats(r);
+        fflush(stdout);
+        edit_shown = wait_displayed(rt.mk, rgb, WIDTH, HEIGHT);
+    }
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+
+    const bool created = r != NULL;
+    if (r) {
+        int devnull = open("/dev/null", O_WRONLY);
+        saved_stdout = dup(STDOUT_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        renderer_destroy(r);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        close(devnull);
+    }
+
+    bool ok = true;
+    ok &= check(created && repeat.frames_emitted == 1 &&
+                    repeat.frames_skipped == 1,
+                "repeated indices and palette skipped");
+    ok &= check(tint_shown && tint.frames_emitted == 2 &&
+                    tint.palette_changes == 1,
+                "new palette sends the frame in full");
+    ok &= check(edit_shown && edit.frames_emitted == 3 &&
+                    edit.palette_changes == 1 &&
+                    mock_kitty_get_stats(rt.mk)->errors == 0,
+                "single index change is sent");
+
+    free(indices);
+    free(rgb);
+    mock_kitty_destroy(rt.mk);
+    return ok;
+}
+
+/* Decode throughput: replay a captured stream through a fresh terminal */
+static void bench_decode(const uint8_t *corpus)
+{
+    round_trip_t rt = {0};
+    mock_kitty_stats_t stats;
+    rt.capture_cap = (size_t) ROUND_TRIP_FRAMES * 300000;
+    rt.capture = malloc(rt.capture_cap);
+    if (!rt.capture || !run_round_trip("xterm-kitty", corpus, &rt, &stats)) {
+        free(rt.capture);
+        return;
+    }
+
+    const int reps = 10;
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < reps; i++) {
+        mock_kitty_t *mk = mock_kitty_create(NULL);
+        uint64_t start = get_time_ns();
+        mock_kitty_feed(mk, rt.capture, rt.capture_len);
+        uint64_t elapsed = get_time_ns() - start;
+        if (elapsed < best)
+            best = elapsed;
+        mock_kitty_destroy(mk);
+    }
+
+    printf("  Stream: %zu bytes for %d frames\n", rt.capture_len,
+           ROUND_TRIP_FRAMES);
+    printf("  Decode: %.2f us/frame => %.1f frames/sec, %.1f MB/s\n",
+           best / 1000.0 / ROUND_TRIP_FRAMES,
+           ROUND_TRIP_FRAMES * 1e9 / (double) best,
+           rt.capture_len / (best / 1e9) / (1024.0 * 1024.0));
+    free(rt.capture);
+}
+
+int main(void)
+{
+    bool ok = true;
+
+    printf("=== Mock Kitty Terminal: Protocol Tests ===\n");
+    ok &= test_direct_chunked();
+    ok &= test_animation_frames();
+    ok &= test_place_delete_query();
+    ok &= test_media();
+#ifdef HAVE_ZLIB
+    ok &= test_compression();
+#else
+    printf("  [SKIP] o=z and f=100 (built without zlib)\n");
+#endif
+    ok &= test_queries();
+
+    uint8_t *corpus = malloc((size_t) ROUND_TRIP_FRAMES * FRAME_SIZE);
+    if (!corpus) {
+        fprintf(stderr, "Failed to allocate frame corpus\n");
+        return 1;
+    }
+    for (int i = 0; i < ROUND_TRIP_FRAMES; i++)
+        make_pattern(corpus + (size_t) i * FRAME_SIZE, WIDTH, HEIGHT, i);
+
+    printf("\n=== Renderer Round Trip ===\n");
+    ok &= test_renderer_round_trip(corpus);
+    ok &= test_renderer_skip_and_hud(corpus);
+    ok &= test_renderer_degrade(corpus, "xterm-kitty");
+    ok &= test_renderer_degrade(corpus, "xterm-256color");
+    ok &= test_renderer_replies(corpus);
+    ok &= test_renderer_palette();
+
+    printf("\n=== Mock Terminal Decode Throughput ===\n");
+    bench_decode(corpus);
+
+    free(corpus);
+
+    return check_summary(ok);
+}